@@ -20,4 +20,5 @@ copy /Y ..\%msvc%\..\..\lib\VolumeViz\nodes\SoVolumeIndexedFaceSet.h %COINDIR%\i
 copy /Y ..\%msvc%\..\..\lib\VolumeViz\nodes\SoVolumeTriangleStripSet.h %COINDIR%\include\VolumeViz\nodes\SoVolumeTriangleStripSet.h >nul:
 copy /Y ..\%msvc%\..\..\lib\VolumeViz\nodes\SoVolumeIndexedTriangleStripSet.h %COINDIR%\include\VolumeViz\nodes\SoVolumeIndexedTriangleStripSet.h >nul:
 copy /Y ..\%msvc%\..\..\lib\VolumeViz\readers\SoVolumeReader.h %COINDIR%\include\VolumeViz\readers\SoVolumeReader.h >nul:
+copy /Y ..\%msvc%\..\..\lib\VolumeViz\readers\SoVRBrickFileReader.h %COINDIR%\include\VolumeViz\readers\SoVRBrickFileReader.h >nul:
 copy /Y ..\%msvc%\..\..\lib\VolumeViz\readers\SoVRVolFileReader.h %COINDIR%\include\VolumeViz\readers\SoVRVolFileReader.h >nul:
@@ -20,4 +20,5 @@ del %COINDIR%\include\VolumeViz\nodes\SoVolumeIndexedFaceSet.h
 del %COINDIR%\include\VolumeViz\nodes\SoVolumeTriangleStripSet.h
 del %COINDIR%\include\VolumeViz\nodes\SoVolumeIndexedTriangleStripSet.h
 del %COINDIR%\include\VolumeViz\readers\SoVolumeReader.h
+del %COINDIR%\include\VolumeViz\readers\SoVRBrickFileReader.h
 del %COINDIR%\include\VolumeViz\readers\SoVRVolFileReader.h
@@ -1,17 +1,37 @@
 // Quick'n'dirty converter from raw 8-bits-per-voxel volume data to
 // VOL format.
 //
-// Compile with 'g++ -o raw2vol raw2vol.cpp -I$(COINDIR)/include'.
+// With the -bricked option, the bricked format read by
+// SoVRBrickFileReader is written instead, see the class doc of that
+// reader for a description of it.
+//
+// The input is streamed through in slabs of slices, so the memory
+// used does not depend on the depth of the volume, and the per-voxel
+// work is spread over a pool of worker threads.
+//
+// Compile with 'g++ -o raw2vol raw2vol.cpp -I$(COINDIR)/include -L$(COINDIR)/lib -lCoin'.
 //
 // 20021128 mortene.
 
+#define _FILE_OFFSET_BITS 64 // for files larger than 2 GB
+
 #include <Inventor/system/inttypes.h>
+#include <Inventor/SbTime.h>
+#include <Inventor/threads/SbMutex.h>
+#include <Inventor/threads/SbThread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/types.h>
+#endif
+
 
 struct vol_header {
   uint32_t magic_number;
@@ -26,6 +46,29 @@ struct vol_header {
   float rotX, rotY, rotZ;
 };
 
+// Header of the bricked format. Must match SoVRBrickFileReader.
+struct cvb_header {
+  uint32_t magic_number;
+  uint32_t header_length;
+  uint32_t width;
+  uint32_t height;
+  uint32_t depth;
+  uint32_t data_type;
+  uint32_t brick_size;
+  uint32_t nr_levels;
+  uint32_t level_method;
+  uint32_t histogram_bins;
+  float minval, maxval;
+  float histogram_min, histogram_max;
+  float scaleX, scaleY, scaleZ;
+};
+
+// Values of SoVolumeData::DataType and SoVolumeData::SubMethod.
+enum { CVB_UNSIGNED_BYTE = 0, CVB_UNSIGNED_SHORT = 1 };
+enum { CVB_NEAREST = 0, CVB_MAX = 1, CVB_AVERAGE = 2 };
+
+static const uint32_t CVB_HISTOGRAM_BINS = 64;
+
 enum EndiannessValues {
   HOST_IS_UNKNOWNENDIAN = -1,
   HOST_IS_LITTLEENDIAN = 0,
@@ -120,10 +163,596 @@ static void
 show_usage(const char * exe)
 {
   (void)fprintf(stderr, 
-                "\n Usage: %s WIDTH HEIGHT DEPTH BITS[:8,12,16] IN-FILENAME.raw OUT-FILENAME.vol\n\n",
+                "\n Usage: %s [OPTIONS] WIDTH HEIGHT DEPTH BITS[:8,12,16] IN-FILENAME.raw OUT-FILENAME.vol\n\n"
+                " Options:\n"
+                "   -bricked            write the bricked format instead of VOL\n"
+                "   -bricksize N        edge length of bricks, must be even (default 64)\n"
+                "   -lod METHOD         how lower resolution levels are made for the\n"
+                "                       bricked format: nearest (default), max or average\n"
+                "   -swap               swap the bytes of 12- and 16-bit input voxels\n"
+                "   -threads N          number of worker threads (default: one per CPU)\n"
+                "   -memory MB          size of the slabs read in VOL mode (default 256)\n\n",
                 exe);
 }
 
+// *************************************************************************
+
+// A minimal worker pool: run_parallel() calls func(closure, i) for
+// each i in [0, nrjobs>, spread over nr_threads threads, with the
+// calling thread as one of them.
+
+static unsigned int nr_threads = 1;
+
+typedef void job_func(void * closure, unsigned int jobidx);
+
+struct parallel_job {
+  job_func * func;
+  void * closure;
+  unsigned int nrjobs;
+  unsigned int next;
+  SbMutex mutex;
+};
+
+static void *
+parallel_worker(void * closure)
+{
+  struct parallel_job * job = (struct parallel_job *)closure;
+  for (;;) {
+    job->mutex.lock();
+    const unsigned int idx = job->next;
+    if (idx < job->nrjobs) { job->next++; }
+    job->mutex.unlock();
+
+    if (idx >= job->nrjobs) { break; }
+    job->func(job->closure, idx);
+  }
+  return NULL;
+}
+
+static void
+run_parallel(unsigned int nrjobs, job_func * func, void * closure)
+{
+  const unsigned int nrthreads = (nr_threads < nrjobs) ? nr_threads : nrjobs;
+  if (nrthreads <= 1) {
+    for (unsigned int i = 0; i < nrjobs; i++) { func(closure, i); }
+    return;
+  }
+
+  struct parallel_job job;
+  job.func = func;
+  job.closure = closure;
+  job.nrjobs = nrjobs;
+  job.next = 0;
+
+  SbThread * threads[64];
+  unsigned int nrstarted = 0;
+  for (unsigned int i = 1; (i < nrthreads) && (nrstarted < 64); i++) {
+    SbThread * thread = SbThread::create(parallel_worker, &job);
+    if (thread) { threads[nrstarted++] = thread; }
+  }
+
+  parallel_worker(&job);
+
+  for (unsigned int i = 0; i < nrstarted; i++) {
+    threads[i]->join();
+    SbThread::destroy(threads[i]);
+  }
+}
+
+static unsigned int
+nr_of_processors(void)
+{
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (unsigned int)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  const long nr = sysconf(_SC_NPROCESSORS_ONLN);
+  return (nr > 0) ? (unsigned int)nr : 1;
+#else
+  return 1;
+#endif
+}
+
+// *************************************************************************
+
+// Seeks with 64-bit offsets, as output files can easily be larger than
+// 2 GB.
+static void
+seek_to(FILE * f, uint64_t offset)
+{
+#ifdef _WIN32
+  const int r = _fseeki64(f, (__int64)offset, SEEK_SET);
+#else
+  const int r = fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+  if (r != 0) {
+    (void)fprintf(stderr, "Couldn't seek in output file: %s\n\n", strerror(errno));
+    exit(1);
+  }
+}
+
+static void
+write_bytes(FILE * f, const void * data, size_t nrbytes)
+{
+  if (fwrite(data, 1, nrbytes, f) != nrbytes) {
+    (void)fprintf(stderr, "Couldn't write to output file: %s\n\n", strerror(errno));
+    exit(1);
+  }
+}
+
+// Keeps track of the conversion throughput.
+struct progress {
+  SbTime start;
+  uint64_t totalbytes;
+  uint64_t donebytes;
+};
+
+static void
+report_progress(struct progress * p, uint64_t nrbytes)
+{
+  p->donebytes += nrbytes;
+  const double secs = (SbTime::getTimeOfDay() - p->start).getValue();
+  const double mb = (double)p->donebytes / (1024.0 * 1024.0);
+  printf("\r* %.0f of %.0f MB read, %.1f MB/s   ",
+         mb, (double)p->totalbytes / (1024.0 * 1024.0),
+         (secs > 0.0) ? (mb / secs) : 0.0);
+  fflush(stdout);
+}
+
+static void
+report_done(struct progress * p)
+{
+  const double secs = (SbTime::getTimeOfDay() - p->start).getValue();
+  const double mb = (double)p->donebytes / (1024.0 * 1024.0);
+  printf("* Converted %.1f MB in %.2f seconds (%.1f MB/s).\n",
+         mb, secs, (secs > 0.0) ? (mb / secs) : 0.0);
+}
+
+// *************************************************************************
+
+// Conversion of the input voxels: byte-swapping and scaling of 12-bit
+// values to 16 bits. Done in chunks on the worker pool.
+
+struct convert_job {
+  uint8_t * voxels;
+  size_t nrvoxels;
+  unsigned int voxelsize;
+  int swap;
+  int shift;
+};
+
+static const size_t CONVERT_CHUNK = 1024 * 1024;
+
+static void
+convert_chunk(void * closure, unsigned int jobidx)
+{
+  struct convert_job * job = (struct convert_job *)closure;
+  const size_t first = (size_t)jobidx * CONVERT_CHUNK;
+  const size_t last = (first + CONVERT_CHUNK < job->nrvoxels) ?
+    (first + CONVERT_CHUNK) : job->nrvoxels;
+
+  uint16_t * ptr = (uint16_t *)job->voxels;
+  for (size_t i = first; i < last; i++) {
+    uint16_t v = ptr[i];
+    if (job->swap) { v = (uint16_t)((v >> 8) | (v << 8)); }
+    if (job->shift) { v = (uint16_t)(v << 4); }
+    ptr[i] = v;
+  }
+}
+
+static void
+convert_voxels(uint8_t * voxels, size_t nrvoxels, unsigned int voxelsize,
+               int swap, int shift)
+{
+  if ((voxelsize == 1) || (!swap && !shift)) { return; }
+
+  struct convert_job job = { voxels, nrvoxels, voxelsize, swap, shift };
+  run_parallel((unsigned int)((nrvoxels + CONVERT_CHUNK - 1) / CONVERT_CHUNK),
+               convert_chunk, &job);
+}
+
+static void
+read_voxels(FILE * f, uint8_t * buffer, size_t nrbytes)
+{
+  if (fread(buffer, 1, nrbytes, f) != nrbytes) {
+    (void)fprintf(stderr, "Couldn't read from input file: %s\n\n",
+                  feof(f) ? "file too short" : strerror(errno));
+    exit(1);
+  }
+}
+
+// *************************************************************************
+
+static uint32_t
+get_voxel(const void * voxels, size_t idx, unsigned int voxelsize)
+{
+  if (voxelsize == 1) { return ((const uint8_t *)voxels)[idx]; }
+  return ((const uint16_t *)voxels)[idx];
+}
+
+static void
+set_voxel(void * voxels, size_t idx, unsigned int voxelsize, uint32_t value)
+{
+  if (voxelsize == 1) { ((uint8_t *)voxels)[idx] = (uint8_t)value; }
+  else { ((uint16_t *)voxels)[idx] = (uint16_t)value; }
+}
+
+// Dimensions of level "level" of the resolution pyramid, as for
+// SoVolumeReader::getNumVoxels().
+static void
+level_dimensions(const uint32_t * dims, unsigned int level, uint32_t * ldims)
+{
+  for (unsigned int i = 0; i < 3; i++) {
+    const uint32_t step = 1 << level;
+    ldims[i] = (dims[i] + step - 1) / step;
+  }
+}
+
+// Interleaves the bits of the brick indices, for laying out the
+// bricks along a Z-order curve.
+static uint64_t
+morton_code(uint32_t x, uint32_t y, uint32_t z)
+{
+  uint64_t code = 0;
+  for (unsigned int bit = 0; bit < 16; bit++) {
+    code |= (uint64_t)((x >> bit) & 1) << (bit * 3 + 0);
+    code |= (uint64_t)((y >> bit) & 1) << (bit * 3 + 1);
+    code |= (uint64_t)((z >> bit) & 1) << (bit * 3 + 2);
+  }
+  return code;
+}
+
+struct brick_order {
+  uint64_t code;
+  uint32_t index;
+};
+
+static int
+compare_brick_order(const void * a, const void * b)
+{
+  const uint64_t ca = ((const struct brick_order *)a)->code;
+  const uint64_t cb = ((const struct brick_order *)b)->code;
+  return (ca < cb) ? -1 : ((ca > cb) ? 1 : 0);
+}
+
+// *************************************************************************
+
+// The bricked format is written one layer of bricks at a time. Each
+// level of the resolution pyramid buffers the slices of its current
+// layer, and when a layer is complete, its bricks are written out at
+// their place in the file, and the layer is reduced into slices for
+// the next level.
+
+struct level_state {
+  uint32_t dims[3];
+  uint32_t nrbricks[3];
+  uint64_t * offsets;    // per brick, in X, Y, Z order
+  uint32_t * ranges;     // min and max per brick
+  uint32_t * histograms; // CVB_HISTOGRAM_BINS per brick
+
+  uint8_t * layer;       // slices of the current layer of bricks
+  uint32_t layerz;       // first slice of the current layer
+  uint32_t nrslices;     // slices in the current layer
+};
+
+struct bricked_output {
+  FILE * file;
+  unsigned int voxelsize;
+  uint32_t bricksize;
+  int method;
+  uint32_t histmax;      // largest value of the data type
+
+  struct level_state levels[16];
+  unsigned int nrlevels;
+  uint8_t * brickbuffers; // one brick buffer per brick of a layer
+};
+
+// Jobs for the bricks of one layer.
+struct layer_job {
+  struct bricked_output * out;
+  unsigned int level;
+};
+
+static void
+brick_bounds(const struct bricked_output * out, const struct level_state * ls,
+             uint32_t brick, uint32_t * bmin, uint32_t * bmax)
+{
+  const uint32_t bidx[3] = {
+    brick % ls->nrbricks[0],
+    (brick / ls->nrbricks[0]) % ls->nrbricks[1],
+    brick / (ls->nrbricks[0] * ls->nrbricks[1])
+  };
+  for (unsigned int i = 0; i < 3; i++) {
+    bmin[i] = bidx[i] * out->bricksize;
+    bmax[i] = (bmin[i] + out->bricksize < ls->dims[i]) ?
+      (bmin[i] + out->bricksize) : ls->dims[i];
+  }
+}
+
+// Copies out brick number "jobidx" of the current layer, finds its
+// value range and histogram, and converts it to little-endian byte
+// order for writing.
+static void
+process_brick(void * closure, unsigned int jobidx)
+{
+  struct layer_job * job = (struct layer_job *)closure;
+  struct bricked_output * out = job->out;
+  struct level_state * ls = &out->levels[job->level];
+  const unsigned int vs = out->voxelsize;
+
+  const uint32_t brick =
+    (ls->layerz / out->bricksize) * ls->nrbricks[0] * ls->nrbricks[1] + jobidx;
+  uint32_t bmin[3], bmax[3];
+  brick_bounds(out, ls, brick, bmin, bmax);
+
+  const size_t brickbytes = (size_t)out->bricksize * out->bricksize * out->bricksize * vs;
+  uint8_t * dst = out->brickbuffers + jobidx * brickbytes;
+  uint8_t * brickstart = dst;
+  const size_t rowbytes = (size_t)(bmax[0] - bmin[0]) * vs;
+
+  uint32_t minval = 0xffffffff, maxval = 0;
+  uint32_t * histogram = ls->histograms + (size_t)brick * CVB_HISTOGRAM_BINS;
+  (void)memset(histogram, 0, CVB_HISTOGRAM_BINS * sizeof(uint32_t));
+
+  for (uint32_t z = bmin[2]; z < bmax[2]; z++) {
+    for (uint32_t y = bmin[1]; y < bmax[1]; y++) {
+      const size_t idx = ((size_t)(z - ls->layerz) * ls->dims[1] + y) * ls->dims[0] + bmin[0];
+      (void)memcpy(dst, ls->layer + idx * vs, rowbytes);
+      for (uint32_t x = 0; x < bmax[0] - bmin[0]; x++) {
+        const uint32_t v = get_voxel(dst, x, vs);
+        if (v < minval) { minval = v; }
+        if (v > maxval) { maxval = v; }
+        histogram[(uint64_t)v * CVB_HISTOGRAM_BINS / ((uint64_t)out->histmax + 1)]++;
+      }
+      dst += rowbytes;
+    }
+  }
+
+  ls->ranges[brick * 2 + 0] = minval;
+  ls->ranges[brick * 2 + 1] = maxval;
+
+  if ((vs == 2) && (host_get_endianness() == HOST_IS_BIGENDIAN)) {
+    for (uint8_t * p = brickstart; p < dst; p += 2) {
+      const uint8_t tmp = p[0];
+      p[0] = p[1];
+      p[1] = tmp;
+    }
+  }
+}
+
+// Reduces slice pair number "jobidx" of the current layer to one
+// slice of the next level, the same way as SIM Voleon does it for
+// its own resolution pyramid. Along axes of odd size, the last block
+// is only partially covered.
+static void
+reduce_slice(void * closure, unsigned int jobidx)
+{
+  struct layer_job * job = (struct layer_job *)closure;
+  struct bricked_output * out = job->out;
+  const struct level_state * ls = &out->levels[job->level];
+  struct level_state * next = &out->levels[job->level + 1];
+  const unsigned int vs = out->voxelsize;
+  const uint32_t * dims = ls->dims;
+
+  const uint32_t z0 = jobidx * 2;
+  const uint32_t nz = (ls->nrslices - z0) < 2 ? 1 : 2;
+  uint8_t * output = next->layer +
+    ((size_t)(next->nrslices + jobidx) * next->dims[1] * next->dims[0]) * vs;
+
+  size_t dstidx = 0;
+  for (uint32_t ry = 0; ry < next->dims[1]; ry++) {
+    const uint32_t y0 = ry * 2, ny = (dims[1] - y0) < 2 ? 1 : 2;
+    for (uint32_t rx = 0; rx < next->dims[0]; rx++) {
+      const uint32_t x0 = rx * 2, nx = (dims[0] - x0) < 2 ? 1 : 2;
+
+      uint32_t sum = 0, maxval = 0;
+      for (uint32_t z = z0; z < z0 + nz; z++) {
+        for (uint32_t y = y0; y < y0 + ny; y++) {
+          for (uint32_t x = x0; x < x0 + nx; x++) {
+            const uint32_t v =
+              get_voxel(ls->layer, ((size_t)z * dims[1] + y) * dims[0] + x, vs);
+            sum += v;
+            if (v > maxval) { maxval = v; }
+          }
+        }
+      }
+
+      uint32_t result;
+      switch (out->method) {
+      case CVB_MAX: result = maxval; break;
+      case CVB_AVERAGE:
+        {
+          const uint32_t n = nx * ny * nz;
+          result = (sum + n / 2) / n;
+        }
+        break;
+      default:
+        result = get_voxel(ls->layer, ((size_t)z0 * dims[1] + y0) * dims[0] + x0, vs);
+        break;
+      }
+      set_voxel(output, dstidx++, vs, result);
+    }
+  }
+}
+
+// Writes out the bricks of the current layer of a level, and passes
+// the layer on, reduced, to the next level.
+static void
+flush_layer(struct bricked_output * out, unsigned int level)
+{
+  struct level_state * ls = &out->levels[level];
+  if (ls->nrslices == 0) { return; }
+
+  struct layer_job job = { out, level };
+  const uint32_t nrlayerbricks = ls->nrbricks[0] * ls->nrbricks[1];
+  run_parallel(nrlayerbricks, process_brick, &job);
+
+  const size_t brickbytes = (size_t)out->bricksize * out->bricksize * out->bricksize *
+    out->voxelsize;
+  const uint32_t firstbrick = (ls->layerz / out->bricksize) * nrlayerbricks;
+  for (uint32_t i = 0; i < nrlayerbricks; i++) {
+    uint32_t bmin[3], bmax[3];
+    brick_bounds(out, ls, firstbrick + i, bmin, bmax);
+    const size_t nrbytes = (size_t)(bmax[0] - bmin[0]) * (bmax[1] - bmin[1]) *
+      (bmax[2] - bmin[2]) * out->voxelsize;
+    seek_to(out->file, ls->offsets[firstbrick + i]);
+    write_bytes(out->file, out->brickbuffers + i * brickbytes, nrbytes);
+  }
+
+  if (level + 1 < out->nrlevels) {
+    struct level_state * next = &out->levels[level + 1];
+    const uint32_t nrreduced = (ls->nrslices + 1) / 2;
+    run_parallel(nrreduced, reduce_slice, &job);
+    next->nrslices += nrreduced;
+
+    const int lastslice = (next->layerz + next->nrslices) == next->dims[2];
+    if ((next->nrslices == out->bricksize) || lastslice) { flush_layer(out, level + 1); }
+  }
+
+  ls->layerz += ls->nrslices;
+  ls->nrslices = 0;
+}
+
+// Sets up the levels, with the placement of each brick in the file.
+static uint64_t
+setup_bricked(struct bricked_output * out, const uint32_t * dims)
+{
+  out->nrlevels = 0;
+  uint32_t ldims[3] = { dims[0], dims[1], dims[2] };
+  for (;;) {
+    struct level_state * ls = &out->levels[out->nrlevels++];
+    uint32_t nrbricks = 1;
+    for (unsigned int i = 0; i < 3; i++) {
+      ls->dims[i] = ldims[i];
+      ls->nrbricks[i] = (ldims[i] + out->bricksize - 1) / out->bricksize;
+      nrbricks *= ls->nrbricks[i];
+    }
+    ls->offsets = (uint64_t *)malloc(nrbricks * sizeof(uint64_t));
+    ls->ranges = (uint32_t *)malloc(nrbricks * 2 * sizeof(uint32_t));
+    ls->histograms = (uint32_t *)malloc(nrbricks * CVB_HISTOGRAM_BINS * sizeof(uint32_t));
+    ls->layer = (uint8_t *)malloc((size_t)ldims[0] * ldims[1] * out->bricksize *
+                                  out->voxelsize);
+    assert(ls->offsets && ls->ranges && ls->histograms && ls->layer);
+    ls->layerz = 0;
+    ls->nrslices = 0;
+
+    if ((out->nrlevels == 16) ||
+        ((ldims[0] <= out->bricksize) && (ldims[1] <= out->bricksize) &&
+         (ldims[2] <= out->bricksize))) {
+      break;
+    }
+    level_dimensions(dims, out->nrlevels, ldims);
+  }
+
+  // Brick tables come right after the header, then the voxels.
+  const size_t entrysize = (4 + CVB_HISTOGRAM_BINS) * sizeof(uint32_t);
+  uint64_t offset = sizeof(struct cvb_header);
+  for (unsigned int l = 0; l < out->nrlevels; l++) {
+    const uint32_t * nb = out->levels[l].nrbricks;
+    offset += (uint64_t)nb[0] * nb[1] * nb[2] * entrysize;
+  }
+
+  // Bricks are placed in Z-curve order.
+  for (unsigned int l = 0; l < out->nrlevels; l++) {
+    struct level_state * ls = &out->levels[l];
+    const uint32_t * nb = ls->nrbricks;
+    const uint32_t nrbricks = nb[0] * nb[1] * nb[2];
+
+    struct brick_order * order =
+      (struct brick_order *)malloc(nrbricks * sizeof(struct brick_order));
+    assert(order);
+    for (uint32_t b = 0; b < nrbricks; b++) {
+      order[b].code = morton_code(b % nb[0], (b / nb[0]) % nb[1], b / (nb[0] * nb[1]));
+      order[b].index = b;
+    }
+    qsort(order, nrbricks, sizeof(struct brick_order), compare_brick_order);
+
+    for (uint32_t i = 0; i < nrbricks; i++) {
+      uint32_t bmin[3], bmax[3];
+      brick_bounds(out, ls, order[i].index, bmin, bmax);
+      ls->offsets[order[i].index] = offset;
+      offset += (uint64_t)(bmax[0] - bmin[0]) * (bmax[1] - bmin[1]) *
+        (bmax[2] - bmin[2]) * out->voxelsize;
+    }
+    free(order);
+  }
+
+  out->brickbuffers = (uint8_t *)malloc((size_t)out->levels[0].nrbricks[0] *
+                                        out->levels[0].nrbricks[1] * out->bricksize *
+                                        out->bricksize * out->bricksize * out->voxelsize);
+  assert(out->brickbuffers);
+  return offset;
+}
+
+static void
+write_uint32(FILE * f, uint32_t value)
+{
+  value = hton_uint32(value);
+  write_bytes(f, &value, sizeof(uint32_t));
+}
+
+static void
+write_float(FILE * f, float value)
+{
+  value = hton_float(value);
+  write_bytes(f, &value, sizeof(float));
+}
+
+// Writes the header and the brick tables, once all bricks are done.
+static void
+finish_bricked(struct bricked_output * out, const uint32_t * dims)
+{
+  const struct level_state * l0 = &out->levels[0];
+  const uint32_t nrbricks0 = l0->nrbricks[0] * l0->nrbricks[1] * l0->nrbricks[2];
+  uint32_t minval = 0xffffffff, maxval = 0;
+  for (uint32_t b = 0; b < nrbricks0; b++) {
+    if (l0->ranges[b * 2 + 0] < minval) { minval = l0->ranges[b * 2 + 0]; }
+    if (l0->ranges[b * 2 + 1] > maxval) { maxval = l0->ranges[b * 2 + 1]; }
+  }
+
+  seek_to(out->file, 0);
+  write_uint32(out->file, 0x43564231); // "CVB1"
+  write_uint32(out->file, sizeof(struct cvb_header));
+  for (unsigned int i = 0; i < 3; i++) { write_uint32(out->file, dims[i]); }
+  write_uint32(out->file, (out->voxelsize == 1) ? CVB_UNSIGNED_BYTE : CVB_UNSIGNED_SHORT);
+  write_uint32(out->file, out->bricksize);
+  write_uint32(out->file, out->nrlevels);
+  write_uint32(out->file, out->method);
+  write_uint32(out->file, CVB_HISTOGRAM_BINS);
+  write_float(out->file, (float)minval);
+  write_float(out->file, (float)maxval);
+  write_float(out->file, 0.0f);
+  write_float(out->file, (float)out->histmax + 1.0f);
+  for (unsigned int i = 0; i < 3; i++) { write_float(out->file, 1.0f); }
+
+  for (unsigned int l = 0; l < out->nrlevels; l++) {
+    struct level_state * ls = &out->levels[l];
+    const uint32_t nrbricks = ls->nrbricks[0] * ls->nrbricks[1] * ls->nrbricks[2];
+    for (uint32_t b = 0; b < nrbricks; b++) {
+      write_uint32(out->file, (uint32_t)(ls->offsets[b] >> 32));
+      write_uint32(out->file, (uint32_t)(ls->offsets[b] & 0xffffffff));
+      write_float(out->file, (float)ls->ranges[b * 2 + 0]);
+      write_float(out->file, (float)ls->ranges[b * 2 + 1]);
+      const uint32_t * histogram = ls->histograms + (size_t)b * CVB_HISTOGRAM_BINS;
+      for (uint32_t i = 0; i < CVB_HISTOGRAM_BINS; i++) {
+        write_uint32(out->file, histogram[i]);
+      }
+    }
+
+    free(ls->offsets);
+    free(ls->ranges);
+    free(ls->histograms);
+    free(ls->layer);
+  }
+  free(out->brickbuffers);
+
+  printf("\n* Wrote %u levels of %ux%ux%u bricks, values in [%u, %u].\n",
+         out->nrlevels, out->bricksize, out->bricksize, out->bricksize,
+         minval, maxval);
+}
+
+// *************************************************************************
 
 int
 main(int argc, char ** argv)
@@ -138,10 +767,59 @@ main(int argc, char ** argv)
   };
 
   const char * exename = argc > 0 ? argv[0] : "raw2vol";
-  if (argc != 7) {
+
+  int bricked = 0;
+  uint32_t bricksize = 64;
+  int lodmethod = CVB_NEAREST;
+  int swap = 0;
+  int memorymb = 256;
+  nr_threads = nr_of_processors();
+
+  int argidx = 1;
+  while ((argidx < argc) && (argv[argidx][0] == '-')) {
+    const char * opt = argv[argidx++];
+    if (strcmp(opt, "-bricked") == 0) {
+      bricked = 1;
+    }
+    else if ((strcmp(opt, "-bricksize") == 0) && (argidx < argc)) {
+      bricksize = atoi(argv[argidx++]);
+      if ((bricksize < 2) || (bricksize > 1024) || (bricksize % 2)) {
+        printf("ERROR: Brick size must be an even number between 2 and 1024.\n");
+        exit(1);
+      }
+    }
+    else if ((strcmp(opt, "-lod") == 0) && (argidx < argc)) {
+      const char * method = argv[argidx++];
+      if (strcmp(method, "nearest") == 0) { lodmethod = CVB_NEAREST; }
+      else if (strcmp(method, "max") == 0) { lodmethod = CVB_MAX; }
+      else if (strcmp(method, "average") == 0) { lodmethod = CVB_AVERAGE; }
+      else {
+        show_usage(exename);
+        exit(1);
+      }
+    }
+    else if (strcmp(opt, "-swap") == 0) {
+      swap = 1;
+    }
+    else if ((strcmp(opt, "-threads") == 0) && (argidx < argc)) {
+      const int n = atoi(argv[argidx++]);
+      nr_threads = (n < 1) ? 1 : ((n > 64) ? 64 : n);
+    }
+    else if ((strcmp(opt, "-memory") == 0) && (argidx < argc)) {
+      memorymb = atoi(argv[argidx++]);
+      if (memorymb < 1) { memorymb = 1; }
+    }
+    else {
+      show_usage(exename);
+      exit(1);
+    }
+  }
+
+  if ((argc - argidx) != 6) {
     show_usage(exename);
     exit(1);
   }
+  argv += argidx - 1;
 
   uint32_t width = atoi(argv[1]);
   uint32_t height = atoi(argv[2]);
@@ -182,49 +860,69 @@ main(int argc, char ** argv)
     exit(1);
   }
 
-
-  size_t waswritten = fwrite(&vh, 1, sizeof(struct vol_header), volf);
-  assert(waswritten == sizeof(struct vol_header));
-
-  const unsigned int rawsize = width * height * images;
-  unsigned int voxelsize = 0;
-  void * rawblock;
-
-  if (bits_per_voxel == 8) {
-    voxelsize = sizeof(unsigned char);
-    rawblock = (uint8_t *)malloc(rawsize*voxelsize);
-    assert(rawblock);
-  }
-  else if (bits_per_voxel == 16 || bits_per_voxel == 12) {
-    voxelsize = sizeof(unsigned short);
-    rawblock = (uint16_t *)malloc(rawsize*voxelsize);
-    assert(rawblock);
-
-    // We'll shift the 12 bits data 4 bits to the right.
-    if (bits_per_voxel == 12) {
-      printf("* Scaling the 12-bit data up to 16-bits.\n");
-      uint16_t * ptr = (uint16_t *) rawblock;
-      for (unsigned int i=0;i<rawsize;++i) {
-        ptr[i] = ptr[i] << 4;
-      }
+  const unsigned int voxelsize = (bits_per_voxel == 8) ? 1 : 2;
+  const size_t slicevoxels = (size_t)width * height;
+  const size_t slicebytes = slicevoxels * voxelsize;
+  // We'll shift the 12 bits data 4 bits to the left.
+  const int shift = (bits_per_voxel == 12);
+
+  struct progress progress;
+  progress.start = SbTime::getTimeOfDay();
+  progress.totalbytes = (uint64_t)slicebytes * images;
+  progress.donebytes = 0;
+
+  printf("* %d-bits dataset (%llu voxels, %llu bytes), %u threads.\n",
+         bits_per_voxel, (unsigned long long)slicevoxels * images,
+         (unsigned long long)progress.totalbytes, nr_threads);
+  if (shift) { printf("* Scaling the 12-bit data up to 16-bits.\n"); }
+
+  if (bricked) {
+    // One layer of bricks is read at a time.
+    struct bricked_output out;
+    out.file = volf;
+    out.voxelsize = voxelsize;
+    out.bricksize = bricksize;
+    out.method = lodmethod;
+    out.histmax = (voxelsize == 1) ? 0xff : 0xffff;
+
+    const uint32_t dims[3] = { width, height, images };
+    (void)setup_bricked(&out, dims);
+
+    struct level_state * l0 = &out.levels[0];
+    for (uint32_t z = 0; z < images; z += bricksize) {
+      const uint32_t n = (images - z < bricksize) ? (images - z) : bricksize;
+      read_voxels(rawf, l0->layer, n * slicebytes);
+      convert_voxels(l0->layer, n * slicevoxels, voxelsize, swap, shift);
+      l0->nrslices = n;
+      flush_layer(&out, 0);
+      report_progress(&progress, n * slicebytes);
     }
 
+    finish_bricked(&out, dims);
   }
   else {
-    assert(0 && "Unknown bitsize. Must be 8, 12 or 16.");
+    // Slabs of as many slices as fit within the memory limit.
+    size_t slabslices = ((size_t)memorymb * 1024 * 1024) / slicebytes;
+    if (slabslices < 1) { slabslices = 1; }
+    if (slabslices > images) { slabslices = images; }
+    uint8_t * slab = (uint8_t *)malloc(slabslices * slicebytes);
+    assert(slab);
+
+    write_bytes(volf, &vh, sizeof(struct vol_header));
+
+    for (uint32_t z = 0; z < images; z += (uint32_t)slabslices) {
+      const size_t n = (images - z < slabslices) ? (images - z) : slabslices;
+      read_voxels(rawf, slab, n * slicebytes);
+      convert_voxels(slab, n * slicevoxels, voxelsize, swap, shift);
+      write_bytes(volf, slab, n * slicebytes);
+      report_progress(&progress, n * slicebytes);
+    }
+    printf("\n");
+    free(slab);
   }
 
-  printf("* %d-bits dataset (%d voxels, %d bytes).\n", 
-         bits_per_voxel, rawsize, rawsize*voxelsize);
-
-  size_t wasread = fread(rawblock, voxelsize, rawsize, rawf);
-  assert(wasread == rawsize);
-  
-  waswritten = fwrite(rawblock, voxelsize, rawsize, volf);
-  assert(waswritten == rawsize);
-
+  report_done(&progress);
 
-  free(rawblock);
   fclose(rawf);
   fclose(volf);
 
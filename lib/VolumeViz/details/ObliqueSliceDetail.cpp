@@ -75,6 +75,7 @@ SoObliqueSliceDetail::copy(void) const
 
   copy->objectcoords = this->objectcoords;
   copy->ijkcoords = this->ijkcoords;
+  copy->voxelpos = this->voxelpos;
   copy->voxelvalue = this->voxelvalue;
 
   return copy;
@@ -106,6 +107,19 @@ SoObliqueSliceDetail::getValueDataPos(void) const
   return this->ijkcoords;
 }
 
+/*!
+  Same as above, but with 32-bit coordinates, for volumes with more
+  than 32767 voxels along an axis. (For such volumes, the 16-bit
+  version above returns <-1, -1, -1>.)
+
+  \since SIM Voleon 2.0
+*/
+void
+SoObliqueSliceDetail::getValueDataPos(SbVec3i32 & pos) const
+{
+  pos = this->voxelpos;
+}
+
 /*!
   Returns value of the picked voxel.
 */
@@ -73,6 +73,7 @@ SoOrthoSliceDetail::copy(void) const
 
   copy->objectcoords = this->objectcoords;
   copy->ijkcoords = this->ijkcoords;
+  copy->voxelpos = this->voxelpos;
   copy->voxelvalue = this->voxelvalue;
 
   return copy;
@@ -104,6 +105,19 @@ SoOrthoSliceDetail::getValueDataPos(void) const
   return this->ijkcoords;
 }
 
+/*!
+  Same as above, but with 32-bit coordinates, for volumes with more
+  than 32767 voxels along an axis. (For such volumes, the 16-bit
+  version above returns <-1, -1, -1>.)
+
+  \since SIM Voleon 2.0
+*/
+void
+SoOrthoSliceDetail::getValueDataPos(SbVec3i32 & pos) const
+{
+  pos = this->voxelpos;
+}
+
 /*!
   Returns value of the picked voxel.
 */
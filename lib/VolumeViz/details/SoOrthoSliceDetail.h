@@ -37,6 +37,7 @@
 #include <Inventor/details/SoSubDetail.h>
 #include <Inventor/SbVec3f.h>
 #include <Inventor/SbVec3s.h>
+#include <Inventor/SbVec3i32.h>
 #include <VolumeViz/C/basic.h>
 
 
@@ -54,11 +55,13 @@ public:
 
   const SbVec3f & getValueObjectPos(void) const;
   const SbVec3s & getValueDataPos(void) const;
+  void getValueDataPos(SbVec3i32 & pos) const;
   unsigned int getValue(void) const;
 
 private:
   SbVec3f objectcoords;
   SbVec3s ijkcoords;
+  SbVec3i32 voxelpos;
   unsigned int voxelvalue;
 
   // FIXME: should rather use a setDetails() function. 20041008 mortene.
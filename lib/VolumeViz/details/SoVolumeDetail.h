@@ -39,6 +39,7 @@
 #include <Inventor/details/SoDetail.h>
 #include <Inventor/details/SoSubDetail.h>
 #include <Inventor/SbLinear.h>
+#include <Inventor/SbVec3i32.h>
 
 #include <VolumeViz/C/basic.h>
 
@@ -56,6 +57,7 @@ public:
 
   void getProfileObjectPos(SbVec3f profile[2]) const;
   int getProfileDataPos(SbVec3s profile[2] = 0) const;
+  void getProfileDataPos(int index, SbVec3i32 & pos) const;
   unsigned int getProfileValue(int index,
                                SbVec3s * pos = 0, SbVec3f * objpos = 0,
                                SbBool flag = FALSE) const;
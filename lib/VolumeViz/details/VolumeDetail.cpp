@@ -44,6 +44,7 @@
 #include <stddef.h>
 #include <string.h>
 
+#include <Inventor/SbBox3i32.h>
 #include <Inventor/SbName.h>
 #include <Inventor/errors/SoDebugError.h>
 #include <Inventor/SoPickedPoint.h>
@@ -54,6 +55,7 @@
 #include <VolumeViz/misc/CvrUtil.h>
 #include <VolumeViz/misc/CvrCLUT.h>
 #include <VolumeViz/misc/CvrVoxelChunk.h>
+#include <VolumeViz/misc/CvrVoxelStore.h>
 #include <VolumeViz/elements/SoTransferFunctionElement.h>
 #include <VolumeViz/elements/CvrVoxelBlockElement.h>
 #include <VolumeViz/nodes/SoVolumeData.h>
@@ -76,17 +78,17 @@ public:
   }
 
   void addVoxelIntersection(const SbVec3f & voxelcoord,
-                            const SbVec3s & voxelindex,
+                            const SbVec3i32 & voxelindex,
                             unsigned int voxelvalue,
                             uint8_t rgba[4]);
   
-  void setVoxelValue(const SbVec3s & voxelpos, uint8_t value, 
+  void setVoxelValue(const SbVec3i32 & voxelpos, uint8_t value, 
                      const CvrVoxelBlockElement * elem);
 
   class VoxelInfo {
   public:
     SbVec3f voxelcoord;
-    SbVec3s voxelindex;
+    SbVec3i32 voxelindex;
     unsigned int voxelvalue;
     uint8_t rgba[4];
   };
@@ -102,6 +104,16 @@ public:
 #define PRIVATE(p) (p->pimpl)
 #define PUBLIC(p) (p->master)
 
+// The 16-bit voxel positions of the public API can not hold positions
+// in volumes with more than 32767 voxels along an axis, so those are
+// returned as <-1, -1, -1>.
+static SbVec3s
+cvr_short_voxelpos(const SbVec3i32 & pos)
+{
+  if (!CvrUtil::fitsShort(pos)) { return SbVec3s(-1, -1, -1); }
+  return CvrUtil::toVec3s(pos);
+}
+
 // *************************************************************************
 
 SO_DETAIL_SOURCE(SoVolumeDetail);
@@ -177,8 +189,8 @@ SoVolumeDetail::getProfileDataPos(SbVec3s profile[2]) const
   assert(nrprofilepoints >= 2);
 
   if (profile != NULL) {
-    profile[0] = PRIVATE(this)->voxelinfolist[0].voxelindex;
-    profile[1] = PRIVATE(this)->voxelinfolist[nrprofilepoints - 1].voxelindex;
+    profile[0] = cvr_short_voxelpos(PRIVATE(this)->voxelinfolist[0].voxelindex);
+    profile[1] = cvr_short_voxelpos(PRIVATE(this)->voxelinfolist[nrprofilepoints - 1].voxelindex);
   }
 
   return nrprofilepoints;
@@ -206,12 +218,30 @@ SoVolumeDetail::getProfileValue(int index,
 {
   assert(index >= 0 && index < PRIVATE(this)->voxelinfolist.getLength());
 
-  if (pos) { *pos = PRIVATE(this)->voxelinfolist[index].voxelindex; }
+  if (pos) { *pos = cvr_short_voxelpos(PRIVATE(this)->voxelinfolist[index].voxelindex); }
   if (objpos) { *objpos = PRIVATE(this)->voxelinfolist[index].voxelcoord; }
   return PRIVATE(this)->voxelinfolist[index].voxelvalue;
 }
 
 
+/*!
+  Sets \a pos to the voxel-space coordinates of the voxel at the given
+  index along the ray intersection profile.
+
+  Use this instead of the 16-bit coordinates of getProfileDataPos()
+  and getProfileValue() for volumes with more than 32767 voxels along
+  an axis.
+
+  \since SIM Voleon 2.0
+*/
+void
+SoVolumeDetail::getProfileDataPos(int index, SbVec3i32 & pos) const
+{
+  assert(index >= 0 && index < PRIVATE(this)->voxelinfolist.getLength());
+  pos = PRIVATE(this)->voxelinfolist[index].voxelindex;
+}
+
+
 /*!
   Fills in the information about the first voxel along the pick ray
   intersection which is not completely transparent.
@@ -244,7 +274,7 @@ SoVolumeDetail::getFirstNonTransparentValue(unsigned int * value,
 
   if (idx == PRIVATE(this)->voxelinfolist.getLength()) { return FALSE; }
 
-  if (pos) { *pos = PRIVATE(this)->voxelinfolist[idx].voxelindex; }
+  if (pos) { *pos = cvr_short_voxelpos(PRIVATE(this)->voxelinfolist[idx].voxelindex); }
   if (objpos) { *objpos = PRIVATE(this)->voxelinfolist[idx].voxelcoord; }
   if (value) { *value = PRIVATE(this)->voxelinfolist[idx].voxelvalue; }
   return TRUE;
@@ -269,7 +299,7 @@ SoVolumeDetail::setDetails(const SbVec3f raystart, const SbVec3f rayend,
 
   // Find objectspace-dimensions of a voxel.
   const SbBox3f & objbbox = vbelem->getUnitDimensionsBox();
-  const SbVec3s & voxcubedims = vbelem->getVoxelCubeDimensions();
+  const SbVec3i32 & voxcubedims = vbelem->getVoxelCubeDimensions();
 
   SbVec3f mincorner, maxcorner;
   objbbox.getBounds(mincorner, maxcorner);
@@ -285,9 +315,10 @@ SoVolumeDetail::setDetails(const SbVec3f raystart, const SbVec3f rayend,
   const float minvoxdim = SbMin(voxelsize[0], SbMin(voxelsize[1], voxelsize[2]));
   const unsigned int maxvoxinray = (unsigned int)(rayvec.length() / minvoxdim + 1);  
   const SbVec3f stepvec = (rayvec / (float)maxvoxinray) / 2.0f;
-  const SbBox3s voxelbounds(SbVec3s(0, 0, 0), voxcubedims - SbVec3s(1, 1, 1));
+  const SbBox3i32 voxelbounds(SbVec3i32(0, 0, 0),
+                              vbelem->getVoxelStore()->getDimensions() - SbVec3i32(1, 1, 1));
 
-  SbVec3s ijk, lastijk(-1, -1, -1);
+  SbVec3i32 ijk, lastijk(-1, -1, -1);
   SoPickedPoint * pickedpoint = NULL;
   CvrCLUT * clut = NULL;
   SbBool opaquevoxelhit = FALSE;
@@ -323,16 +354,17 @@ SoVolumeDetail::setDetails(const SbVec3f raystart, const SbVec3f rayend,
                              ijk[0], ijk[1], ijk[2]);
     }
 
-    clut = CvrVoxelChunk::getCLUT(transferfunctionelement, CvrCLUT::ALPHA_AS_IS);
+    clut = CvrVoxelChunk::getCLUT(transferfunctionelement, CvrCLUT::ALPHA_AS_IS,
+                                  vbelem->getVoxelStore());
     clut->ref();
     uint8_t rgba[4];
 
-    // FIXME: As SIMVoleon does not support 16bits voxels 100% yet,
-    // we'll have to scale down the value to 8bit if needed before
-    // passing on the data. (20100806 handegar)
-    const uint32_t voxelvalue = vbelem->getVoxelValue(ijk) >> 8*(vbelem->getBytesPrVoxel() - 1);
+    // The CLUT covers the full range of lookup indices, also for
+    // 16-bit, SIGNED_SHORT and FLOAT data.
+    const uint32_t voxelindex = vbelem->getVoxelStore()->getVoxelIndex(ijk);
+    const uint32_t voxelvalue = vbelem->getVoxelValue(ijk);
 
-    clut->lookupRGBA(voxelvalue, rgba);
+    clut->lookupRGBA(voxelindex, rgba);
      
     if (pickedpoint == NULL) {                
       if (rgba[3] != 0) {
@@ -388,7 +420,7 @@ SoVolumeDetail::setDetails(const SbVec3f raystart, const SbVec3f rayend,
 
 void
 SoVolumeDetailP::addVoxelIntersection(const SbVec3f & voxelcoord,
-                                      const SbVec3s & voxelindex,
+                                      const SbVec3i32 & voxelindex,
                                       unsigned int voxelvalue,
                                       uint8_t rgba[4])
 {
@@ -407,22 +439,28 @@ SoVolumeDetailP::addVoxelIntersection(const SbVec3f & voxelcoord,
 
 // For debugging purposes
 void
-SoVolumeDetailP::setVoxelValue(const SbVec3s & voxelpos, uint8_t value, 
+SoVolumeDetailP::setVoxelValue(const SbVec3i32 & voxelpos, uint8_t value, 
                                const CvrVoxelBlockElement * elem)
 {
-  SbVec3s voxelcubedims = elem->getVoxelCubeDimensions();
+  const SbVec3i32 & voxelcubedims = elem->getVoxelStore()->getDimensions();
 
   assert(voxelpos[0] < voxelcubedims[0]);
   assert(voxelpos[1] < voxelcubedims[1]);
   assert(voxelpos[2] < voxelcubedims[2]);
 
-  uint8_t * voxptr = (uint8_t *) elem->getVoxels(); // Cast the const away
-
-  int advance = 0;
-  const unsigned int dim[3] = { // so we don't overflow a short
-    static_cast<unsigned int>(voxelcubedims[0]),
-    static_cast<unsigned int>(voxelcubedims[1]),
-    static_cast<unsigned int>(voxelcubedims[2])
+  // Only possible to annotate the voxels if they are all in memory.
+  CvrVoxelStore * store = elem->getVoxelStore();
+  uint8_t * voxptr = (uint8_t *) store->getResidentVoxels(); // Cast the const away
+  if (voxptr == NULL) { return; }
+
+  // The voxels of a subSetting() view are laid out as in the volume
+  // it views.
+  const SbVec3i32 & residentdims = store->getResidentDimensions();
+  size_t advance = 0;
+  const size_t dim[3] = { // so we don't overflow on large volumes
+    static_cast<size_t>(residentdims[0]),
+    static_cast<size_t>(residentdims[1]),
+    static_cast<size_t>(residentdims[2])
   };
   advance += voxelpos[2] * dim[0] * dim[1];
   advance += voxelpos[1] * dim[0];
@@ -434,6 +472,7 @@ SoVolumeDetailP::setVoxelValue(const SbVec3s & voxelpos, uint8_t value,
   switch (elem->getBytesPrVoxel()) {
   case 1: *voxptr = value; break;
   case 2: *((uint16_t *)voxptr) = value; break;
+  case 4: *((float *)voxptr) = value; break;
   default: assert(FALSE); break;
   }
 }
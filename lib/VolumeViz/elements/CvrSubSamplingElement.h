@@ -0,0 +1,77 @@
+#ifndef SIMVOLEON_CVRSUBSAMPLINGELEMENT_H
+#define SIMVOLEON_CVRSUBSAMPLINGELEMENT_H
+
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+#include <Inventor/SbVec3f.h>
+#include <Inventor/elements/SoSubElement.h>
+#include <VolumeViz/nodes/SoVolumeData.h>
+
+// *************************************************************************
+
+class CvrSubSamplingElement : public SoElement {
+  typedef SoElement inherited;
+
+  SO_ELEMENT_HEADER(CvrSubSamplingElement);
+
+public:
+  static void initClass(void);
+  virtual void init(SoState * state);
+  static const CvrSubSamplingElement * getInstance(SoState * const state);
+
+  virtual SbBool matches(const SoElement * element) const;
+  virtual SoElement * copyMatchInfo(void) const;
+
+  static void set(SoState * state, SbBool fixedlevel, unsigned int level,
+                  SbBool autolevel, unsigned int budgetlevel,
+                  SoVolumeData::SubMethod method);
+
+  SoVolumeData::SubMethod getMethod(void) const;
+  unsigned int getLevel(SoState * state, const SbVec3f & center,
+                        const SbVec3f voxeledges[3],
+                        unsigned int nrlevels) const;
+
+protected:
+  virtual ~CvrSubSamplingElement();
+
+private:
+  SbBool fixedlevel;
+  unsigned int level;
+  SbBool autolevel;
+  unsigned int budgetlevel;
+  SoVolumeData::SubMethod method;
+};
+
+// *************************************************************************
+
+#endif // !SIMVOLEON_CVRSUBSAMPLINGELEMENT_H
@@ -34,9 +34,11 @@
 \**************************************************************************/
 
 #include <Inventor/elements/SoReplacedElement.h>
-#include <Inventor/SbVec3s.h>
+#include <Inventor/SbVec3i32.h>
 #include <Inventor/SbBox3f.h>
 
+class CvrVoxelStore;
+
 // *************************************************************************
 
 class CvrVoxelBlockElement : public SoReplacedElement {
@@ -45,26 +47,28 @@ class CvrVoxelBlockElement : public SoReplacedElement {
 
 public:
   static void set(SoState * state, SoNode * node, unsigned int bytesprvoxel,
-                  const SbVec3s & voxelcubedims, const uint8_t * voxels,
-                  const SbBox3f & unitdimensionsbox);
+                  const SbVec3i32 & voxelcubedims, CvrVoxelStore * voxels,
+                  const SbBox3f & unitdimensionsbox,
+                  SbUniqueId dataid, SbUniqueId storageid);
 
   unsigned int getBytesPrVoxel(void) const;
-  const SbVec3s & getVoxelCubeDimensions(void) const;
-  const uint8_t * getVoxels(void) const;
+  const SbVec3i32 & getVoxelCubeDimensions(void) const;
+  CvrVoxelStore * getVoxelStore(void) const;
+  SbUniqueId getStorageId(void) const;
 
   const SbBox3f & getUnitDimensionsBox(void) const;
 
   // The following public functions are convenience methods,
   // collecting common code working on the data from SoVolumeData.
 
-  SbVec3s objectCoordsToIJK(const SbVec3f & objectpos) const;
+  SbVec3i32 objectCoordsToIJK(const SbVec3f & objectpos) const;
 
   void getPageGeometry(const int axis, const int slicenr,
                        SbVec3f & origo,
                        SbVec3f & horizspan,
                        SbVec3f & verticalspan) const;
 
-  uint32_t getVoxelValue(const SbVec3s & voxelpos) const;
+  uint32_t getVoxelValue(const SbVec3i32 & voxelpos) const;
 
 
   // Standard element class machinery:
@@ -81,9 +85,10 @@ protected:
 
 private:
   unsigned int bytesprvoxel;
-  SbVec3s voxelcubedims;
-  const uint8_t * voxels;
+  SbVec3i32 voxelcubedims;
+  CvrVoxelStore * voxels;
   SbBox3f unitdimensionsbox;
+  SbUniqueId storageid;
 };
 
 // *************************************************************************
@@ -62,6 +62,10 @@ public:
   void getTransparencyThresholds(uint32_t & low, uint32_t & high) const;
 
 
+  static void setDataWindow(SoState * const state, float low, float high);
+  SbBool getDataWindow(float & low, float & high) const;
+
+
   static const SoTransferFunctionElement * getInstance(SoState * const state);
 
 
@@ -71,6 +75,7 @@ protected:
 private:
   SoTransferFunction * transferfunction;
   uint32_t transpthreshold[2];
+  float datawindow[2];
 };
 
 #endif // !COIN_SOTRANSFERFUNCTIONELEMENT_H
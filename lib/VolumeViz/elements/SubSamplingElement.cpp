@@ -0,0 +1,193 @@
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+// Decides which level of the voxel store's resolution pyramid should
+// be used for rendering a part of the volume, either as set up
+// explicitly from SoVolumeData::setSubSamplingLevel(), or from how
+// large the part will be on screen. The level is never finer than
+// what fits within the texture memory limit set with
+// SoVolumeData::setTexMemorySize().
+
+#include <VolumeViz/elements/CvrSubSamplingElement.h>
+
+#include <assert.h>
+
+#include <Inventor/SbLinear.h>
+#include <Inventor/SbViewportRegion.h>
+#include <Inventor/elements/SoModelMatrixElement.h>
+#include <Inventor/elements/SoViewVolumeElement.h>
+#include <Inventor/elements/SoViewportRegionElement.h>
+
+// *************************************************************************
+
+SO_ELEMENT_SOURCE(CvrSubSamplingElement);
+
+// *************************************************************************
+
+void
+CvrSubSamplingElement::initClass(void)
+{
+  SO_ELEMENT_INIT_CLASS(CvrSubSamplingElement, inherited);
+}
+
+
+CvrSubSamplingElement::~CvrSubSamplingElement(void)
+{
+}
+
+void
+CvrSubSamplingElement::init(SoState * state)
+{
+  inherited::init(state);
+  this->fixedlevel = FALSE;
+  this->level = 0;
+  this->autolevel = FALSE;
+  this->budgetlevel = 0;
+  this->method = SoVolumeData::NEAREST;
+}
+
+const CvrSubSamplingElement *
+CvrSubSamplingElement::getInstance(SoState * const state)
+{
+  return (const CvrSubSamplingElement *)
+    CvrSubSamplingElement::getConstElement(state,
+                                           CvrSubSamplingElement::classStackIndex);
+}
+
+// *************************************************************************
+
+SbBool
+CvrSubSamplingElement::matches(const SoElement * element) const
+{
+  const CvrSubSamplingElement * elem = (const CvrSubSamplingElement *)element;
+  return
+    inherited::matches(element) &&
+    (elem->fixedlevel == this->fixedlevel) &&
+    (elem->level == this->level) &&
+    (elem->autolevel == this->autolevel) &&
+    (elem->budgetlevel == this->budgetlevel) &&
+    (elem->method == this->method);
+}
+
+SoElement *
+CvrSubSamplingElement::copyMatchInfo(void) const
+{
+  assert(this->getTypeId().canCreateInstance());
+
+  CvrSubSamplingElement * element = (CvrSubSamplingElement *)
+    this->getTypeId().createInstance();
+
+  *element = *this;
+
+  return element;
+}
+
+
+void
+CvrSubSamplingElement::set(SoState * state, SbBool fixedlevel, unsigned int level,
+                           SbBool autolevel, unsigned int budgetlevel,
+                           SoVolumeData::SubMethod method)
+{
+  CvrSubSamplingElement * element = (CvrSubSamplingElement *)
+    CvrSubSamplingElement::getElement(state, CvrSubSamplingElement::classStackIndex);
+  element->fixedlevel = fixedlevel;
+  element->level = level;
+  element->autolevel = autolevel;
+  element->budgetlevel = budgetlevel;
+  element->method = method;
+}
+
+SoVolumeData::SubMethod
+CvrSubSamplingElement::getMethod(void) const
+{
+  return this->method;
+}
+
+// *************************************************************************
+
+// Returns the pyramid level to use for a part of the volume centered
+// at \a center, where \a voxeledges are the edges of a single voxel
+// along each of the three axes. Both are in the current local
+// coordinate system. A zero vector in \a voxeledges means that the
+// axis should be ignored, as for 2D slices.
+//
+// Level 0 is full resolution, and the returned value will always be
+// less than \a nrlevels.
+unsigned int
+CvrSubSamplingElement::getLevel(SoState * state, const SbVec3f & center,
+                                const SbVec3f voxeledges[3],
+                                unsigned int nrlevels) const
+{
+  assert(nrlevels > 0);
+
+  unsigned int l = this->fixedlevel ? this->level : 0;
+  l = SbMax(l, this->budgetlevel);
+
+  if (this->autolevel) {
+    const SbMatrix & mm = SoModelMatrixElement::get(state);
+    const SbViewVolume & vv = SoViewVolumeElement::get(state);
+    const SbViewportRegion & vp = SoViewportRegionElement::get(state);
+
+    // Find the smallest voxel extent in world space.
+    float voxelsize = -1.0f;
+    for (unsigned int i = 0; i < 3; i++) {
+      if (voxeledges[i] == SbVec3f(0.0f, 0.0f, 0.0f)) { continue; }
+      SbVec3f edge;
+      mm.multDirMatrix(voxeledges[i], edge);
+      const float len = edge.length();
+      if ((voxelsize < 0.0f) || (len < voxelsize)) { voxelsize = len; }
+    }
+
+    // The size of a single pixel in world space, at the given
+    // position.
+    SbVec3f worldcenter;
+    mm.multVecMatrix(center, worldcenter);
+    const short pixels = vp.getViewportSizePixels()[1];
+    const float pixelsize =
+      vv.getWorldToScreenScale(worldcenter, 1.0f) / (pixels > 0 ? pixels : 1);
+
+    // Pick the coarsest level where voxels will still not be larger
+    // than a pixel on screen.
+    if ((voxelsize > 0.0f) && (pixelsize > 0.0f)) {
+      unsigned int autol = 0;
+      while (((autol + 1) < nrlevels) &&
+             (voxelsize * float(1 << (autol + 1)) <= pixelsize)) {
+        autol++;
+      }
+      l = SbMax(l, autol);
+    }
+  }
+
+  return SbMin(l, nrlevels - 1);
+}
+
+// *************************************************************************
@@ -68,6 +68,9 @@ SoTransferFunctionElement::init(SoState * state)
   // overflow.
   this->transpthreshold[0] = 0;
   this->transpthreshold[1] = (uint32_t(1 << 31) - 1) * 2 + 1;
+
+  // An empty window means no windowing.
+  this->datawindow[0] = this->datawindow[1] = 0.0f;
 }
 
 void
@@ -109,6 +112,28 @@ SoTransferFunctionElement::getTransparencyThresholds(uint32_t & low,
   high = this->transpthreshold[1];
 }
 
+void
+SoTransferFunctionElement::setDataWindow(SoState * const state,
+                                         float low, float high)
+{
+  SoTransferFunctionElement * elem = (SoTransferFunctionElement *)
+    SoElement::getElement(state, SoTransferFunctionElement::classStackIndex);
+
+  if (elem) {
+    elem->datawindow[0] = low;
+    elem->datawindow[1] = high;
+  }
+}
+
+// Returns FALSE if no window is set.
+SbBool
+SoTransferFunctionElement::getDataWindow(float & low, float & high) const
+{
+  low = this->datawindow[0];
+  high = this->datawindow[1];
+  return low < high;
+}
+
 const SoTransferFunctionElement *
 SoTransferFunctionElement::getInstance(SoState * const state)
 {
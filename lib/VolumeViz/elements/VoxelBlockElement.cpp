@@ -40,6 +40,7 @@
 #include <Inventor/nodes/SoNode.h>
 
 #include <VolumeViz/misc/CvrUtil.h>
+#include <VolumeViz/misc/CvrVoxelStore.h>
 
 // *************************************************************************
 
@@ -68,6 +69,7 @@ CvrVoxelBlockElement::init(SoState * state)
   this->bytesprvoxel = 1;
   this->voxelcubedims.setValue(0, 0, 0);
   this->voxels = NULL;
+  this->storageid = 0;
 }
 
 
@@ -94,7 +96,8 @@ CvrVoxelBlockElement::matches(const SoElement * element) const
     elem->bytesprvoxel == this->bytesprvoxel &&
     elem->voxelcubedims == this->voxelcubedims &&
     elem->voxels == this->voxels &&
-    elem->unitdimensionsbox == this->unitdimensionsbox;
+    elem->unitdimensionsbox == this->unitdimensionsbox &&
+    elem->storageid == this->storageid;
 }
 
 
@@ -117,19 +120,24 @@ CvrVoxelBlockElement::copyMatchInfo(void) const
 void
 CvrVoxelBlockElement::set(SoState * state, SoNode * node,
                           unsigned int bytesprvoxel,
-                          const SbVec3s & voxelcubedims,
-                          const uint8_t * voxels,
-                          const SbBox3f & unitdimensionsbox)
+                          const SbVec3i32 & voxelcubedims,
+                          CvrVoxelStore * voxels,
+                          const SbBox3f & unitdimensionsbox,
+                          SbUniqueId dataid, SbUniqueId storageid)
 {
   CvrVoxelBlockElement * elem = (CvrVoxelBlockElement *)
     SoElement::getElement(state, CvrVoxelBlockElement::classStackIndex);
   assert(elem);
 
-  elem->nodeId = node->getNodeId();
+  // Changes whenever the voxels may have changed, which for a view
+  // made by SoVolumeData::subSetting() is not only when the node
+  // itself is touched.
+  elem->nodeId = dataid;
   elem->bytesprvoxel = bytesprvoxel;
   elem->voxelcubedims = voxelcubedims;
   elem->voxels = voxels;
   elem->unitdimensionsbox = unitdimensionsbox;
+  elem->storageid = storageid;
 }
 
 
@@ -143,20 +151,34 @@ CvrVoxelBlockElement::getBytesPrVoxel(void) const
 }
 
 
-const SbVec3s &
+const SbVec3i32 &
 CvrVoxelBlockElement::getVoxelCubeDimensions(void) const
 {
   return this->voxelcubedims;
 }
 
 
-const uint8_t *
-CvrVoxelBlockElement::getVoxels(void) const
+// Returns the store which gives access to the voxel data. Note that
+// the voxels are not necessarily all resident in memory, they should
+// be fetched from the store only for the region actually needed.
+CvrVoxelStore *
+CvrVoxelBlockElement::getVoxelStore(void) const
 {
   return this->voxels;
 }
 
 
+// Returns the id of the node which owns the voxel storage. This is
+// the node itself, except for SoVolumeData::subSetting() views, which
+// return the id of the volume they view, so textures can be shared
+// with it.
+SbUniqueId
+CvrVoxelBlockElement::getStorageId(void) const
+{
+  return this->storageid;
+}
+
+
 const SbBox3f &
 CvrVoxelBlockElement::getUnitDimensionsBox(void) const
 {
@@ -167,19 +189,22 @@ CvrVoxelBlockElement::getUnitDimensionsBox(void) const
 // *************************************************************************
 
 
-SbVec3s
+// The voxel coordinates are found from the dimensions of the voxel
+// store.
+SbVec3i32
 CvrVoxelBlockElement::objectCoordsToIJK(const SbVec3f & objectpos) const
 {
-  const SbVec3s & voxeldims = this->getVoxelCubeDimensions();
+  assert(this->voxels);
+  const SbVec3i32 & voxeldims = this->voxels->getDimensions();
 
   const SbBox3f & volsize = this->getUnitDimensionsBox();
   const SbVec3f & mincorner = volsize.getMin();
   const SbVec3f size = volsize.getMax() - mincorner;
 
-  SbVec3s ijk;
+  SbVec3i32 ijk;
   for (int i=0; i < 3; i++) {
     const float normcoord = (objectpos[i] - mincorner[i]) / size[i];
-    ijk[i] = (short)(normcoord * voxeldims[i]);
+    ijk[i] = (int32_t)(normcoord * voxeldims[i]);
   }
 
   if (0 && CvrUtil::debugRayPicks()) {
@@ -225,7 +250,7 @@ CvrVoxelBlockElement::getPageGeometry(const int axis, const int slicenr,
   SbVec2f qmax, qmin;
   QUAD.getBounds(qmin, qmax);
 
-  const SbVec3s & dimensions = this->getVoxelCubeDimensions();
+  const SbVec3i32 & dimensions = this->getVoxelCubeDimensions();
  
   const float depthprslice = (spacemax[axis] - spacemin[axis]) / dimensions[axis];
   const float depth = spacemin[axis] + slicenr * depthprslice + depthprslice/2.0f;
@@ -277,38 +302,11 @@ CvrVoxelBlockElement::getPageGeometry(const int axis, const int slicenr,
 // *************************************************************************
 
 
-// FIXME: this function is also present in SoVolumeData.  Refactor
-// to common util function. 20040719 mortene.
 uint32_t
-CvrVoxelBlockElement::getVoxelValue(const SbVec3s & voxelpos) const
+CvrVoxelBlockElement::getVoxelValue(const SbVec3i32 & voxelpos) const
 {
-  assert(voxelpos[0] < this->voxelcubedims[0]);
-  assert(voxelpos[1] < this->voxelcubedims[1]);
-  assert(voxelpos[2] < this->voxelcubedims[2]);
-
-  const uint8_t * voxptr = this->voxels;
-
-  int advance = 0;
-  const unsigned int dim[3] = { // so we don't overflow a short
-    static_cast<unsigned int>(this->voxelcubedims[0]),
-    static_cast<unsigned int>(this->voxelcubedims[1]),  
-    static_cast<unsigned int>(this->voxelcubedims[2])
-  };
-  advance += voxelpos[2] * dim[0] * dim[1];
-  advance += voxelpos[1] * dim[0];
-  advance += voxelpos[0];
-
-  advance *= this->bytesprvoxel;
-
-  voxptr += advance;
-
-  uint32_t val = 0;
-  switch (this->bytesprvoxel) {
-  case 1: val = *voxptr; break;
-  case 2: val = *((uint16_t *)voxptr); break;
-  default: assert(FALSE); break;
-  }
-  return val;
+  assert(this->voxels);
+  return this->voxels->getVoxelValue(voxelpos);
 }
 
 
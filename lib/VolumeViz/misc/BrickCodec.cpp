@@ -0,0 +1,306 @@
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+#include <VolumeViz/misc/CvrBrickCodec.h>
+
+#include <assert.h>
+#include <string.h> // memcpy()
+
+// *************************************************************************
+
+// The compressed stream starts with one byte telling how the rest of
+// it is to be interpreted.
+enum { CVR_CODEC_STORED = 0, CVR_CODEC_LZ = 1 };
+
+// The LZ stream is a series of sequences, each made up of a token
+// byte, literal bytes to copy, and a 16-bit back-reference offset
+// for the match to copy. The upper and lower 4 bits of the token give
+// the number of literals and the match length (minus MINMATCH), where
+// 15 means that more length bytes follow. The last sequence has only
+// literals.
+
+static const unsigned int MINMATCH = 4;
+static const unsigned int HASHBITS = 13;
+static const size_t MAXOFFSET = 65535;
+
+// The last bytes of the input are always emitted as literals, which
+// keeps match extension and 32-bit reads within the input.
+static const size_t LASTLITERALS = 5;
+static const size_t MFLIMIT = 12;
+
+// *************************************************************************
+
+static inline uint32_t
+cvr_codec_read32(const uint8_t * p)
+{
+  uint32_t v;
+  (void)memcpy(&v, p, sizeof(uint32_t));
+  return v;
+}
+
+static inline unsigned int
+cvr_codec_hash(const uint32_t v)
+{
+  return (v * 2654435761u) >> (32 - HASHBITS);
+}
+
+static inline uint8_t *
+cvr_codec_write_length(uint8_t * op, size_t len)
+{
+  while (len >= 255) { *op++ = 255; len -= 255; }
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+static inline SbBool
+cvr_codec_read_length(const uint8_t *& ip, const uint8_t * iend, size_t & len)
+{
+  unsigned int b;
+  do {
+    if (ip >= iend) { return FALSE; }
+    b = *ip++;
+    len += b;
+  } while (b == 255);
+  return TRUE;
+}
+
+// Writes the token and the literals of a sequence. Returns the output
+// position after the literals, and the token position in "token".
+static uint8_t *
+cvr_codec_write_literals(uint8_t * op, const uint8_t * literals,
+                         const size_t litlen, uint8_t *& token)
+{
+  token = op++;
+  *token = (uint8_t)(((litlen >= 15) ? 15 : litlen) << 4);
+  if (litlen >= 15) { op = cvr_codec_write_length(op, litlen - 15); }
+  (void)memcpy(op, literals, litlen);
+  return op + litlen;
+}
+
+static size_t
+cvr_codec_lz_compress(const uint8_t * in, const size_t n, uint8_t * out)
+{
+  uint8_t * op = out;
+  uint8_t * token;
+  const uint8_t * anchor = in;
+
+  if (n > MFLIMIT) {
+    const uint8_t * const matchlimit = in + n - LASTLITERALS;
+    const uint8_t * const iplimit = in + n - MFLIMIT;
+
+    uint32_t table[1 << HASHBITS];
+    (void)memset(table, 0, sizeof(table));
+
+    const uint8_t * ip = in + 1;
+    while (ip < iplimit) {
+      const uint32_t seq = cvr_codec_read32(ip);
+      const unsigned int h = cvr_codec_hash(seq);
+      const uint8_t * ref = in + table[h];
+      table[h] = (uint32_t)(ip - in);
+
+      if (((size_t)(ip - ref) > MAXOFFSET) || (cvr_codec_read32(ref) != seq)) {
+        // Skip faster through data which does not compress.
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+
+      const uint8_t * mp = ip + MINMATCH;
+      const uint8_t * rp = ref + MINMATCH;
+      while ((mp < matchlimit) && (*mp == *rp)) { mp++; rp++; }
+
+      op = cvr_codec_write_literals(op, anchor, ip - anchor, token);
+
+      const size_t offset = ip - ref;
+      *op++ = (uint8_t)(offset & 0xff);
+      *op++ = (uint8_t)(offset >> 8);
+
+      const size_t matchlen = (mp - ip) - MINMATCH;
+      *token |= (uint8_t)((matchlen >= 15) ? 15 : matchlen);
+      if (matchlen >= 15) { op = cvr_codec_write_length(op, matchlen - 15); }
+
+      ip = mp;
+      anchor = ip;
+    }
+  }
+
+  op = cvr_codec_write_literals(op, anchor, in + n - anchor, token);
+  return op - out;
+}
+
+static SbBool
+cvr_codec_lz_decompress(const uint8_t * in, const size_t inlen,
+                        uint8_t * out, const size_t n)
+{
+  const uint8_t * ip = in;
+  const uint8_t * const iend = in + inlen;
+  uint8_t * op = out;
+  uint8_t * const oend = out + n;
+
+  while (ip < iend) {
+    const unsigned int token = *ip++;
+
+    size_t litlen = token >> 4;
+    if ((litlen == 15) && !cvr_codec_read_length(ip, iend, litlen)) { return FALSE; }
+    if (((size_t)(iend - ip) < litlen) || ((size_t)(oend - op) < litlen)) { return FALSE; }
+    (void)memcpy(op, ip, litlen);
+    op += litlen;
+    ip += litlen;
+
+    if (ip == iend) { break; } // last sequence has no match
+
+    if ((iend - ip) < 2) { return FALSE; }
+    const size_t offset = ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+    if ((offset == 0) || (offset > (size_t)(op - out))) { return FALSE; }
+
+    size_t matchlen = token & 15;
+    if ((matchlen == 15) && !cvr_codec_read_length(ip, iend, matchlen)) { return FALSE; }
+    matchlen += MINMATCH;
+    if ((size_t)(oend - op) < matchlen) { return FALSE; }
+
+    const uint8_t * match = op - offset;
+    if (offset >= matchlen) {
+      (void)memcpy(op, match, matchlen);
+      op += matchlen;
+    }
+    else {
+      // Overlapping copy, repeats the last "offset" bytes.
+      for (size_t i = 0; i < matchlen; i++) { *op++ = *match++; }
+    }
+  }
+
+  return op == oend;
+}
+
+// Reorders the bytes of "in" so all first bytes of the voxels come
+// first, then all second bytes, etc.
+static void
+cvr_codec_shuffle(const uint8_t * in, const size_t n, const unsigned int unitsize,
+                  uint8_t * out)
+{
+  const size_t nrunits = n / unitsize;
+  for (unsigned int b = 0; b < unitsize; b++) {
+    uint8_t * plane = out + b * nrunits;
+    for (size_t i = 0; i < nrunits; i++) { plane[i] = in[i * unitsize + b]; }
+  }
+}
+
+static void
+cvr_codec_unshuffle(const uint8_t * in, const size_t n, const unsigned int unitsize,
+                    uint8_t * out)
+{
+  const size_t nrunits = n / unitsize;
+  for (unsigned int b = 0; b < unitsize; b++) {
+    const uint8_t * plane = in + b * nrunits;
+    for (size_t i = 0; i < nrunits; i++) { out[i * unitsize + b] = plane[i]; }
+  }
+}
+
+// *************************************************************************
+
+// Returns the size of the output buffer needed for compress() of
+// "nrbytes" input bytes, for the worst case of incompressible data.
+size_t
+CvrBrickCodec::getMaxCompressedSize(const size_t nrbytes)
+{
+  return 1 + nrbytes + (nrbytes / 255) + 16;
+}
+
+// Compresses "nrbytes" bytes of voxels of "unitsize" bytes each from
+// "input" to "output", which must have room for
+// getMaxCompressedSize() bytes. Returns the number of bytes written.
+size_t
+CvrBrickCodec::compress(const uint8_t * input, const size_t nrbytes,
+                        const unsigned int unitsize, uint8_t * output)
+{
+  assert(unitsize > 0);
+  assert((nrbytes % unitsize) == 0);
+
+  const uint8_t * src = input;
+  uint8_t * shuffled = NULL;
+  if (unitsize > 1) {
+    shuffled = new uint8_t[nrbytes];
+    cvr_codec_shuffle(input, nrbytes, unitsize, shuffled);
+    src = shuffled;
+  }
+
+  size_t packedsize = 1 + cvr_codec_lz_compress(src, nrbytes, output + 1);
+  delete[] shuffled;
+
+  if (packedsize < (1 + nrbytes)) {
+    output[0] = CVR_CODEC_LZ;
+  }
+  else {
+    // Incompressible, so just store it.
+    output[0] = CVR_CODEC_STORED;
+    (void)memcpy(output + 1, input, nrbytes);
+    packedsize = 1 + nrbytes;
+  }
+  return packedsize;
+}
+
+// Decompresses "inputbytes" bytes of data from compress() into
+// "output", which must be of exactly the original size. Returns FALSE
+// if the data is corrupt.
+SbBool
+CvrBrickCodec::decompress(const uint8_t * input, const size_t inputbytes,
+                          const unsigned int unitsize,
+                          uint8_t * output, const size_t nrbytes)
+{
+  assert(unitsize > 0);
+  if (inputbytes < 1) { return FALSE; }
+
+  switch (input[0]) {
+  case CVR_CODEC_STORED:
+    if (inputbytes != (1 + nrbytes)) { return FALSE; }
+    (void)memcpy(output, input + 1, nrbytes);
+    return TRUE;
+
+  case CVR_CODEC_LZ:
+    {
+      if (unitsize == 1) {
+        return cvr_codec_lz_decompress(input + 1, inputbytes - 1, output, nrbytes);
+      }
+      uint8_t * shuffled = new uint8_t[nrbytes];
+      const SbBool ok =
+        cvr_codec_lz_decompress(input + 1, inputbytes - 1, shuffled, nrbytes);
+      if (ok) { cvr_codec_unshuffle(shuffled, nrbytes, unitsize, output); }
+      delete[] shuffled;
+      return ok;
+    }
+
+  default:
+    return FALSE;
+  }
+}
+
+// *************************************************************************
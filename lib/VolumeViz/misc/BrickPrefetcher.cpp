@@ -0,0 +1,308 @@
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+#include <VolumeViz/misc/CvrBrickPrefetcher.h>
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include <Inventor/C/tidbits.h>
+#include <Inventor/SbBox3f.h>
+#include <Inventor/SbViewVolume.h>
+#include <Inventor/elements/SoModelMatrixElement.h>
+#include <Inventor/elements/SoViewVolumeElement.h>
+#include <Inventor/errors/SoDebugError.h>
+#include <Inventor/threads/SbThread.h>
+
+#include <VolumeViz/misc/CvrUtil.h>
+#include <VolumeViz/misc/CvrVoxelStore.h>
+
+// *************************************************************************
+
+// How far ahead in time the camera motion is extrapolated, and in how
+// many steps at most.
+static const double CVR_PREFETCH_LOOKAHEAD = 0.5;
+static const unsigned int CVR_PREFETCH_MAX_STEPS = 8;
+
+// Traversals further apart than this are not taken as one continuous
+// camera motion.
+static const double CVR_PREFETCH_MAX_INTERVAL = 1.0;
+
+// A brick to prefetch, found within the view volume predicted for
+// "step" frames ahead, at "distance" from the predicted viewpoint.
+struct cvr_prefetch_item {
+  SbVec3i32 brickidx;
+  unsigned int step;
+  float distance;
+};
+
+static int
+cvr_prefetch_item_compare(const void * a, const void * b)
+{
+  const cvr_prefetch_item * ia = (const cvr_prefetch_item *)a;
+  const cvr_prefetch_item * ib = (const cvr_prefetch_item *)b;
+  if (ia->step != ib->step) { return (ia->step < ib->step) ? -1 : 1; }
+  if (ia->distance != ib->distance) { return (ia->distance < ib->distance) ? -1 : 1; }
+  return 0;
+}
+
+// Number of bytes the prefetcher may read per rendered frame.
+static size_t
+cvr_prefetch_io_budget(void)
+{
+  const char * env = coin_getenv("CVR_PREFETCH_IO_BUDGET");
+  const int mb = env ? atoi(env) : 16;
+  return (size_t)SbMax(mb, 1) * 1024 * 1024;
+}
+
+// Upper limit for the memory held by prefetched bricks which have not
+// been used for rendering yet.
+static size_t
+cvr_prefetch_memory_budget(void)
+{
+  const char * env = coin_getenv("CVR_PREFETCH_MEMORY");
+  if (env) { return (size_t)SbMax(atoi(env), 1) * 1024 * 1024; }
+  return CvrVoxelStore::getMemoryLimit() / 4;
+}
+
+// Returns the transformation from the camera's own coordinate system
+// to the coordinate system of the view volume.
+static SbMatrix
+cvr_view_frame(const SbViewVolume & vv)
+{
+  SbVec3f dir = vv.getProjectionDirection();
+  (void)dir.normalize();
+  SbVec3f right = dir.cross(vv.getViewUp());
+  (void)right.normalize();
+  const SbVec3f up = right.cross(dir);
+  const SbVec3f & pos = vv.getProjectionPoint();
+
+  return SbMatrix(right[0], right[1], right[2], 0.0f,
+                  up[0], up[1], up[2], 0.0f,
+                  -dir[0], -dir[1], -dir[2], 0.0f,
+                  pos[0], pos[1], pos[2], 1.0f);
+}
+
+// *************************************************************************
+
+CvrBrickPrefetcher::CvrBrickPrefetcher(CvrVoxelStore * store)
+{
+  assert(store);
+  this->store = store;
+  this->queuepos = 0;
+  this->iobudget = 0;
+  this->quit = FALSE;
+  this->haveprevious = FALSE;
+
+  this->thread = SbThread::create(CvrBrickPrefetcher::workerCB, this);
+}
+
+CvrBrickPrefetcher::~CvrBrickPrefetcher()
+{
+  this->mutex.lock();
+  this->quit = TRUE;
+  this->wakeup.wakeAll();
+  this->mutex.unlock();
+
+  (void)this->thread->join();
+  SbThread::destroy(this->thread);
+}
+
+// Returns FALSE if prefetching has been turned off with the
+// CVR_NO_PREFETCH environment variable.
+SbBool
+CvrBrickPrefetcher::isEnabled(void)
+{
+  static int enabled = -1;
+  if (enabled == -1) {
+    const char * env = coin_getenv("CVR_NO_PREFETCH");
+    enabled = (env && (atoi(env) > 0)) ? 0 : 1;
+  }
+  return enabled ? TRUE : FALSE;
+}
+
+// Should be called on each render traversal, with the state at the
+// volume data node, and the object-space box the volume is rendered
+// within. Replaces the bricks queued for the previous frame with
+// those predicted to come into view next.
+void
+CvrBrickPrefetcher::update(SoState * state, const SbBox3f & volumesize)
+{
+  // Everything is done in the object space of the volume, so camera
+  // motion and volume motion are handled alike.
+  SbViewVolume vv = SoViewVolumeElement::get(state);
+  vv.transform(SoModelMatrixElement::get(state).inverse());
+
+  const SbMatrix frame = cvr_view_frame(vv);
+  const SbTime now = SbTime::getTimeOfDay();
+  const double interval = (now - this->prevtime).getValue();
+
+  const SbBool moving = this->haveprevious &&
+    (interval > 0.0) && (interval < CVR_PREFETCH_MAX_INTERVAL) &&
+    !frame.equals(this->prevframe, 1.0e-6f);
+
+  SbMatrix motion;
+  if (moving) {
+    motion = this->prevframe.inverse();
+    motion.multRight(frame);
+  }
+
+  this->haveprevious = TRUE;
+  this->prevtime = now;
+  this->prevframe = frame;
+
+  // With a still camera, the rendering pulls in what it needs itself.
+  if (!moving) { return; }
+
+  const unsigned int nrsteps = (unsigned int)
+    SbMin((double)CVR_PREFETCH_MAX_STEPS, ceil(CVR_PREFETCH_LOOKAHEAD / interval));
+
+  const SbVec3i32 & nrbricks = this->store->getNrOfBricks();
+  const size_t totalbricks = (size_t)nrbricks[0] * nrbricks[1] * nrbricks[2];
+  uint8_t * queued = new uint8_t[totalbricks];
+  for (size_t i = 0; i < totalbricks; i++) { queued[i] = 0; }
+
+  SbList<cvr_prefetch_item> items;
+  for (unsigned int step = 1; step <= nrsteps; step++) {
+    vv.transform(motion);
+    this->findBricks(vv, volumesize, step, queued, items);
+  }
+  delete[] queued;
+
+  if (items.getLength() > 0) {
+    qsort((void *)items.getArrayPtr(), items.getLength(),
+          sizeof(cvr_prefetch_item), cvr_prefetch_item_compare);
+  }
+
+  if (CvrUtil::doDebugging()) {
+    SoDebugError::postInfo("CvrBrickPrefetcher::update",
+                           "%d bricks within %u predicted views",
+                           items.getLength(), nrsteps);
+  }
+
+  this->mutex.lock();
+  this->queue.truncate(0);
+  for (int i = 0; i < items.getLength(); i++) { this->queue.append(items[i].brickidx); }
+  this->queuepos = 0;
+  this->iobudget = cvr_prefetch_io_budget();
+  this->wakeup.wakeOne();
+  this->mutex.unlock();
+}
+
+// Adds all bricks intersecting the view volume which are not already
+// marked in "queued" to "items".
+void
+CvrBrickPrefetcher::findBricks(const SbViewVolume & viewvolume,
+                               const SbBox3f & volumesize,
+                               unsigned int step, uint8_t * queued,
+                               SbList<cvr_prefetch_item> & items) const
+{
+  const SbVec3i32 & dims = this->store->getDimensions();
+  const SbVec3i32 & bricksize = this->store->getBrickSize();
+  const SbVec3i32 & nrbricks = this->store->getNrOfBricks();
+
+  SbVec3f vmin, vmax;
+  volumesize.getBounds(vmin, vmax);
+  SbVec3f voxelsize;
+  for (unsigned int i = 0; i < 3; i++) { voxelsize[i] = (vmax[i] - vmin[i]) / dims[i]; }
+
+  const SbVec3f & eye = viewvolume.getProjectionPoint();
+
+  size_t idx = 0;
+  for (int32_t z = 0; z < nrbricks[2]; z++) {
+    for (int32_t y = 0; y < nrbricks[1]; y++) {
+      for (int32_t x = 0; x < nrbricks[0]; x++, idx++) {
+        if (queued[idx]) { continue; }
+
+        const SbVec3i32 brickidx(x, y, z);
+        SbVec3f bmin, bmax;
+        for (unsigned int i = 0; i < 3; i++) {
+          const int first = brickidx[i] * bricksize[i];
+          const int last = SbMin(first + bricksize[i], dims[i]);
+          bmin[i] = vmin[i] + first * voxelsize[i];
+          bmax[i] = vmin[i] + last * voxelsize[i];
+        }
+        if (!viewvolume.intersect(SbBox3f(bmin, bmax))) { continue; }
+
+        queued[idx] = 1;
+        cvr_prefetch_item item;
+        item.brickidx = brickidx;
+        item.step = step;
+        item.distance = ((bmin + bmax) * 0.5f - eye).length();
+        items.append(item);
+      }
+    }
+  }
+}
+
+// *************************************************************************
+
+void *
+CvrBrickPrefetcher::workerCB(void * closure)
+{
+  ((CvrBrickPrefetcher *)closure)->work();
+  return NULL;
+}
+
+// Loop of the worker thread: loads queued bricks in order, until the
+// I/O budget of the current frame is used up, or prefetched bricks
+// fill their share of the cache.
+void
+CvrBrickPrefetcher::work(void)
+{
+  const size_t memorybudget = cvr_prefetch_memory_budget();
+
+  this->mutex.lock();
+  for (;;) {
+    while (!this->quit && (this->queuepos >= this->queue.getLength())) {
+      (void)this->wakeup.wait(this->mutex);
+    }
+    if (this->quit) { break; }
+
+    if ((this->iobudget == 0) ||
+        (CvrVoxelStore::getPrefetchedMemory() >= memorybudget)) {
+      this->queuepos = this->queue.getLength();
+      continue;
+    }
+
+    const SbVec3i32 brickidx = this->queue[this->queuepos++];
+    this->mutex.unlock();
+    const size_t nrbytes = this->store->prefetchBrick(brickidx);
+    this->mutex.lock();
+
+    this->iobudget -= SbMin(this->iobudget, nrbytes);
+  }
+  this->mutex.unlock();
+}
+
+// *************************************************************************
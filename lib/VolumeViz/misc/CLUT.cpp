@@ -37,6 +37,7 @@
 #include <VolumeViz/misc/CvrCLUT.h>
 
 #include <assert.h>
+#include <math.h>
 #include <string.h>
 
 #ifdef HAVE_CONFIG_H
@@ -49,9 +50,12 @@
 #include <Inventor/actions/SoGLRenderAction.h>
 #include <Inventor/errors/SoDebugError.h>
 
+#include <VolumeViz/elements/CvrLightingElement.h>
 #include <VolumeViz/elements/CvrPalettedTexturesElement.h>
+#include <VolumeViz/elements/CvrVoxelBlockElement.h>
 #include <VolumeViz/misc/CvrUtil.h>
 #include <VolumeViz/misc/CvrResourceManager.h>
+#include <VolumeViz/misc/CvrVoxelStore.h>
 
 class SoState;
 
@@ -130,6 +134,45 @@ static const char * gradientprogram =
 "MOV result.color.w, R0;\n"
 "END\n";
 
+// Version of the gradient program for compact normals (see
+// CvrUtil::useCompactNormals()), where the texture has the gradient
+// octahedral-mapped in its y and z components:
+//
+//     float2 e = voxel.yz * 2.0f - 1.0f;
+//     float3 N = float3(e, 1.0f - abs(e.x) - abs(e.y));
+//     if (N.z < 0) { N.xy = (1.0f - abs(N.yx)) * (N.xy >= 0 ? 1 : -1); }
+//     N = normalize(N);
+//
+// The '%s' is filled in with the clamping of the dot product to
+// zero, or a plain move when CVR_NOCLAMP_COLOR is set.
+static const char * octgradientprogram =
+"!!ARBfp1.0\n"
+"PARAM c[2] = { { 2, 1, 0 },\n"
+"               program.local[1] };\n"
+"TEMP R0;\n"
+"TEMP R1;\n"
+"TEMP R2;\n"
+"TEX R0, fragment.texcoord[0], texture[0], 3D;\n"
+"MAD R1.xy, R0.yzzw, c[0].x, -c[0].y;\n"
+"ABS R2.xy, R1.yxzw;\n"
+"ADD R2.z, R2.x, R2.y;\n"
+"SUB R1.z, c[0].y, R2.z;\n"
+"SUB R2.xy, c[0].y, R2;\n"
+"SGE R2.zw, R1.xxxy, c[0].z;\n"
+"MAD R2.zw, R2, c[0].x, -c[0].y;\n"
+"MUL R2.xy, R2, R2.zwzw;\n"
+"CMP R1.xy, R1.z, R2, R1;\n"
+"DP3 R2.x, R1, R1;\n"
+"RSQ R2.x, R2.x;\n"
+"MUL R1.xyz, R1, R2.x;\n"
+"DP3 R0.y, R1, c[1];\n"
+"%s"
+"TEX R0, R0, texture[1], 1D;\n"
+"MUL R0.xyz, R0, R1.x;\n"
+"MUL result.color.xyz, R0, c[1].w;\n"
+"MOV result.color.w, R0;\n"
+"END\n";
+
 // Fragment program for using an index value to look up a colour from
 // a 1D texture.
 //
@@ -156,6 +199,34 @@ static const char * palettelookupprogram_modulate =
 static const char * palettelookupprogram_replace =
 "MOV result.color, R0";
 
+// Fragment program for diffuse lighting of RGBA 3D textures, with the
+// range compressed gradient read from a second 3D texture, as
+//
+//     float4 col = tex3D(RGBAsampler, texCoord);
+//     float3 N = tex3D(GRADsampler, texCoord).xyz * 2.0f - 1.0f;
+//     col.xyz *= max(dot(N, light.xyz), 0) * light.w;
+//
+// So unlike when the light is applied as the RGBA textures are made,
+// light changes only need a new program parameter. The first '%s' is
+// the clamping of the dot product, left out with CVR_NOCLAMP_COLOR,
+// the second is the modulation or replacement of the fragment color,
+// as for the palette lookup program.
+static const char * shadingprogram =
+"!!ARBfp1.0\n"
+"PARAM c[2] = { { 2, 1, 0 },\n"
+"               program.local[1] };\n"
+"TEMP R0;\n"
+"TEMP R1;\n"
+"TEX R0, fragment.texcoord[0], texture[0], 3D;\n"
+"TEX R1, fragment.texcoord[0], texture[1], 3D;\n"
+"MAD R1.xyz, R1, c[0].x, -c[0].y;\n"
+"DP3 R1.x, R1, c[1];\n"
+"%s"
+"MUL R1.x, R1.x, c[1].w;\n"
+"MUL R0.xyz, R0, R1.x;\n"
+"%s;\n"
+"END\n";
+
 // This is just to have a guaranteed unique pointer value for the
 // CvrResourceManager::getInstance() for data which is common for
 // CvrCLUT instances (over one GL context).
@@ -164,9 +235,14 @@ static const char * CVRCLUT_STATIC_KEYID = "foobar";
 // *************************************************************************
 
 // colormap values are between 0 and 255
-CvrCLUT::CvrCLUT(const unsigned int nrcols, const uint8_t * colormap, AlphaUse policy)
+//
+// nrindices is the number of different voxel values the lookup table
+// must cover, i.e. 256 for 8-bit data and 65536 for 16-bit data.
+CvrCLUT::CvrCLUT(const unsigned int nrcols, const uint8_t * colormap, AlphaUse policy,
+                 const unsigned int nrindices)
 {
   this->nrentries = nrcols;
+  this->nrindices = nrindices;
   this->nrcomponents = 4;
   this->datatype = INTS;
 
@@ -186,9 +262,11 @@ CvrCLUT::CvrCLUT(const unsigned int nrcols, const uint8_t * colormap, AlphaUse p
 //
 // values in colormap are between 0.0 and 1.0
 CvrCLUT::CvrCLUT(const unsigned int nrcols, const unsigned int nrcomponents,
-                 const float * colormap, AlphaUse policy)
+                 const float * colormap, AlphaUse policy,
+                 const unsigned int nrindices)
 {
   this->nrentries = nrcols;
+  this->nrindices = nrindices;
   this->nrcomponents = nrcomponents;
   this->datatype = FLOATS;
 
@@ -211,8 +289,11 @@ CvrCLUT::commonConstructor(AlphaUse policy)
   this->transparencythresholds[0] = 0;
   this->transparencythresholds[1] = this->nrentries - 1;
   this->alphapolicy = policy;
+  this->window[0] = 0.0;
+  this->window[1] = this->nrindices;
 
-  this->glcolors = new uint8_t[this->nrentries * 4];
+  this->glcolors = new uint8_t[this->nrindices * 4];
+  this->opaquecount = new uint32_t[this->nrindices + 1];
   this->regenerateGLColorData();
 }
 
@@ -221,6 +302,7 @@ CvrCLUT::commonConstructor(AlphaUse policy)
 CvrCLUT::CvrCLUT(const CvrCLUT & clut)
 {
   this->nrentries = clut.nrentries;
+  this->nrindices = clut.nrindices;
   this->nrcomponents = clut.nrcomponents;
   this->datatype = clut.datatype;
 
@@ -246,10 +328,13 @@ CvrCLUT::CvrCLUT(const CvrCLUT & clut)
 
   this->transparencythresholds[0] = clut.transparencythresholds[0];
   this->transparencythresholds[1] = clut.transparencythresholds[1];
+  this->window[0] = clut.window[0];
+  this->window[1] = clut.window[1];
 
   this->alphapolicy = clut.alphapolicy;
 
-  this->glcolors = new uint8_t[this->nrentries * 4];
+  this->glcolors = new uint8_t[this->nrindices * 4];
+  this->opaquecount = new uint32_t[this->nrindices + 1];
   this->regenerateGLColorData();
 }
 
@@ -264,6 +349,7 @@ CvrCLUT::~CvrCLUT()
     delete[] this->flt_entries;
 
   delete[] this->glcolors;
+  delete[] this->opaquecount;
 }
 
 
@@ -322,6 +408,7 @@ operator==(const CvrCLUT & c1, const CvrCLUT & c2)
   if (&c1 == &c2) { return TRUE; }
 
   if (c1.crc32cmap != c2.crc32cmap) { return FALSE; }
+  if (c1.nrindices != c2.nrindices) { return FALSE; }
 
   assert(c1.nrentries == c2.nrentries);
   assert(c1.nrcomponents == c2.nrcomponents);
@@ -338,6 +425,8 @@ operator==(const CvrCLUT & c1, const CvrCLUT & c2)
   if (c1.transparencythresholds[0] != c2.transparencythresholds[0]) { return FALSE; }
   if (c1.transparencythresholds[1] != c2.transparencythresholds[1]) { return FALSE; }
   if (c1.alphapolicy != c2.alphapolicy) { return FALSE; }
+  if (c1.window[0] != c2.window[0]) { return FALSE; }
+  if (c1.window[1] != c2.window[1]) { return FALSE; }
 
   return TRUE;
 }
@@ -373,15 +462,42 @@ CvrCLUT::setTransparencyThresholds(uint32_t low, uint32_t high)
   this->regenerateGLColorData();
 }
 
+// Spread the colormap over the indices from "low" to "high" only,
+// instead of over all indices. Used for windowing of the voxel data
+// values, which then does not involve touching the voxels themselves,
+// just regenerating the lookup table.
+void
+CvrCLUT::setWindow(double low, double high)
+{
+  assert(low < high);
+  if ((this->window[0] == low) && (this->window[1] == high)) { return; }
+
+  this->window[0] = low;
+  this->window[1] = high;
+
+  this->regenerateGLColorData();
+}
+
+void
+CvrCLUT::getWindow(double & low, double & high) const
+{
+  low = this->window[0];
+  high = this->window[1];
+}
+
 
 void
 CvrCLUT::initFragmentProgram(const cc_glglue * glue,
                              CvrCLUT::GlobalGLContextStorage * ctxstorage)
 {
-  // Two programs, one each for 2D textures and 3D textures.
-  cc_glglue_glGenPrograms(glue, 2, ctxstorage->fragmentprogramid);
+  // Four programs, one each for 2D textures and 3D textures, one for
+  // 3D textures with gradients, and one for shading RGBA 3D textures.
+  cc_glglue_glGenPrograms(glue, 4, ctxstorage->fragmentprogramid);
+
+  const char * env = coin_getenv("CVR_NOCLAMP_COLOR");
+  const SbBool noclamp = env && atoi(env) > 0;
 
-  for (int i=CvrCLUT::TEXTURE2D; i <= CvrCLUT::TEXTURE3D_GRADIENT; i++) {
+  for (int i=CvrCLUT::TEXTURE2D; i <= CvrCLUT::TEXTURE3D_SHADED; i++) {
     cc_glglue_glBindProgram(glue, GL_FRAGMENT_PROGRAM_ARB,
                             ctxstorage->fragmentprogramid[i]);
 
@@ -400,13 +516,23 @@ CvrCLUT::initFragmentProgram(const cc_glglue * glue,
                               texenvmode);
       break;
     case CvrCLUT::TEXTURE3D_GRADIENT:
-      const char * env = coin_getenv("CVR_NOCLAMP_COLOR");
-      if (env && atoi(env) > 0) {
+      if (CvrUtil::useCompactNormals()) {
+        fragmentprogram.sprintf(octgradientprogram,
+                                noclamp ? "MOV R1.x, R0.y;\n" :
+                                "MAX R1.x, R0.y, c[0].z;\n");
+      }
+      else if (noclamp) {
         fragmentprogram.sprintf(gradientprogram_noclamp);
       }
       else {
         fragmentprogram.sprintf(gradientprogram);
       }
+      break;
+    case CvrCLUT::TEXTURE3D_SHADED:
+      fragmentprogram.sprintf(shadingprogram,
+                              noclamp ? "" : "MAX R1.x, R1.x, c[0].z;\n",
+                              texenvmode);
+      break;
     }
 
     cc_glglue_glProgramString(glue, GL_FRAGMENT_PROGRAM_ARB, GL_PROGRAM_FORMAT_ASCII_ARB,
@@ -444,11 +570,32 @@ CvrCLUT::initPaletteTexture(const cc_glglue * glue,
 
   glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP);
 
-  assert(this->nrentries == 256 && "Palette lookup using fragment program will "
-         "not work if palette size is != 256");
+  // The fragment program looks up with the normalized luminance
+  // value, so the 1D texture need not hold every index of a 16-bit
+  // lookup table. If the table is larger than what the driver
+  // supports, every n'th entry is picked, which gives for instance a
+  // 4096-entry lookup table for 16-bit data on hardware with that
+  // limit for 1D textures.
+  GLint maxsize;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxsize);
+  unsigned int texsize = this->nrindices;
+  while ((texsize > 256) && (texsize > (unsigned int)maxsize)) { texsize >>= 1; }
+
+  const uint8_t * texcolors = this->glcolors;
+  uint8_t * reduced = NULL;
+  if (texsize != this->nrindices) {
+    const unsigned int stride = this->nrindices / texsize;
+    reduced = new uint8_t[texsize * 4];
+    for (unsigned int i = 0; i < texsize; i++) {
+      (void)memcpy(&reduced[i * 4], &this->glcolors[i * stride * 4], 4);
+    }
+    texcolors = reduced;
+  }
+
+  glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA8, texsize, 1, GL_RGBA,
+               GL_UNSIGNED_BYTE, (GLvoid *) texcolors);
 
-  glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA8, this->nrentries, 1, GL_RGBA,
-               GL_UNSIGNED_BYTE, (GLvoid *) this->glcolors);
+  delete[] reduced;
 
   // FIXME: shouldn't we restore the glEnable(GL_TEXTURE_1D) here?
   // 20041103 mortene.
@@ -506,7 +653,7 @@ CvrCLUT::contextDeletedCB(void * closure, uint32_t ctxid)
 #endif // debug
 
       const cc_glglue * glw = cc_glglue_instance(ctxid);
-      cc_glglue_glDeletePrograms(glw, 2, ctxstorage->fragmentprogramid);
+      cc_glglue_glDeletePrograms(glw, 4, ctxstorage->fragmentprogramid);
     }
 
     rm->remove(CVRCLUT_STATIC_KEYID);
@@ -582,6 +729,41 @@ CvrCLUT::activateFragmentProgram(uint32_t ctxid, CvrCLUT::TextureType texturetyp
 }
 
 
+/*!
+  Activates the fragment program shading lit RGBA 3D textures, with
+  the texture on unit 0 and its gradient texture on unit 1. The light
+  direction and intensity must be set as local parameter 1 of the
+  program.
+*/
+void
+CvrCLUT::activateShading(uint32_t ctxid)
+{
+  const cc_glglue * glw = cc_glglue_instance(ctxid);
+
+  CvrCLUT::GlobalGLContextStorage * ctxstaticstorage =
+    CvrCLUT::getGlobalGLContextStorage(ctxid);
+
+  if (ctxstaticstorage->fragmentprogramid[0] == 0) {
+    CvrCLUT::initFragmentProgram(glw, ctxstaticstorage);
+  }
+
+  cc_glglue_glBindProgram(glw, GL_FRAGMENT_PROGRAM_ARB,
+                          ctxstaticstorage->fragmentprogramid[CvrCLUT::TEXTURE3D_SHADED]);
+
+  glEnable(GL_FRAGMENT_PROGRAM_ARB);
+}
+
+
+void
+CvrCLUT::deactivateShading(const cc_glglue * glw)
+{
+  glDisable(GL_FRAGMENT_PROGRAM_ARB);
+  cc_glglue_glActiveTexture(glw, GL_TEXTURE1);
+  glDisable(GL_TEXTURE_3D);
+  cc_glglue_glActiveTexture(glw, GL_TEXTURE0);
+}
+
+
 void
 CvrCLUT::activatePalette(const cc_glglue * glw, CvrCLUT::TextureType texturetype) const
 {
@@ -590,8 +772,10 @@ CvrCLUT::activatePalette(const cc_glglue * glw, CvrCLUT::TextureType texturetype
   // FIXME: should only need to do this once somewhere else
   glEnable(GL_COLOR_TABLE);
 
-  // FIXME: handle this->nrentries != 256
-  assert(this->nrentries == 256);
+  // 16-bit voxel data is only rendered as paletted textures when we
+  // can do the lookup with a fragment program, see
+  // usePaletteTextures().
+  assert(this->nrindices == 256);
 
   // FIXME: should probably set glColorTableParameter() on
   // GL_COLOR_TABLE_SCALE and GL_COLOR_TABLE_BIAS.
@@ -603,7 +787,7 @@ CvrCLUT::activatePalette(const cc_glglue * glw, CvrCLUT::TextureType texturetype
                          (texturetype == CvrCLUT::TEXTURE2D) ?
                          GL_TEXTURE_2D : GL_TEXTURE_3D, /* target */
                          GL_RGBA, /* GL internalformat */
-                         this->nrentries, /* nr of paletteentries */
+                         this->nrindices, /* nr of paletteentries */
                          GL_RGBA, /* palette entry format */
                          GL_UNSIGNED_BYTE, /* palette entry unit type */
                          this->glcolors); /* data ptr */
@@ -650,7 +834,7 @@ CvrCLUT::activatePalette(const cc_glglue * glw, CvrCLUT::TextureType texturetype
                                        GL_TEXTURE_2D : GL_TEXTURE_3D,
                                        GL_COLOR_TABLE_WIDTH, &actualsize);
 
-  assert(actualsize == (GLint)this->nrentries);
+  assert(actualsize == (GLint)this->nrindices);
 }
 
 
@@ -696,12 +880,38 @@ CvrCLUT::deactivate(const cc_glglue * glw) const
 void
 CvrCLUT::lookupRGBA(const unsigned int idx, uint8_t rgba[4]) const
 {
-  assert(idx < this->nrentries);  
+  assert(idx < this->nrindices);  
   for (int i=0; i < 4; i++) { 
     rgba[i] = this->glcolors[idx * 4 + i]; 
   }
 }
 
+// Returns the complete table of RGBA colors, 4 bytes for each of the
+// getNrOfIndices() indices, for lookups in bulk.
+const uint8_t *
+CvrCLUT::getRGBAColors(void) const
+{
+  return this->glcolors;
+}
+
+
+// Returns the number of voxel values covered by the lookup table.
+unsigned int
+CvrCLUT::getNrOfIndices(void) const
+{
+  return this->nrindices;
+}
+
+// Returns TRUE if all indices in [lowidx, highidx] map to fully
+// transparent colors. Done in constant time, so it can be used to
+// skip empty parts of a volume from the value ranges of its bricks.
+SbBool
+CvrCLUT::isTransparent(const unsigned int lowidx, const unsigned int highidx) const
+{
+  assert(lowidx <= highidx && highidx < this->nrindices);
+  return this->opaquecount[highidx + 1] == this->opaquecount[lowidx];
+}
+
 
 // FIXME: this doesn't seem compatible with the fact that
 // CvrCLUT-instances should be possible to share between any number of
@@ -720,15 +930,25 @@ CvrCLUT::setAlphaUse(AlphaUse policy)
 void
 CvrCLUT::regenerateGLColorData(void)
 {
-  for (unsigned int idx = 0; idx < this->nrentries; idx++) {
+  // The colormap entries are spread out evenly over the full range of
+  // voxel values, so the usual 256-entry colormaps work as before for
+  // 16-bit data, while larger colormaps give the full precision.
+  //
+  // If a window is set, the colormap is spread over that instead, and
+  // indices outside of it are clamped to the first or last entry.
+  const double windowsize = this->window[1] - this->window[0];
+  for (unsigned int idx = 0; idx < this->nrindices; idx++) {
+    const double pos = floor((idx - this->window[0]) * this->nrentries / windowsize);
+    const unsigned int entry = (pos <= 0.0) ? 0 :
+      (unsigned int)SbMin(pos, (double)(this->nrentries - 1));
     uint8_t * rgba = &this->glcolors[idx * 4];
-    if ((idx < this->transparencythresholds[0]) ||
-        (idx > this->transparencythresholds[1])) {
+    if ((entry < this->transparencythresholds[0]) ||
+        (entry > this->transparencythresholds[1])) {
       rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0x00;
     }
     else {
       if (this->datatype == FLOATS) {
-        const float * colvals = &(this->flt_entries[idx * this->nrcomponents]);
+        const float * colvals = &(this->flt_entries[entry * this->nrcomponents]);
         switch (this->nrcomponents) {
         case 1: // ALPHA
           rgba[0] = rgba[1] = rgba[2] = rgba[3] = uint8_t(colvals[0] * 255.0f);
@@ -752,7 +972,7 @@ CvrCLUT::regenerateGLColorData(void)
         }
       }
       else if (this->datatype == INTS) {
-        const int colidx = idx * 4;
+        const int colidx = entry * 4;
         rgba[0] = this->int_entries[colidx + 0];
         rgba[1] = this->int_entries[colidx + 1];
         rgba[2] = this->int_entries[colidx + 2];
@@ -769,6 +989,12 @@ CvrCLUT::regenerateGLColorData(void)
     }
   }
 
+  this->opaquecount[0] = 0;
+  for (unsigned int idx = 0; idx < this->nrindices; idx++) {
+    this->opaquecount[idx + 1] =
+      this->opaquecount[idx] + ((this->glcolors[idx * 4 + 3] != 0) ? 1 : 0);
+  }
+
   this->killAll1DTextures();
 }
 
@@ -813,6 +1039,16 @@ CvrCLUT::usePaletteTextures(const SoGLRenderAction * action)
   const SbBool usefragmentprogram = CvrCLUT::useFragmentProgramLookup(glw);
   usepalettetex = usepalettetex && (usepaletteextension || usefragmentprogram);
 
+  // 16-bit indices can only be looked up from a fragment program, as
+  // the palette extension is limited to 8-bit indices. Without
+  // fragment programs, 16-bit data is instead converted to RGBA
+  // textures through the full size lookup table.
+  const CvrVoxelBlockElement * vbelem = CvrVoxelBlockElement::getInstance(state);
+  if (vbelem && vbelem->getVoxelStore() &&
+      (vbelem->getVoxelStore()->getIndexSize() == 2)) {
+    usepalettetex = usepalettetex && usefragmentprogram;
+  }
+
   static SbBool first = TRUE;
   if (first && CvrUtil::doDebugging()) {
     SoDebugError::postInfo("CvrCLUT::usePaletteTextures",
@@ -829,6 +1065,33 @@ CvrCLUT::usePaletteTextures(const SoGLRenderAction * action)
 }
 
 
+// Lit RGBA 3D textures are shaded at fragment time when fragment
+// programs are available, from gradients kept in a separate texture
+// (see Cvr3DGradientTexture). The RGBA textures are then made
+// without the light, so changing the light direction or intensity
+// doesn't rebuild them. Can be turned off with the environment
+// variable CVR_DISABLE_FRAGMENT_SHADING=1.
+SbBool
+CvrCLUT::useFragmentShading(const SoGLRenderAction * action)
+{
+  static int disable_shading = -1; // "-1" means "undecided"
+
+  if (disable_shading == -1) {
+    const char * env = coin_getenv("CVR_DISABLE_FRAGMENT_SHADING");
+    disable_shading = env && (atoi(env) > 0);
+  }
+
+  if (disable_shading) { return FALSE; }
+
+  SoState * state = action->getState();
+  if (!CvrLightingElement::getInstance(state)->useLighting(state)) { return FALSE; }
+  if (CvrCLUT::usePaletteTextures(action)) { return FALSE; }
+
+  const cc_glglue * glw = cc_glglue_instance(action->getCacheContext());
+  return cc_glglue_has_arb_fragment_program(glw);
+}
+
+
 SbBool
 CvrCLUT::usePaletteExtension(const cc_glglue * glw)
 {
@@ -32,7 +32,7 @@
 
 #include <VolumeViz/misc/CvrCentralDifferenceGradient.h>
 #include <Inventor/SbVec3f.h>
-#include <Inventor/SbVec3s.h>
+#include <Inventor/SbVec3i32.h>
 
 // *************************************************************************
 
@@ -0,0 +1,63 @@
+#ifndef SIMVOLEON_CVRBRICKCODEC_H
+#define SIMVOLEON_CVRBRICKCODEC_H
+
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+// Lossless compression of voxel bricks, used for keeping volumes
+// compressed in memory.
+//
+// The codec is a byte-oriented LZ77 variant, tuned for fast
+// decompression rather than for the best compression ratio. Voxels of
+// more than one byte are split into byte planes before compression,
+// so the mostly constant high-order bytes of e.g. 16-bit data end up
+// in long runs.
+
+#include <stddef.h> // size_t
+#include <Inventor/SbBasic.h>
+
+// *************************************************************************
+
+class CvrBrickCodec {
+public:
+  static size_t getMaxCompressedSize(const size_t nrbytes);
+
+  static size_t compress(const uint8_t * input, const size_t nrbytes,
+                         const unsigned int unitsize, uint8_t * output);
+  static SbBool decompress(const uint8_t * input, const size_t inputbytes,
+                           const unsigned int unitsize,
+                           uint8_t * output, const size_t nrbytes);
+};
+
+// *************************************************************************
+
+#endif // !SIMVOLEON_CVRBRICKCODEC_H
@@ -0,0 +1,108 @@
+#ifndef SIMVOLEON_CVRBRICKPREFETCHER_H
+#define SIMVOLEON_CVRBRICKPREFETCHER_H
+
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+// Loads bricks of a CvrVoxelStore into the brick cache from a
+// background thread, ahead of when the rendering needs them.
+//
+// On each render traversal, the motion of the camera relative to the
+// volume is found from the view volume of the previous traversal,
+// and extrapolated a short while into the future. The bricks within
+// the predicted view volumes are then queued for loading, nearest to
+// the predicted viewpoint first. Loading a brick also records the
+// range of its voxel values.
+//
+// The prefetching is bounded by how much it may read for each
+// rendered frame (CVR_PREFETCH_IO_BUDGET, in megabytes, default 16),
+// and by how much memory prefetched bricks not yet used for rendering
+// may occupy in the brick cache (CVR_PREFETCH_MEMORY, in megabytes,
+// default a quarter of the cache size). Set CVR_NO_PREFETCH to turn
+// prefetching off.
+
+#include <stddef.h> // size_t
+
+#include <Inventor/SbBasic.h>
+#include <Inventor/SbMatrix.h>
+#include <Inventor/SbTime.h>
+#include <Inventor/SbVec3i32.h>
+#include <Inventor/lists/SbList.h>
+#include <Inventor/threads/SbCondVar.h>
+#include <Inventor/threads/SbMutex.h>
+
+class CvrVoxelStore;
+class SbBox3f;
+class SbThread;
+class SbViewVolume;
+class SoState;
+struct cvr_prefetch_item;
+
+// *************************************************************************
+
+class CvrBrickPrefetcher {
+public:
+  CvrBrickPrefetcher(CvrVoxelStore * store);
+  ~CvrBrickPrefetcher();
+
+  void update(SoState * state, const SbBox3f & volumesize);
+
+  static SbBool isEnabled(void);
+
+private:
+  void findBricks(const SbViewVolume & viewvolume, const SbBox3f & volumesize,
+                  unsigned int step, uint8_t * queued,
+                  SbList<cvr_prefetch_item> & items) const;
+  static void * workerCB(void * closure);
+  void work(void);
+
+  CvrVoxelStore * store;
+  SbThread * thread;
+
+  // Protects all of the below, and is waited on by the worker thread
+  // when it runs out of bricks.
+  SbMutex mutex;
+  SbCondVar wakeup;
+  SbList<SbVec3i32> queue;
+  int queuepos;
+  size_t iobudget;
+  SbBool quit;
+
+  // The view of the previous render traversal.
+  SbBool haveprevious;
+  SbTime prevtime;
+  SbMatrix prevframe;
+};
+
+// *************************************************************************
+
+#endif // !SIMVOLEON_CVRBRICKPREFETCHER_H
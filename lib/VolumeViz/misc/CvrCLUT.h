@@ -47,9 +47,11 @@ public:
   // Note: must match the enum in SoOrthoSlice.
   enum AlphaUse { ALPHA_AS_IS = 0, ALPHA_OPAQUE = 1, ALPHA_BINARY = 2 };
 
-  CvrCLUT(const unsigned int nrcols, const uint8_t * colormap, AlphaUse policy);
+  CvrCLUT(const unsigned int nrcols, const uint8_t * colormap, AlphaUse policy,
+          const unsigned int nrindices);
   CvrCLUT(const unsigned int nrcols, const unsigned int nrcomponents,
-          const float * colormap, AlphaUse policy);
+          const float * colormap, AlphaUse policy,
+          const unsigned int nrindices);
   CvrCLUT(const CvrCLUT & clut);
 
   friend int operator==(const CvrCLUT & c1, const CvrCLUT & c2);
@@ -60,15 +62,27 @@ public:
   int32_t getRefCount(void) const;
 
   void setTransparencyThresholds(uint32_t low, uint32_t high);
+  void setWindow(double low, double high);
+  void getWindow(double & low, double & high) const;
 
-  enum TextureType { TEXTURE2D = 0, TEXTURE3D = 1, TEXTURE3D_GRADIENT = 2 };
+  // TEXTURE3D_SHADED is not a paletted type, but the fragment program
+  // of lit RGBA textures shaded with activateShading().
+  enum TextureType { TEXTURE2D = 0, TEXTURE3D = 1, TEXTURE3D_GRADIENT = 2,
+                     TEXTURE3D_SHADED = 3 };
 
   void activate(uint32_t ctxid, TextureType t) const;
   void deactivate(const cc_glglue * glw) const;
 
+  static void activateShading(uint32_t ctxid);
+  static void deactivateShading(const cc_glglue * glw);
+
   void lookupRGBA(const unsigned int idx, uint8_t rgba[4]) const;
+  const uint8_t * getRGBAColors(void) const;
+  unsigned int getNrOfIndices(void) const;
+  SbBool isTransparent(const unsigned int lowidx, const unsigned int highidx) const;
 
   static SbBool usePaletteTextures(const SoGLRenderAction * action);
+  static SbBool useFragmentShading(const SoGLRenderAction * action);
 
   static SbBool usePaletteExtension(const cc_glglue * glw);
   static SbBool useFragmentProgramLookup(const cc_glglue * glw);
@@ -95,10 +109,10 @@ private:
     GlobalGLContextStorage(void)
     {
       this->fragmentprogramid[0] = this->fragmentprogramid[1] =
-        this->fragmentprogramid[2] = 0;
+        this->fragmentprogramid[2] = this->fragmentprogramid[3] = 0;
     }
 
-    GLuint fragmentprogramid[3];
+    GLuint fragmentprogramid[4];
   };
   static GlobalGLContextStorage * getGlobalGLContextStorage(uint32_t ctxid);
   GLContextStorage * getGLContextStorage(uint32_t ctxid);
@@ -114,7 +128,14 @@ private:
 
   unsigned int nrentries;
   unsigned int nrcomponents;
-
+  // The number of voxel values covered by the lookup table, i.e. 256
+  // for 8-bit voxels and 65536 for 16-bit voxels. The colormap
+  // entries are spread out evenly over this range.
+  unsigned int nrindices;
+  // The range of indices the colormap is spread over. Indices below
+  // or above it get the first or last colormap entry. Defaults to the
+  // full range [0, nrindices>.
+  double window[2];
 
   enum DataType { INTS, FLOATS } datatype;
   union {
@@ -127,6 +148,9 @@ private:
   AlphaUse alphapolicy;
 
   uint8_t * glcolors;
+  // Number of indices below each index which map to a color with
+  // non-zero alpha, with one extra entry at the end for the total.
+  uint32_t * opaquecount;
 
   int refcount;
 
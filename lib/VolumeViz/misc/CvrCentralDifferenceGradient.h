@@ -36,15 +36,16 @@
 #include <Inventor/SbBasic.h>
 #include <VolumeViz/misc/CvrGradient.h>
 
-class SbVec3s;
+class SbVec3i32;
 class SbVec3f;
 
 // *************************************************************************
 
 class CvrCentralDifferenceGradient : public CvrGradient {
 public:
-  CvrCentralDifferenceGradient(const uint8_t * buf, const SbVec3s & size, SbBool useFlippedYAxis) :
-    CvrGradient(buf, size, useFlippedYAxis) { }
+  CvrCentralDifferenceGradient(const uint8_t * buf, SoVolumeData::DataType type,
+                               const SbVec3i32 & size, SbBool useFlippedYAxis) :
+    CvrGradient(buf, type, size, useFlippedYAxis) { }
   
   SbVec3f getGradient(unsigned int x, unsigned int y, unsigned int z);
 };
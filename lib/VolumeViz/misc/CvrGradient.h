@@ -34,7 +34,8 @@
 \**************************************************************************/
 
 #include <Inventor/SbBasic.h>
-#include <Inventor/SbVec3s.h>
+#include <Inventor/SbVec3i32.h>
+#include <VolumeViz/nodes/SoVolumeData.h>
 
 class SbVec3f;
 
@@ -42,18 +43,21 @@ class SbVec3f;
 
 class CvrGradient {
 public:
-  CvrGradient(const uint8_t * buf, const SbVec3s & size, SbBool useFlippedYAxis);
+  CvrGradient(const uint8_t * buf, SoVolumeData::DataType type, const SbVec3i32 & size,
+              SbBool useFlippedYAxis);
+  virtual ~CvrGradient() {}
 
   SbVec3f getGradientRangeCompressed(unsigned int x, unsigned int y, unsigned int z);
   virtual SbVec3f getGradient(unsigned int x, unsigned int y, unsigned int z) = 0;
 
 protected:
-  uint8_t getVoxel(int x, int y, int z);
+  float getVoxel(int x, int y, int z);
   
 private:
-  unsigned int getVoxelIdx(int x, int y, int z);
+  size_t getVoxelIdx(int x, int y, int z);
   const uint8_t * buf;
-  SbVec3s size;
+  SoVolumeData::DataType type;
+  SbVec3i32 size;
   SbBool useFlippedYAxis;
 };
 
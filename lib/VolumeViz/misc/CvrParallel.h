@@ -0,0 +1,61 @@
+#ifndef SIMVOLEON_CVRPARALLEL_H
+#define SIMVOLEON_CVRPARALLEL_H
+
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+// Runs independent jobs on several threads. The calling thread takes
+// part in the work, and the call returns when all jobs are done. The
+// other threads are kept in a pool between calls.
+//
+// The number of threads defaults to the number of processors, and
+// can be overridden with the CVR_NR_THREADS environment variable
+// (where 1 means that all jobs are run by the calling thread). The
+// pool threads are stopped by cleanup(), which SoVolumeRendering
+// calls when Coin cleans up at exit.
+
+#include <Inventor/SbBasic.h>
+
+// *************************************************************************
+
+class CvrParallel {
+public:
+  typedef void JobFunc(void * closure, unsigned int jobidx);
+
+  static void run(unsigned int nrjobs, JobFunc * func, void * closure);
+  static unsigned int getNrOfThreads(void);
+  static void cleanup(void);
+};
+
+// *************************************************************************
+
+#endif // !SIMVOLEON_CVRPARALLEL_H
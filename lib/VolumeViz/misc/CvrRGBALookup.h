@@ -0,0 +1,66 @@
+#ifndef SIMVOLEON_CVRRGBALOOKUP_H
+#define SIMVOLEON_CVRRGBALOOKUP_H
+
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+// Looks up RGBA colors for a row of voxel lookup indices, as done
+// when transferring voxels to RGBA textures. There is a scalar
+// version, and SSE4.1 and AVX2 versions for x86 CPUs supporting
+// them. They give bit-identical results.
+//
+// This only depends on Coin headers, so testcode/rgbalookup.cpp can
+// build it on its own to check the versions against each other.
+
+#include <Inventor/SbBasic.h>
+
+// *************************************************************************
+
+class CvrRGBALookup {
+public:
+  enum Implementation { SCALAR, SSE41, AVX2 };
+
+  // Each index is mapped to (index << shift) + offset, which must be
+  // less than "nrcolors". Returns TRUE if any of the colors is not
+  // fully transparent.
+  typedef SbBool RowFunc(const uint32_t * indices, const unsigned int nr,
+                         const int32_t shift, const int32_t offset,
+                         const uint8_t * colors, const unsigned int nrcolors,
+                         uint8_t * rgba);
+
+  static RowFunc * getRowFunc(Implementation impl);
+  static const char * getName(Implementation impl);
+};
+
+// *************************************************************************
+
+#endif // !SIMVOLEON_CVRRGBALOOKUP_H
@@ -0,0 +1,70 @@
+#ifndef SIMVOLEON_CVRRESAMPLER_H
+#define SIMVOLEON_CVRRESAMPLER_H
+
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+// Resamples the voxels of a CvrVoxelStore to new dimensions, for
+// SoVolumeData::reSampling().
+//
+// For downsampling, each voxel of the result covers a box of source
+// voxels, which is reduced one axis at a time: the source rows of the
+// box are first combined into a line buffer, which is then reduced
+// along the X axis. Source voxels are thereby read in memory order,
+// and each of them is read only once. The result is split into tiles
+// of rows, which are resampled in parallel.
+//
+// For oversampling, the source is interpolated with a separable
+// kernel, one axis at a time, over float buffers. Any region of the
+// result can be computed on its own, so a large result can be made
+// chunk by chunk, as it is needed.
+
+#include <Inventor/SbBox3i32.h>
+#include <Inventor/SbVec3i32.h>
+#include <VolumeViz/nodes/SoVolumeData.h>
+
+class CvrVoxelStore;
+
+// *************************************************************************
+
+class CvrResampler {
+public:
+  static void downSample(CvrVoxelStore * source, const SbVec3i32 & dimensions,
+                         SoVolumeData::SubMethod method, void * output);
+  static void overSample(CvrVoxelStore * source, const SbVec3i32 & dimensions,
+                         SoVolumeData::OverMethod method,
+                         const SbBox3i32 & region, void * output);
+};
+
+// *************************************************************************
+
+#endif // !SIMVOLEON_CVRRESAMPLER_H
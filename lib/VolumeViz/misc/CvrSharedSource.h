@@ -0,0 +1,94 @@
+#ifndef SIMVOLEON_CVRSHAREDSOURCE_H
+#define SIMVOLEON_CVRSHAREDSOURCE_H
+
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+// The voxel stores of volume files, shared by all SoVolumeData nodes
+// reading the same file, so that the voxels, the bricks and the
+// resolution pyramid built from them, and the textures, are held only
+// once however many scene graphs show the volume.
+//
+// Files are told apart by their canonical path, modification time and
+// size, so a file which has been written to since another node opened
+// it gets a store of its own. Compressed and uncompressed storage of
+// the same file are kept apart as well.
+//
+// The nodes render the voxels by the data id of the source, which is
+// renewed whenever the store is flushed, so textures are shared
+// between them too.
+
+#include <Inventor/SbBasic.h>
+#include <Inventor/SbString.h>
+#include <Inventor/lists/SbList.h>
+
+class CvrVoxelStore;
+class SoVolumeData;
+class SoVolumeReader;
+
+// *************************************************************************
+
+class CvrSharedSource {
+public:
+  static CvrSharedSource * acquire(const char * filename, const SbBool compressed,
+                                   SoVolumeData * user);
+  void release(SoVolumeData * user);
+
+  SoVolumeReader * getReader(void) const;
+  CvrVoxelStore * getVoxelStore(void) const;
+  const SbList<SoVolumeData *> & getUsers(void) const;
+
+  SbUniqueId getDataId(void) const;
+  void renewDataId(void);
+
+private:
+  CvrSharedSource(const SbString & path, const SbBool compressed);
+  ~CvrSharedSource();
+
+  static SbBool identify(const char * filename, SbString & path,
+                         int64_t & mtime, int64_t & size);
+
+  SbString path;
+  int64_t mtime, size;
+  SbBool compressed;
+
+  SoVolumeReader * reader;
+  CvrVoxelStore * store;
+  SbList<SoVolumeData *> users;
+  SbUniqueId dataid;
+
+  static SbList<CvrSharedSource *> * sources;
+};
+
+// *************************************************************************
+
+#endif // !SIMVOLEON_CVRSHAREDSOURCE_H
@@ -0,0 +1,107 @@
+#ifndef SIMVOLEON_CVRTIMESERIES_H
+#define SIMVOLEON_CVRTIMESERIES_H
+
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+// Double buffered voxel stores for the time steps of a time-varying
+// volume, as delivered by SoVolumeReader::getTimeStep().
+//
+// One step is current, and is what the voxel store returned from
+// setCurrentStep() holds. Once the caller has taken that store into
+// use, decodeAhead() starts decoding the step after it into the other
+// buffer, from a background thread, at the stride the steps were last
+// stepped through. Playback at a steady pace will then usually
+// find the next step ready, and switching to it is just a swap of the
+// two buffers.
+//
+// Stepping to a step which is not the one decoded ahead waits for it
+// to be decoded.
+
+#include <Inventor/SbBasic.h>
+#include <Inventor/SbVec3i32.h>
+#include <Inventor/threads/SbCondVar.h>
+#include <Inventor/threads/SbMutex.h>
+#include <VolumeViz/nodes/SoVolumeData.h>
+
+class CvrVoxelStore;
+class SbThread;
+class SoVolumeReader;
+
+// *************************************************************************
+
+class CvrTimeSeries {
+public:
+  CvrTimeSeries(SoVolumeReader * reader, const SbVec3i32 & dimensions,
+                SoVolumeData::DataType datatype);
+  ~CvrTimeSeries();
+
+  int getNumTimeSteps(void) const;
+  int getCurrentStep(void) const;
+
+  CvrVoxelStore * setCurrentStep(int step);
+  void decodeAhead(void);
+
+private:
+  enum State { EMPTY, QUEUED, DECODING, READY, FAILED };
+
+  struct Buffer {
+    int step;
+    State state;
+    uint8_t * voxels;
+    CvrVoxelStore * store;
+  };
+
+  void queue(Buffer & buffer, int step);
+  static void * workerCB(void * closure);
+  void work(void);
+
+  SoVolumeReader * reader;
+  SbVec3i32 dimensions;
+  SoVolumeData::DataType datatype;
+  int nrsteps;
+  int stride;
+  int failedstep;
+  SbThread * thread;
+
+  // Protects all of the below. The worker thread waits on "wakeup"
+  // for a step to decode, and signals "decoded" when done. Voxel
+  // stores are only made and deleted from the calling thread.
+  SbMutex mutex;
+  SbCondVar wakeup, decoded;
+  Buffer current, next;
+  SbBool quit;
+};
+
+// *************************************************************************
+
+#endif // !SIMVOLEON_CVRTIMESERIES_H
@@ -35,7 +35,11 @@
 
 #include <Inventor/SbBasic.h>
 
+class SbBox3i32;
+class SbBox3s;
 class SbMatrix;
+class SbVec3i32;
+class SbVec3s;
 class CvrVoxelBlockElement;
 
 // *************************************************************************
@@ -50,11 +54,19 @@ public:
   static SbBool useFlippedYAxis(void);
   static SbBool dontModulateTextures(void);
   static SbBool force2DTextureRendering(void);
+  static SbBool useCompactNormals(void);
   
   static uint32_t crc32(uint8_t * buf, unsigned int len);
 
   static void getTransformFromVolumeBoxDimensions(const CvrVoxelBlockElement * vd,
                                                   SbMatrix & m);
+
+  static SbVec3i32 toVec3i32(const SbVec3s & v);
+  static SbVec3s toVec3s(const SbVec3i32 & v);
+  static SbBox3i32 toBox3i32(const SbBox3s & box);
+  static SbBox3s toBox3s(const SbBox3i32 & box);
+  static SbBool fitsShort(const SbVec3i32 & v);
+  static SbBool fitsShort(const SbBox3i32 & box);
 };
 
 // *************************************************************************
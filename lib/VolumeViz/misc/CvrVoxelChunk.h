@@ -33,54 +33,84 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 \**************************************************************************/
 
-#include <Inventor/SbVec3s.h>
-#include <Inventor/SbBox3s.h>
+#include <Inventor/SbVec3f.h>
+#include <Inventor/SbVec3i32.h>
+#include <Inventor/SbBox3i32.h>
+#include <VolumeViz/nodes/SoVolumeData.h>
 #include <VolumeViz/nodes/SoTransferFunction.h>
 #include <VolumeViz/misc/CvrCLUT.h>
 
 class CvrTextureObject;
+class CvrVoxelStore;
 class SoGLRenderAction;
 class SoTransferFunctionElement;
-class SbBox2s;
+class SbBox2i32;
 
 // *************************************************************************
 
 class CvrVoxelChunk {
 public:
-  CvrVoxelChunk(const SbVec3s & dimensions, unsigned int bytesprvoxel,
+  CvrVoxelChunk(const SbVec3i32 & dimensions, unsigned int bytesprvoxel,
                 const void * buffer = NULL);
   ~CvrVoxelChunk();
 
+  // The parts of the traversal state the transfer depends on.
+  struct TransferInfo {
+    int32_t shift, offset;
+    SoVolumeData::DataType datatype;
+    unsigned int bytesprvoxel;
+    unsigned int indexsize;
+    double mapoffset, mapscale;
+    SbBool lighting;
+    SbVec3f lightdir;
+    float lightintensity;
+  };
+  static void getTransferInfo(const SoGLRenderAction * action, TransferInfo & info);
+  static void prepareTransfer(const CvrCLUT * clut, CvrTextureObject * texobj);
+
   void transfer(const SoGLRenderAction * action, const CvrCLUT * clut, CvrTextureObject * texobj, SbBool & invisible) const;
+  void transfer(const TransferInfo & info, const CvrCLUT * clut, CvrTextureObject * texobj,
+                const unsigned int firstslice, const unsigned int endslice,
+                SbBool & invisible) const;
 
   const void * getBuffer(void) const;
   const uint8_t * getBuffer8(void) const;
   const uint16_t * getBuffer16(void) const;
 
-  unsigned int bufferSize(void) const;
+  size_t bufferSize(void) const;
 
-  const SbVec3s & getDimensions(void) const;
+  const SbVec3i32 & getDimensions(void) const;
   unsigned int getUnitSize(void) const;
 
+  void setGradients(const uint8_t * gradients, const SbVec3i32 & volumedims);
+
   void dumpToPPM(const char * filename) const;
 
   // FIXME: move to CvrCLUT?
-  static CvrCLUT * getCLUT(const SoTransferFunctionElement * e, CvrCLUT::AlphaUse alphause);
+  static CvrCLUT * getCLUT(const SoTransferFunctionElement * e, CvrCLUT::AlphaUse alphause,
+                           CvrVoxelStore * store);
 
   CvrVoxelChunk * buildSubPage(const unsigned int axisidx, const int pageidx,
-                               const SbBox2s & cutslice);
+                               const SbBox2i32 & cutslice);
 
-  CvrVoxelChunk * buildSubCube(const SbBox3s & cubecut);
+  CvrVoxelChunk * buildSubCube(const SbBox3i32 & cubecut);
 
 private:
-  void transfer2D(const SoGLRenderAction * action, const CvrCLUT * clut, CvrTextureObject * texobj, SbBool & invisible) const;
-  void transfer3D(const SoGLRenderAction * action, const CvrCLUT * clut, CvrTextureObject * texobj, SbBool & invisible) const;
+  void transfer2D(const TransferInfo & info, const CvrCLUT * clut, CvrTextureObject * texobj, SbBool & invisible) const;
+  void transfer3D(const TransferInfo & info, const CvrCLUT * clut, CvrTextureObject * texobj,
+                  const unsigned int firstslice, const unsigned int endslice,
+                  SbBool & invisible) const;
+  void transferGradients(const TransferInfo & info, CvrTextureObject * texobj,
+                         const unsigned int firstslice, const unsigned int endslice) const;
   
-  CvrVoxelChunk * buildSubPageX(const int pageidx, const SbBox2s & cutslice);
-  CvrVoxelChunk * buildSubPageY(const int pageidx, const SbBox2s & cutslice);
-  CvrVoxelChunk * buildSubPageZ(const int pageidx, const SbBox2s & cutslice);
-
-  static CvrCLUT * makeCLUT(const SoTransferFunctionElement * e, CvrCLUT::AlphaUse alphause);
+  CvrVoxelChunk * buildSubPageX(const int pageidx, const SbBox2i32 & cutslice);
+  CvrVoxelChunk * buildSubPageY(const int pageidx, const SbBox2i32 & cutslice);
+  CvrVoxelChunk * buildSubPageZ(const int pageidx, const SbBox2i32 & cutslice);
+
+  static CvrCLUT * makeCLUT(const SoTransferFunctionElement * e, CvrCLUT::AlphaUse alphause,
+                            const unsigned int indexsize);
+  static SbBool getIndexWindow(const SoTransferFunctionElement * e, CvrVoxelStore * store,
+                               double & low, double & high);
   static SbDict * CLUTdict;
 
   static uint8_t PREDEFGRADIENTS[SoTransferFunction::SEISMIC + 1][256][4];
@@ -88,8 +118,10 @@ private:
 
   SbBool destructbuffer;
   const void * voxelbuffer;
-  SbVec3s dimensions;
+  SbVec3i32 dimensions;
   unsigned int unitsize;
+  const uint8_t * gradients;
+  SbVec3i32 gradientdims;
 };
 
 // *************************************************************************
@@ -0,0 +1,390 @@
+#ifndef SIMVOLEON_CVRVOXELSTORE_H
+#define SIMVOLEON_CVRVOXELSTORE_H
+
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+// This class gives brick-addressed access to the voxels of a volume,
+// so the rendering code can pull in only those parts of the volume it
+// actually needs, instead of requiring the complete voxel set to be
+// present in memory.
+//
+// If the reader already has all voxels resident in memory, they are
+// accessed directly. Otherwise, bricks are loaded on demand from the
+// reader, and kept in a least-recently-used cache which is shared by
+// all CvrVoxelStore instances, and bounded by a global memory limit.
+//
+// A store can also provide a multi-resolution pyramid of itself, for
+// rendering at lower resolution. Level n of the pyramid is reduced by
+// a factor of 2^n along each axis. Each level is a store of its own,
+// whose bricks are reduced from the level below as they are needed,
+// and kept in the brick cache like any other bricks.
+//
+// Voxels of SIGNED_SHORT and FLOAT type are stored as-is, and only
+// mapped to unsigned 16-bit lookup indices when textures are built,
+// by the mapping returned from getIndexMapping(). The value range
+// of each brick is recorded as it is scanned, and the data window of
+// the transfer function is applied in the color lookup table, so
+// changing it does not touch the voxels.
+//
+// The histogram of the lookup indices is also kept per brick, so
+// after flushRegion() only the bricks within the region have to be
+// counted again.
+//
+// Changes to parts of the voxels are announced with updateRegion(),
+// which also keeps a log of the changed regions for the rendering
+// code, so it only has to rebuild the textures covering them.
+//
+// For lit rendering, the gradients of all voxels can be computed once
+// with buildGradients(), and are then shared by all the chunks cut
+// from the store. Their memory is counted against the limit of the
+// brick cache, like the bricks.
+//
+// When the reader is a SoVRBrickFileReader, the store uses the bricks
+// of the file as its own bricks, takes the value ranges from the
+// file's brick tables, and reads levels of the resolution pyramid
+// from the file when they were built by the requested method. Those
+// levels are read brick by brick into the brick cache, like level 0.
+//
+// A store can be converted to hold all its bricks compressed in
+// memory, with compress(). The bricks are then decompressed into the
+// brick cache on demand, which thereby works as a "hot" cache of
+// uncompressed bricks, and the store no longer reads from the reader
+// or the resident voxels.
+//
+// Bricks can be loaded into the cache ahead of need from another
+// thread, with prefetchBrick(), and several threads can read voxels
+// at once. All access to the brick cache is therefore serialized on a
+// global mutex, and all calls to the reader on a mutex of the store.
+// The cache mutex is not held while bricks are read. A brick in use
+// is pinned, so it is not evicted until its user lets go of it.
+//
+// A store can be made as a view of a sub-box of another store. It
+// then shares the resident voxels of the viewed store, addressed with
+// that store's strides, or else copies its bricks out of the viewed
+// store through the brick cache.
+//
+// Extents, voxel positions and regions are 32-bit throughout the
+// store, so it is not limited to 32767 voxels along each axis. Voxels
+// are read through the SbBox3i32 functions of SoVolumeReader.
+
+#include <assert.h>
+#include <math.h>
+#include <stddef.h> // size_t
+
+#include <Inventor/SbBasic.h>
+#include <Inventor/SbVec3i32.h>
+#include <Inventor/SbBox3i32.h>
+#include <Inventor/lists/SbList.h>
+#include <Inventor/threads/SbMutex.h>
+#include <VolumeViz/nodes/SoVolumeData.h>
+
+class SbBox2i32;
+class SbDict;
+class SbThreadMutex;
+class SoVolumeReader;
+class SoVRBrickFileReader;
+class CvrVoxelChunk;
+
+// *************************************************************************
+
+class CvrVoxelStore {
+public:
+  CvrVoxelStore(SoVolumeReader * reader, const SbVec3i32 & dimensions,
+                SoVolumeData::DataType datatype,
+                const void * residentvoxels = NULL);
+  CvrVoxelStore(CvrVoxelStore * viewed, const SbBox3i32 & region);
+  ~CvrVoxelStore();
+
+  const SbVec3i32 & getDimensions(void) const;
+  SoVolumeData::DataType getDataType(void) const;
+  unsigned int getBytesPrVoxel(void) const;
+  unsigned int getIndexSize(void) const;
+  const SbVec3i32 & getBrickSize(void) const;
+
+  const uint8_t * getResidentVoxels(void) const;
+  const SbVec3i32 & getResidentDimensions(void) const;
+
+  CvrVoxelStore * getViewedStore(void) const;
+  const SbVec3i32 & getViewOffset(void) const;
+
+  uint32_t getVoxelValue(const SbVec3i32 & voxelpos);
+  uint32_t getVoxelIndex(const SbVec3i32 & voxelpos);
+
+  void getBrickMinMax(const SbVec3i32 & brickidx, double & minval, double & maxval);
+  void getMinMax(double & minval, double & maxval);
+  SbBool getRegionIndexRange(const SbBox3i32 & region, uint32_t & lowidx, uint32_t & highidx);
+  void getIndexMapping(double & offset, double & scale);
+  static inline uint32_t voxelToIndex(const void * voxels, const size_t idx,
+                                      const SoVolumeData::DataType type,
+                                      const double offset, const double scale);
+
+  void getHistogram(int * histogram, unsigned int length);
+
+  void copyRegion(const SbBox3i32 & region, void * output);
+
+  CvrVoxelChunk * buildSubCube(const SbBox3i32 & cutcube);
+  CvrVoxelChunk * buildSubPage(const unsigned int axisidx, const int pageidx,
+                               const SbBox2i32 & cutslice);
+  SbBox3i32 getPageRegion(const unsigned int axisidx, const int pageidx,
+                          const SbBox2i32 & cutslice) const;
+
+  SbBool buildGradients(void);
+
+  CvrVoxelStore * getLevel(unsigned int level, SoVolumeData::SubMethod method);
+  unsigned int getNrOfLevels(void) const;
+  static SbVec3i32 getLevelDimensions(const SbVec3i32 & dimensions, unsigned int level);
+  static SbBox3i32 getLevelRegion(const SbBox3i32 & region, unsigned int level);
+
+  void flush(void);
+  void flushRegion(const SbBox3i32 & region);
+
+  void updateRegion(const SbBox3i32 & region);
+  unsigned int getUpdateSerial(void) const;
+  SbBool isUpdatedSince(const SbBox3i32 & region, unsigned int serial) const;
+
+  SbBool compress(void);
+  SbBool isCompressed(void) const;
+  size_t getCompressedSize(void) const;
+
+  size_t prefetchBrick(const SbVec3i32 & brickidx);
+  const SbVec3i32 & getNrOfBricks(void) const;
+
+  static void setMemoryLimit(size_t nrbytes);
+  static size_t getMemoryLimit(void);
+  static size_t getResidentMemory(void);
+  static size_t getPrefetchedMemory(void);
+
+private:
+  struct Brick {
+    CvrVoxelStore * owner;
+    uintptr_t key;
+    SbVec3i32 dimensions;
+    uint8_t * voxels;
+    SbBool ownsvoxels;
+    size_t nrbytes;
+    SbBool prefetched; // loaded by prefetchBrick(), and not yet used
+    unsigned int users; // pins from getBrick() not yet handed back
+    SbBool evicted; // thrown out of the cache while pinned
+    Brick * prev;
+    Brick * next;
+  };
+
+  // Value range of the voxels within one brick.
+  struct BrickRange {
+    SbBool valid;
+    double minval, maxval;
+  };
+
+  // Histogram of the lookup indices of the voxels within one brick,
+  // as "nrentries" pairs of (index, count) for the non-empty bins.
+  struct BrickHistogram {
+    uint32_t * entries;
+    unsigned int nrentries;
+  };
+
+  // A brick in compressed form.
+  struct PackedBrick {
+    uint8_t * data;
+    size_t nrbytes;
+  };
+
+  // Bricks compressed by packBricks(), with their value ranges, to be
+  // put into the store by installPackedBricks().
+  struct PackedBatch {
+    SbList<uintptr_t> keys;
+    SbList<PackedBrick> bricks;
+    SbList<BrickRange> ranges;
+  };
+
+  // A change of the voxels, recorded by updateRegion().
+  struct Update {
+    SbBox3i32 region;
+    unsigned int serial;
+  };
+
+  CvrVoxelStore(CvrVoxelStore * finer, SoVolumeData::SubMethod method);
+  CvrVoxelStore(CvrVoxelStore * full, unsigned int level);
+
+  void init(void);
+  uintptr_t brickKey(const SbVec3i32 & brickidx) const;
+  SbVec3i32 brickIndex(uintptr_t key) const;
+  SbBox3i32 brickRegion(const SbVec3i32 & brickidx) const;
+  const void * getVoxelPointer(const SbBox3i32 & region);
+  const uint8_t * getVoxelAddress(const SbVec3i32 & voxelpos, Brick *& brick);
+  void scanRange(BrickRange & range, const SbBox3i32 & region,
+                 const uint8_t * voxels, const SbVec3i32 & bufferdims) const;
+  Brick * getBrick(const SbVec3i32 & brickidx);
+  Brick * lookupBrick(uintptr_t key);
+  void unpinBrick(Brick * brick);
+  Brick * newBrick(const SbVec3i32 & brickidx);
+  void loadBrick(Brick * brick, const SbBox3i32 & region);
+  void recordRange(const Brick * brick);
+  void readRanges(void);
+  void insertBrick(Brick * brick);
+  void fetchBricks(const SbBox3i32 & region);
+  SbBool packBricks(const SbBox3i32 & region, PackedBatch & packed);
+  void installPackedBricks(const PackedBatch & packed);
+  static void freePackedBricks(PackedBatch & packed);
+  static void compressBrickCB(void * closure, unsigned int jobidx);
+  static void decompressBrickCB(void * closure, unsigned int jobidx);
+  static void reduceBrickCB(void * closure, unsigned int jobidx);
+  static void histogramBrickCB(void * closure, unsigned int jobidx);
+  static void rangeBrickCB(void * closure, unsigned int jobidx);
+  static void gradientSlabCB(void * closure, unsigned int jobidx);
+  void computeGradients(const SbBox3i32 & region);
+  void computeRanges(void);
+  SbBool getKnownHistogram(const SbVec3i32 & brickidx, unsigned int length,
+                           BrickHistogram & histogram);
+  void clearHistograms(void);
+  static void releaseBrick(Brick * brick);
+
+  CvrVoxelStore * buildReducedStore(SoVolumeData::SubMethod method);
+  void reduceRegion(SoVolumeData::SubMethod method, const SbBox3i32 & region,
+                    uint8_t * output);
+  void updateLevels(const SbBox3i32 & region);
+  CvrVoxelStore * loadLevel(unsigned int level, SoVolumeData::SubMethod method);
+  void flushLevels(void);
+
+  static void lruUnlink(Brick * brick);
+  static void lruPushFront(Brick * brick);
+  static void makeRoomFor(size_t nrbytes);
+  void releaseGradients(void);
+
+  SoVolumeReader * reader;
+  SoVRBrickFileReader * brickreader;
+  SbVec3i32 dimensions;
+  SoVolumeData::DataType datatype;
+  unsigned int bytesprvoxel;
+  const uint8_t * residentvoxels;
+  SbVec3i32 residentdims;
+  SbVec3i32 bricksize;
+  SbVec3i32 nrbricks;
+  SbDict * brickdict;
+  SbMutex readermutex;
+
+  // Increased on each flush(), so bricks read without holding the
+  // cache mutex from before the flush can be told apart.
+  unsigned int generation;
+
+  // One entry per brick, filled in as the bricks are scanned.
+  BrickRange * brickranges;
+  BrickRange totalrange;
+
+  // One entry per brick, computed by getHistogram(), and the sum of
+  // them all. Kept for as long as the lookup index mapping they were
+  // counted with is unchanged, and within a memory limit.
+  BrickHistogram * brickhistograms;
+  size_t histogrambytes;
+  double histogramoffset, histogramscale;
+  int * totalhistogram;
+  unsigned int totalhistogramlength;
+
+  // All bricks in compressed form, indexed like "brickranges", or
+  // NULL if the store is not compressed.
+  PackedBrick * packedbricks;
+  size_t packedbytes;
+
+  // Coarser levels of the resolution pyramid, where index 0 holds
+  // level 1. Levels are only read from a bricked file while
+  // "readlevels" is set, which it is not after parts of the voxels
+  // have changed.
+  SbList<CvrVoxelStore *> levels;
+  SoVolumeData::SubMethod levelmethod;
+  SbBool readlevels;
+
+  // For a level of the resolution pyramid, the store of the level
+  // below, which the bricks are reduced from, and by which method.
+  CvrVoxelStore * reducedfrom;
+  SoVolumeData::SubMethod reducemethod;
+
+  // For a level of the resolution pyramid read from a bricked file,
+  // the store of level 0, whose reader is read through, and the level
+  // in the file. "readerlevel" is 0 for all other stores.
+  CvrVoxelStore * levelof;
+  unsigned int readerlevel;
+
+  // The store this is a view of, and the view's position within it.
+  CvrVoxelStore * viewedstore;
+  SbVec3i32 viewoffset;
+
+  // Normalized gradients of all voxels, range compressed to 3 bytes
+  // per voxel, or NULL if not built. Those within "gradientsdirty"
+  // are out of date. "gradientbytes" is their size, as counted in
+  // "residentbytes".
+  uint8_t * gradients;
+  size_t gradientbytes;
+  SbBox3i32 gradientsdirty;
+
+  // The most recent updates, oldest first.
+  SbList<Update> updates;
+  unsigned int updateserial;
+
+  static Brick * lruhead;
+  static Brick * lrutail;
+  static size_t residentbytes;
+  static size_t memorylimit;
+  static size_t prefetchedbytes;
+  static SbThreadMutex * cachemutex;
+};
+
+// *************************************************************************
+
+// Maps voxel number "idx" of "voxels" to a lookup index, as
+// (value - offset) * scale. Unsigned types map to their own value,
+// for which the caller passes offset 0 and scale 1. FLOAT values
+// outside the range of the mapping are clamped, and NaN maps to 0.
+inline uint32_t
+CvrVoxelStore::voxelToIndex(const void * voxels, const size_t idx,
+                            const SoVolumeData::DataType type,
+                            const double offset, const double scale)
+{
+  switch (type) {
+  case SoVolumeData::UNSIGNED_BYTE: return ((const uint8_t *)voxels)[idx];
+  case SoVolumeData::UNSIGNED_SHORT: return ((const uint16_t *)voxels)[idx];
+  case SoVolumeData::SIGNED_SHORT:
+    return (uint32_t)(((const int16_t *)voxels)[idx] + 32768);
+  case SoVolumeData::FLOAT:
+    {
+      const double v = (((const float *)voxels)[idx] - offset) * scale;
+      if (!(v > 0.0)) { return 0; } // also catches NaN
+      if (v >= 65535.0) { return 65535; }
+      return (uint32_t)floor(v + 0.5);
+    }
+  default: assert(FALSE); break;
+  }
+  return 0;
+}
+
+// *************************************************************************
+
+#endif // !SIMVOLEON_CVRVOXELSTORE_H
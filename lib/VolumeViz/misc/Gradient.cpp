@@ -31,14 +31,20 @@
 \**************************************************************************/
 
 #include <VolumeViz/misc/CvrGradient.h>
+
+#include <assert.h>
+
 #include <Inventor/SbVec3f.h>
-#include <Inventor/SbVec3s.h>
+#include <Inventor/SbVec3i32.h>
 
 // *************************************************************************
 
-CvrGradient::CvrGradient(const uint8_t * buf, const SbVec3s & size, SbBool useFlippedYAxis)
+// The voxels in buf are of the given data type.
+CvrGradient::CvrGradient(const uint8_t * buf, SoVolumeData::DataType type, const SbVec3i32 & size,
+                         SbBool useFlippedYAxis)
 {
   this->buf = buf;
+  this->type = type;
   this->size = size;
   this->useFlippedYAxis = useFlippedYAxis;
 }
@@ -53,7 +59,7 @@ CvrGradient::getGradientRangeCompressed(unsigned int x, unsigned int y, unsigned
   return g;
 }
 
-unsigned int
+size_t
 CvrGradient::getVoxelIdx(int x, int y, int z)
 {
   if (x < 0) x++; if (x >= size[0]) x--;
@@ -61,13 +67,25 @@ CvrGradient::getVoxelIdx(int x, int y, int z)
   if (z < 0) z++; if (z >= size[2]) z--;
 
   if (useFlippedYAxis)
-    return (z * (size[0]*size[1])) + (((size[1]-1) - y) * size[0]) + x;
+    return (z * ((size_t)size[0] * size[1])) + (((size[1]-1) - y) * (size_t)size[0]) + x;
   
-  return (z * (size[0]*size[1])) + (size[0]*y) + x;
+  return (z * ((size_t)size[0] * size[1])) + ((size_t)size[0] * y) + x;
 }
 
-uint8_t
+float
 CvrGradient::getVoxel(int x, int y, int z)
 {
-  return buf[this->getVoxelIdx(x, y, z)];
+  const size_t idx = this->getVoxelIdx(x, y, z);
+  switch (this->type) {
+  case SoVolumeData::UNSIGNED_BYTE: return this->buf[idx];
+  case SoVolumeData::UNSIGNED_SHORT: return ((const uint16_t *)this->buf)[idx];
+  case SoVolumeData::SIGNED_SHORT: return ((const int16_t *)this->buf)[idx];
+  case SoVolumeData::FLOAT:
+    {
+      const float v = ((const float *)this->buf)[idx];
+      return (v == v) ? v : 0.0f; // NaN
+    }
+  default: assert(FALSE); break;
+  }
+  return 0.0f;
 }
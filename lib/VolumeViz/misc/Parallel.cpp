@@ -0,0 +1,245 @@
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+
+#include <VolumeViz/misc/CvrParallel.h>
+
+#include <assert.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <Inventor/C/tidbits.h>
+#include <Inventor/lists/SbList.h>
+#include <Inventor/threads/SbCondVar.h>
+#include <Inventor/threads/SbMutex.h>
+#include <Inventor/threads/SbThread.h>
+
+// *************************************************************************
+
+struct cvr_parallel_job {
+  CvrParallel::JobFunc * func;
+  void * closure;
+  unsigned int nrjobs;
+  unsigned int next;
+  unsigned int maxhelpers; // pool threads allowed to join in
+  SbMutex mutex;
+};
+
+// The worker threads are started on the first run() and then kept
+// waiting for work, so a run() only costs a wakeup. The pool takes
+// one batch of jobs at a time. A run() made while the pool is busy,
+// like one made from inside a job, is done by its calling thread
+// alone.
+//
+// The pool is destructed by CvrParallel::cleanup(), which stops and
+// joins the threads.
+struct cvr_parallel_pool {
+  SbMutex mutex;
+  SbCondVar wakeup; // a new batch is posted
+  SbCondVar done; // the last helper has left the batch
+  SbList<SbThread *> threads;
+  cvr_parallel_job * job; // the batch being run, or NULL
+  unsigned int generation; // counts the batches posted
+  unsigned int nrhelpers; // pool threads working on the batch
+  SbBool quit; // set by CvrParallel::cleanup()
+};
+
+static SbMutex cvr_parallel_poolmutex;
+static cvr_parallel_pool * cvr_parallel_thepool = NULL;
+
+// Picks jobs until there are none left.
+static void
+cvr_parallel_work(cvr_parallel_job * job)
+{
+  for (;;) {
+    job->mutex.lock();
+    const unsigned int idx = job->next;
+    if (idx < job->nrjobs) { job->next++; }
+    job->mutex.unlock();
+
+    if (idx >= job->nrjobs) { break; }
+    job->func(job->closure, idx);
+  }
+}
+
+static void *
+cvr_parallel_worker(void * closure)
+{
+  cvr_parallel_pool * pool = (cvr_parallel_pool *)closure;
+  unsigned int seen = 0;
+
+  pool->mutex.lock();
+  for (;;) {
+    while (!pool->quit && ((pool->job == NULL) || (pool->generation == seen))) {
+      (void)pool->wakeup.wait(pool->mutex);
+    }
+    if (pool->quit) { break; }
+    seen = pool->generation;
+
+    cvr_parallel_job * job = pool->job;
+    if (pool->nrhelpers >= job->maxhelpers) { continue; }
+    pool->nrhelpers++;
+    pool->mutex.unlock();
+
+    cvr_parallel_work(job);
+
+    pool->mutex.lock();
+    pool->nrhelpers--;
+    if (pool->nrhelpers == 0) { pool->done.wakeAll(); }
+  }
+  pool->mutex.unlock();
+  return NULL;
+}
+
+static cvr_parallel_pool *
+cvr_parallel_get_pool(void)
+{
+  cvr_parallel_poolmutex.lock();
+  if (cvr_parallel_thepool == NULL) {
+    cvr_parallel_pool * pool = new cvr_parallel_pool;
+    pool->job = NULL;
+    pool->generation = 0;
+    pool->nrhelpers = 0;
+    pool->quit = FALSE;
+
+    const unsigned int nrthreads = CvrParallel::getNrOfThreads();
+    for (unsigned int i = 1; i < nrthreads; i++) {
+      SbThread * thread = SbThread::create(cvr_parallel_worker, pool);
+      if (thread) { pool->threads.append(thread); }
+    }
+    cvr_parallel_thepool = pool;
+  }
+  cvr_parallel_poolmutex.unlock();
+  return cvr_parallel_thepool;
+}
+
+static unsigned int
+cvr_nr_of_processors(void)
+{
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (unsigned int)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  const long nr = sysconf(_SC_NPROCESSORS_ONLN);
+  return (nr > 0) ? (unsigned int)nr : 1;
+#else
+  return 1;
+#endif
+}
+
+// *************************************************************************
+
+unsigned int
+CvrParallel::getNrOfThreads(void)
+{
+  static int nrthreads = -1;
+  if (nrthreads == -1) {
+    const char * env = coin_getenv("CVR_NR_THREADS");
+    nrthreads = env ? atoi(env) : (int)cvr_nr_of_processors();
+    if (nrthreads < 1) { nrthreads = 1; }
+    if (nrthreads > 64) { nrthreads = 64; }
+  }
+  return (unsigned int)nrthreads;
+}
+
+// Calls func(closure, i) for all i in [0, nrjobs>, spread over the
+// available threads. The jobs must not depend on each other, and must
+// not touch shared state without locking.
+void
+CvrParallel::run(unsigned int nrjobs, JobFunc * func, void * closure)
+{
+  const unsigned int nrthreads = SbMin(CvrParallel::getNrOfThreads(), nrjobs);
+  if (nrthreads <= 1) {
+    for (unsigned int i = 0; i < nrjobs; i++) { func(closure, i); }
+    return;
+  }
+
+  cvr_parallel_job job;
+  job.func = func;
+  job.closure = closure;
+  job.nrjobs = nrjobs;
+  job.next = 0;
+  job.maxhelpers = nrthreads - 1;
+
+  cvr_parallel_pool * pool = cvr_parallel_get_pool();
+  pool->mutex.lock();
+  const SbBool busy = (pool->job != NULL);
+  if (!busy) {
+    pool->job = &job;
+    pool->generation++;
+    pool->wakeup.wakeAll();
+  }
+  pool->mutex.unlock();
+
+  cvr_parallel_work(&job);
+  if (busy) { return; }
+
+  // The job is on our stack, so wait until no pool thread is still
+  // looking at it.
+  pool->mutex.lock();
+  pool->job = NULL;
+  while (pool->nrhelpers > 0) { (void)pool->done.wait(pool->mutex); }
+  pool->mutex.unlock();
+}
+
+// Stops and joins the pool threads, and destructs the pool. Called
+// when the library is cleaned up, and must not be called while any
+// run() is in progress. A later run() starts a new pool.
+void
+CvrParallel::cleanup(void)
+{
+  cvr_parallel_poolmutex.lock();
+  cvr_parallel_pool * pool = cvr_parallel_thepool;
+  cvr_parallel_thepool = NULL;
+  cvr_parallel_poolmutex.unlock();
+  if (pool == NULL) { return; }
+
+  pool->mutex.lock();
+  assert(pool->job == NULL);
+  pool->quit = TRUE;
+  pool->wakeup.wakeAll();
+  pool->mutex.unlock();
+
+  for (int i = 0; i < pool->threads.getLength(); i++) {
+    (void)pool->threads[i]->join();
+    SbThread::destroy(pool->threads[i]);
+  }
+  delete pool;
+}
+
+// *************************************************************************
@@ -0,0 +1,180 @@
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+#include <VolumeViz/misc/CvrRGBALookup.h>
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define CVR_HAVE_SIMD_LOOKUP 1
+#include <immintrin.h>
+#endif // gcc or clang on x86
+
+// *************************************************************************
+
+// The reference the other versions are checked against.
+static SbBool
+cvr_rgba_row_scalar(const uint32_t * indices, const unsigned int nr,
+                    const int32_t shift, const int32_t offset,
+                    const uint8_t * colors, const unsigned int nrcolors,
+                    uint8_t * rgba)
+{
+  uint8_t alpha = 0;
+  for (unsigned int i = 0; i < nr; i++) {
+    const uint32_t idx = (indices[i] << shift) + offset;
+    assert(idx < nrcolors);
+    (void)memcpy(&rgba[i * 4], &colors[idx * 4], 4);
+    alpha |= rgba[i * 4 + 3];
+  }
+  return (alpha != 0) ? TRUE : FALSE;
+}
+
+#ifdef CVR_HAVE_SIMD_LOOKUP
+
+static inline int
+cvr_load_color(const uint8_t * colors, const uint32_t idx)
+{
+  int color;
+  (void)memcpy(&color, &colors[idx * 4], 4);
+  return color;
+}
+
+// Looks up 4 colors at a time. SSE4.1 has no gather loads, but
+// extracting and inserting 32-bit lanes still saves the per-voxel
+// shuffling of bytes, and the alpha test is done on whole vectors.
+__attribute__((target("sse4.1")))
+static SbBool
+cvr_rgba_row_sse41(const uint32_t * indices, const unsigned int nr,
+                   const int32_t shift, const int32_t offset,
+                   const uint8_t * colors, const unsigned int nrcolors,
+                   uint8_t * rgba)
+{
+  const __m128i shiftcount = _mm_cvtsi32_si128(shift);
+  const __m128i offsets = _mm_set1_epi32(offset);
+  const __m128i alphamask = _mm_set1_epi32((int)0xff000000);
+  __m128i alpha = _mm_setzero_si128();
+
+  unsigned int i = 0;
+  for (; (i + 4) <= nr; i += 4) {
+    __m128i idx = _mm_loadu_si128((const __m128i *)&indices[i]);
+    idx = _mm_add_epi32(_mm_sll_epi32(idx, shiftcount), offsets);
+    const uint32_t idx0 = (uint32_t)_mm_cvtsi128_si32(idx);
+    const uint32_t idx1 = (uint32_t)_mm_extract_epi32(idx, 1);
+    const uint32_t idx2 = (uint32_t)_mm_extract_epi32(idx, 2);
+    const uint32_t idx3 = (uint32_t)_mm_extract_epi32(idx, 3);
+    assert((idx0 < nrcolors) && (idx1 < nrcolors) &&
+           (idx2 < nrcolors) && (idx3 < nrcolors));
+
+    __m128i texels = _mm_cvtsi32_si128(cvr_load_color(colors, idx0));
+    texels = _mm_insert_epi32(texels, cvr_load_color(colors, idx1), 1);
+    texels = _mm_insert_epi32(texels, cvr_load_color(colors, idx2), 2);
+    texels = _mm_insert_epi32(texels, cvr_load_color(colors, idx3), 3);
+    _mm_storeu_si128((__m128i *)&rgba[i * 4], texels);
+    alpha = _mm_or_si128(alpha, _mm_and_si128(texels, alphamask));
+  }
+
+  const SbBool visible = _mm_testz_si128(alpha, alpha) ? FALSE : TRUE;
+  if (i == nr) { return visible; }
+  const SbBool rest = cvr_rgba_row_scalar(&indices[i], nr - i, shift, offset,
+                                          colors, nrcolors, &rgba[i * 4]);
+  return visible || rest;
+}
+
+// Looks up 8 colors at a time with gather loads.
+__attribute__((target("avx2")))
+static SbBool
+cvr_rgba_row_avx2(const uint32_t * indices, const unsigned int nr,
+                  const int32_t shift, const int32_t offset,
+                  const uint8_t * colors, const unsigned int nrcolors,
+                  uint8_t * rgba)
+{
+  const __m128i shiftcount = _mm_cvtsi32_si128(shift);
+  const __m256i offsets = _mm256_set1_epi32(offset);
+  const __m256i alphamask = _mm256_set1_epi32((int)0xff000000);
+  __m256i alpha = _mm256_setzero_si256();
+
+  unsigned int i = 0;
+  for (; (i + 8) <= nr; i += 8) {
+    __m256i idx = _mm256_loadu_si256((const __m256i *)&indices[i]);
+    idx = _mm256_add_epi32(_mm256_sll_epi32(idx, shiftcount), offsets);
+#ifndef NDEBUG
+    // The gather does no bounds checking of its own.
+    uint32_t checkidx[8];
+    _mm256_storeu_si256((__m256i *)checkidx, idx);
+    for (unsigned int j = 0; j < 8; j++) { assert(checkidx[j] < nrcolors); }
+#endif // !NDEBUG
+    const __m256i texels = _mm256_i32gather_epi32((const int *)colors, idx, 4);
+    _mm256_storeu_si256((__m256i *)&rgba[i * 4], texels);
+    alpha = _mm256_or_si256(alpha, _mm256_and_si256(texels, alphamask));
+  }
+
+  const SbBool visible = _mm256_testz_si256(alpha, alpha) ? FALSE : TRUE;
+  if (i == nr) { return visible; }
+  const SbBool rest = cvr_rgba_row_scalar(&indices[i], nr - i, shift, offset,
+                                          colors, nrcolors, &rgba[i * 4]);
+  return visible || rest;
+}
+
+#endif // CVR_HAVE_SIMD_LOOKUP
+
+// *************************************************************************
+
+// Returns the given version of the row lookup, or NULL if it was not
+// built in or is not supported by the CPU.
+CvrRGBALookup::RowFunc *
+CvrRGBALookup::getRowFunc(Implementation impl)
+{
+  switch (impl) {
+  case SCALAR: return cvr_rgba_row_scalar;
+#ifdef CVR_HAVE_SIMD_LOOKUP
+  case SSE41:
+    return __builtin_cpu_supports("sse4.1") ? cvr_rgba_row_sse41 : NULL;
+  case AVX2:
+    return __builtin_cpu_supports("avx2") ? cvr_rgba_row_avx2 : NULL;
+#endif // CVR_HAVE_SIMD_LOOKUP
+  default: break;
+  }
+  return NULL;
+}
+
+const char *
+CvrRGBALookup::getName(Implementation impl)
+{
+  switch (impl) {
+  case SCALAR: return "scalar code";
+  case SSE41: return "SSE4.1";
+  case AVX2: return "AVX2";
+  default: assert(FALSE); break;
+  }
+  return NULL;
+}
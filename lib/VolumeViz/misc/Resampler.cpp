@@ -0,0 +1,565 @@
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+#include <VolumeViz/misc/CvrResampler.h>
+
+#include <assert.h>
+#include <math.h>
+#include <string.h> // memcpy()
+
+#include <Inventor/SbBox3i32.h>
+#include <Inventor/errors/SoDebugError.h>
+
+#include <VolumeViz/misc/CvrParallel.h>
+#include <VolumeViz/misc/CvrUtil.h>
+#include <VolumeViz/misc/CvrVoxelStore.h>
+
+// *************************************************************************
+
+struct cvr_resample_job {
+  CvrVoxelStore * source;
+  SoVolumeData::SubMethod method;
+  SoVolumeData::DataType type;
+  unsigned int bpv;
+  SbVec3i32 srcdims, dstdims;
+  // For each voxel of the result along each axis, the first source
+  // voxel it covers, and the number of source voxels it covers.
+  int * start[3];
+  int * count[3];
+  int rowspertile, tilesperslice;
+  uint8_t * output;
+};
+
+// Sets up which source voxels each of the "dstlen" voxels of the
+// result along an axis covers. The source voxels are split evenly
+// between them, and NEAREST picks the first of each.
+static void
+cvr_resample_windows(const int srclen, const int dstlen,
+                     const SoVolumeData::SubMethod method,
+                     int * start, int * count)
+{
+  assert(dstlen > 0 && dstlen <= srclen);
+  for (int i = 0; i < dstlen; i++) {
+    const int s0 = (int)(((size_t)i * srclen) / dstlen);
+    const int s1 = (int)(((size_t)(i + 1) * srclen) / dstlen);
+    start[i] = s0;
+    count[i] = (method == SoVolumeData::NEAREST) ? 1 : (s1 - s0);
+  }
+}
+
+// Converts a row of "n" voxels to doubles. The switch is kept out of
+// the inner loops, so the compiler can vectorize them.
+static void
+cvr_resample_convert(const uint8_t * row, const SoVolumeData::DataType type,
+                     const int n, double * line)
+{
+  switch (type) {
+  case SoVolumeData::UNSIGNED_BYTE:
+    for (int x = 0; x < n; x++) { line[x] = row[x]; }
+    break;
+  case SoVolumeData::UNSIGNED_SHORT:
+    {
+      const uint16_t * r = (const uint16_t *)row;
+      for (int x = 0; x < n; x++) { line[x] = r[x]; }
+    }
+    break;
+  case SoVolumeData::SIGNED_SHORT:
+    {
+      const int16_t * r = (const int16_t *)row;
+      for (int x = 0; x < n; x++) { line[x] = r[x]; }
+    }
+    break;
+  case SoVolumeData::FLOAT:
+    {
+      const float * r = (const float *)row;
+      for (int x = 0; x < n; x++) { line[x] = r[x]; }
+    }
+    break;
+  default: assert(FALSE); break;
+  }
+}
+
+// Combines a converted row into the line buffer, as either the sum or
+// the maximum of the rows.
+static void
+cvr_resample_combine(const double * line, const int n,
+                     const SoVolumeData::SubMethod method, double * acc)
+{
+  if (method == SoVolumeData::MAX) {
+    for (int x = 0; x < n; x++) { if (line[x] > acc[x]) { acc[x] = line[x]; } }
+  }
+  else {
+    for (int x = 0; x < n; x++) { acc[x] += line[x]; }
+  }
+}
+
+// Stores a resampled value as voxel number "idx" of "output". Averages
+// of integer types are rounded to the nearest integer.
+static void
+cvr_resample_store(const double v, const SoVolumeData::DataType type,
+                   uint8_t * output, const size_t idx)
+{
+  switch (type) {
+  case SoVolumeData::UNSIGNED_BYTE:
+    output[idx] = (uint8_t)floor(v + 0.5);
+    break;
+  case SoVolumeData::UNSIGNED_SHORT:
+    ((uint16_t *)output)[idx] = (uint16_t)floor(v + 0.5);
+    break;
+  case SoVolumeData::SIGNED_SHORT:
+    ((int16_t *)output)[idx] = (int16_t)floor(v + 0.5);
+    break;
+  case SoVolumeData::FLOAT:
+    ((float *)output)[idx] = (float)v;
+    break;
+  default: assert(FALSE); break;
+  }
+}
+
+// Resamples one tile of the result, which is a range of rows within
+// a slice. Called from CvrParallel::run(), and only writes to the
+// rows of its own tile.
+static void
+cvr_resample_tile(void * closure, unsigned int jobidx)
+{
+  cvr_resample_job * job = (cvr_resample_job *)closure;
+  const SbVec3i32 & src = job->srcdims;
+  const SbVec3i32 & dst = job->dstdims;
+  const size_t bpv = job->bpv;
+
+  const int k = jobidx / job->tilesperslice;
+  const int j0 = (jobidx % job->tilesperslice) * job->rowspertile;
+  const int j1 = SbMin(j0 + job->rowspertile, (int)dst[1]);
+
+  // The part of the source covered by the tile. Voxels resident in
+  // memory are read in place, with the strides of the volume they are
+  // resident in, and otherwise copied out of the store.
+  const int z0 = job->start[2][k];
+  const int nz = job->count[2][k];
+  const int y0 = job->start[1][j0];
+  const int y1 = job->start[1][j1 - 1] + job->count[1][j1 - 1];
+  const size_t rowbytes = src[0] * bpv;
+
+  const uint8_t * voxels = job->source->getResidentVoxels();
+  uint8_t * buffer = NULL;
+  size_t rowstride, slicerows;
+  int firstrow;
+  if (voxels) {
+    const SbVec3i32 & rdims = job->source->getResidentDimensions();
+    rowstride = rdims[0] * bpv;
+    slicerows = rdims[1];
+    voxels += (size_t)z0 * slicerows * rowstride;
+    firstrow = 0;
+  }
+  else {
+    buffer = new uint8_t[(size_t)nz * (y1 - y0) * rowbytes];
+    job->source->copyRegion(SbBox3i32(0, y0, z0, src[0], y1, z0 + nz), buffer);
+    voxels = buffer;
+    rowstride = rowbytes;
+    slicerows = y1 - y0;
+    firstrow = y0;
+  }
+
+  double * line = NULL;
+  double * acc = NULL;
+  if (job->method != SoVolumeData::NEAREST) {
+    line = new double[src[0]];
+    acc = new double[src[0]];
+  }
+
+  for (int j = j0; j < j1; j++) {
+    const size_t outidx = ((size_t)k * dst[1] + j) * dst[0];
+    const int ys = job->start[1][j];
+
+    if (job->method == SoVolumeData::NEAREST) {
+      const uint8_t * row = voxels + (size_t)(ys - firstrow) * rowstride;
+      uint8_t * out = job->output + outidx * bpv;
+      for (int i = 0; i < dst[0]; i++) {
+        (void)memcpy(out + i * bpv, row + job->start[0][i] * bpv, bpv);
+      }
+      continue;
+    }
+
+    // Reduce along Z and Y, by combining all source rows covered by
+    // the output row into the line buffer..
+    const int ny = job->count[1][j];
+    for (int z = 0; z < nz; z++) {
+      for (int y = 0; y < ny; y++) {
+        const uint8_t * row =
+          voxels + ((size_t)z * slicerows + (ys + y - firstrow)) * rowstride;
+        if ((z == 0) && (y == 0)) {
+          cvr_resample_convert(row, job->type, src[0], acc);
+        }
+        else {
+          cvr_resample_convert(row, job->type, src[0], line);
+          cvr_resample_combine(line, src[0], job->method, acc);
+        }
+      }
+    }
+
+    // ..and then along X.
+    for (int i = 0; i < dst[0]; i++) {
+      const int xs = job->start[0][i];
+      const int nx = job->count[0][i];
+      double v = acc[xs];
+      if (job->method == SoVolumeData::MAX) {
+        for (int x = 1; x < nx; x++) { v = SbMax(v, acc[xs + x]); }
+      }
+      else {
+        for (int x = 1; x < nx; x++) { v += acc[xs + x]; }
+        v /= (double)nx * ny * nz;
+      }
+      cvr_resample_store(v, job->type, job->output, outidx + i);
+    }
+  }
+
+  delete[] line;
+  delete[] acc;
+  delete[] buffer;
+}
+
+// *************************************************************************
+
+// Resamples the voxels of "source" down to "dimensions", which must
+// not be larger than the source along any axis, and writes them to
+// "output" in the data type of the source.
+void
+CvrResampler::downSample(CvrVoxelStore * source, const SbVec3i32 & dimensions,
+                         SoVolumeData::SubMethod method, void * output)
+{
+  const SbVec3i32 & srcdims = source->getDimensions();
+
+  if (CvrUtil::doDebugging()) {
+    SoDebugError::postInfo("CvrResampler::downSample",
+                           "resampling <%d, %d, %d> to <%d, %d, %d> (method %d)",
+                           srcdims[0], srcdims[1], srcdims[2],
+                           dimensions[0], dimensions[1], dimensions[2],
+                           (int)method);
+  }
+
+  cvr_resample_job job;
+  job.source = source;
+  job.method = method;
+  job.type = source->getDataType();
+  job.bpv = source->getBytesPrVoxel();
+  job.srcdims = srcdims;
+  job.dstdims = dimensions;
+  job.output = (uint8_t *)output;
+
+  for (unsigned int i = 0; i < 3; i++) {
+    job.start[i] = new int[dimensions[i]];
+    job.count[i] = new int[dimensions[i]];
+    cvr_resample_windows(srcdims[i], dimensions[i], method,
+                         job.start[i], job.count[i]);
+  }
+
+  // Split the slices into tiles of rows, so there are enough jobs to
+  // keep all threads busy also when there are few slices.
+  const int nrthreads = (int)CvrParallel::getNrOfThreads();
+  const int wanted = (4 * nrthreads + dimensions[2] - 1) / dimensions[2];
+  const int tiles = SbMax(1, SbMin(wanted, (int)dimensions[1]));
+  job.rowspertile = (dimensions[1] + tiles - 1) / tiles;
+  job.tilesperslice = (dimensions[1] + job.rowspertile - 1) / job.rowspertile;
+
+  CvrParallel::run(dimensions[2] * job.tilesperslice, cvr_resample_tile, &job);
+
+  for (unsigned int i = 0; i < 3; i++) {
+    delete[] job.start[i];
+    delete[] job.count[i];
+  }
+}
+
+// *************************************************************************
+
+// Interpolation taps along one axis of an oversampled region. For
+// each voxel of the region, "nrtaps" source voxel indices and their
+// weights. The indices are relative to "srcfirst", as only the
+// "srclen" source voxels from there on are used by the region.
+struct cvr_oversample_axis {
+  int nrtaps;
+  int * index;
+  float * weight;
+  int srcfirst, srclen;
+};
+
+struct cvr_oversample_job {
+  SoVolumeData::DataType type;
+  unsigned int bpv;
+  cvr_oversample_axis axis[3];
+  SbVec3i32 outdims;
+  // The source voxels used by the region, and the same voxels
+  // interpolated along X and Y.
+  const uint8_t * source;
+  float * planes;
+  uint8_t * output;
+};
+
+// Sets up the taps for the "count" voxels from "first" on, along an
+// axis of "dstlen" voxels, resampled from "srclen" voxels. Voxel
+// centers are aligned, so both volumes cover the same space.
+static void
+cvr_oversample_taps(const int srclen, const int dstlen,
+                    const SoVolumeData::OverMethod method,
+                    const int first, const int count,
+                    cvr_oversample_axis & axis)
+{
+  switch (method) {
+  case SoVolumeData::LINEAR: axis.nrtaps = 2; break;
+  case SoVolumeData::CUBIC: axis.nrtaps = 4; break;
+  default: axis.nrtaps = 1; break;
+  }
+  axis.index = new int[count * axis.nrtaps];
+  axis.weight = new float[count * axis.nrtaps];
+
+  for (int i = 0; i < count; i++) {
+    const double u = ((first + i) + 0.5) * srclen / dstlen - 0.5;
+    int * idx = axis.index + i * axis.nrtaps;
+    float * w = axis.weight + i * axis.nrtaps;
+
+    if (axis.nrtaps == 1) {
+      idx[0] = (int)floor(u + 0.5);
+      w[0] = 1.0f;
+    }
+    else if (axis.nrtaps == 2) {
+      const int i0 = (int)floor(u);
+      const double f = u - i0;
+      idx[0] = i0;
+      idx[1] = i0 + 1;
+      w[0] = (float)(1.0 - f);
+      w[1] = (float)f;
+    }
+    else {
+      // Catmull-Rom spline, which passes through the source values.
+      const int i0 = (int)floor(u);
+      const double f = u - i0;
+      const double f2 = f * f;
+      const double f3 = f2 * f;
+      for (int t = 0; t < 4; t++) { idx[t] = i0 - 1 + t; }
+      w[0] = (float)(0.5 * (-f3 + 2.0 * f2 - f));
+      w[1] = (float)(0.5 * (3.0 * f3 - 5.0 * f2 + 2.0));
+      w[2] = (float)(0.5 * (-3.0 * f3 + 4.0 * f2 + f));
+      w[3] = (float)(0.5 * (f3 - f2));
+    }
+
+    // Taps outside the source repeat the border voxels.
+    for (int t = 0; t < axis.nrtaps; t++) {
+      idx[t] = SbMax(0, SbMin(idx[t], srclen - 1));
+    }
+  }
+
+  // The indices never decrease, so the first and last tap tell which
+  // part of the source is used.
+  const int nrindices = count * axis.nrtaps;
+  axis.srcfirst = axis.index[0];
+  axis.srclen = axis.index[nrindices - 1] - axis.srcfirst + 1;
+  for (int i = 0; i < nrindices; i++) { axis.index[i] -= axis.srcfirst; }
+}
+
+// Converts a row of "n" voxels to floats.
+static void
+cvr_oversample_convert(const uint8_t * row, const SoVolumeData::DataType type,
+                       const int n, float * line)
+{
+  switch (type) {
+  case SoVolumeData::UNSIGNED_BYTE:
+    for (int x = 0; x < n; x++) { line[x] = row[x]; }
+    break;
+  case SoVolumeData::UNSIGNED_SHORT:
+    {
+      const uint16_t * r = (const uint16_t *)row;
+      for (int x = 0; x < n; x++) { line[x] = r[x]; }
+    }
+    break;
+  case SoVolumeData::SIGNED_SHORT:
+    {
+      const int16_t * r = (const int16_t *)row;
+      for (int x = 0; x < n; x++) { line[x] = r[x]; }
+    }
+    break;
+  case SoVolumeData::FLOAT:
+    (void)memcpy(line, row, n * sizeof(float));
+    break;
+  default: assert(FALSE); break;
+  }
+}
+
+// Stores "n" interpolated values as voxels. The cubic kernel can
+// overshoot, so values of integer types are clamped to their range.
+static void
+cvr_oversample_store(const float * values, const size_t n,
+                     const SoVolumeData::DataType type, uint8_t * output)
+{
+  switch (type) {
+  case SoVolumeData::UNSIGNED_BYTE:
+    for (size_t i = 0; i < n; i++) {
+      output[i] = (uint8_t)(SbMax(0.0f, SbMin(values[i], 255.0f)) + 0.5f);
+    }
+    break;
+  case SoVolumeData::UNSIGNED_SHORT:
+    {
+      uint16_t * out = (uint16_t *)output;
+      for (size_t i = 0; i < n; i++) {
+        out[i] = (uint16_t)(SbMax(0.0f, SbMin(values[i], 65535.0f)) + 0.5f);
+      }
+    }
+    break;
+  case SoVolumeData::SIGNED_SHORT:
+    {
+      int16_t * out = (int16_t *)output;
+      for (size_t i = 0; i < n; i++) {
+        out[i] = (int16_t)floor(SbMax(-32768.0f, SbMin(values[i], 32767.0f)) + 0.5f);
+      }
+    }
+    break;
+  case SoVolumeData::FLOAT:
+    (void)memcpy(output, values, n * sizeof(float));
+    break;
+  default: assert(FALSE); break;
+  }
+}
+
+// Interpolates one source slice along X, and then along Y. Called
+// from CvrParallel::run(), and only writes to its own plane.
+static void
+cvr_oversample_xy(void * closure, unsigned int jobidx)
+{
+  cvr_oversample_job * job = (cvr_oversample_job *)closure;
+  const cvr_oversample_axis & ax = job->axis[0];
+  const cvr_oversample_axis & ay = job->axis[1];
+  const int ox = job->outdims[0];
+  const int oy = job->outdims[1];
+  const size_t rowbytes = (size_t)ax.srclen * job->bpv;
+
+  float * line = new float[ax.srclen];
+  float * rows = new float[(size_t)ay.srclen * ox];
+  const uint8_t * slice = job->source + (size_t)jobidx * ay.srclen * rowbytes;
+
+  for (int y = 0; y < ay.srclen; y++) {
+    cvr_oversample_convert(slice + y * rowbytes, job->type, ax.srclen, line);
+    float * r = rows + (size_t)y * ox;
+    for (int i = 0; i < ox; i++) {
+      const int * idx = ax.index + i * ax.nrtaps;
+      const float * w = ax.weight + i * ax.nrtaps;
+      float v = 0.0f;
+      for (int t = 0; t < ax.nrtaps; t++) { v += w[t] * line[idx[t]]; }
+      r[i] = v;
+    }
+  }
+
+  // Along Y, each output row is a weighted sum of whole rows, which
+  // the compiler can vectorize.
+  float * plane = job->planes + (size_t)jobidx * oy * ox;
+  for (int j = 0; j < oy; j++) {
+    float * out = plane + (size_t)j * ox;
+    for (int i = 0; i < ox; i++) { out[i] = 0.0f; }
+    for (int t = 0; t < ay.nrtaps; t++) {
+      const float w = ay.weight[j * ay.nrtaps + t];
+      const float * r = rows + (size_t)ay.index[j * ay.nrtaps + t] * ox;
+      for (int i = 0; i < ox; i++) { out[i] += w * r[i]; }
+    }
+  }
+
+  delete[] line;
+  delete[] rows;
+}
+
+// Interpolates one output slice along Z, from the planes made by
+// cvr_oversample_xy(), and stores it.
+static void
+cvr_oversample_z(void * closure, unsigned int jobidx)
+{
+  cvr_oversample_job * job = (cvr_oversample_job *)closure;
+  const cvr_oversample_axis & az = job->axis[2];
+  const size_t planelen = (size_t)job->outdims[0] * job->outdims[1];
+
+  float * values = new float[planelen];
+  for (size_t i = 0; i < planelen; i++) { values[i] = 0.0f; }
+  for (int t = 0; t < az.nrtaps; t++) {
+    const float w = az.weight[jobidx * az.nrtaps + t];
+    const float * plane = job->planes + az.index[jobidx * az.nrtaps + t] * planelen;
+    for (size_t i = 0; i < planelen; i++) { values[i] += w * plane[i]; }
+  }
+
+  cvr_oversample_store(values, planelen, job->type,
+                       job->output + jobidx * planelen * job->bpv);
+  delete[] values;
+}
+
+// Computes the voxels within "region" of the source resampled to
+// "dimensions", by interpolation with the given method, and writes
+// them to "output" in the data type of the source. CONSTANT (and
+// NONE) pick the nearest source voxel.
+//
+// Works for any dimensions, but is meant for oversampling, as it
+// only interpolates between the nearest source voxels.
+void
+CvrResampler::overSample(CvrVoxelStore * source, const SbVec3i32 & dimensions,
+                         SoVolumeData::OverMethod method,
+                         const SbBox3i32 & region, void * output)
+{
+  const SbVec3i32 & srcdims = source->getDimensions();
+  SbVec3i32 rmin, rmax;
+  region.getBounds(rmin, rmax);
+
+  cvr_oversample_job job;
+  job.type = source->getDataType();
+  job.bpv = source->getBytesPrVoxel();
+  job.outdims = rmax - rmin;
+  job.output = (uint8_t *)output;
+
+  SbVec3i32 srcmin, srcmax;
+  for (unsigned int i = 0; i < 3; i++) {
+    assert(rmin[i] >= 0 && rmin[i] < rmax[i] && rmax[i] <= dimensions[i]);
+    cvr_oversample_taps(srcdims[i], dimensions[i], method,
+                        rmin[i], job.outdims[i], job.axis[i]);
+    srcmin[i] = job.axis[i].srcfirst;
+    srcmax[i] = job.axis[i].srcfirst + job.axis[i].srclen;
+  }
+
+  // The source voxels are copied out on the calling thread, as it may
+  // already hold the lock of the voxel store's cache.
+  uint8_t * buffer = new uint8_t[(size_t)job.axis[0].srclen * job.axis[1].srclen *
+                                 job.axis[2].srclen * job.bpv];
+  source->copyRegion(SbBox3i32(srcmin, srcmax), buffer);
+  job.source = buffer;
+  job.planes = new float[(size_t)job.axis[2].srclen * job.outdims[1] * job.outdims[0]];
+
+  CvrParallel::run(job.axis[2].srclen, cvr_oversample_xy, &job);
+  CvrParallel::run(job.outdims[2], cvr_oversample_z, &job);
+
+  delete[] job.planes;
+  delete[] buffer;
+  for (unsigned int i = 0; i < 3; i++) {
+    delete[] job.axis[i].index;
+    delete[] job.axis[i].weight;
+  }
+}
@@ -0,0 +1,236 @@
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+#include <VolumeViz/misc/CvrSharedSource.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <Inventor/SbBox3f.h>
+#include <Inventor/SbVec3i32.h>
+#include <Inventor/errors/SoDebugError.h>
+#include <Inventor/nodes/SoNode.h>
+
+#include <VolumeViz/misc/CvrUtil.h>
+#include <VolumeViz/misc/CvrVoxelStore.h>
+#include <VolumeViz/nodes/SoVolumeData.h>
+#include <VolumeViz/readers/SoVRBrickFileReader.h>
+#include <VolumeViz/readers/SoVRVolFileReader.h>
+
+// *************************************************************************
+
+SbList<CvrSharedSource *> * CvrSharedSource::sources = NULL;
+
+// *************************************************************************
+
+// Returns the source for the given file, which must exist, and
+// registers "user" as one of the nodes using it. The file is read and
+// its voxel store set up if no other node uses it. Returns NULL if the
+// file can not be read.
+CvrSharedSource *
+CvrSharedSource::acquire(const char * filename, const SbBool compressed,
+                         SoVolumeData * user)
+{
+  SbString path;
+  int64_t mtime, size;
+  if (!CvrSharedSource::identify(filename, path, mtime, size)) { return NULL; }
+
+  if (CvrSharedSource::sources == NULL) {
+    CvrSharedSource::sources = new SbList<CvrSharedSource *>;
+  }
+
+  SbList<CvrSharedSource *> & sources = *CvrSharedSource::sources;
+  for (int i = 0; i < sources.getLength(); i++) {
+    CvrSharedSource * source = sources[i];
+    if ((source->path == path) && (source->mtime == mtime) &&
+        (source->size == size) && (source->compressed == compressed)) {
+      source->users.append(user);
+      return source;
+    }
+  }
+
+  CvrSharedSource * source = new CvrSharedSource(path, compressed);
+  if (source->store == NULL) {
+    delete source;
+    return NULL;
+  }
+  source->mtime = mtime;
+  source->size = size;
+  source->users.append(user);
+  sources.append(source);
+
+  if (CvrUtil::doDebugging()) {
+    SoDebugError::postInfo("CvrSharedSource::acquire",
+                           "reading '%s' (%d sources open)",
+                           path.getString(), sources.getLength());
+  }
+  return source;
+}
+
+// Unregisters a user. The source is destructed, with its reader and
+// voxel store, when the last user is gone.
+void
+CvrSharedSource::release(SoVolumeData * user)
+{
+  const int idx = this->users.find(user);
+  assert(idx != -1);
+  this->users.remove(idx);
+  if (this->users.getLength() > 0) { return; }
+
+  SbList<CvrSharedSource *> & sources = *CvrSharedSource::sources;
+  const int srcidx = sources.find(this);
+  assert(srcidx != -1);
+  sources.removeFast(srcidx);
+  delete this;
+}
+
+// Finds the canonical path of a file, to match the same file reached
+// through different search paths, relative paths or links.
+SbBool
+CvrSharedSource::identify(const char * filename, SbString & path,
+                          int64_t & mtime, int64_t & size)
+{
+  struct stat buf;
+  if (stat(filename, &buf) != 0) {
+    SoDebugError::post("CvrSharedSource::identify",
+                       "couldn't stat() '%s'", filename);
+    return FALSE;
+  }
+  mtime = (int64_t)buf.st_mtime;
+  size = (int64_t)buf.st_size;
+
+#ifdef _WIN32
+  char * canonical = _fullpath(NULL, filename, 0);
+#else // !_WIN32
+  char * canonical = realpath(filename, NULL);
+#endif // !_WIN32
+  path = canonical ? canonical : filename;
+  free(canonical);
+  return TRUE;
+}
+
+// *************************************************************************
+
+CvrSharedSource::CvrSharedSource(const SbString & path, const SbBool compressed)
+{
+  this->path = path;
+  this->compressed = compressed;
+  this->dataid = SoNode::getNextNodeId();
+
+  // Files in the bricked format are recognized by their magic
+  // number, anything else is assumed to be a VOL file.
+  SoVRBrickFileReader * brickreader = NULL;
+  if (SoVRBrickFileReader::isBrickFile(this->path.getString())) {
+    brickreader = new SoVRBrickFileReader;
+    this->reader = brickreader;
+  }
+  else {
+    this->reader = new SoVRVolFileReader;
+  }
+  this->reader->setUserData((void *)this->path.getString());
+  this->store = NULL;
+
+  // The readers have no error return from setUserData(). A VOL file
+  // reader which failed leaves m_data unset, and a brick file reader
+  // which failed has no levels. acquire() drops the source if no
+  // voxel store was set up.
+  const SbBool valid = brickreader ?
+    (brickreader->getNumLevels() > 0) : (this->reader->m_data != NULL);
+  if (!valid) {
+    SoDebugError::post("CvrSharedSource::CvrSharedSource",
+                       "couldn't read '%s'", this->path.getString());
+    return;
+  }
+
+  // If the reader has the complete voxel set in memory, the store
+  // will use it directly. If not, voxels will be fetched through the
+  // reader brick by brick, as they are needed.
+  SbBox3f dummyvolbox;
+  SoVolumeData::DataType datatype;
+  SbVec3i32 dimensions;
+  this->reader->getDataChar(dummyvolbox, datatype, dimensions);
+  if ((dimensions[0] <= 0) || (dimensions[1] <= 0) || (dimensions[2] <= 0)) {
+    SoDebugError::post("CvrSharedSource::CvrSharedSource",
+                       "'%s' has invalid dimensions %dx%dx%d",
+                       this->path.getString(), dimensions[0],
+                       dimensions[1], dimensions[2]);
+    return;
+  }
+
+  this->store = new CvrVoxelStore(this->reader, dimensions, datatype,
+                                  this->reader->m_data);
+  if (this->compressed) { this->store->compress(); }
+}
+
+CvrSharedSource::~CvrSharedSource()
+{
+  delete this->store;
+  delete this->reader;
+}
+
+// *************************************************************************
+
+SoVolumeReader *
+CvrSharedSource::getReader(void) const
+{
+  return this->reader;
+}
+
+CvrVoxelStore *
+CvrSharedSource::getVoxelStore(void) const
+{
+  return this->store;
+}
+
+const SbList<SoVolumeData *> &
+CvrSharedSource::getUsers(void) const
+{
+  return this->users;
+}
+
+// The id the users render the voxels by, see
+// CvrVoxelBlockElement::getNodeId().
+SbUniqueId
+CvrSharedSource::getDataId(void) const
+{
+  return this->dataid;
+}
+
+// To be called when the voxel store has been flushed, to make all
+// users rebuild their textures.
+void
+CvrSharedSource::renewDataId(void)
+{
+  this->dataid = SoNode::getNextNodeId();
+}
@@ -0,0 +1,250 @@
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+#include <VolumeViz/misc/CvrTimeSeries.h>
+
+#include <assert.h>
+
+#include <Inventor/errors/SoDebugError.h>
+#include <Inventor/threads/SbThread.h>
+
+#include <VolumeViz/misc/CvrVoxelStore.h>
+#include <VolumeViz/readers/SoVolumeReader.h>
+
+// *************************************************************************
+
+CvrTimeSeries::CvrTimeSeries(SoVolumeReader * reader,
+                             const SbVec3i32 & dimensions,
+                             SoVolumeData::DataType datatype)
+{
+  assert(reader);
+  this->reader = reader;
+  this->dimensions = dimensions;
+  this->datatype = datatype;
+  this->nrsteps = SbMax(reader->getNumTimeSteps(), 1);
+  this->stride = 1;
+  this->failedstep = -1;
+  this->quit = FALSE;
+
+  size_t bytesprvoxel = 1;
+  switch (datatype) {
+  case SoVolumeData::UNSIGNED_BYTE: bytesprvoxel = 1; break;
+  case SoVolumeData::UNSIGNED_SHORT: bytesprvoxel = 2; break;
+  case SoVolumeData::SIGNED_SHORT: bytesprvoxel = 2; break;
+  case SoVolumeData::FLOAT: bytesprvoxel = 4; break;
+  default: assert(FALSE && "unknown data type"); break;
+  }
+  const size_t nrbytes =
+    (size_t)dimensions[0] * dimensions[1] * dimensions[2] * bytesprvoxel;
+
+  // Both buffers are allocated up front, and then reused for every
+  // step decoded into them.
+  Buffer * buffers[2] = { &this->current, &this->next };
+  for (unsigned int i = 0; i < 2; i++) {
+    buffers[i]->step = -1;
+    buffers[i]->state = EMPTY;
+    buffers[i]->voxels = new uint8_t[nrbytes];
+    buffers[i]->store = NULL;
+  }
+
+  this->thread = SbThread::create(CvrTimeSeries::workerCB, this);
+}
+
+CvrTimeSeries::~CvrTimeSeries()
+{
+  this->mutex.lock();
+  this->quit = TRUE;
+  this->wakeup.wakeAll();
+  this->mutex.unlock();
+
+  (void)this->thread->join();
+  SbThread::destroy(this->thread);
+
+  Buffer * buffers[2] = { &this->current, &this->next };
+  for (unsigned int i = 0; i < 2; i++) {
+    delete buffers[i]->store;
+    delete[] buffers[i]->voxels;
+  }
+}
+
+// *************************************************************************
+
+int
+CvrTimeSeries::getNumTimeSteps(void) const
+{
+  return this->nrsteps;
+}
+
+// Returns the current step, or -1 if no step has been made current
+// yet.
+int
+CvrTimeSeries::getCurrentStep(void) const
+{
+  return this->current.step;
+}
+
+// Makes "step" current, and returns the voxel store holding it. Waits
+// for the step to be decoded unless it already has been decoded
+// ahead.
+//
+// The store returned before stays valid until the next call to
+// decodeAhead() or setCurrentStep(), so the caller must switch to the
+// new store before that. Returns NULL, and keeps the current step, if
+// the reader could not deliver "step". A step which failed is read
+// again the next time it is asked for, in case the failure was
+// temporary.
+CvrVoxelStore *
+CvrTimeSeries::setCurrentStep(int step)
+{
+  assert((step >= 0) && (step < this->nrsteps));
+  if ((this->current.step == step) && this->current.store) {
+    return this->current.store;
+  }
+
+  this->mutex.lock();
+  if ((this->next.step != step) || (this->next.state == FAILED)) {
+    // A step being decoded can not be interrupted, so that has to
+    // finish before the buffer can be given another step.
+    while (this->next.state == DECODING) {
+      (void)this->decoded.wait(this->mutex);
+    }
+    this->queue(this->next, step);
+  }
+  while ((this->next.state == QUEUED) || (this->next.state == DECODING)) {
+    (void)this->decoded.wait(this->mutex);
+  }
+
+  const SbBool ok = (this->next.state == READY);
+  if (ok) {
+    const int previous = this->current.step;
+    const Buffer swap = this->current;
+    this->current = this->next;
+    this->next = swap;
+
+    // Remember the stride of the playback, taking the shortest way
+    // around for sequences played in a loop.
+    if (previous != -1) {
+      int delta = step - previous;
+      if ((2 * delta) > this->nrsteps) { delta -= this->nrsteps; }
+      else if ((2 * delta) < -this->nrsteps) { delta += this->nrsteps; }
+      if (delta != 0) { this->stride = delta; }
+    }
+  }
+  this->mutex.unlock();
+
+  // Only reported once, as the step will be asked for again on every
+  // traversal.
+  if (!ok) {
+    if (step != this->failedstep) {
+      SoDebugError::post("CvrTimeSeries::setCurrentStep",
+                         "could not read time step %d", step);
+      this->failedstep = step;
+    }
+    return NULL;
+  }
+  if (step == this->failedstep) { this->failedstep = -1; }
+
+  if (this->current.store == NULL) {
+    this->current.store = new CvrVoxelStore(NULL, this->dimensions,
+                                            this->datatype,
+                                            this->current.voxels);
+  }
+  return this->current.store;
+}
+
+// Starts decoding the step following the current one, at the stride
+// of the playback, into the buffer not in use.
+void
+CvrTimeSeries::decodeAhead(void)
+{
+  if ((this->nrsteps < 2) || (this->current.step == -1)) { return; }
+
+  int step = (this->current.step + this->stride) % this->nrsteps;
+  if (step < 0) { step += this->nrsteps; }
+
+  this->mutex.lock();
+  if ((this->next.step != step) && (this->next.state != DECODING)) {
+    this->queue(this->next, step);
+  }
+  this->mutex.unlock();
+}
+
+// Hands "buffer" over to the worker thread for decoding "step". The
+// mutex must be held, and the buffer not be in the middle of being
+// decoded.
+void
+CvrTimeSeries::queue(Buffer & buffer, int step)
+{
+  assert(buffer.state != DECODING);
+  delete buffer.store;
+  buffer.store = NULL;
+  buffer.step = step;
+  buffer.state = QUEUED;
+  this->wakeup.wakeOne();
+}
+
+// *************************************************************************
+
+void *
+CvrTimeSeries::workerCB(void * closure)
+{
+  ((CvrTimeSeries *)closure)->work();
+  return NULL;
+}
+
+// Loop of the worker thread: decodes the step queued into the buffer
+// not in use. The buffers are not swapped while decoding, so the
+// voxel pointer stays with the step.
+void
+CvrTimeSeries::work(void)
+{
+  this->mutex.lock();
+  for (;;) {
+    while (!this->quit && (this->next.state != QUEUED)) {
+      (void)this->wakeup.wait(this->mutex);
+    }
+    if (this->quit) { break; }
+
+    const int step = this->next.step;
+    uint8_t * voxels = this->next.voxels;
+    this->next.state = DECODING;
+    this->mutex.unlock();
+    const SbBool ok = this->reader->getTimeStep(step, voxels);
+    this->mutex.lock();
+
+    this->next.state = ok ? READY : FAILED;
+    this->decoded.wakeAll();
+  }
+  this->mutex.unlock();
+}
+
+// *************************************************************************
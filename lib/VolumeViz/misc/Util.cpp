@@ -32,8 +32,12 @@
 
 #include <VolumeViz/misc/CvrUtil.h>
 
+#include <assert.h>
+#include <limits.h>
 #include <string.h>
 
+#include <Inventor/SbBox3i32.h>
+#include <Inventor/SbBox3s.h>
 #include <Inventor/SbRotation.h>
 #include <Inventor/SbLinear.h>
 #include <Inventor/C/tidbits.h>
@@ -132,6 +136,21 @@ CvrUtil::force2DTextureRendering(void)
   return (flag == 0) ? FALSE : TRUE;
 }
 
+// Shall the gradients of lit paletted 3D textures be stored as
+// octahedral-mapped normals in two texel components, instead of as
+// three range compressed vector components? Saves one component per
+// texel, at the cost of a few more fragment program instructions.
+SbBool
+CvrUtil::useCompactNormals(void)
+{
+  static int flag = -1;
+  if (flag == -1) {
+    const char * envstr = coin_getenv("CVR_COMPACT_NORMALS");
+    flag = envstr && (atoi(envstr) > 0);
+  }
+  return (flag == 0) ? FALSE : TRUE;
+}
+
 static uint32_t crc32_precalc_table[] = {
   0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
   0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
@@ -197,7 +216,7 @@ void
 CvrUtil::getTransformFromVolumeBoxDimensions(const CvrVoxelBlockElement * vd,
                                              SbMatrix & m)
 {
-  const SbVec3s & voxcubedims = vd->getVoxelCubeDimensions();
+  const SbVec3i32 & voxcubedims = vd->getVoxelCubeDimensions();
   const SbBox3f & localbox = vd->getUnitDimensionsBox();
 
   const SbVec3f
@@ -219,3 +238,50 @@ CvrUtil::getTransformFromVolumeBoxDimensions(const CvrVoxelBlockElement * vd,
 
   m.setTransform(localtrans, SbRotation::identity(), localspan);
 }
+
+// Conversions between the 32-bit vectors and boxes used for voxel
+// extents, and the 16-bit ones of the older SoVolumeReader and
+// SoVolumeData interfaces and of texture sizes, which are bounded by
+// the page size. Converting to 16 bits must only be done for values
+// which fitsShort() accepts.
+SbVec3i32
+CvrUtil::toVec3i32(const SbVec3s & v)
+{
+  return SbVec3i32(v[0], v[1], v[2]);
+}
+
+SbVec3s
+CvrUtil::toVec3s(const SbVec3i32 & v)
+{
+  for (unsigned int i = 0; i < 3; i++) {
+    assert((v[i] >= SHRT_MIN) && (v[i] <= SHRT_MAX));
+  }
+  return SbVec3s((short)v[0], (short)v[1], (short)v[2]);
+}
+
+SbBox3i32
+CvrUtil::toBox3i32(const SbBox3s & box)
+{
+  return SbBox3i32(CvrUtil::toVec3i32(box.getMin()), CvrUtil::toVec3i32(box.getMax()));
+}
+
+SbBox3s
+CvrUtil::toBox3s(const SbBox3i32 & box)
+{
+  return SbBox3s(CvrUtil::toVec3s(box.getMin()), CvrUtil::toVec3s(box.getMax()));
+}
+
+SbBool
+CvrUtil::fitsShort(const SbVec3i32 & v)
+{
+  for (unsigned int i = 0; i < 3; i++) {
+    if ((v[i] < SHRT_MIN) || (v[i] > SHRT_MAX)) { return FALSE; }
+  }
+  return TRUE;
+}
+
+SbBool
+CvrUtil::fitsShort(const SbBox3i32 & box)
+{
+  return CvrUtil::fitsShort(box.getMin()) && CvrUtil::fitsShort(box.getMax());
+}
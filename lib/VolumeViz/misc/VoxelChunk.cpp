@@ -32,6 +32,8 @@
 #include <VolumeViz/misc/CvrVoxelChunk.h>
 
 #include <cassert>
+#include <cmath> // fabs()
+#include <cstdlib> // atoi()
 #include <cstring> // memcpy()
 
 #include <Inventor/C/glue/gl.h>
@@ -39,18 +41,24 @@
 #include <Inventor/actions/SoGLRenderAction.h>
 #include <Inventor/errors/SoDebugError.h>
 #include <Inventor/misc/SoState.h>
+#include <Inventor/SbBox2i32.h>
+#include <Inventor/SbVec2s.h>
 #include <Inventor/SbVec3f.h>
+#include <Inventor/SbVec3s.h>
 
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif // HAVE_CONFIG_H
 
 #include <VolumeViz/elements/CvrPalettedTexturesElement.h>
+#include <VolumeViz/elements/CvrVoxelBlockElement.h>
 #include <VolumeViz/elements/SoTransferFunctionElement.h>
 #include <VolumeViz/elements/CvrLightingElement.h>
 #include <VolumeViz/misc/CvrCLUT.h>
 #include <VolumeViz/misc/CvrGIMPGradient.h>
+#include <VolumeViz/misc/CvrRGBALookup.h>
 #include <VolumeViz/misc/CvrUtil.h>
+#include <VolumeViz/misc/CvrVoxelStore.h>
 #include <VolumeViz/nodes/SoTransferFunction.h>
 #include <VolumeViz/nodes/gradients/BLUE_RED.h>
 #include <VolumeViz/nodes/gradients/GLOW.h>
@@ -61,6 +69,8 @@
 #include <VolumeViz/nodes/gradients/TEMPERATURE.h>
 #include <VolumeViz/render/common/Cvr2DPaletteTexture.h>
 #include <VolumeViz/render/common/Cvr2DRGBATexture.h>
+#include <VolumeViz/render/common/Cvr3DGradientTexture.h>
+#include <VolumeViz/render/common/Cvr3DPaletteGradientTexture.h>
 #include <VolumeViz/render/common/Cvr3DPaletteTexture.h>
 #include <VolumeViz/render/common/Cvr3DRGBATexture.h>
 #include <VolumeViz/render/common/CvrPaletteTexture.h>
@@ -76,6 +86,145 @@ SbDict * CvrVoxelChunk::CLUTdict = NULL;
 
 // *************************************************************************
 
+// The transfer of voxels to texels is done one row of voxels at a
+// time. The voxels of a row are first converted to indices, and then
+// written out by a loop specialized for the texture format, with all
+// tests of format and data type done once per row instead of once
+// per voxel.
+
+// Converts "nr" voxels, starting at voxel "first", to indices.
+static void
+cvr_index_row(const void * voxels, const size_t first, const unsigned int nr,
+              const SoVolumeData::DataType datatype,
+              const double mapoffset, const double mapscale,
+              uint32_t * indices)
+{
+  switch (datatype) {
+  case SoVolumeData::UNSIGNED_BYTE:
+    {
+      const uint8_t * input = (const uint8_t *)voxels + first;
+      for (unsigned int i = 0; i < nr; i++) { indices[i] = input[i]; }
+    }
+    break;
+  case SoVolumeData::UNSIGNED_SHORT:
+    {
+      const uint16_t * input = (const uint16_t *)voxels + first;
+      for (unsigned int i = 0; i < nr; i++) { indices[i] = input[i]; }
+    }
+    break;
+  default:
+    for (unsigned int i = 0; i < nr; i++) {
+      indices[i] = CvrVoxelStore::voxelToIndex(voxels, first + i, datatype,
+                                               mapoffset, mapscale);
+    }
+    break;
+  }
+}
+
+// Writes 8-bit palette indices, "stride" texel components apart.
+static void
+cvr_index8_row(const uint32_t * indices, const unsigned int nr,
+               const int32_t shift, const int32_t offset,
+               const unsigned int stride, uint8_t * output)
+{
+  for (unsigned int i = 0; i < nr; i++) {
+    output[i * stride] = (uint8_t)((indices[i] << shift) + offset);
+  }
+}
+
+// Writes 16-bit palette indices, "stride" texel components apart.
+static void
+cvr_index16_row(const uint32_t * indices, const unsigned int nr,
+                const int32_t shift, const int32_t offset,
+                const unsigned int stride, uint16_t * output)
+{
+  for (unsigned int i = 0; i < nr; i++) {
+    output[i * stride] = (uint16_t)((indices[i] << shift) + offset);
+  }
+}
+
+// Octahedral mapping of a range compressed gradient, for the compact
+// normals of lit paletted textures: the normal is projected onto the
+// octahedron |x| + |y| + |z| = 1, and the lower half is folded out
+// over the corners, so the direction is given by two coordinates.
+// These are returned in [0, 1]. The gradient program in CvrCLUT
+// does the inverse.
+static void
+cvr_octahedral_normal(const SbVec3f & rcgrad, float & u, float & v)
+{
+  const float x = rcgrad[0] / 127.5f - 1.0f;
+  const float y = rcgrad[1] / 127.5f - 1.0f;
+  const float z = rcgrad[2] / 127.5f - 1.0f;
+  const float l1 = (float)(fabs(x) + fabs(y) + fabs(z));
+  float ox = 0.0f, oy = 0.0f;
+  if (l1 > 0.0f) { ox = x / l1; oy = y / l1; }
+  if (z < 0.0f) {
+    const float fx = (1.0f - (float)fabs(oy)) * ((ox >= 0.0f) ? 1.0f : -1.0f);
+    const float fy = (1.0f - (float)fabs(ox)) * ((oy >= 0.0f) ? 1.0f : -1.0f);
+    ox = fx;
+    oy = fy;
+  }
+  u = ox * 0.5f + 0.5f;
+  v = oy * 0.5f + 0.5f;
+}
+
+// Set to 1 by the CVR_CHECK_TRANSFER environment variable, to check
+// the row lookups against the scalar version. For debugging.
+static int cvr_check_transfer = -1;
+static CvrRGBALookup::RowFunc * cvr_rgba_row_impl = NULL;
+static CvrRGBALookup::RowFunc * cvr_rgba_row_scalar = NULL;
+
+// Picks the fastest row lookup supported by the CPU. The
+// CVR_NO_SIMD environment variable forces the scalar version.
+static void
+cvr_init_transfer(void)
+{
+  if (cvr_rgba_row_impl) { return; }
+
+  const char * env = coin_getenv("CVR_CHECK_TRANSFER");
+  cvr_check_transfer = (env && (atoi(env) > 0)) ? 1 : 0;
+
+  env = coin_getenv("CVR_NO_SIMD");
+  const SbBool nosimd = env && (atoi(env) > 0);
+
+  cvr_rgba_row_scalar = CvrRGBALookup::getRowFunc(CvrRGBALookup::SCALAR);
+
+  CvrRGBALookup::Implementation impl = CvrRGBALookup::SCALAR;
+  if (!nosimd) {
+    if (CvrRGBALookup::getRowFunc(CvrRGBALookup::AVX2)) { impl = CvrRGBALookup::AVX2; }
+    else if (CvrRGBALookup::getRowFunc(CvrRGBALookup::SSE41)) { impl = CvrRGBALookup::SSE41; }
+  }
+  cvr_rgba_row_impl = CvrRGBALookup::getRowFunc(impl);
+
+  if (CvrUtil::doDebugging()) {
+    SoDebugError::postInfo("cvr_init_transfer", "RGBA lookups use %s",
+                           CvrRGBALookup::getName(impl));
+  }
+}
+
+static SbBool
+cvr_rgba_row(const uint32_t * indices, const unsigned int nr,
+             const int32_t shift, const int32_t offset,
+             const uint8_t * colors, const unsigned int nrcolors,
+             uint8_t * rgba)
+{
+  const SbBool visible =
+    cvr_rgba_row_impl(indices, nr, shift, offset, colors, nrcolors, rgba);
+
+  if (cvr_check_transfer && (cvr_rgba_row_impl != cvr_rgba_row_scalar)) {
+    uint8_t * check = new uint8_t[nr * 4];
+    const SbBool checkvisible =
+      cvr_rgba_row_scalar(indices, nr, shift, offset, colors, nrcolors, check);
+    if ((memcmp(check, rgba, nr * 4) != 0) || (checkvisible != visible)) {
+      SoDebugError::post("cvr_rgba_row", "RGBA lookup differs from scalar code");
+    }
+    delete[] check;
+  }
+  return visible;
+}
+
+// *************************************************************************
+
 // Allocates an uninitialized buffer for storing enough voxel data to
 // fit into the given dimensions with space per voxel allocated
 // according to the second argument.
@@ -84,13 +233,13 @@ SbDict * CvrVoxelChunk::CLUTdict = NULL;
 // but rather just use that pointer. It is then the caller's
 // responsibility to a) not destruct that buffer before this instance
 // is destructed, and b) to deallocate the buffer data.
-CvrVoxelChunk::CvrVoxelChunk(const SbVec3s & dimensions, unsigned int size,
+CvrVoxelChunk::CvrVoxelChunk(const SbVec3i32 & dimensions, unsigned int size,
                              const void * buffer)
 {
   assert(dimensions[0] > 0);
   assert(dimensions[1] > 0);
   assert(dimensions[2] > 0);
-  assert(size == 1 || size == 2);
+  assert(size == 1 || size == 2 || size == 4);
 
   this->dimensions = dimensions;
   this->unitsize = size;
@@ -103,6 +252,8 @@ CvrVoxelChunk::CvrVoxelChunk(const SbVec3s & dimensions, unsigned int size,
     this->voxelbuffer = buffer;
     this->destructbuffer = FALSE;
   }
+
+  this->gradients = NULL;
 }
 
 
@@ -113,11 +264,11 @@ CvrVoxelChunk::~CvrVoxelChunk()
 
 
 // Number of bytes in buffer.
-unsigned int
+size_t
 CvrVoxelChunk::bufferSize(void) const
 {
   return
-    this->dimensions[0] * this->dimensions[1] * this->dimensions[2] *
+    (size_t)this->dimensions[0] * this->dimensions[1] * this->dimensions[2] *
     this->unitsize;
 }
 
@@ -152,7 +303,7 @@ CvrVoxelChunk::getBuffer16(void) const
 }
 
 
-const SbVec3s &
+const SbVec3i32 &
 CvrVoxelChunk::getDimensions(void) const
 {
   return this->dimensions;
@@ -165,11 +316,28 @@ CvrVoxelChunk::getUnitSize(void) const
   return this->unitsize;
 }
 
+// Makes lit transfers use gradients precomputed for the volume the
+// chunk was cut from, by CvrVoxelStore::buildGradients(), instead of
+// finding them from the voxels of the chunk alone. "gradients" points
+// to those of the first voxel of the chunk, within a gradient volume
+// of dimensions "volumedims".
+void
+CvrVoxelChunk::setGradients(const uint8_t * gradients, const SbVec3i32 & volumedims)
+{
+  this->gradients = gradients;
+  this->gradientdims = volumedims;
+}
+
 
-// Converts the transferfunction's colormap into a CvrCLUT object.
+// Converts the transferfunction's colormap into a CvrCLUT object,
+// covering all lookup indices of the given size.
 CvrCLUT *
-CvrVoxelChunk::makeCLUT(const SoTransferFunctionElement * tfelement, CvrCLUT::AlphaUse alphause)
+CvrVoxelChunk::makeCLUT(const SoTransferFunctionElement * tfelement, CvrCLUT::AlphaUse alphause,
+                        const unsigned int indexsize)
 {
+  assert(indexsize == 1 || indexsize == 2);
+  const unsigned int nrindices = 1 << (8 * indexsize);
+
   static SbBool init_predefs = TRUE;
   if (init_predefs) {
     init_predefs = FALSE;
@@ -189,7 +357,7 @@ CvrVoxelChunk::makeCLUT(const SoTransferFunctionElement * tfelement, CvrCLUT::Al
   if (predefmapidx != SoTransferFunction::NONE) {
     uint8_t * predefmap = &(CvrVoxelChunk::PREDEFGRADIENTS[predefmapidx][0][0]);
     nrcols = COLOR_TABLE_PREDEF_SIZE;
-    clut = new CvrCLUT(nrcols, predefmap, alphause);
+    clut = new CvrCLUT(nrcols, predefmap, alphause, nrindices);
   }
   else {
     const float * colormap = transferfunc->colorMap.getValues(0);
@@ -206,7 +374,7 @@ CvrVoxelChunk::makeCLUT(const SoTransferFunctionElement * tfelement, CvrCLUT::Al
     nrcols = transferfunc->colorMap.getNum() / nrcomponents;
     assert((transferfunc->colorMap.getNum() % nrcomponents) == 0);
 
-    clut = new CvrCLUT(nrcols, nrcomponents, colormap, alphause);
+    clut = new CvrCLUT(nrcols, nrcomponents, colormap, alphause, nrindices);
   }
 
   uint32_t transparencythresholds[2];
@@ -218,10 +386,35 @@ CvrVoxelChunk::makeCLUT(const SoTransferFunctionElement * tfelement, CvrCLUT::Al
 }
 
 
-// Fetch a CLUT that represents the current
-// SoTransferFunction. Facilitates sharing of palettes.
+// Converts the data window of the transfer function to lookup
+// indices for the voxels of the given store. Returns FALSE if there
+// is no window set.
+SbBool
+CvrVoxelChunk::getIndexWindow(const SoTransferFunctionElement * tfelement,
+                              CvrVoxelStore * store, double & low, double & high)
+{
+  float wlow, whigh;
+  if (!tfelement->getDataWindow(wlow, whigh)) { return FALSE; }
+
+  double offset, scale;
+  store->getIndexMapping(offset, scale);
+  if (scale == 0.0) { return FALSE; } // all voxels have the same value
+
+  // Voxels are mapped to indices by rounding, and then shifted in the
+  // same way as done in transfer2D() and transfer3D().
+  const SoTransferFunction * transferfunc = tfelement->getTransferFunction();
+  const double shiftmul = (double)(1 << transferfunc->shift.getValue());
+  const double offsetval = transferfunc->offset.getValue();
+  low = ((wlow - offset) * scale + 0.5) * shiftmul + offsetval;
+  high = ((whigh - offset) * scale + 0.5) * shiftmul + offsetval;
+  return low < high;
+}
+
+// Fetch a CLUT that represents the current SoTransferFunction, for
+// the voxels of the given store. Facilitates sharing of palettes.
 CvrCLUT *
-CvrVoxelChunk::getCLUT(const SoTransferFunctionElement * tfelement, CvrCLUT::AlphaUse alphause)
+CvrVoxelChunk::getCLUT(const SoTransferFunctionElement * tfelement, CvrCLUT::AlphaUse alphause,
+                       CvrVoxelStore * store)
 {
   if (!CvrVoxelChunk::CLUTdict) {
     // FIXME: dealloc at exit
@@ -231,54 +424,210 @@ CvrVoxelChunk::getCLUT(const SoTransferFunctionElement * tfelement, CvrCLUT::Alp
   SoTransferFunction * transferfunc = tfelement->getTransferFunction();
   assert(transferfunc != NULL);
 
+  // The same transfer function can be used for volumes of different
+  // voxel sizes, which need lookup tables of different sizes.
+  const unsigned int indexsize = store->getIndexSize();
+  const unsigned long clutkey = (indexsize << 8) | alphause;
+
+  double window[2] = { 0.0, (double)(1 << (8 * indexsize)) };
+  (void)CvrVoxelChunk::getIndexWindow(tfelement, store, window[0], window[1]);
+
   void * clutptr;
-  CvrCLUT * clut;
+  CvrCLUT * clut = NULL;
   void * alphauseptr;
   SbDict * alphadict;
   if (CvrVoxelChunk::CLUTdict->find(transferfunc->getNodeId(), alphauseptr)) {
     alphadict = (SbDict *) alphauseptr;
-    if (alphadict->find(alphause, clutptr)) {
+    double clutwindow[2] = { 0.0, 0.0 };
+    if (alphadict->find(clutkey, clutptr)) {
       clut = (CvrCLUT *) clutptr;
-    } else {
-      clut = CvrVoxelChunk::makeCLUT(tfelement, alphause);
+      clut->getWindow(clutwindow[0], clutwindow[1]);
+    }
+
+    // A new lookup table is also needed when the window in index space
+    // differs, which happens when the same transfer function is used
+    // for FLOAT volumes with different value ranges.
+    if ((clut == NULL) ||
+        (clutwindow[0] != window[0]) || (clutwindow[1] != window[1])) {
+      if (clut) { clut->unref(); }
+      clut = CvrVoxelChunk::makeCLUT(tfelement, alphause, indexsize);
+      clut->setWindow(window[0], window[1]);
       // FIXME: ref(), or else we'd get dangling pointers to destructed
       // CvrCLUT entries in the dict. Should provide a "destructing now"
       // callback on the CvrCLUT class to clean up the design, as this
       // is a resource leak as it now stands.
       clut->ref();
-      alphadict->enter(alphause, clut);
+      alphadict->enter(clutkey, clut);
     }
   }
   else {
     alphadict = new SbDict;
     SbBool r = CvrVoxelChunk::CLUTdict->enter(transferfunc->getNodeId(), alphadict);
     assert(r == TRUE && "clut should not exist on nodeid");
-    return CvrVoxelChunk::getCLUT(tfelement, alphause);
+    return CvrVoxelChunk::getCLUT(tfelement, alphause, store);
   }
 
   return clut;
 }
 
 
+// Reads the parts of the traversal state the transfer depends on.
+// Must be called from the thread doing the traversal.
+void
+CvrVoxelChunk::getTransferInfo(const SoGLRenderAction * action, TransferInfo & info)
+{
+  SoState * state = action->getState();
+  const SoTransferFunctionElement * tfelement = SoTransferFunctionElement::getInstance(state);
+  assert(tfelement != NULL);
+  const SoTransferFunction * transferfunc = tfelement->getTransferFunction();
+  assert(transferfunc != NULL);
+  info.shift = transferfunc->shift.getValue();
+  info.offset = transferfunc->offset.getValue();
+
+  // 16-bit voxels are kept at full precision: they are either
+  // written as 16-bit indices to the texture, or looked up in a CLUT
+  // covering all 65536 values. This happens in the same pass as the
+  // copy into the texture buffer, so there is no separate conversion
+  // pass over the voxels.
+  //
+  // SIGNED_SHORT and FLOAT voxels are mapped to 16-bit indices in the
+  // same pass, by the mapping of the complete volume (not just of
+  // this chunk, as that would give seams between textures). Any data
+  // window is applied in the CLUT, not here.
+  const CvrVoxelBlockElement * vbelem = CvrVoxelBlockElement::getInstance(state);
+  assert(vbelem != NULL);
+  CvrVoxelStore * store = vbelem->getVoxelStore();
+  info.datatype = store->getDataType();
+  info.bytesprvoxel = store->getBytesPrVoxel();
+  info.indexsize = store->getIndexSize();
+  store->getIndexMapping(info.mapoffset, info.mapscale);
+
+  const CvrLightingElement * lightelem = CvrLightingElement::getInstance(state);
+  assert(lightelem != NULL);
+  // RGBA textures shaded at fragment time are made without the
+  // light, their gradients go in a separate texture.
+  info.lighting = lightelem->useLighting(state) && !CvrCLUT::useFragmentShading(action);
+  lightelem->get(state, info.lightdir, info.lightintensity);
+
+  cvr_init_transfer();
+}
+
+// Gets "texobj" ready for transfer() calls from any thread: hands it
+// the CLUT of paletted textures, and allocates its texel buffer.
+void
+CvrVoxelChunk::prepareTransfer(const CvrCLUT * clut, CvrTextureObject * texobj)
+{
+  if (texobj->getTypeId().isDerivedFrom(CvrPaletteTexture::getClassTypeId())) {
+    CvrPaletteTexture * palettetex = (CvrPaletteTexture *)texobj;
+    palettetex->setCLUT(clut);
+    (void)palettetex->getIndex8Buffer();
+  }
+  else {
+    (void)((CvrRGBATexture *)texobj)->getRGBABuffer();
+  }
+}
+
 void
 CvrVoxelChunk::transfer(const SoGLRenderAction * action, const CvrCLUT * clut,
                         CvrTextureObject * texobj, SbBool & invisible) const
 {
+  TransferInfo info;
+  CvrVoxelChunk::getTransferInfo(action, info);
+  // (Gradient textures have no CLUT.)
+  if (clut) { clut->ref(); }
+  CvrVoxelChunk::prepareTransfer(clut, texobj);
+  this->transfer(info, clut, texobj, 0, this->dimensions[2], invisible);
+  if (clut) { clut->unref(); }
+}
+
+// Transfers the slices [firstslice, endslice> of the chunk, so large
+// 3D chunks can be split over several threads. 2D chunks have only
+// the one slice. Only touches the part of the texel buffer of
+// "texobj" made from those slices, which prepareTransfer() must have
+// been called for.
+void
+CvrVoxelChunk::transfer(const TransferInfo & info, const CvrCLUT * clut,
+                        CvrTextureObject * texobj,
+                        const unsigned int firstslice, const unsigned int endslice,
+                        SbBool & invisible) const
+{
+  assert((firstslice < endslice) && (endslice <= (unsigned int)this->dimensions[2]));
   if ((texobj->getTypeId() == Cvr2DPaletteTexture::getClassTypeId()) ||
       (texobj->getTypeId() == Cvr2DRGBATexture::getClassTypeId())) {
-    this->transfer2D(action, clut, texobj, invisible);
+    this->transfer2D(info, clut, texobj, invisible);
+  }
+  else if (texobj->getTypeId() == Cvr3DGradientTexture::getClassTypeId()) {
+    this->transferGradients(info, texobj, firstslice, endslice);
+    invisible = FALSE;
   }
   else {
-    this->transfer3D(action, clut, texobj, invisible);
+    this->transfer3D(info, clut, texobj, firstslice, endslice, invisible);
+  }
+}
+
+// Fills in the gradients of a Cvr3DGradientTexture, range compressed
+// to the components of its RGB texels.
+void
+CvrVoxelChunk::transferGradients(const TransferInfo & info, CvrTextureObject * texobj,
+                                 const unsigned int firstslice,
+                                 const unsigned int endslice) const
+{
+  const SbVec3i32 & size = this->dimensions;
+  const SbVec3s & texsize = texobj->getDimensions();
+  uint8_t * output = (uint8_t *) ((CvrRGBATexture *)texobj)->getRGBABuffer();
+  const unsigned int nrcomponents = Cvr3DGradientTexture::getNrOfComponents();
+  assert(nrcomponents == 3);
+
+  const SbBool flipped = CvrUtil::useFlippedYAxis();
+  const size_t gradrowstride = (size_t)this->gradientdims[0] * 3;
+  const size_t gradslicestride = gradrowstride * this->gradientdims[1];
+  const uint8_t gradyflip = flipped ? 255 : 0;
+  CvrGradient * grad = NULL;
+  if (this->gradients == NULL) {
+    grad = new CvrCentralDifferenceGradient((const uint8_t *) this->getBuffer(),
+                                            info.datatype, size, flipped);
+  }
+
+  for (unsigned int z = firstslice; z < endslice; z++) {
+    for (unsigned int y = 0; y < (unsigned int)size[1]; y++) {
+      const unsigned int voxely = flipped ? ((size[1] - 1) - y) : y;
+      const size_t texelidx =
+        (z * ((size_t)texsize[0] * texsize[1])) + (y * (size_t)texsize[0]);
+      assert((texelidx + size[0]) <= ((size_t)texsize[0] * texsize[1] * texsize[2]));
+      uint8_t * row = &output[texelidx * nrcomponents];
+
+      if (this->gradients) {
+        const uint8_t * gradrow =
+          this->gradients + z * gradslicestride + voxely * gradrowstride;
+        for (unsigned int x = 0; x < (unsigned int)size[0]; x++) {
+          const uint8_t * g = &gradrow[x * 3];
+          row[x * 3 + 0] = g[0];
+          row[x * 3 + 1] = g[1] ^ gradyflip;
+          row[x * 3 + 2] = g[2];
+        }
+      }
+      else {
+        for (unsigned int x = 0; x < (unsigned int)size[0]; x++) {
+          SbVec3f voxgrad = grad->getGradientRangeCompressed(x, y, z);
+          row[x * 3 + 0] = (uint8_t) voxgrad[0];
+          row[x * 3 + 1] = (uint8_t) voxgrad[1];
+          row[x * 3 + 2] = (uint8_t) voxgrad[2];
+        }
+      }
+    }
   }
+
+  delete grad;
 }
 
 
 // FIXME: handegar duplicated this from transfer2D(). Should merge
 // back the common code again. Grmbl. 20040721 mortene.
 void
-CvrVoxelChunk::transfer3D(const SoGLRenderAction * action, const CvrCLUT * clut,
-                          CvrTextureObject * texobj, SbBool & invisible) const
+CvrVoxelChunk::transfer3D(const TransferInfo & info, const CvrCLUT * clut,
+                          CvrTextureObject * texobj,
+                          const unsigned int firstslice, const unsigned int endslice,
+                          SbBool & invisible) const
 {
   // FIXME: Only the CvrTextureManager should be allowed to create
   // texture objects. A small rearrangement should be done
@@ -293,13 +642,7 @@ CvrVoxelChunk::transfer3D(const SoGLRenderAction * action, const CvrCLUT * clut,
   // "opaqueness" area, to make it possible to optimize rendering by
   // occlusion culling. 20021201 mortene.
 
-  SoState * state = action->getState();
-  const SoTransferFunctionElement * tfelement = SoTransferFunctionElement::getInstance(state);
-  assert(tfelement != NULL);
-  const SoTransferFunction * transferfunc = tfelement->getTransferFunction();
-  assert(transferfunc != NULL);
-
-  const SbVec3s size(this->dimensions[0], this->dimensions[1], this->dimensions[2]);
+  const SbVec3i32 & size = this->dimensions;
 
   // FIXME: this is just a temporary fix for what seems like a really
   // weird and nasty NVidia driver bug; allocate enough textures of 1-
@@ -349,87 +692,169 @@ CvrVoxelChunk::transfer3D(const SoGLRenderAction * action, const CvrCLUT * clut,
 
   assert((rgbatex && !palettetex) || (!rgbatex && palettetex));
 
-  const int unitsize = this->getUnitSize();
-  clut->ref();
-
-  if (palettetex) { palettetex->setCLUT(clut); }
-
-  const int32_t shiftval = transferfunc->shift.getValue();
-  const int32_t offsetval = transferfunc->offset.getValue();
+  const int32_t shiftval = info.shift;
+  const int32_t offsetval = info.offset;
+  const SoVolumeData::DataType datatype = info.datatype;
+  const unsigned int indexsize = info.indexsize;
+  const double mapoffset = info.mapoffset;
+  const double mapscale = info.mapscale;
+
+  assert((this->getUnitSize() == info.bytesprvoxel) && "Unknown unit size!");
+  assert(!palettetex || (palettetex->getIndexSize() == indexsize));
+  assert(!palettetex || (palettetex->getCLUT() == clut));
+  assert(clut->getNrOfIndices() == (1u << (8 * indexsize)));
+
+  uint8_t * output = NULL;
+  uint16_t * output16 = NULL;
+  if (palettetex && (indexsize == 2)) output16 = palettetex->getIndex16Buffer();
+  else if (palettetex) output = palettetex->getIndex8Buffer();
+  else output = (uint8_t *) rgbatex->getRGBABuffer();
 
-  const void * inputbytebuffer;
-  if (unitsize == 1) { inputbytebuffer = this->getBuffer8(); }
-  else if (unitsize == 2) {
-    assert(palettetex && "16 bits textures must be palette textures!");
-    static SbBool flag = FALSE;
-    if (!flag) { // Print only once.
-      SoDebugError::postWarning("transfer3D", "16 bits pr voxel unit size is not "
-                                "properly implemented yet. Voxels will therefore be "
-                                "scaled down to 8 bits.");
-      flag = TRUE;
-    }
-    inputbytebuffer = this->getBuffer16();
+  const uint8_t * colors = clut->getRGBAColors();
+  const unsigned int nrcolors = clut->getNrOfIndices();
+  const SbBool flipped = CvrUtil::useFlippedYAxis();
+  uint32_t * indices = new uint32_t[size[0]];
+
+  const SbBool lighting = info.lighting;
+  const SbVec3f & lightDir = info.lightdir;
+  const float lightIntensity = info.lightintensity;
+
+  // Gradients are taken from those precomputed for the complete
+  // volume when available. They are range compressed to [0, 255],
+  // and in the voxel order, so the y component is mirrored along
+  // with the rows of flipped textures.
+  const size_t gradrowstride = (size_t)this->gradientdims[0] * 3;
+  const size_t gradslicestride = gradrowstride * this->gradientdims[1];
+  const uint8_t gradyflip = flipped ? 255 : 0;
+  CvrGradient * grad = NULL;
+  if (lighting && (this->gradients == NULL)) {
+    grad = new CvrCentralDifferenceGradient((const uint8_t *) this->getBuffer(),
+                                            datatype, size,
+                                            CvrUtil::useFlippedYAxis());
   }
-  else { assert(FALSE && "Unknown unit size!"); }
-
-  uint8_t * output;
-  if (palettetex) output = palettetex->getIndex8Buffer();
-  else output = (uint8_t *) rgbatex->getRGBABuffer();
 
-  const CvrLightingElement * lightelem = CvrLightingElement::getInstance(action->getState());
-  assert(lightelem != NULL);
-  const SbBool lighting = lightelem->useLighting(action->getState());
-  SbVec3f lightDir;
-  float lightIntensity;
-  lightelem->get(action->getState(), lightDir, lightIntensity);
-  CvrGradient * grad = new CvrCentralDifferenceGradient((uint8_t *) inputbytebuffer, size, 
-                                                        CvrUtil::useFlippedYAxis());
-
-  for (unsigned int z = 0; z < (unsigned int)  size[2]; z++) {
-    for (unsigned int y = 0; y < (unsigned int) size[1]; y++) {
-      for (unsigned int x = 0; x < (unsigned int) size[0]; x++) {
-
-        int voxelidx;
-        if (CvrUtil::useFlippedYAxis()) {
-          voxelidx = (z * (size[0]*size[1])) + (((size[1]-1) - y) * size[0]) + x;
+  // With lighting, palette textures get the gradient in the three
+  // other components of each texel (or in two, octahedral-mapped,
+  // with compact normals), and RGBA textures are shaded after the
+  // lookup.
+  const unsigned int stride = (palettetex && lighting) ?
+    Cvr3DPaletteGradientTexture::getNrOfComponents() : 1;
+  const SbBool compactnormals = (stride == 3);
+
+  for (unsigned int z = firstslice; z < endslice; z++) {
+    for (unsigned int y = 0; y < (unsigned int)size[1]; y++) {
+      const unsigned int voxely = flipped ? ((size[1] - 1) - y) : y;
+      const size_t voxelidx =
+        (z * ((size_t)size[0] * size[1])) + (voxely * (size_t)size[0]);
+      const size_t texelidx =
+        (z * ((size_t)texsize[0] * texsize[1])) + (y * (size_t)texsize[0]);
+      assert((voxelidx + size[0]) <= ((size_t)size[0] * size[1] * size[2]));
+      assert((texelidx + size[0]) <= ((size_t)texsize[0] * texsize[1] * texsize[2]));
+
+      cvr_index_row(this->voxelbuffer, voxelidx, size[0], datatype,
+                    mapoffset, mapscale, indices);
+      const uint8_t * gradrow = (lighting && this->gradients) ?
+        (this->gradients + z * gradslicestride + voxely * gradrowstride) : NULL;
+
+      if (output16) {
+        uint16_t * row = &output16[texelidx * stride];
+        cvr_index16_row(indices, size[0], shiftval, offsetval, stride, row);
+        if (lighting && gradrow && !compactnormals) {
+          for (unsigned int x = 0; x < (unsigned int)size[0]; x++) {
+            // Scale the range compressed gradient up to the full
+            // 16-bit range of the texture components.
+            const uint8_t * g = &gradrow[x * 3];
+            row[x * 4 + 1] = (uint16_t) (g[0] * 257);
+            row[x * 4 + 2] = (uint16_t) ((g[1] ^ gradyflip) * 257);
+            row[x * 4 + 3] = (uint16_t) (g[2] * 257);
+          }
+        }
+        else if (lighting) {
+          for (unsigned int x = 0; x < (unsigned int)size[0]; x++) {
+            SbVec3f voxgrad;
+            if (gradrow) {
+              const uint8_t * g = &gradrow[x * 3];
+              voxgrad.setValue(g[0], g[1] ^ gradyflip, g[2]);
+            }
+            else {
+              voxgrad = grad->getGradientRangeCompressed(x, y, z);
+            }
+            if (compactnormals) {
+              float u, v;
+              cvr_octahedral_normal(voxgrad, u, v);
+              row[x * 3 + 1] = (uint16_t) (u * 65535.0f + 0.5f);
+              row[x * 3 + 2] = (uint16_t) (v * 65535.0f + 0.5f);
+            }
+            else {
+              row[x * 4 + 1] = (uint16_t) (voxgrad[0] * 257.0f);
+              row[x * 4 + 2] = (uint16_t) (voxgrad[1] * 257.0f);
+              row[x * 4 + 3] = (uint16_t) (voxgrad[2] * 257.0f);
+            }
+          }
         }
-        else {
-          voxelidx = (z * (size[0]*size[1])) + (size[0]*y) + x;
+      }
+      else if (palettetex) {
+        uint8_t * row = &output[texelidx * stride];
+        cvr_index8_row(indices, size[0], shiftval, offsetval, stride, row);
+        if (lighting && gradrow && !compactnormals) {
+          for (unsigned int x = 0; x < (unsigned int)size[0]; x++) {
+            const uint8_t * g = &gradrow[x * 3];
+            row[x * 4 + 1] = g[0];
+            row[x * 4 + 2] = g[1] ^ gradyflip;
+            row[x * 4 + 3] = g[2];
+          }
         }
-
-        int texelidx = (z * (texsize[0] * texsize[1])) + (y * texsize[0]) + x;
-        assert(voxelidx <= (size[0] * size[1] * size[2]));
-        assert(texelidx <= (texsize[0] * texsize[1] * texsize[2]));
-
-        if (palettetex) {
-          if (lighting) texelidx *= 4;
-          uint8_t voldataidx;
-          if (unitsize == 1) voldataidx = ((uint8_t *) inputbytebuffer)[voxelidx];
-          else voldataidx = (((uint16_t *) inputbytebuffer)[voxelidx] >> 8); // Shift value to 8bit
-          output[texelidx] = (uint8_t) (voldataidx << shiftval) + offsetval;
-          if (lighting) {
-            SbVec3f voxgrad = grad->getGradientRangeCompressed(x, y, z);
-            output[texelidx+1] = (uint8_t) voxgrad[0];
-            output[texelidx+2] = (uint8_t) voxgrad[1];
-            output[texelidx+3] = (uint8_t) voxgrad[2];
+        else if (lighting) {
+          for (unsigned int x = 0; x < (unsigned int)size[0]; x++) {
+            SbVec3f voxgrad;
+            if (gradrow) {
+              const uint8_t * g = &gradrow[x * 3];
+              voxgrad.setValue(g[0], g[1] ^ gradyflip, g[2]);
+            }
+            else {
+              voxgrad = grad->getGradientRangeCompressed(x, y, z);
+            }
+            if (compactnormals) {
+              float u, v;
+              cvr_octahedral_normal(voxgrad, u, v);
+              row[x * 3 + 1] = (uint8_t) (u * 255.0f + 0.5f);
+              row[x * 3 + 2] = (uint8_t) (v * 255.0f + 0.5f);
+            }
+            else {
+              row[x * 4 + 1] = (uint8_t) voxgrad[0];
+              row[x * 4 + 2] = (uint8_t) voxgrad[1];
+              row[x * 4 + 3] = (uint8_t) voxgrad[2];
+            }
           }
         }
-        else {
-          const uint32_t voldataidx = ((uint8_t *) inputbytebuffer)[voxelidx];
-          const uint32_t colidx = (voldataidx << shiftval) + offsetval;
-          clut->lookupRGBA(colidx, &output[texelidx * 4]);
-          SbBool inv = output[texelidx * 4 + 3] == 0x00;
-          if (lighting && !inv) {
-            SbVec3f voxgrad = grad->getGradient(x, y, z);
+      }
+      else {
+        uint8_t * row = &output[texelidx * 4];
+        if (cvr_rgba_row(indices, size[0], shiftval, offsetval,
+                         colors, nrcolors, row)) {
+          invisible = FALSE;
+        }
+        if (lighting) {
+          for (unsigned int x = 0; x < (unsigned int)size[0]; x++) {
+            uint8_t * texel = &row[x * 4];
+            if (texel[3] == 0x00) { continue; }
+            SbVec3f voxgrad;
+            if (gradrow) {
+              const uint8_t * g = &gradrow[x * 3];
+              voxgrad.setValue(g[0] / 127.5f - 1.0f,
+                               (g[1] ^ gradyflip) / 127.5f - 1.0f,
+                               g[2] / 127.5f - 1.0f);
+            }
+            else {
+              voxgrad = grad->getGradient(x, y, z);
+            }
             float diffuseLight = SbMax(voxgrad.dot(lightDir), 0.0f);
             diffuseLight *= lightIntensity;
             for (int i=0; i < 3; i++) {
-              output[texelidx * 4 + i] = (uint8_t) (output[texelidx * 4 + i] * diffuseLight);
+              texel[i] = (uint8_t) (texel[i] * diffuseLight);
             }
           }
-          invisible = invisible && inv;
         }
-
       }
     }
   }
@@ -456,7 +881,8 @@ CvrVoxelChunk::transfer3D(const SoGLRenderAction * action, const CvrCLUT * clut,
   if (palettetex)
     invisible = FALSE;
 
-  clut->unref();
+  delete[] indices;
+  delete grad;
 }
 
 
@@ -467,7 +893,7 @@ CvrVoxelChunk::transfer3D(const SoGLRenderAction * action, const CvrCLUT * clut,
   at least one texel that's not fully transparent.
 */
 void
-CvrVoxelChunk::transfer2D(const SoGLRenderAction * action, const CvrCLUT * clut,
+CvrVoxelChunk::transfer2D(const TransferInfo & info, const CvrCLUT * clut,
                           CvrTextureObject * texobj, SbBool & invisible) const
 {
   // FIXME: about the "invisible" flag: this should really be an
@@ -479,13 +905,6 @@ CvrVoxelChunk::transfer2D(const SoGLRenderAction * action, const CvrCLUT * clut,
   // "opaqueness" area, to make it possible to optimize rendering by
   // occlusion culling. 20021201 mortene.
 
-
-  SoState * state = action->getState();
-  const SoTransferFunctionElement * tfelement = SoTransferFunctionElement::getInstance(state);
-  assert(tfelement != NULL);
-  const SoTransferFunction * transferfunc = tfelement->getTransferFunction();
-  assert(transferfunc != NULL);
-
   // FIXME: only handles 2D textures yet. 20021203 mortene.
   assert(this->getDimensions()[2] == 1);
 
@@ -506,54 +925,49 @@ CvrVoxelChunk::transfer2D(const SoGLRenderAction * action, const CvrCLUT * clut,
 
   assert((rgbatex && !palettetex) || (!rgbatex && palettetex));
 
-  const int unitsize = this->getUnitSize();
-  clut->ref();
-
-  if (palettetex) { palettetex->setCLUT(clut); }
-
-  const int32_t shiftval = transferfunc->shift.getValue();
-  const int32_t offsetval = transferfunc->offset.getValue();
-
-  const void * inputbytebuffer;
-  if (unitsize == 1) { inputbytebuffer = this->getBuffer8(); }
-  else if (unitsize == 2) {
-    assert(palettetex && "16 bits textures must be palette textures!");
-    static SbBool flag = FALSE;
-    if (!flag) { // Print only once
-      SoDebugError::postWarning("transfer2D", 
-                                "16 bits pr voxel unit size is not properly implemented "
-                                "yet. Voxels will therefore be scaled down to 8 bits.");
-      flag = TRUE;
-    }
-    inputbytebuffer = this->getBuffer16();
-  }
-  else { assert(FALSE && "Unknown unit size!"); }
-
-  uint8_t * output;
-  if (palettetex) output = palettetex->getIndex8Buffer();
+  const int32_t shiftval = info.shift;
+  const int32_t offsetval = info.offset;
+  const SoVolumeData::DataType datatype = info.datatype;
+  const unsigned int indexsize = info.indexsize;
+  const double mapoffset = info.mapoffset;
+  const double mapscale = info.mapscale;
+
+  assert((this->getUnitSize() == info.bytesprvoxel) && "Unknown unit size!");
+  assert(!palettetex || (palettetex->getIndexSize() == indexsize));
+  assert(!palettetex || (palettetex->getCLUT() == clut));
+  assert(clut->getNrOfIndices() == (1u << (8 * indexsize)));
+
+  uint8_t * output = NULL;
+  uint16_t * output16 = NULL;
+  if (palettetex && (indexsize == 2)) output16 = palettetex->getIndex16Buffer();
+  else if (palettetex) output = palettetex->getIndex8Buffer();
   else output = (uint8_t *) rgbatex->getRGBABuffer();
 
+  const uint8_t * colors = clut->getRGBAColors();
+  const unsigned int nrcolors = clut->getNrOfIndices();
+  uint32_t * indices = new uint32_t[size[0]];
+
   for (unsigned int y = 0; y < (unsigned int) size[1]; y++) {
-    for (unsigned int x = 0; x < (unsigned int) size[0]; x++) {
+    const size_t voxelidx = y * (size_t)size[0];
+    const size_t texelidx = y * (size_t)texsize[0];
 
-      const int voxelidx = y * size[0] + x;
-      const int texelidx = y * texsize[0] + x;
+    cvr_index_row(this->voxelbuffer, voxelidx, size[0], datatype,
+                  mapoffset, mapscale, indices);
 
-      if (palettetex) {
-        uint8_t voldataidx;
-        if (unitsize == 1) voldataidx = ((uint8_t *) inputbytebuffer)[voxelidx];
-        else voldataidx = (((uint16_t *) inputbytebuffer)[voxelidx] >> 8); // Shift value to 8bit
-        output[texelidx] = (uint8_t) (voldataidx << shiftval) + offsetval;
-      }
-      else {
-        const uint32_t voldataidx = ((uint8_t *) inputbytebuffer)[voxelidx];
-        const uint32_t colidx = (voldataidx << shiftval) + offsetval;
-        clut->lookupRGBA(colidx, &output[texelidx * 4]);
-        invisible = invisible && (output[texelidx * 4 + 3] == 0x00);
-      }
+    if (output16) {
+      cvr_index16_row(indices, size[0], shiftval, offsetval, 1, &output16[texelidx]);
+    }
+    else if (palettetex) {
+      cvr_index8_row(indices, size[0], shiftval, offsetval, 1, &output[texelidx]);
+    }
+    else if (cvr_rgba_row(indices, size[0], shiftval, offsetval,
+                          colors, nrcolors, &output[texelidx * 4])) {
+      invisible = FALSE;
     }
   }
 
+  delete[] indices;
+
   // FIXME: should set the ''invisible'' flag correctly to
   // optimize the amount of the available fill-rate of the gfx
   // card we're using.
@@ -574,8 +988,6 @@ CvrVoxelChunk::transfer2D(const SoGLRenderAction * action, const CvrCLUT * clut,
   // initially held as invisible.
   if (palettetex)
     invisible = FALSE;
-
-  clut->unref();
 }
 
 
@@ -624,8 +1036,8 @@ CvrVoxelChunk::dumpToPPM(const char * filename) const
   (void)fprintf(f, "P2\n%d %d 255\n",  // width height maxcolval
                 this->getDimensions()[0], this->getDimensions()[1]);
 
-  const int nrvoxels = this->getDimensions()[0] * this->getDimensions()[1];
-  for (int i=0; i < nrvoxels; i++) {
+  const size_t nrvoxels = (size_t)this->getDimensions()[0] * this->getDimensions()[1];
+  for (size_t i=0; i < nrvoxels; i++) {
     (void)fprintf(f, "%d\n", slicebuf[i]);
   }
   (void)fclose(f);
@@ -635,7 +1047,7 @@ CvrVoxelChunk::dumpToPPM(const char * filename) const
 // Cut a slice along any principal axis, of a single image depth.
 CvrVoxelChunk *
 CvrVoxelChunk::buildSubPage(const unsigned int axisidx, const int pageidx,
-                            const SbBox2s & cutslice)
+                            const SbBox2i32 & cutslice)
 {
   CvrVoxelChunk * output = NULL;
   switch (axisidx) {
@@ -662,17 +1074,17 @@ CvrVoxelChunk::buildSubPage(const unsigned int axisidx, const int pageidx,
 // Copies rows of z-axis data down the y-axis.
 CvrVoxelChunk *
 CvrVoxelChunk::buildSubPageX(const int pageidx, // FIXME: get rid of this by using an SbBox3s for cutslice. 20021203 mortene.
-                             const SbBox2s & cutslice)
+                             const SbBox2i32 & cutslice)
 {
   assert(pageidx >= 0);
   assert(pageidx < this->getDimensions()[0]);
 
-  SbVec2s ssmin, ssmax;
+  SbVec2i32 ssmin, ssmax;
   cutslice.getBounds(ssmin, ssmax);
 
-  const SbVec3s dim = this->getDimensions();
+  const SbVec3i32 & dim = this->getDimensions();
 
-  const int zAdd = dim[0] * dim[1];
+  const int64_t zAdd = (int64_t)dim[0] * dim[1];
 
   // We're adding 2 here to make room for the border that helps of get
   // rid of the seams between tiles.
@@ -686,13 +1098,15 @@ CvrVoxelChunk::buildSubPageX(const int pageidx, // FIXME: get rid of this by usi
   const int nrvertvoxels = ssmax[1] - ssmin[1] + 2;
   assert(nrvertvoxels > 2);
   
-  const SbVec3s outputdims(nrhorizvoxels, nrvertvoxels, 1);
+  const SbVec3i32 outputdims(nrhorizvoxels, nrvertvoxels, 1);
   CvrVoxelChunk * output = new CvrVoxelChunk(outputdims, this->getUnitSize());
 
   ssmin[0]-=1; ssmin[1]-=1;
 
-  const unsigned int staticoffset =
-    pageidx + ssmin[1] * dim[0] + ssmin[0] * zAdd;
+  // Offsets are signed, as they can start out at -1 because of the
+  // border.
+  const int64_t staticoffset =
+    pageidx + (int64_t)ssmin[1] * dim[0] + ssmin[0] * zAdd;
 
   const unsigned int voxelsize = this->getUnitSize();
   uint8_t * inputbytebuffer = (uint8_t *)this->getBuffer();
@@ -703,9 +1117,9 @@ CvrVoxelChunk::buildSubPageX(const int pageidx, // FIXME: get rid of this by usi
     if(ssmin[1]<0 && rowidx==0) rowidx_t++;
     if(ssmax[1]==dim[1] && rowidx==(nrvertvoxels-1)) rowidx_t--;
 
-    const unsigned int inoffset = staticoffset + (rowidx_t * dim[0]);
+    const int64_t inoffset = staticoffset + ((int64_t)rowidx_t * dim[0]);
 
-    uint8_t * dstptr = &(outputbytebuffer[nrhorizvoxels * rowidx * voxelsize]);
+    uint8_t * dstptr = &(outputbytebuffer[(size_t)nrhorizvoxels * rowidx * voxelsize]);
 
     int pixcropfront = ssmin[0]<0 ? 1 : 0;
     int pixcropback = ssmax[0]==dim[2] ? 1 : 0;
@@ -772,15 +1186,15 @@ CvrVoxelChunk::buildSubPageX(const int pageidx, // FIXME: get rid of this by usi
 */
 CvrVoxelChunk *
 CvrVoxelChunk::buildSubPageY(const int pageidx, // FIXME: get rid of this by using an SbBox3s for cutslice. 20021203 mortene.
-                             const SbBox2s & cutslice)
+                             const SbBox2i32 & cutslice)
 {
   assert(pageidx >= 0);
   assert(pageidx < this->getDimensions()[1]);
 
-  SbVec2s ssmin, ssmax;
+  SbVec2i32 ssmin, ssmax;
   cutslice.getBounds(ssmin, ssmax);
 
-  const SbVec3s dim = this->getDimensions();
+  const SbVec3i32 & dim = this->getDimensions();
 
 
   // We're adding 2 here to make room for the border that helps of get
@@ -795,14 +1209,14 @@ CvrVoxelChunk::buildSubPageY(const int pageidx, // FIXME: get rid of this by usi
   const int nrvertvoxels = ssmax[1] - ssmin[1] + 2;
   assert(nrvertvoxels > 0);
 
-  const SbVec3s outputdims(nrhorizvoxels, nrvertvoxels, 1);
+  const SbVec3i32 outputdims(nrhorizvoxels, nrvertvoxels, 1);
   CvrVoxelChunk * output = new CvrVoxelChunk(outputdims, this->getUnitSize());
 
   ssmin[0]-=1;   
   ssmin[1]-=1;
 
-  const unsigned int staticoffset =
-    (ssmin[1] * dim[0] * dim[1]) + (pageidx * dim[0]) + ssmin[0];
+  const int64_t staticoffset =
+    ((int64_t)ssmin[1] * dim[0] * dim[1]) + ((int64_t)pageidx * dim[0]) + ssmin[0];
 
   const unsigned int voxelsize = this->getUnitSize();
   uint8_t * inputbytebuffer = (uint8_t *)this->getBuffer();
@@ -813,9 +1227,9 @@ CvrVoxelChunk::buildSubPageY(const int pageidx, // FIXME: get rid of this by usi
     if(ssmin[1]<0 && rowidx==0) rowidx_t++;
     if(ssmax[1]==dim[2] && rowidx==(nrvertvoxels-1)) rowidx_t--;
 
-    const unsigned int inoffset = staticoffset + (rowidx_t * dim[0] * dim[1]);
+    const int64_t inoffset = staticoffset + ((int64_t)rowidx_t * dim[0] * dim[1]);
 
-    uint8_t * dstptr = &(outputbytebuffer[nrhorizvoxels * rowidx * voxelsize]);
+    uint8_t * dstptr = &(outputbytebuffer[(size_t)nrhorizvoxels * rowidx * voxelsize]);
 
     int pixcropfront = ssmin[0]<0 ? 1 : 0;
     int pixcropback = ssmax[0]==dim[0] ? 1 : 0;
@@ -839,15 +1253,15 @@ CvrVoxelChunk::buildSubPageY(const int pageidx, // FIXME: get rid of this by usi
 // Copies rows of x-axis data down the y-axis.
 CvrVoxelChunk *
 CvrVoxelChunk::buildSubPageZ(const int pageidx, // FIXME: get rid of this by using an SbBox3s for cutslice. 20021203 mortene.
-                             const SbBox2s & cutslice)
+                             const SbBox2i32 & cutslice)
 {
   assert(pageidx >= 0);
   assert(pageidx < this->getDimensions()[2]);
 
-  SbVec2s ssmin, ssmax;
+  SbVec2i32 ssmin, ssmax;
   cutslice.getBounds(ssmin, ssmax);
 
-  const SbVec3s dim = this->getDimensions();
+  const SbVec3i32 & dim = this->getDimensions();
 
   // We're adding 2 here to make room for the border that helps of get
   // rid of the seams between tiles.
@@ -861,14 +1275,14 @@ CvrVoxelChunk::buildSubPageZ(const int pageidx, // FIXME: get rid of this by usi
   const int nrvertvoxels = ssmax[1] - ssmin[1] + 2;
   assert(nrvertvoxels > 0);
 
-  const SbVec3s outputdims(nrhorizvoxels, nrvertvoxels, 1);
+  const SbVec3i32 outputdims(nrhorizvoxels, nrvertvoxels, 1);
   CvrVoxelChunk * output = new CvrVoxelChunk(outputdims, this->getUnitSize());
 
   ssmin[0]-=1;
   ssmin[1]-=1;
 
-  const unsigned int staticoffset =
-    (pageidx * dim[0] * dim[1]) + (ssmin[1] * dim[0]) + ssmin[0];
+  const int64_t staticoffset =
+    ((int64_t)pageidx * dim[0] * dim[1]) + ((int64_t)ssmin[1] * dim[0]) + ssmin[0];
 
   const unsigned int voxelsize = this->getUnitSize();
   uint8_t * inputbytebuffer = (uint8_t *)this->getBuffer();
@@ -879,9 +1293,9 @@ CvrVoxelChunk::buildSubPageZ(const int pageidx, // FIXME: get rid of this by usi
     if(ssmin[1]<0 && rowidx==0) rowidx_t++;
     if(ssmax[1]==dim[1] && rowidx==(nrvertvoxels-1)) rowidx_t--;
 
-    unsigned int inoffset = staticoffset + (rowidx_t * dim[0]);
+    int64_t inoffset = staticoffset + ((int64_t)rowidx_t * dim[0]);
 
-    uint8_t * dstptr = &(outputbytebuffer[nrhorizvoxels * rowidx * voxelsize]);
+    uint8_t * dstptr = &(outputbytebuffer[(size_t)nrhorizvoxels * rowidx * voxelsize]);
 
     int pixcropfront = ssmin[0]<0 ? 1 : 0;
     int pixcropback = ssmax[0]==dim[0] ? 1 : 0;
@@ -907,11 +1321,11 @@ CvrVoxelChunk::buildSubPageZ(const int pageidx, // FIXME: get rid of this by usi
 
 
 CvrVoxelChunk *
-CvrVoxelChunk::buildSubCube(const SbBox3s & cutcube)
+CvrVoxelChunk::buildSubCube(const SbBox3i32 & cutcube)
 {
-  SbVec3s ccmin, ccmax;
+  SbVec3i32 ccmin, ccmax;
   cutcube.getBounds(ccmin, ccmax);
-  const SbVec3s dim = this->getDimensions();
+  const SbVec3i32 & dim = this->getDimensions();
 
   const int nrhorizvoxels = ccmax[0] - ccmin[0];
   const int nrvertvoxels = ccmax[1] - ccmin[1];
@@ -921,10 +1335,11 @@ CvrVoxelChunk::buildSubCube(const SbBox3s & cutcube)
   assert(nrvertvoxels > 0);
   assert(nrdepthvoxels > 0);
 
-  const SbVec3s outputdims(nrhorizvoxels, nrvertvoxels, nrdepthvoxels);
+  const SbVec3i32 outputdims(nrhorizvoxels, nrvertvoxels, nrdepthvoxels);
   CvrVoxelChunk * output = new CvrVoxelChunk(outputdims, this->getUnitSize());
 
-  const unsigned int staticoffset = (ccmin[2] * dim[0] * dim[1]) + (ccmin[1] * dim[0]) + ccmin[0];
+  const size_t staticoffset =
+    ((size_t)ccmin[2] * dim[0] * dim[1]) + ((size_t)ccmin[1] * dim[0]) + ccmin[0];
 
   const unsigned int voxelsize = this->getUnitSize();
   uint8_t * inputbytebuffer = (uint8_t *)this->getBuffer();
@@ -932,9 +1347,10 @@ CvrVoxelChunk::buildSubCube(const SbBox3s & cutcube)
 
   for (int depthidx = 0; depthidx < nrdepthvoxels; depthidx++) {
     for (int rowidx = 0; rowidx < nrvertvoxels; rowidx++) {
-      const unsigned int inoffset = staticoffset + (rowidx * dim[0]) + (depthidx * dim[0]*dim[1]);
+      const size_t inoffset =
+        staticoffset + ((size_t)rowidx * dim[0]) + ((size_t)depthidx * dim[0] * dim[1]);
       const uint8_t * srcptr = &(inputbytebuffer[inoffset * voxelsize]);
-      uint8_t * dstptr = &(outputbytebuffer[((depthidx * nrhorizvoxels * nrvertvoxels) + (nrhorizvoxels * rowidx)) * voxelsize]);
+      uint8_t * dstptr = &(outputbytebuffer[(((size_t)depthidx * nrhorizvoxels * nrvertvoxels) + ((size_t)nrhorizvoxels * rowidx)) * voxelsize]);
       (void) memcpy(dstptr, srcptr, (size_t)nrhorizvoxels * voxelsize);
     }
   }
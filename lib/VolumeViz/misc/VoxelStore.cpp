@@ -0,0 +1,2684 @@
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+#include <VolumeViz/misc/CvrVoxelStore.h>
+
+#include <assert.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h> // memcpy()
+
+#include <Inventor/C/tidbits.h>
+#include <Inventor/SbBox2i32.h>
+#include <Inventor/SbDict.h>
+#include <Inventor/errors/SoDebugError.h>
+#include <Inventor/threads/SbThreadAutoLock.h>
+#include <Inventor/threads/SbThreadMutex.h>
+
+#include <VolumeViz/misc/CvrBrickCodec.h>
+#include <VolumeViz/misc/CvrParallel.h>
+#include <VolumeViz/misc/CvrUtil.h>
+#include <VolumeViz/misc/CvrVoxelChunk.h>
+#include <VolumeViz/readers/SoVRBrickFileReader.h>
+#include <VolumeViz/readers/SoVolumeReader.h>
+
+// *************************************************************************
+
+CvrVoxelStore::Brick * CvrVoxelStore::lruhead = NULL;
+CvrVoxelStore::Brick * CvrVoxelStore::lrutail = NULL;
+size_t CvrVoxelStore::residentbytes = 0;
+size_t CvrVoxelStore::memorylimit = 0;
+size_t CvrVoxelStore::prefetchedbytes = 0;
+SbThreadMutex * CvrVoxelStore::cachemutex = NULL;
+
+// Number of updates kept by updateRegion(). Textures older than the
+// oldest of them are taken to be out of date everywhere.
+#define CVR_MAX_LOGGED_UPDATES 64
+
+// A set of bricks to be compressed, decompressed or reduced from the
+// level below in parallel.
+struct cvr_brick_batch {
+  CvrVoxelStore * owner;
+  SbList<uintptr_t> keys;
+  SbList<SbVec3i32> dimensions;
+  SbList<uint8_t *> buffers;
+  // For compression, the CvrVoxelStore::PackedBatch the results go
+  // to, from entry "firstpacked" on.
+  void * packed;
+  int firstpacked;
+};
+
+// A set of bricks to scan the value range of in parallel.
+struct cvr_range_job {
+  CvrVoxelStore * owner;
+  SbList<SbVec3i32> bricks;
+};
+
+// A set of bricks to count the voxel values of in parallel, with one
+// result slot per brick.
+struct cvr_histogram_job {
+  CvrVoxelStore * owner;
+  SbList<SbVec3i32> bricks;
+  unsigned int length;
+  double offset, scale;
+  uint32_t ** entries;
+  unsigned int * nrentries;
+};
+
+// A region to compute the gradients of in parallel, by slabs of
+// CVR_GRADIENT_SLAB_SLICES slices.
+struct cvr_gradient_job {
+  CvrVoxelStore * owner;
+  SbVec3i32 rmin, rmax;
+};
+
+#define CVR_GRADIENT_SLAB_SLICES 8
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define CVR_HAVE_SSE2_GRADIENTS 1
+#include <emmintrin.h>
+#endif // SSE2
+
+// *************************************************************************
+
+// Edge length of the bricks the volume is split into when it is not
+// resident in memory. Can be overridden with the CVR_BRICK_SIZE
+// environment variable.
+static short
+cvr_brick_size(void)
+{
+  static int size = -1;
+  if (size == -1) {
+    const char * env = coin_getenv("CVR_BRICK_SIZE");
+    size = env ? atoi(env) : 64;
+    if (size < 8) { size = 8; }
+    if (size > 1024) { size = 1024; }
+  }
+  return (short)size;
+}
+
+// Default upper limit for how much memory the brick cache can
+// use. Given in megabytes through the CVR_VOXEL_CACHE_SIZE environment
+// variable, defaults to 512 MB.
+static size_t
+cvr_default_memory_limit(void)
+{
+  const char * env = coin_getenv("CVR_VOXEL_CACHE_SIZE");
+  const int mb = env ? atoi(env) : 512;
+  return (size_t)SbMax(mb, 1) * 1024 * 1024;
+}
+
+// Counts 8-bit voxels into four sets of 256 bins, used in turn, so
+// that consecutive increments rarely hit the same counter and have to
+// wait for each other.
+static void
+cvr_count_uint8(const uint8_t * voxels, size_t nrvoxels, uint32_t * bins)
+{
+  uint32_t * bins0 = bins;
+  uint32_t * bins1 = bins + 256;
+  uint32_t * bins2 = bins + 512;
+  uint32_t * bins3 = bins + 768;
+
+  size_t i = 0;
+  for (; (i + 4) <= nrvoxels; i += 4) {
+    bins0[voxels[i]]++;
+    bins1[voxels[i + 1]]++;
+    bins2[voxels[i + 2]]++;
+    bins3[voxels[i + 3]]++;
+  }
+  for (; i < nrvoxels; i++) { bins0[voxels[i]]++; }
+}
+
+// Counts 16-bit voxels into 65536 bins, after xor'ing "flip" into
+// each value. A flip of 0x8000 maps SIGNED_SHORT values to their
+// lookup index. With this many bins, collisions between consecutive
+// voxels are rare enough that one set of bins will do.
+static void
+cvr_count_uint16(const uint16_t * voxels, size_t nrvoxels, uint16_t flip,
+                 uint32_t * bins)
+{
+  size_t i = 0;
+  for (; (i + 4) <= nrvoxels; i += 4) {
+    bins[voxels[i] ^ flip]++;
+    bins[voxels[i + 1] ^ flip]++;
+    bins[voxels[i + 2] ^ flip]++;
+    bins[voxels[i + 3] ^ flip]++;
+  }
+  for (; i < nrvoxels; i++) { bins[voxels[i] ^ flip]++; }
+}
+
+// Converts "n" voxels from "voxels", starting at voxel number "idx",
+// to floats. NaN maps to 0, as in CvrGradient.
+static void
+cvr_voxel_row_to_float(const uint8_t * voxels, size_t idx, unsigned int n,
+                       SoVolumeData::DataType type, float * out)
+{
+  unsigned int i;
+  switch (type) {
+  case SoVolumeData::UNSIGNED_BYTE:
+    for (i = 0; i < n; i++) { out[i] = voxels[idx + i]; }
+    break;
+  case SoVolumeData::UNSIGNED_SHORT:
+    for (i = 0; i < n; i++) { out[i] = ((const uint16_t *)voxels)[idx + i]; }
+    break;
+  case SoVolumeData::SIGNED_SHORT:
+    for (i = 0; i < n; i++) { out[i] = ((const int16_t *)voxels)[idx + i]; }
+    break;
+  case SoVolumeData::FLOAT:
+    for (i = 0; i < n; i++) {
+      const float v = ((const float *)voxels)[idx + i];
+      out[i] = (v == v) ? v : 0.0f;
+    }
+    break;
+  default: assert(FALSE); break;
+  }
+}
+
+// Finds the gradients of a row of "n" voxels by central differences,
+// where "c" points to the first of them within a padded block of
+// values, such that all neighbours can be looked up without any
+// clamping. Gradients are normalized, and stored range compressed
+// to [0, 255], as 3 bytes per voxel.
+//
+// Four voxels are done at a time with SSE2 where that is available,
+// which is always the case on x86-64. The vector and scalar code
+// do the same operations in the same order, so give the same result.
+static void
+cvr_gradient_row(const float * c, const size_t rowstride, const size_t slicestride,
+                 const unsigned int n, uint8_t * out)
+{
+  const float * xm = c - 1;
+  const float * xp = c + 1;
+  const float * ym = c - rowstride;
+  const float * yp = c + rowstride;
+  const float * zm = c - slicestride;
+  const float * zp = c + slicestride;
+
+  unsigned int x = 0;
+
+#ifdef CVR_HAVE_SSE2_GRADIENTS
+  const __m128 tiny = _mm_set1_ps(FLT_MIN);
+  const __m128 scale = _mm_set1_ps(127.5f);
+  const __m128 mid = _mm_set1_ps(128.0f);
+  const __m128 top = _mm_set1_ps(255.0f);
+  for (; (x + 4) <= n; x += 4) {
+    const __m128 gx = _mm_sub_ps(_mm_loadu_ps(xm + x), _mm_loadu_ps(xp + x));
+    const __m128 gy = _mm_sub_ps(_mm_loadu_ps(ym + x), _mm_loadu_ps(yp + x));
+    const __m128 gz = _mm_sub_ps(_mm_loadu_ps(zm + x), _mm_loadu_ps(zp + x));
+    const __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy)),
+                                   _mm_mul_ps(gz, gz));
+    const __m128 s = _mm_div_ps(scale, _mm_sqrt_ps(_mm_add_ps(len2, tiny)));
+    int32_t q[3][4];
+    _mm_storeu_si128((__m128i *)q[0], _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(_mm_mul_ps(gx, s), mid), top)));
+    _mm_storeu_si128((__m128i *)q[1], _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(_mm_mul_ps(gy, s), mid), top)));
+    _mm_storeu_si128((__m128i *)q[2], _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(_mm_mul_ps(gz, s), mid), top)));
+    for (unsigned int i = 0; i < 4; i++) {
+      out[(x + i) * 3 + 0] = (uint8_t)q[0][i];
+      out[(x + i) * 3 + 1] = (uint8_t)q[1][i];
+      out[(x + i) * 3 + 2] = (uint8_t)q[2][i];
+    }
+  }
+#endif // CVR_HAVE_SSE2_GRADIENTS
+
+  for (; x < n; x++) {
+    const float gx = xm[x] - xp[x];
+    const float gy = ym[x] - yp[x];
+    const float gz = zm[x] - zp[x];
+    const float len2 = gx * gx + gy * gy + gz * gz;
+    // FLT_MIN avoids a division by zero for flat areas, which then
+    // get the zero vector.
+    const float s = 127.5f / sqrtf(len2 + FLT_MIN);
+    // Rounded, so the compressed value of -g is 255 minus that of g.
+    const float qx = gx * s + 128.0f;
+    const float qy = gy * s + 128.0f;
+    const float qz = gz * s + 128.0f;
+    out[x * 3 + 0] = (uint8_t)(qx < 255.0f ? qx : 255.0f);
+    out[x * 3 + 1] = (uint8_t)(qy < 255.0f ? qy : 255.0f);
+    out[x * 3 + 2] = (uint8_t)(qz < 255.0f ? qz : 255.0f);
+  }
+}
+
+// *************************************************************************
+
+// If "residentvoxels" is non-NULL, it should point to the complete
+// set of voxels, and no bricks will be loaded through the reader. It
+// is then the caller's responsibility to keep the buffer alive for
+// the lifetime of this instance.
+CvrVoxelStore::CvrVoxelStore(SoVolumeReader * reader,
+                             const SbVec3i32 & dimensions,
+                             SoVolumeData::DataType datatype,
+                             const void * residentvoxels)
+{
+  assert(reader || residentvoxels);
+
+  this->reader = reader;
+  this->dimensions = dimensions;
+  this->datatype = datatype;
+  this->residentvoxels = (const uint8_t *)residentvoxels;
+  this->residentdims = dimensions;
+  this->viewedstore = NULL;
+  this->viewoffset.setValue(0, 0, 0);
+  this->reducedfrom = NULL;
+  this->reducemethod = SoVolumeData::NEAREST;
+  this->levelof = NULL;
+  this->readerlevel = 0;
+
+  // Bricks are matched up with the bricks of a bricked file, so each
+  // brick is loaded with a single read.
+  this->brickreader = dynamic_cast<SoVRBrickFileReader *>(reader);
+  this->init();
+}
+
+// Makes a store which is a view of "region" of the "viewed" store,
+// without copying any voxels. If the viewed store has all its voxels
+// resident, so does the view, addressed with the strides of the
+// viewed store. Otherwise, the bricks of the view are copied out of
+// the viewed store as they are needed.
+//
+// The viewed store must outlive the view.
+CvrVoxelStore::CvrVoxelStore(CvrVoxelStore * viewed, const SbBox3i32 & region)
+{
+  SbVec3i32 rmin, rmax;
+  region.getBounds(rmin, rmax);
+  for (unsigned int i = 0; i < 3; i++) {
+    assert(rmin[i] >= 0 && rmin[i] < rmax[i] && rmax[i] <= viewed->dimensions[i]);
+  }
+
+  this->reader = NULL;
+  this->brickreader = NULL;
+  this->dimensions = rmax - rmin;
+  this->datatype = viewed->datatype;
+  this->viewedstore = viewed;
+  this->viewoffset = rmin;
+  this->reducedfrom = NULL;
+  this->reducemethod = SoVolumeData::NEAREST;
+  this->levelof = NULL;
+  this->readerlevel = 0;
+
+  this->residentvoxels = NULL;
+  this->residentdims = viewed->residentdims;
+  if (viewed->residentvoxels) {
+    const SbVec3i32 & rdims = viewed->residentdims;
+    const size_t offset =
+      ((size_t)rmin[2] * rdims[1] + rmin[1]) * rdims[0] + rmin[0];
+    this->residentvoxels = viewed->residentvoxels + offset * viewed->bytesprvoxel;
+  }
+
+  this->init();
+}
+
+// Makes a store for the next level of the resolution pyramid of the
+// "finer" store, which must outlive it. Nothing is reduced up front:
+// each brick is reduced from the voxels it covers in the finer store
+// when it is loaded into the brick cache.
+CvrVoxelStore::CvrVoxelStore(CvrVoxelStore * finer, SoVolumeData::SubMethod method)
+{
+  this->reader = NULL;
+  this->brickreader = NULL;
+  this->dimensions = CvrVoxelStore::getLevelDimensions(finer->dimensions, 1);
+  this->datatype = finer->datatype;
+  this->residentvoxels = NULL;
+  this->residentdims = this->dimensions;
+  this->viewedstore = NULL;
+  this->viewoffset.setValue(0, 0, 0);
+  this->reducedfrom = finer;
+  this->reducemethod = method;
+  this->levelof = NULL;
+  this->readerlevel = 0;
+
+  this->init();
+}
+
+// Makes a store for the given level of the resolution pyramid stored
+// in the bricked file which the "full" store reads from. The full
+// store must outlive it. Its bricks are the bricks of the level in
+// the file, and are read as they are needed.
+CvrVoxelStore::CvrVoxelStore(CvrVoxelStore * full, unsigned int level)
+{
+  assert(full->brickreader && (level > 0) &&
+         (level < full->brickreader->getNumLevels()));
+
+  this->reader = full->reader;
+  this->brickreader = full->brickreader;
+  this->dimensions = CvrVoxelStore::getLevelDimensions(full->dimensions, level);
+  this->datatype = full->datatype;
+  this->residentvoxels = NULL;
+  this->residentdims = this->dimensions;
+  this->viewedstore = NULL;
+  this->viewoffset.setValue(0, 0, 0);
+  this->reducedfrom = NULL;
+  this->reducemethod = SoVolumeData::NEAREST;
+  this->levelof = full;
+  this->readerlevel = level;
+
+  this->init();
+  assert(this->nrbricks == this->brickreader->getNumBricks(level));
+}
+
+// Sets up everything which does not depend on where the voxels come
+// from.
+void
+CvrVoxelStore::init(void)
+{
+  switch (this->datatype) {
+  case SoVolumeData::UNSIGNED_BYTE: this->bytesprvoxel = 1; break;
+  case SoVolumeData::UNSIGNED_SHORT: this->bytesprvoxel = 2; break;
+  case SoVolumeData::SIGNED_SHORT: this->bytesprvoxel = 2; break;
+  case SoVolumeData::FLOAT: this->bytesprvoxel = 4; break;
+  default: assert(FALSE && "unknown data type"); this->bytesprvoxel = 1; break;
+  }
+
+  const int32_t bs = this->brickreader ?
+    this->brickreader->getBrickSize()[0] : cvr_brick_size();
+  this->bricksize.setValue(bs, bs, bs);
+  for (unsigned int i = 0; i < 3; i++) {
+    this->nrbricks[i] = (this->dimensions[i] + bs - 1) / bs;
+  }
+
+  this->brickdict = new SbDict;
+  this->generation = 0;
+
+  // Stores are only constructed from the thread doing the scene graph
+  // traversals, so this is safe without any locking.
+  if (CvrVoxelStore::cachemutex == NULL) {
+    CvrVoxelStore::cachemutex = new SbThreadMutex;
+  }
+
+  const size_t nrranges =
+    (size_t)this->nrbricks[0] * this->nrbricks[1] * this->nrbricks[2];
+  this->brickranges = new BrickRange[nrranges];
+  for (size_t i = 0; i < nrranges; i++) { this->brickranges[i].valid = FALSE; }
+  this->totalrange.valid = FALSE;
+  this->readRanges();
+
+  this->brickhistograms = new BrickHistogram[nrranges];
+  for (size_t i = 0; i < nrranges; i++) {
+    this->brickhistograms[i].entries = NULL;
+    this->brickhistograms[i].nrentries = 0;
+  }
+  this->histogrambytes = 0;
+  this->histogramoffset = 0.0;
+  this->histogramscale = 1.0;
+  this->totalhistogram = NULL;
+  this->totalhistogramlength = 0;
+
+  this->packedbricks = NULL;
+  this->packedbytes = 0;
+
+  this->levelmethod = SoVolumeData::NEAREST;
+  this->readlevels = TRUE;
+  this->updateserial = 0;
+
+  this->gradients = NULL;
+  this->gradientbytes = 0;
+  this->gradientsdirty.makeEmpty();
+
+  if (CvrVoxelStore::memorylimit == 0) {
+    CvrVoxelStore::memorylimit = cvr_default_memory_limit();
+  }
+}
+
+CvrVoxelStore::~CvrVoxelStore()
+{
+  this->flush();
+  this->clearHistograms();
+  delete this->brickdict;
+  delete[] this->brickranges;
+  delete[] this->brickhistograms;
+  {
+    SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+    this->releaseGradients();
+  }
+
+  if (this->packedbricks) {
+    const size_t nrpacked =
+      (size_t)this->nrbricks[0] * this->nrbricks[1] * this->nrbricks[2];
+    for (size_t i = 0; i < nrpacked; i++) { delete[] this->packedbricks[i].data; }
+    delete[] this->packedbricks;
+  }
+}
+
+// *************************************************************************
+
+const SbVec3i32 &
+CvrVoxelStore::getDimensions(void) const
+{
+  return this->dimensions;
+}
+
+SoVolumeData::DataType
+CvrVoxelStore::getDataType(void) const
+{
+  return this->datatype;
+}
+
+unsigned int
+CvrVoxelStore::getBytesPrVoxel(void) const
+{
+  return this->bytesprvoxel;
+}
+
+// Returns the number of bytes in the lookup indices the voxels are
+// mapped to for texturing: 1 for UNSIGNED_BYTE data, 2 for all other
+// types.
+unsigned int
+CvrVoxelStore::getIndexSize(void) const
+{
+  return (this->datatype == SoVolumeData::UNSIGNED_BYTE) ? 1 : 2;
+}
+
+const SbVec3i32 &
+CvrVoxelStore::getBrickSize(void) const
+{
+  return this->bricksize;
+}
+
+// Returns pointer to the complete voxel set, or NULL if the volume is
+// only available brick by brick. The voxels are laid out as in a
+// volume of getResidentDimensions(), which is larger than the store
+// itself for a view.
+const uint8_t *
+CvrVoxelStore::getResidentVoxels(void) const
+{
+  return this->residentvoxels;
+}
+
+const SbVec3i32 &
+CvrVoxelStore::getResidentDimensions(void) const
+{
+  return this->residentdims;
+}
+
+// Returns the store this is a view of, or NULL if it is not a view.
+CvrVoxelStore *
+CvrVoxelStore::getViewedStore(void) const
+{
+  return this->viewedstore;
+}
+
+// Returns the position of the view within the store it views.
+const SbVec3i32 &
+CvrVoxelStore::getViewOffset(void) const
+{
+  return this->viewoffset;
+}
+
+// Returns the number of bricks along each axis.
+const SbVec3i32 &
+CvrVoxelStore::getNrOfBricks(void) const
+{
+  return this->nrbricks;
+}
+
+// *************************************************************************
+
+// Sets the upper limit for the total amount of memory used for bricks
+// by all CvrVoxelStore instances. Bricks are thrown out in
+// least-recently-used order when the limit is reached.
+void
+CvrVoxelStore::setMemoryLimit(size_t nrbytes)
+{
+  assert(nrbytes > 0);
+  SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+  CvrVoxelStore::memorylimit = nrbytes;
+  CvrVoxelStore::makeRoomFor(0);
+}
+
+size_t
+CvrVoxelStore::getMemoryLimit(void)
+{
+  if (CvrVoxelStore::memorylimit == 0) {
+    CvrVoxelStore::memorylimit = cvr_default_memory_limit();
+  }
+  return CvrVoxelStore::memorylimit;
+}
+
+size_t
+CvrVoxelStore::getResidentMemory(void)
+{
+  SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+  return CvrVoxelStore::residentbytes;
+}
+
+// Returns the amount of memory used by bricks which were loaded by
+// prefetchBrick(), and which have not been used since.
+size_t
+CvrVoxelStore::getPrefetchedMemory(void)
+{
+  SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+  return CvrVoxelStore::prefetchedbytes;
+}
+
+// *************************************************************************
+
+// Returns address of the voxel at the given position. If the voxel
+// is in a brick, that is returned in "brick", pinned in the cache,
+// and must be handed back with unpinBrick() when the caller is done
+// with the voxel. Otherwise "brick" is set to NULL.
+const uint8_t *
+CvrVoxelStore::getVoxelAddress(const SbVec3i32 & voxelpos, Brick *& brick)
+{
+  assert(voxelpos[0] >= 0 && voxelpos[0] < this->dimensions[0]);
+  assert(voxelpos[1] >= 0 && voxelpos[1] < this->dimensions[1]);
+  assert(voxelpos[2] >= 0 && voxelpos[2] < this->dimensions[2]);
+
+  if (this->residentvoxels) {
+    brick = NULL;
+    const size_t idx =
+      ((size_t)voxelpos[2] * this->residentdims[1] + voxelpos[1]) *
+      this->residentdims[0] + voxelpos[0];
+    return this->residentvoxels + idx * this->bytesprvoxel;
+  }
+
+  const SbVec3i32 brickidx(voxelpos[0] / this->bricksize[0],
+                         voxelpos[1] / this->bricksize[1],
+                         voxelpos[2] / this->bricksize[2]);
+  brick = this->getBrick(brickidx);
+  const SbVec3i32 & bdims = brick->dimensions;
+  const size_t idx =
+    ((size_t)(voxelpos[2] % this->bricksize[2]) * bdims[1] +
+     (voxelpos[1] % this->bricksize[1])) * bdims[0] +
+    (voxelpos[0] % this->bricksize[0]);
+  return brick->voxels + idx * this->bytesprvoxel;
+}
+
+// Returns "raw" value of voxel at given position. For FLOAT data,
+// this is the bit pattern of the value.
+uint32_t
+CvrVoxelStore::getVoxelValue(const SbVec3i32 & voxelpos)
+{
+  Brick * brick;
+  const uint8_t * voxptr = this->getVoxelAddress(voxelpos, brick);
+
+  uint32_t value = 0;
+  switch (this->bytesprvoxel) {
+  case 1: value = *voxptr; break;
+  case 2: value = *((const uint16_t *)voxptr); break;
+  case 4: value = *((const uint32_t *)voxptr); break;
+  default: assert(FALSE); break;
+  }
+
+  if (brick) { this->unpinBrick(brick); }
+  return value;
+}
+
+// Returns the lookup index the voxel at the given position maps to,
+// i.e. the index into the color lookup table used for rendering it.
+uint32_t
+CvrVoxelStore::getVoxelIndex(const SbVec3i32 & voxelpos)
+{
+  double offset, scale;
+  this->getIndexMapping(offset, scale);
+
+  Brick * brick;
+  const uint8_t * voxptr = this->getVoxelAddress(voxelpos, brick);
+  const uint32_t idx =
+    CvrVoxelStore::voxelToIndex(voxptr, 0, this->datatype, offset, scale);
+  if (brick) { this->unpinBrick(brick); }
+  return idx;
+}
+
+// *************************************************************************
+
+// Updates "range" with the values of the voxels within "region" of
+// "voxels", which is a buffer of dimensions "bufferdims" starting at
+// the minimum corner of "region".
+void
+CvrVoxelStore::scanRange(BrickRange & range, const SbBox3i32 & region,
+                         const uint8_t * voxels, const SbVec3i32 & bufferdims) const
+{
+  SbVec3i32 rmin, rmax;
+  region.getBounds(rmin, rmax);
+  const size_t rowlen = rmax[0] - rmin[0];
+
+  double minval = range.valid ? range.minval : DBL_MAX;
+  double maxval = range.valid ? range.maxval : -DBL_MAX;
+
+  for (int32_t z = 0; z < rmax[2] - rmin[2]; z++) {
+    for (int32_t y = 0; y < rmax[1] - rmin[1]; y++) {
+      const size_t rowstart = ((size_t)z * bufferdims[1] + y) * bufferdims[0];
+      for (size_t x = 0; x < rowlen; x++) {
+        double v;
+        switch (this->datatype) {
+        case SoVolumeData::UNSIGNED_BYTE: v = voxels[rowstart + x]; break;
+        case SoVolumeData::UNSIGNED_SHORT: v = ((const uint16_t *)voxels)[rowstart + x]; break;
+        case SoVolumeData::SIGNED_SHORT: v = ((const int16_t *)voxels)[rowstart + x]; break;
+        case SoVolumeData::FLOAT:
+          v = ((const float *)voxels)[rowstart + x];
+          if (v != v) { continue; } // NaN is "no value"
+          break;
+        default: assert(FALSE); v = 0.0; break;
+        }
+        if (v < minval) { minval = v; }
+        if (v > maxval) { maxval = v; }
+      }
+    }
+  }
+
+  // A region of only NaN values gives an empty range, which is
+  // represented as [0, 0].
+  range.valid = TRUE;
+  range.minval = (minval <= maxval) ? minval : 0.0;
+  range.maxval = (minval <= maxval) ? maxval : 0.0;
+}
+
+// Returns the range of the voxel values within the given brick. The
+// range is recorded when the brick is loaded, or scanned on demand
+// for resident volumes.
+void
+CvrVoxelStore::getBrickMinMax(const SbVec3i32 & brickidx,
+                              double & minval, double & maxval)
+{
+  for (unsigned int i = 0; i < 3; i++) {
+    assert(brickidx[i] >= 0 && brickidx[i] < this->nrbricks[i]);
+  }
+
+  SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+  BrickRange & range = this->brickranges[this->brickKey(brickidx)];
+  if (!range.valid) {
+    const SbBox3i32 region = this->brickRegion(brickidx);
+    if (this->residentvoxels) {
+      SbVec3i32 rmin, rmax;
+      region.getBounds(rmin, rmax);
+      const SbVec3i32 & rdims = this->residentdims;
+      const size_t offset = ((size_t)rmin[2] * rdims[1] + rmin[1]) * rdims[0] + rmin[0];
+      this->scanRange(range, region,
+                      this->residentvoxels + offset * this->bytesprvoxel, rdims);
+    }
+    else {
+      // The range is normally recorded as the brick is loaded, but
+      // it may have been dropped by a flushRegion() since.
+      CvrVoxelStore::cachemutex->unlock();
+      Brick * brick = this->getBrick(brickidx);
+      CvrVoxelStore::cachemutex->lock();
+      this->recordRange(brick);
+      this->unpinBrick(brick);
+    }
+  }
+
+  minval = range.minval;
+  maxval = range.maxval;
+}
+
+// Returns the range of all voxel values in the volume. The first
+// time, this scans all bricks whose range is not known already, over
+// several threads. After that, it just combines the ranges of the
+// bricks, until the next flush().
+//
+// Must not be called with the cache mutex locked.
+void
+CvrVoxelStore::getMinMax(double & minval, double & maxval)
+{
+  SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+  if (!this->totalrange.valid) {
+    // Let go of the lock while the bricks are scanned, as the threads
+    // scanning them may have to load them.
+    CvrVoxelStore::cachemutex->unlock();
+    this->computeRanges();
+    CvrVoxelStore::cachemutex->lock();
+
+    double lo = DBL_MAX, hi = -DBL_MAX;
+    const size_t nrranges =
+      (size_t)this->nrbricks[0] * this->nrbricks[1] * this->nrbricks[2];
+    for (size_t i = 0; i < nrranges; i++) {
+      const BrickRange & range = this->brickranges[i];
+      // May have been flushed since it was scanned.
+      if (!range.valid) { continue; }
+      lo = SbMin(lo, range.minval);
+      hi = SbMax(hi, range.maxval);
+    }
+    this->totalrange.valid = TRUE;
+    this->totalrange.minval = (lo <= hi) ? lo : 0.0;
+    this->totalrange.maxval = (lo <= hi) ? hi : 0.0;
+  }
+
+  minval = this->totalrange.minval;
+  maxval = this->totalrange.maxval;
+}
+
+// Scans the value range of each brick for which it is not known,
+// spread over several threads.
+void
+CvrVoxelStore::computeRanges(void)
+{
+  cvr_range_job job;
+  job.owner = this;
+  {
+    SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+    for (int32_t z = 0; z < this->nrbricks[2]; z++) {
+      for (int32_t y = 0; y < this->nrbricks[1]; y++) {
+        for (int32_t x = 0; x < this->nrbricks[0]; x++) {
+          const SbVec3i32 brickidx(x, y, z);
+          if (!this->brickranges[this->brickKey(brickidx)].valid) {
+            job.bricks.append(brickidx);
+          }
+        }
+      }
+    }
+  }
+
+  if ((job.bricks.getLength() > 0) && CvrUtil::doDebugging()) {
+    SoDebugError::postInfo("CvrVoxelStore::computeRanges",
+                           "scanning value range of %d bricks",
+                           job.bricks.getLength());
+  }
+
+  CvrParallel::run(job.bricks.getLength(), CvrVoxelStore::rangeBrickCB, &job);
+}
+
+// Scans the value range of one brick of a cvr_range_job. Resident
+// voxels are scanned in place, other bricks are copied out first.
+void
+CvrVoxelStore::rangeBrickCB(void * closure, unsigned int jobidx)
+{
+  cvr_range_job * job = (cvr_range_job *)closure;
+  CvrVoxelStore * thisp = job->owner;
+  const SbVec3i32 & brickidx = job->bricks[jobidx];
+
+  const SbBox3i32 region = thisp->brickRegion(brickidx);
+  SbVec3i32 bmin, bmax;
+  region.getBounds(bmin, bmax);
+
+  BrickRange range;
+  range.valid = FALSE;
+  if (thisp->residentvoxels) {
+    const SbVec3i32 & dims = thisp->residentdims;
+    const size_t offset = ((size_t)bmin[2] * dims[1] + bmin[1]) * dims[0] + bmin[0];
+    thisp->scanRange(range, region,
+                     thisp->residentvoxels + offset * thisp->bytesprvoxel, dims);
+  }
+  else {
+    const SbVec3i32 bdims = bmax - bmin;
+    uint8_t * copy =
+      new uint8_t[(size_t)bdims[0] * bdims[1] * bdims[2] * thisp->bytesprvoxel];
+    thisp->copyRegion(region, copy);
+    thisp->scanRange(range, region, copy, bdims);
+    delete[] copy;
+  }
+
+  SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+  BrickRange & stored = thisp->brickranges[thisp->brickKey(brickidx)];
+  if (!stored.valid) { stored = range; }
+}
+
+// Finds the range of lookup indices the voxels within "region" map
+// to, from the value ranges of the bricks overlapping it, which makes
+// it a conservative estimate. Returns FALSE if the range of any of
+// those bricks is not known, and could not be found without loading
+// the brick.
+//
+// This is what the rendering uses to skip parts of the volume where
+// all voxels are fully transparent, without reading them.
+SbBool
+CvrVoxelStore::getRegionIndexRange(const SbBox3i32 & region,
+                                   uint32_t & lowidx, uint32_t & highidx)
+{
+  double offset, scale;
+  this->getIndexMapping(offset, scale);
+
+  SbVec3i32 rmin, rmax;
+  region.getBounds(rmin, rmax);
+  for (unsigned int i = 0; i < 3; i++) {
+    assert(rmin[i] >= 0 && rmin[i] < rmax[i] && rmax[i] <= this->dimensions[i]);
+  }
+
+  SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+
+  double lo = DBL_MAX, hi = -DBL_MAX;
+  const SbVec3i32 & bs = this->bricksize;
+  for (int32_t bz = rmin[2] / bs[2]; bz <= (rmax[2] - 1) / bs[2]; bz++) {
+    for (int32_t by = rmin[1] / bs[1]; by <= (rmax[1] - 1) / bs[1]; by++) {
+      for (int32_t bx = rmin[0] / bs[0]; bx <= (rmax[0] - 1) / bs[0]; bx++) {
+        const SbVec3i32 brickidx(bx, by, bz);
+        const BrickRange & range = this->brickranges[this->brickKey(brickidx)];
+        double bmin, bmax;
+        if (range.valid) {
+          bmin = range.minval;
+          bmax = range.maxval;
+        }
+        else if (this->residentvoxels) {
+          this->getBrickMinMax(brickidx, bmin, bmax);
+        }
+        else {
+          return FALSE;
+        }
+        lo = SbMin(lo, bmin);
+        hi = SbMax(hi, bmax);
+      }
+    }
+  }
+
+  // Same mapping as voxelToIndex(), which is monotonic, so the range
+  // maps to a range.
+  const double maxidx = (1 << (8 * this->getIndexSize())) - 1;
+  const double idx[2] = { (lo - offset) * scale, (hi - offset) * scale };
+  uint32_t result[2];
+  for (unsigned int i = 0; i < 2; i++) {
+    if (!(idx[i] > 0.0)) { result[i] = 0; }
+    else if (idx[i] >= maxidx) { result[i] = (uint32_t)maxidx; }
+    else { result[i] = (uint32_t)floor(idx[i] + 0.5); }
+  }
+  lowidx = result[0];
+  highidx = result[1];
+  return TRUE;
+}
+
+// Returns the mapping from voxel values to unsigned lookup indices,
+// as index = (value - offset) * scale. Unsigned types map to
+// themselves, and SIGNED_SHORT is shifted to start at index 0. FLOAT
+// data has no natural index range, so its value range is stretched
+// over the 16-bit index range.
+void
+CvrVoxelStore::getIndexMapping(double & offset, double & scale)
+{
+  switch (this->datatype) {
+  case SoVolumeData::UNSIGNED_BYTE:
+  case SoVolumeData::UNSIGNED_SHORT:
+    offset = 0.0;
+    scale = 1.0;
+    break;
+  case SoVolumeData::SIGNED_SHORT:
+    offset = -32768.0;
+    scale = 1.0;
+    break;
+  case SoVolumeData::FLOAT:
+    {
+      double minval, maxval;
+      this->getMinMax(minval, maxval);
+      offset = minval;
+      scale = (maxval > minval) ? (65535.0 / (maxval - minval)) : 0.0;
+    }
+    break;
+  default:
+    assert(FALSE);
+    offset = 0.0;
+    scale = 1.0;
+    break;
+  }
+}
+
+// Fills in "histogram" with the number of voxels mapping to each
+// lookup index. "length" must be 256 for UNSIGNED_BYTE data, and
+// 65536 for the other types.
+//
+// The histogram is kept per brick, so only bricks which have not been
+// counted before, or which have been thrown out by flushRegion(), are
+// counted. They are spread over several threads, each brick counted
+// into its own set of bins. Bricks with only one value, and bricks
+// for which a bricked file has a histogram with a bin per lookup
+// index, are not read at all.
+void
+CvrVoxelStore::getHistogram(int * histogram, unsigned int length)
+{
+  assert(length == (1u << (8 * this->getIndexSize())));
+
+  // For FLOAT data, the mapping to lookup indices depends on the
+  // value range of the complete volume.
+  double offset, scale;
+  this->getIndexMapping(offset, scale);
+  if ((offset != this->histogramoffset) || (scale != this->histogramscale)) {
+    this->clearHistograms();
+    this->histogramoffset = offset;
+    this->histogramscale = scale;
+  }
+
+  if (this->totalhistogram == NULL) {
+    cvr_histogram_job job;
+    job.owner = this;
+    job.length = length;
+    job.offset = offset;
+    job.scale = scale;
+
+    for (int32_t z = 0; z < this->nrbricks[2]; z++) {
+      for (int32_t y = 0; y < this->nrbricks[1]; y++) {
+        for (int32_t x = 0; x < this->nrbricks[0]; x++) {
+          const SbVec3i32 brickidx(x, y, z);
+          BrickHistogram & bh = this->brickhistograms[this->brickKey(brickidx)];
+          if (bh.entries) { continue; }
+          if (this->getKnownHistogram(brickidx, length, bh)) {
+            this->histogrambytes += bh.nrentries * 2 * sizeof(uint32_t);
+            continue;
+          }
+          job.bricks.append(brickidx);
+        }
+      }
+    }
+
+    this->totalhistogram = new int[length];
+    this->totalhistogramlength = length;
+    for (unsigned int i = 0; i < length; i++) { this->totalhistogram[i] = 0; }
+
+    const size_t nrbricks =
+      (size_t)this->nrbricks[0] * this->nrbricks[1] * this->nrbricks[2];
+    for (size_t i = 0; i < nrbricks; i++) {
+      const BrickHistogram & bh = this->brickhistograms[i];
+      for (unsigned int e = 0; e < bh.nrentries; e++) {
+        this->totalhistogram[bh.entries[e * 2]] += (int)bh.entries[e * 2 + 1];
+      }
+    }
+
+    const int nrjobs = job.bricks.getLength();
+    job.entries = new uint32_t *[nrjobs];
+    job.nrentries = new unsigned int[nrjobs];
+    CvrParallel::run(nrjobs, CvrVoxelStore::histogramBrickCB, &job);
+
+    // Brick histograms are kept as long as they take up no more than
+    // a quarter of the memory set aside for the brick cache.
+    const size_t maxbytes = CvrVoxelStore::getMemoryLimit() / 4;
+    for (int i = 0; i < nrjobs; i++) {
+      const size_t nrbytes = job.nrentries[i] * 2 * sizeof(uint32_t);
+      BrickHistogram & bh = this->brickhistograms[this->brickKey(job.bricks[i])];
+      bh.entries = job.entries[i];
+      bh.nrentries = job.nrentries[i];
+      for (unsigned int e = 0; e < bh.nrentries; e++) {
+        this->totalhistogram[bh.entries[e * 2]] += (int)bh.entries[e * 2 + 1];
+      }
+      if ((this->histogrambytes + nrbytes) <= maxbytes) {
+        this->histogrambytes += nrbytes;
+      }
+      else {
+        delete[] bh.entries;
+        bh.entries = NULL;
+        bh.nrentries = 0;
+      }
+    }
+    delete[] job.entries;
+    delete[] job.nrentries;
+  }
+
+  assert(this->totalhistogramlength == length);
+  (void)memcpy(histogram, this->totalhistogram, length * sizeof(int));
+}
+
+// Sets up the histogram of a brick without reading its voxels, if
+// that is possible: for integer data where all voxels of the brick
+// have the same value, and from the brick tables of a bricked file
+// with one histogram bin per lookup index.
+SbBool
+CvrVoxelStore::getKnownHistogram(const SbVec3i32 & brickidx, unsigned int length,
+                                 BrickHistogram & histogram)
+{
+  if (this->datatype == SoVolumeData::FLOAT) { return FALSE; }
+
+  const uintptr_t key = this->brickKey(brickidx);
+  SbVec3i32 bmin, bmax;
+  this->brickRegion(brickidx).getBounds(bmin, bmax);
+
+  BrickRange range;
+  {
+    SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+    range = this->brickranges[key];
+  }
+
+  // Integer values map to lookup indices by just an offset.
+  if (range.valid && (range.minval == range.maxval)) {
+    histogram.entries = new uint32_t[2];
+    histogram.entries[0] = (uint32_t)(range.minval - this->histogramoffset);
+    histogram.entries[1] =
+      (uint32_t)(bmax[0] - bmin[0]) * (bmax[1] - bmin[1]) * (bmax[2] - bmin[2]);
+    histogram.nrentries = 1;
+    return TRUE;
+  }
+
+  if (this->brickreader == NULL) { return FALSE; }
+
+  double hmin, hmax;
+  this->brickreader->getHistogramRange(hmin, hmax);
+  unsigned int nrbins;
+  const uint32_t * bins =
+    this->brickreader->getBrickHistogram(this->readerlevel, brickidx, nrbins);
+  if ((bins == NULL) || (nrbins != length) ||
+      (hmin != this->histogramoffset) || (hmax != this->histogramoffset + length)) {
+    return FALSE;
+  }
+
+  unsigned int nrentries = 0;
+  for (unsigned int i = 0; i < nrbins; i++) { if (bins[i]) { nrentries++; } }
+  histogram.entries = new uint32_t[nrentries * 2];
+  histogram.nrentries = 0;
+  for (unsigned int i = 0; i < nrbins; i++) {
+    if (bins[i] == 0) { continue; }
+    histogram.entries[histogram.nrentries * 2] = i;
+    histogram.entries[histogram.nrentries * 2 + 1] = bins[i];
+    histogram.nrentries++;
+  }
+  return TRUE;
+}
+
+// Counts the voxels of one brick of a cvr_histogram_job. Called from
+// CvrParallel::run(), and so only touches the result slots for its own
+// brick.
+//
+// For a store which is not resident, the brick is copied out through
+// copyRegion().
+void
+CvrVoxelStore::histogramBrickCB(void * closure, unsigned int jobidx)
+{
+  cvr_histogram_job * job = (cvr_histogram_job *)closure;
+  CvrVoxelStore * thisp = job->owner;
+  const size_t bpv = thisp->bytesprvoxel;
+
+  const SbBox3i32 region = thisp->brickRegion(job->bricks[jobidx]);
+  SbVec3i32 bmin, bmax;
+  region.getBounds(bmin, bmax);
+  const SbVec3i32 bdims = bmax - bmin;
+
+  const uint8_t * voxels;
+  SbVec3i32 bufferdims;
+  uint8_t * copy = NULL;
+  if (thisp->residentvoxels) {
+    const SbVec3i32 & dims = thisp->residentdims;
+    voxels = thisp->residentvoxels +
+      (((size_t)bmin[2] * dims[1] + bmin[1]) * dims[0] + bmin[0]) * bpv;
+    bufferdims = dims;
+  }
+  else {
+    copy = new uint8_t[(size_t)bdims[0] * bdims[1] * bdims[2] * bpv];
+    thisp->copyRegion(region, copy);
+    voxels = copy;
+    bufferdims = bdims;
+  }
+
+  const unsigned int length = job->length;
+  const unsigned int nrsets = (thisp->datatype == SoVolumeData::UNSIGNED_BYTE) ? 4 : 1;
+  uint32_t * bins = new uint32_t[length * nrsets];
+  (void)memset(bins, 0, length * nrsets * sizeof(uint32_t));
+
+  for (int32_t z = 0; z < bdims[2]; z++) {
+    for (int32_t y = 0; y < bdims[1]; y++) {
+      const uint8_t * row =
+        voxels + (((size_t)z * bufferdims[1] + y) * bufferdims[0]) * bpv;
+      switch (thisp->datatype) {
+      case SoVolumeData::UNSIGNED_BYTE:
+        cvr_count_uint8(row, bdims[0], bins);
+        break;
+      case SoVolumeData::UNSIGNED_SHORT:
+        cvr_count_uint16((const uint16_t *)row, bdims[0], 0, bins);
+        break;
+      case SoVolumeData::SIGNED_SHORT:
+        cvr_count_uint16((const uint16_t *)row, bdims[0], 0x8000, bins);
+        break;
+      case SoVolumeData::FLOAT:
+        for (int32_t x = 0; x < bdims[0]; x++) {
+          bins[CvrVoxelStore::voxelToIndex(row, x, SoVolumeData::FLOAT,
+                                           job->offset, job->scale)]++;
+        }
+        break;
+      default: assert(FALSE); break;
+      }
+    }
+  }
+  delete[] copy;
+
+  for (unsigned int set = 1; set < nrsets; set++) {
+    for (unsigned int i = 0; i < length; i++) { bins[i] += bins[set * length + i]; }
+  }
+
+  unsigned int nrentries = 0;
+  for (unsigned int i = 0; i < length; i++) { if (bins[i]) { nrentries++; } }
+  uint32_t * entries = new uint32_t[nrentries * 2];
+  unsigned int e = 0;
+  for (unsigned int i = 0; i < length; i++) {
+    if (bins[i] == 0) { continue; }
+    entries[e++] = i;
+    entries[e++] = bins[i];
+  }
+  delete[] bins;
+
+  job->entries[jobidx] = entries;
+  job->nrentries[jobidx] = nrentries;
+}
+
+// Throws out all brick histograms.
+void
+CvrVoxelStore::clearHistograms(void)
+{
+  const size_t nrbricks =
+    (size_t)this->nrbricks[0] * this->nrbricks[1] * this->nrbricks[2];
+  for (size_t i = 0; i < nrbricks; i++) {
+    delete[] this->brickhistograms[i].entries;
+    this->brickhistograms[i].entries = NULL;
+    this->brickhistograms[i].nrentries = 0;
+  }
+  this->histogrambytes = 0;
+  delete[] this->totalhistogram;
+  this->totalhistogram = NULL;
+  this->totalhistogramlength = 0;
+}
+
+// Copies the voxels within "region" to "output", which must have room
+// for the full region. The minimum corner of "region" is inclusive,
+// the maximum corner is exclusive (i.e. the same convention as used
+// for the "cutcube" boxes elsewhere in the library).
+void
+CvrVoxelStore::copyRegion(const SbBox3i32 & region, void * output)
+{
+  SbVec3i32 rmin, rmax;
+  region.getBounds(rmin, rmax);
+
+  for (unsigned int i = 0; i < 3; i++) {
+    assert(rmin[i] >= 0 && rmin[i] < rmax[i] && rmax[i] <= this->dimensions[i]);
+  }
+
+  const size_t bpv = this->bytesprvoxel;
+  const size_t outw = rmax[0] - rmin[0];
+  const size_t outh = rmax[1] - rmin[1];
+  uint8_t * outptr = (uint8_t *)output;
+
+  if (this->residentvoxels) {
+    const size_t dimx = this->residentdims[0];
+    const size_t dimy = this->residentdims[1];
+    for (int32_t z = rmin[2]; z < rmax[2]; z++) {
+      for (int32_t y = rmin[1]; y < rmax[1]; y++) {
+        const uint8_t * src =
+          this->residentvoxels + ((z * dimy + y) * dimx + rmin[0]) * bpv;
+        uint8_t * dst = outptr + (((z - rmin[2]) * outh + (y - rmin[1])) * outw) * bpv;
+        (void)memcpy(dst, src, outw * bpv);
+      }
+    }
+    return;
+  }
+
+  // Visit each brick overlapping the region, and copy out the
+  // intersecting part. Each brick is pinned in the cache while it is
+  // copied from, and let go of before the next one is fetched.
+
+  if (this->packedbricks || this->reducedfrom) { this->fetchBricks(region); }
+
+  const SbVec3i32 & bs = this->bricksize;
+  for (int32_t bz = rmin[2] / bs[2]; bz <= (rmax[2] - 1) / bs[2]; bz++) {
+    for (int32_t by = rmin[1] / bs[1]; by <= (rmax[1] - 1) / bs[1]; by++) {
+      for (int32_t bx = rmin[0] / bs[0]; bx <= (rmax[0] - 1) / bs[0]; bx++) {
+        const SbVec3i32 brickidx(bx, by, bz);
+        Brick * brick = this->getBrick(brickidx);
+        const SbVec3i32 bmin(bx * bs[0], by * bs[1], bz * bs[2]);
+        const SbVec3i32 & bdims = brick->dimensions;
+
+        SbVec3i32 cmin, cmax;
+        for (unsigned int i = 0; i < 3; i++) {
+          cmin[i] = SbMax(rmin[i], bmin[i]);
+          cmax[i] = SbMin(rmax[i], bmin[i] + bdims[i]);
+        }
+
+        const size_t rowbytes = (cmax[0] - cmin[0]) * bpv;
+        for (int32_t z = cmin[2]; z < cmax[2]; z++) {
+          for (int32_t y = cmin[1]; y < cmax[1]; y++) {
+            const uint8_t * src = brick->voxels +
+              (((size_t)(z - bmin[2]) * bdims[1] + (y - bmin[1])) * bdims[0] +
+               (cmin[0] - bmin[0])) * bpv;
+            uint8_t * dst = outptr +
+              (((size_t)(z - rmin[2]) * outh + (y - rmin[1])) * outw +
+               (cmin[0] - rmin[0])) * bpv;
+            (void)memcpy(dst, src, rowbytes);
+          }
+        }
+        this->unpinBrick(brick);
+      }
+    }
+  }
+}
+
+// *************************************************************************
+
+// Returns a new chunk with the voxels of the given sub-cube. Caller
+// is responsible for deallocating it.
+//
+// If the reader can hand back a pointer into its own storage for the
+// sub-cube, the chunk will just wrap that, without copying any voxels.
+CvrVoxelChunk *
+CvrVoxelStore::buildSubCube(const SbBox3i32 & cutcube)
+{
+  SbVec3i32 ccmin, ccmax;
+  cutcube.getBounds(ccmin, ccmax);
+
+  CvrVoxelChunk * output;
+  const void * voxels = this->getVoxelPointer(cutcube);
+  if (voxels) {
+    output = new CvrVoxelChunk(ccmax - ccmin, this->bytesprvoxel, voxels);
+  }
+  else {
+    output = new CvrVoxelChunk(ccmax - ccmin, this->bytesprvoxel);
+    this->copyRegion(cutcube, (void *)output->getBuffer());
+  }
+
+  if (this->gradients && this->gradientsdirty.isEmpty()) {
+    const size_t idx =
+      ((size_t)ccmin[2] * this->dimensions[1] + ccmin[1]) * this->dimensions[0] + ccmin[0];
+    output->setGradients(this->gradients + idx * 3, this->dimensions);
+  }
+  return output;
+}
+
+// Returns a new chunk with the voxels of the given sub-page, with the
+// one-voxel border used to avoid seams between 2D texture tiles.
+//
+// Only the region of the volume needed for the page (plus border) is
+// pulled in, and the actual cut is then done by
+// CvrVoxelChunk::buildSubPage() on that smaller chunk.
+CvrVoxelChunk *
+CvrVoxelStore::buildSubPage(const unsigned int axisidx, const int pageidx,
+                            const SbBox2i32 & cutslice)
+{
+  const SbBox3i32 pageregion = this->getPageRegion(axisidx, pageidx, cutslice);
+  SbVec3i32 rmin, rmax;
+  pageregion.getBounds(rmin, rmax);
+  CvrVoxelChunk * region = this->buildSubCube(pageregion);
+
+  // Which volume axes the horizontal and vertical axis of the cut
+  // slice maps to. See CvrVoxelChunk::buildSubPage[X|Y|Z]().
+  static const unsigned int horizaxis[3] = { 2, 0, 0 };
+  static const unsigned int vertaxis[3] = { 1, 2, 1 };
+  const unsigned int h = horizaxis[axisidx];
+  const unsigned int v = vertaxis[axisidx];
+
+  SbVec2i32 ssmin, ssmax;
+  cutslice.getBounds(ssmin, ssmax);
+  const SbBox2i32 localcut(ssmin[0] - rmin[h], ssmin[1] - rmin[v],
+                         ssmax[0] - rmin[h], ssmax[1] - rmin[v]);
+  CvrVoxelChunk * output = region->buildSubPage(axisidx, 0, localcut);
+  delete region;
+  return output;
+}
+
+// Returns the region of the volume holding the voxels of the given
+// sub-page, including its border.
+SbBox3i32
+CvrVoxelStore::getPageRegion(const unsigned int axisidx, const int pageidx,
+                             const SbBox2i32 & cutslice) const
+{
+  assert(axisidx < 3);
+  assert(pageidx >= 0 && pageidx < this->dimensions[axisidx]);
+
+  static const unsigned int horizaxis[3] = { 2, 0, 0 };
+  static const unsigned int vertaxis[3] = { 1, 2, 1 };
+  const unsigned int h = horizaxis[axisidx];
+  const unsigned int v = vertaxis[axisidx];
+
+  SbVec2i32 ssmin, ssmax;
+  cutslice.getBounds(ssmin, ssmax);
+
+  SbVec3i32 rmin, rmax;
+  rmin[axisidx] = pageidx;
+  rmax[axisidx] = pageidx + 1;
+  rmin[h] = SbMax(0, ssmin[0] - 1);
+  rmax[h] = SbMin(this->dimensions[h], ssmax[0] + 1);
+  rmin[v] = SbMax(0, ssmin[1] - 1);
+  rmax[v] = SbMin(this->dimensions[v], ssmax[1] + 1);
+  return SbBox3i32(rmin, rmax);
+}
+
+// *************************************************************************
+
+// Computes the gradients of all voxels, for lit rendering, unless
+// that is already done. After updateRegion(), only the gradients
+// around the changed region are computed again. Chunks made by
+// buildSubCube() from then on share the result, so the gradients are
+// right also at the edges of the chunks.
+//
+// The gradients take 3 bytes per voxel, which are counted against
+// the memory limit of the brick cache. Bricks are thrown out to make
+// room for them. They are not made if they would take more than half
+// the limit, leaving too little for the bricks they are computed
+// from, or if they do not fit beside the bricks in use. FALSE is then
+// returned, and each chunk finds the gradients from its own voxels.
+//
+// Must not be called while texture chunks are being transferred from
+// other threads.
+SbBool
+CvrVoxelStore::buildGradients(void)
+{
+  if (this->gradients == NULL) {
+    const size_t nrbytes = (size_t)this->dimensions[0] *
+      this->dimensions[1] * this->dimensions[2] * 3;
+    {
+      SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+      const size_t limit = CvrVoxelStore::getMemoryLimit();
+      if (nrbytes > limit / 2) { return FALSE; }
+      CvrVoxelStore::makeRoomFor(nrbytes);
+      if (CvrVoxelStore::residentbytes + nrbytes > limit) { return FALSE; }
+      CvrVoxelStore::residentbytes += nrbytes;
+      this->gradientbytes = nrbytes;
+      this->gradients = new uint8_t[nrbytes];
+      this->gradientsdirty.setBounds(SbVec3i32(0, 0, 0), this->dimensions);
+    }
+
+    if (CvrUtil::doDebugging()) {
+      SoDebugError::postInfo("CvrVoxelStore::buildGradients",
+                             "computing gradients of <%d, %d, %d> voxels",
+                             this->dimensions[0], this->dimensions[1],
+                             this->dimensions[2]);
+    }
+  }
+
+  if (!this->gradientsdirty.isEmpty()) {
+    this->computeGradients(this->gradientsdirty);
+    this->gradientsdirty.makeEmpty();
+  }
+  return TRUE;
+}
+
+// Frees the gradients, and takes their memory out of the brick
+// cache's count. The cache mutex must be held.
+void
+CvrVoxelStore::releaseGradients(void)
+{
+  if (this->gradients == NULL) { return; }
+  assert(CvrVoxelStore::residentbytes >= this->gradientbytes);
+  CvrVoxelStore::residentbytes -= this->gradientbytes;
+  this->gradientbytes = 0;
+  delete[] this->gradients;
+  this->gradients = NULL;
+}
+
+// Computes the gradients within "region", spread over the CvrParallel
+// threads by slabs of slices.
+void
+CvrVoxelStore::computeGradients(const SbBox3i32 & region)
+{
+  cvr_gradient_job job;
+  job.owner = this;
+  region.getBounds(job.rmin, job.rmax);
+  const unsigned int nrslabs =
+    (job.rmax[2] - job.rmin[2] + CVR_GRADIENT_SLAB_SLICES - 1) / CVR_GRADIENT_SLAB_SLICES;
+  CvrParallel::run(nrslabs, CvrVoxelStore::gradientSlabCB, &job);
+}
+
+// Computes the gradients of one slab of a cvr_gradient_job. Called
+// from CvrParallel::run(), and so only writes to the gradients of its
+// own slab.
+void
+CvrVoxelStore::gradientSlabCB(void * closure, unsigned int jobidx)
+{
+  cvr_gradient_job * job = (cvr_gradient_job *)closure;
+  CvrVoxelStore * store = job->owner;
+  const SbVec3i32 & dims = store->dimensions;
+
+  int cmin[3], cmax[3];
+  for (unsigned int i = 0; i < 3; i++) {
+    cmin[i] = job->rmin[i];
+    cmax[i] = job->rmax[i];
+  }
+  cmin[2] += jobidx * CVR_GRADIENT_SLAB_SLICES;
+  cmax[2] = SbMin(cmax[2], cmin[2] + CVR_GRADIENT_SLAB_SLICES);
+
+  // Read the slab, with its one voxel border where that is within
+  // the volume.
+  SbVec3i32 readmin, readmax;
+  for (unsigned int i = 0; i < 3; i++) {
+    readmin[i] = SbMax(cmin[i] - 1, 0);
+    readmax[i] = SbMin(cmax[i] + 1, dims[i]);
+  }
+  const unsigned int rw = readmax[0] - readmin[0];
+  const unsigned int rh = readmax[1] - readmin[1];
+  const unsigned int rd = readmax[2] - readmin[2];
+  uint8_t * voxels = new uint8_t[(size_t)rw * rh * rd * store->bytesprvoxel];
+  store->copyRegion(SbBox3i32(readmin, readmax), voxels);
+
+  // Convert to floats, padded by one value on all sides. Outside the
+  // volume, the edge voxels are repeated, as CvrGradient clamps its
+  // lookups.
+  const unsigned int pw = cmax[0] - cmin[0] + 2;
+  const unsigned int ph = cmax[1] - cmin[1] + 2;
+  const unsigned int pd = cmax[2] - cmin[2] + 2;
+  float * values = new float[(size_t)pw * ph * pd];
+  float * rowvalues = new float[rw];
+  for (unsigned int pz = 0; pz < pd; pz++) {
+    const int sz = SbClamp(cmin[2] - 1 + (int)pz, 0, dims[2] - 1) - readmin[2];
+    for (unsigned int py = 0; py < ph; py++) {
+      const int sy = SbClamp(cmin[1] - 1 + (int)py, 0, dims[1] - 1) - readmin[1];
+      cvr_voxel_row_to_float(voxels, ((size_t)sz * rh + sy) * rw, rw,
+                             store->datatype, rowvalues);
+      float * dst = values + ((size_t)pz * ph + py) * pw;
+      for (unsigned int px = 0; px < pw; px++) {
+        const int sx = SbClamp(cmin[0] - 1 + (int)px, 0, dims[0] - 1) - readmin[0];
+        dst[px] = rowvalues[sx];
+      }
+    }
+  }
+  delete[] rowvalues;
+  delete[] voxels;
+
+  for (int z = cmin[2]; z < cmax[2]; z++) {
+    for (int y = cmin[1]; y < cmax[1]; y++) {
+      const float * c =
+        values + ((size_t)(z - cmin[2] + 1) * ph + (y - cmin[1] + 1)) * pw + 1;
+      uint8_t * out = store->gradients +
+        (((size_t)z * dims[1] + y) * dims[0] + cmin[0]) * 3;
+      cvr_gradient_row(c, pw, (size_t)pw * ph, cmax[0] - cmin[0], out);
+    }
+  }
+  delete[] values;
+}
+
+// *************************************************************************
+
+// Returns the store for the given level of the resolution pyramid,
+// where level 0 is this store itself. Levels are set up on first
+// request, each one reduced from the previous level by the given
+// method as its bricks are needed. If a different method is asked
+// for than what the current levels were set up with, they are all
+// thrown out.
+//
+// Levels above getNrOfLevels() - 1 are clamped to the coarsest level.
+CvrVoxelStore *
+CvrVoxelStore::getLevel(unsigned int level, SoVolumeData::SubMethod method)
+{
+  if (level == 0) { return this; }
+  level = SbMin(level, this->getNrOfLevels() - 1);
+  if (level == 0) { return this; }
+
+  if (method != this->levelmethod) {
+    this->flushLevels();
+    this->levelmethod = method;
+  }
+
+  while ((unsigned int)this->levels.getLength() < level) {
+    const int nrlevels = this->levels.getLength();
+    CvrVoxelStore * reduced = this->loadLevel(nrlevels + 1, method);
+    if (reduced == NULL) {
+      CvrVoxelStore * src = (nrlevels == 0) ? this : this->levels[nrlevels - 1];
+      reduced = src->buildReducedStore(method);
+    }
+    this->levels.append(reduced);
+  }
+  return this->levels[level - 1];
+}
+
+// Returns a store for the given pyramid level read from the
+// precomputed levels of a bricked file, or NULL if the file does not
+// have that level, or if its levels were built by another method.
+// Nothing is read here: the bricks of the level are read into the
+// brick cache when they are needed.
+CvrVoxelStore *
+CvrVoxelStore::loadLevel(unsigned int level, SoVolumeData::SubMethod method)
+{
+  if ((this->brickreader == NULL) || this->packedbricks) { return NULL; }
+  if (!this->readlevels) { return NULL; }
+  if (this->brickreader->getLevelMethod() != method) { return NULL; }
+  if (level >= this->brickreader->getNumLevels()) { return NULL; }
+
+  SbBox3i32 volume(SbVec3i32(0, 0, 0), this->dimensions);
+  const SbVec3s reqlevel(level, level, level);
+  SbVec3s gotlevel;
+  SoVolumeReader::CopyPolicy policy;
+  {
+    SbThreadAutoLock lock(&this->readermutex);
+    if (!this->reader->getSubVolumeInfo(volume, reqlevel, gotlevel, policy) ||
+        (gotlevel != reqlevel) ||
+        (policy != SoVolumeReader::NO_COPY_AND_DELETE)) {
+      return NULL;
+    }
+  }
+
+  if (CvrUtil::doDebugging()) {
+    SoDebugError::postInfo("CvrVoxelStore::loadLevel",
+                           "reading precomputed level %u from file", level);
+  }
+
+  return new CvrVoxelStore(this, level);
+}
+
+// Returns the number of levels in the resolution pyramid, including
+// level 0. The coarsest level has dimensions 1x1x1.
+unsigned int
+CvrVoxelStore::getNrOfLevels(void) const
+{
+  const int32_t maxdim =
+    SbMax(this->dimensions[0], SbMax(this->dimensions[1], this->dimensions[2]));
+  unsigned int nrlevels = 1;
+  while ((1u << (nrlevels - 1)) < (uint32_t)maxdim) { nrlevels++; }
+  return nrlevels;
+}
+
+// Returns the dimensions of a volume of the given dimensions, at the
+// given pyramid level.
+SbVec3i32
+CvrVoxelStore::getLevelDimensions(const SbVec3i32 & dimensions, unsigned int level)
+{
+  assert(level < 31);
+  SbVec3i32 ldims;
+  for (unsigned int i = 0; i < 3; i++) {
+    const int32_t step = 1 << level;
+    ldims[i] = SbMax(1, (dimensions[i] + step - 1) / step);
+  }
+  return ldims;
+}
+
+// Converts a region in level 0 voxel coordinates to the region
+// covering it at the given pyramid level.
+SbBox3i32
+CvrVoxelStore::getLevelRegion(const SbBox3i32 & region, unsigned int level)
+{
+  assert(level < 31);
+  SbVec3i32 rmin, rmax;
+  region.getBounds(rmin, rmax);
+
+  const int32_t step = 1 << level;
+  for (unsigned int i = 0; i < 3; i++) {
+    rmin[i] = rmin[i] / step;
+    rmax[i] = SbMax(rmin[i] + 1, (rmax[i] + step - 1) / step);
+  }
+  return SbBox3i32(rmin, rmax);
+}
+
+// Returns a store for the next level of the resolution pyramid of
+// this store, where each 2x2x2 block of voxels is reduced to one.
+// Along axes of odd size, the last block is only partially covered.
+//
+// The level is not resident: its bricks are reduced when they are
+// loaded into the brick cache, and so count towards the cache's
+// memory limit, and can be evicted and reduced again like any other
+// bricks.
+CvrVoxelStore *
+CvrVoxelStore::buildReducedStore(SoVolumeData::SubMethod method)
+{
+  if (CvrUtil::doDebugging()) {
+    const SbVec3i32 & dims = this->dimensions;
+    const SbVec3i32 rdims = CvrVoxelStore::getLevelDimensions(dims, 1);
+    SoDebugError::postInfo("CvrVoxelStore::buildReducedStore",
+                           "reducing <%d, %d, %d> to <%d, %d, %d> (method %d)",
+                           dims[0], dims[1], dims[2],
+                           rdims[0], rdims[1], rdims[2], (int)method);
+  }
+
+  return new CvrVoxelStore(this, method);
+}
+
+// Reduces the voxels of this store to the voxels within "region" of
+// the next level of the resolution pyramid, which are written to
+// "output", holding just the region.
+//
+// The source voxels are pulled in two slices at a time, through the
+// brick cache if this store is not resident.
+void
+CvrVoxelStore::reduceRegion(SoVolumeData::SubMethod method,
+                            const SbBox3i32 & region, uint8_t * output)
+{
+  const SbVec3i32 & dims = this->dimensions;
+  const size_t bpv = this->bytesprvoxel;
+
+  SbVec3i32 rmin, rmax;
+  region.getBounds(rmin, rmax);
+  const size_t outw = rmax[0] - rmin[0];
+  const size_t outh = rmax[1] - rmin[1];
+
+  // The part of this store covered by the region, pulled in two
+  // slices at a time.
+  const int32_t sx0 = rmin[0] * 2, sx1 = SbMin(rmax[0] * 2, dims[0]);
+  const int32_t sy0 = rmin[1] * 2, sy1 = SbMin(rmax[1] * 2, dims[1]);
+  const size_t rowlen = sx1 - sx0;
+  const size_t slicelen = rowlen * (sy1 - sy0);
+  uint8_t * slab = new uint8_t[slicelen * 2 * bpv];
+
+  for (int32_t rz = rmin[2]; rz < rmax[2]; rz++) {
+    const int32_t z0 = rz * 2;
+    const int32_t nz = SbMin(2, dims[2] - z0);
+    this->copyRegion(SbBox3i32(sx0, sy0, z0, sx1, sy1, z0 + nz), slab);
+
+    for (int32_t ry = rmin[1]; ry < rmax[1]; ry++) {
+      const int32_t y0 = ry * 2;
+      const int32_t ny = SbMin(2, dims[1] - y0);
+      size_t dstidx = ((size_t)(rz - rmin[2]) * outh + (ry - rmin[1])) * outw;
+
+      for (int32_t rx = rmin[0]; rx < rmax[0]; rx++) {
+        const int32_t x0 = rx * 2;
+        const int32_t nx = SbMin(2, dims[0] - x0);
+
+        if (method == SoVolumeData::NEAREST) {
+          const size_t idx = (size_t)(y0 - sy0) * rowlen + (x0 - sx0);
+          (void)memcpy(output + dstidx * bpv, slab + idx * bpv, bpv);
+          dstidx++;
+          continue;
+        }
+
+        double sum = 0.0, maxval = -DBL_MAX;
+        for (int32_t z = 0; z < nz; z++) {
+          for (int32_t y = 0; y < ny; y++) {
+            const size_t idx =
+              z * slicelen + (size_t)(y0 - sy0 + y) * rowlen + (x0 - sx0);
+            for (int32_t x = 0; x < nx; x++) {
+              double v;
+              switch (this->datatype) {
+              case SoVolumeData::UNSIGNED_BYTE: v = slab[idx + x]; break;
+              case SoVolumeData::UNSIGNED_SHORT: v = ((uint16_t *)slab)[idx + x]; break;
+              case SoVolumeData::SIGNED_SHORT: v = ((int16_t *)slab)[idx + x]; break;
+              case SoVolumeData::FLOAT: v = ((float *)slab)[idx + x]; break;
+              default: assert(FALSE); v = 0.0; break;
+              }
+              sum += v;
+              maxval = SbMax(maxval, v);
+            }
+          }
+        }
+        const double result = (method == SoVolumeData::MAX) ?
+          maxval : (sum / (nx * ny * nz));
+
+        switch (this->datatype) {
+        case SoVolumeData::UNSIGNED_BYTE:
+          output[dstidx] = (uint8_t)floor(result + 0.5);
+          break;
+        case SoVolumeData::UNSIGNED_SHORT:
+          ((uint16_t *)output)[dstidx] = (uint16_t)floor(result + 0.5);
+          break;
+        case SoVolumeData::SIGNED_SHORT:
+          ((int16_t *)output)[dstidx] = (int16_t)floor(result + 0.5);
+          break;
+        case SoVolumeData::FLOAT:
+          ((float *)output)[dstidx] = (float)result;
+          break;
+        default: assert(FALSE); break;
+        }
+        dstidx++;
+      }
+    }
+  }
+
+  delete[] slab;
+}
+
+void
+CvrVoxelStore::flushLevels(void)
+{
+  // Each level reduces its bricks from the one below, so the coarsest
+  // levels go first.
+  for (int i = this->levels.getLength() - 1; i >= 0; i--) { delete this->levels[i]; }
+  this->levels.truncate(0);
+}
+
+// *************************************************************************
+
+// Throws out all cached bricks of this store, and all levels of the
+// resolution pyramid. Should be called when the underlying voxel data
+// has changed.
+//
+// A compressed store holds its own copy of the voxels, so for such a
+// store this only throws out the decompressed bricks.
+void
+CvrVoxelStore::flush(void)
+{
+  SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+  this->generation++;
+
+  SbPList keys, values;
+  this->brickdict->makePList(keys, values);
+  for (int i = 0; i < values.getLength(); i++) {
+    this->releaseBrick((Brick *)values[i]);
+  }
+  this->brickdict->clear();
+
+  this->flushLevels();
+  this->readlevels = TRUE;
+
+  if (this->packedbricks) { return; }
+
+  this->releaseGradients();
+
+  const size_t nrranges =
+    (size_t)this->nrbricks[0] * this->nrbricks[1] * this->nrbricks[2];
+  for (size_t i = 0; i < nrranges; i++) { this->brickranges[i].valid = FALSE; }
+  this->totalrange.valid = FALSE;
+  this->readRanges();
+  this->clearHistograms();
+}
+
+// Throws out the cached bricks overlapping "region", along with their
+// value ranges and histograms, and the bricks covering the region in
+// the levels of the resolution pyramid which have been set up. This
+// is what flush() does for the complete volume, for when only the
+// voxels within the region have changed.
+//
+// The value ranges of a compressed store are kept, as they are found
+// when the bricks are compressed.
+void
+CvrVoxelStore::flushRegion(const SbBox3i32 & region)
+{
+  SbVec3i32 rmin, rmax;
+  region.getBounds(rmin, rmax);
+  for (unsigned int i = 0; i < 3; i++) {
+    rmin[i] = SbMax(rmin[i], 0);
+    rmax[i] = SbMin(rmax[i], this->dimensions[i]);
+    if (rmin[i] >= rmax[i]) { return; }
+  }
+
+  SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+  this->generation++;
+
+  const SbVec3i32 & bs = this->bricksize;
+  for (int32_t bz = rmin[2] / bs[2]; bz <= (rmax[2] - 1) / bs[2]; bz++) {
+    for (int32_t by = rmin[1] / bs[1]; by <= (rmax[1] - 1) / bs[1]; by++) {
+      for (int32_t bx = rmin[0] / bs[0]; bx <= (rmax[0] - 1) / bs[0]; bx++) {
+        const uintptr_t key = this->brickKey(SbVec3i32(bx, by, bz));
+        void * ptr;
+        if (this->brickdict->find(key, ptr)) {
+          const SbBool ok = this->brickdict->remove(key);
+          assert(ok);
+          this->releaseBrick((Brick *)ptr);
+        }
+        if (this->packedbricks == NULL) { this->brickranges[key].valid = FALSE; }
+        BrickHistogram & histogram = this->brickhistograms[key];
+        if (histogram.entries) {
+          this->histogrambytes -= histogram.nrentries * 2 * sizeof(uint32_t);
+          delete[] histogram.entries;
+          histogram.entries = NULL;
+          histogram.nrentries = 0;
+        }
+      }
+    }
+  }
+
+  this->updateLevels(SbBox3i32(rmin, rmax));
+
+  // The gradients next to the region depend on voxels within it.
+  if (this->gradients) {
+    SbVec3i32 gmin, gmax;
+    for (unsigned int i = 0; i < 3; i++) {
+      gmin[i] = SbMax(0, rmin[i] - 1);
+      gmax[i] = SbMin(this->dimensions[i], rmax[i] + 1);
+    }
+    this->gradientsdirty.extendBy(SbBox3i32(gmin, gmax));
+  }
+
+  this->totalrange.valid = FALSE;
+  delete[] this->totalhistogram;
+  this->totalhistogram = NULL;
+}
+
+// Throws out the bricks covering "region" in each level of the
+// resolution pyramid which has been set up, so they are reduced again
+// when next needed. Levels read from a bricked file no longer match
+// the voxels, so those are thrown out completely, along with the
+// levels above them, and are reduced from now on.
+void
+CvrVoxelStore::updateLevels(const SbBox3i32 & region)
+{
+  for (int i = 0; i < this->levels.getLength(); i++) {
+    CvrVoxelStore * level = this->levels[i];
+    if (level->reducedfrom == NULL) {
+      for (int j = this->levels.getLength() - 1; j >= i; j--) { delete this->levels[j]; }
+      this->levels.truncate(i);
+      this->readlevels = FALSE;
+      return;
+    }
+    level->flushRegion(CvrVoxelStore::getLevelRegion(region, i + 1));
+  }
+}
+
+// To be called when the voxels within "region" have been changed in
+// the reader (or in the resident voxels). Drops or rebuilds whatever
+// the store has derived from them, and records the region, so the
+// rendering code can find out which of its textures are out of date
+// with isUpdatedSince().
+//
+// A compressed store compresses the bricks within the region again,
+// so then the reader must still have its voxels. That is done
+// without holding the cache mutex, which is only taken to put the
+// new bricks in place.
+void
+CvrVoxelStore::updateRegion(const SbBox3i32 & region)
+{
+  SbVec3i32 rmin, rmax;
+  region.getBounds(rmin, rmax);
+  for (unsigned int i = 0; i < 3; i++) {
+    rmin[i] = SbMax(rmin[i], 0);
+    rmax[i] = SbMin(rmax[i], this->dimensions[i]);
+    if (rmin[i] >= rmax[i]) { return; }
+  }
+  const SbBox3i32 clipped(rmin, rmax);
+
+  // The bricks of a compressed store are read and compressed again
+  // before the cache mutex is taken, so other stores can be used
+  // meanwhile. A brick the reader fails to deliver is zero-filled by
+  // packBricks(), which has posted the error.
+  PackedBatch packed;
+  if (this->packedbricks) { (void)this->packBricks(clipped, packed); }
+
+  SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+  if (this->packedbricks) { this->installPackedBricks(packed); }
+  this->flushRegion(clipped);
+
+  this->updateserial++;
+  if (this->updates.getLength() == CVR_MAX_LOGGED_UPDATES) { this->updates.remove(0); }
+  Update update;
+  update.region = clipped;
+  update.serial = this->updateserial;
+  this->updates.append(update);
+}
+
+// Returns the serial number of the last update by updateRegion(), for
+// passing to isUpdatedSince() later.
+unsigned int
+CvrVoxelStore::getUpdateSerial(void) const
+{
+  return this->updateserial;
+}
+
+// Returns TRUE if any voxel within "region" may have been changed by
+// updateRegion() after getUpdateSerial() returned "serial".
+SbBool
+CvrVoxelStore::isUpdatedSince(const SbBox3i32 & region, unsigned int serial) const
+{
+  if (serial == this->updateserial) { return FALSE; }
+
+  // Updates which are no longer in the log could have been anywhere.
+  const int nrupdates = this->updates.getLength();
+  if ((nrupdates == 0) || (this->updates[0].serial > serial + 1)) { return TRUE; }
+
+  SbVec3i32 rmin, rmax;
+  region.getBounds(rmin, rmax);
+  for (int i = nrupdates - 1; (i >= 0) && (this->updates[i].serial > serial); i--) {
+    SbVec3i32 umin, umax;
+    this->updates[i].region.getBounds(umin, umax);
+    if ((rmin[0] < umax[0]) && (umin[0] < rmax[0]) &&
+        (rmin[1] < umax[1]) && (umin[1] < rmax[1]) &&
+        (rmin[2] < umax[2]) && (umin[2] < rmax[2])) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+// Takes the value range of each brick from the brick tables of a
+// bricked file, so they never have to be found by scanning voxels.
+void
+CvrVoxelStore::readRanges(void)
+{
+  if (this->brickreader == NULL) { return; }
+
+  for (int32_t z = 0; z < this->nrbricks[2]; z++) {
+    for (int32_t y = 0; y < this->nrbricks[1]; y++) {
+      for (int32_t x = 0; x < this->nrbricks[0]; x++) {
+        const SbVec3i32 brickidx(x, y, z);
+        BrickRange & range = this->brickranges[this->brickKey(brickidx)];
+        this->brickreader->getBrickMinMax(this->readerlevel, brickidx,
+                                          range.minval, range.maxval);
+        range.valid = TRUE;
+      }
+    }
+  }
+
+  // The range of a level is combined from its bricks when asked for.
+  if (this->readerlevel > 0) { return; }
+  this->brickreader->getMinMax(this->totalrange.minval, this->totalrange.maxval);
+  this->totalrange.valid = TRUE;
+}
+
+// Returns a pointer to the voxels of the given region, if the reader
+// can provide them without copying, or NULL otherwise. The pointer
+// stays valid until the reader is given new data.
+const void *
+CvrVoxelStore::getVoxelPointer(const SbBox3i32 & region)
+{
+  if ((this->reader == NULL) || this->packedbricks) { return NULL; }
+  if (this->readerlevel > 0) { return NULL; }
+
+  SbBox3i32 subvolume = region;
+  SbVec3s subsamplelevel;
+  SoVolumeReader::CopyPolicy policy;
+  SbThreadAutoLock lock(&this->readermutex);
+  if (!this->reader->getSubVolumeInfo(subvolume, SbVec3s(0, 0, 0),
+                                      subsamplelevel, policy) ||
+      (policy != SoVolumeReader::NO_COPY) ||
+      (subsamplelevel != SbVec3s(0, 0, 0))) {
+    return NULL;
+  }
+
+  void * voxels = NULL;
+  if (!this->reader->getSubVolume(region, subsamplelevel, voxels)) {
+    return NULL;
+  }
+  return voxels;
+}
+
+uintptr_t
+CvrVoxelStore::brickKey(const SbVec3i32 & brickidx) const
+{
+  return
+    ((uintptr_t)brickidx[2] * this->nrbricks[1] + brickidx[1]) *
+    this->nrbricks[0] + brickidx[0];
+}
+
+// The inverse of brickKey().
+SbVec3i32
+CvrVoxelStore::brickIndex(uintptr_t key) const
+{
+  return SbVec3i32((int32_t)(key % this->nrbricks[0]),
+                   (int32_t)((key / this->nrbricks[0]) % this->nrbricks[1]),
+                   (int32_t)(key / ((uintptr_t)this->nrbricks[0] * this->nrbricks[1])));
+}
+
+SbBox3i32
+CvrVoxelStore::brickRegion(const SbVec3i32 & brickidx) const
+{
+  SbVec3i32 bmin, bmax;
+  for (unsigned int i = 0; i < 3; i++) {
+    bmin[i] = brickidx[i] * this->bricksize[i];
+    bmax[i] = SbMin(bmin[i] + this->bricksize[i], this->dimensions[i]);
+  }
+  return SbBox3i32(bmin, bmax);
+}
+
+// Returns the brick at the given brick index, loading it through the
+// reader if it is not in the cache. The brick is pinned in the cache,
+// so it is not evicted, until it is handed back with unpinBrick().
+//
+// The cache mutex is only held while the cache is looked up and the
+// brick is put into it. The voxels are read and scanned without
+// holding it, so other threads can use the cache in the meantime.
+CvrVoxelStore::Brick *
+CvrVoxelStore::getBrick(const SbVec3i32 & brickidx)
+{
+  const uintptr_t key = this->brickKey(brickidx);
+
+  unsigned int generation;
+  SbBool scanrange;
+  {
+    SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+    Brick * brick = this->lookupBrick(key);
+    if (brick) { return brick; }
+    generation = this->generation;
+    scanrange = !this->brickranges[key].valid;
+  }
+
+  for (;;) {
+    Brick * loaded = this->newBrick(brickidx);
+    this->loadBrick(loaded, this->brickRegion(brickidx));
+
+    BrickRange range;
+    range.valid = FALSE;
+    if (scanrange) {
+      this->scanRange(range, SbBox3i32(SbVec3i32(0, 0, 0), loaded->dimensions),
+                      loaded->voxels, loaded->dimensions);
+    }
+
+    SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+    Brick * brick = this->lookupBrick(key);
+    if ((brick == NULL) && (generation == this->generation)) {
+      CvrVoxelStore::makeRoomFor(loaded->nrbytes);
+      this->insertBrick(loaded);
+      loaded->users = 1;
+
+      BrickRange & stored = this->brickranges[key];
+      if (!stored.valid && range.valid) { stored = range; }
+      return loaded;
+    }
+
+    // Another thread put the brick into the cache while we were
+    // reading it, or the store was flushed, and what we read may be
+    // out of date. In the latter case, read it again.
+    if (loaded->ownsvoxels) { delete[] loaded->voxels; }
+    delete loaded;
+    if (brick) { return brick; }
+
+    generation = this->generation;
+    scanrange = !this->brickranges[key].valid;
+  }
+}
+
+// Returns the brick with the given key, pinned, if it is in the
+// cache, or NULL otherwise. Must be called with the cache mutex
+// locked.
+CvrVoxelStore::Brick *
+CvrVoxelStore::lookupBrick(uintptr_t key)
+{
+  void * ptr;
+  if (!this->brickdict->find(key, ptr)) { return NULL; }
+
+  Brick * brick = (Brick *)ptr;
+  if (brick != CvrVoxelStore::lruhead) {
+    CvrVoxelStore::lruUnlink(brick);
+    CvrVoxelStore::lruPushFront(brick);
+  }
+  if (brick->prefetched) {
+    brick->prefetched = FALSE;
+    CvrVoxelStore::prefetchedbytes -= brick->nrbytes;
+  }
+  brick->users++;
+  return brick;
+}
+
+// Lets go of a brick returned from getBrick(). If it was thrown out
+// of the cache while pinned, it is deallocated now.
+void
+CvrVoxelStore::unpinBrick(Brick * brick)
+{
+  SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+  assert(brick->users > 0);
+  brick->users--;
+  if ((brick->users == 0) && brick->evicted) {
+    if (brick->ownsvoxels) { delete[] brick->voxels; }
+    delete brick;
+  }
+}
+
+// Returns a brick for the given brick index, with no voxels loaded.
+CvrVoxelStore::Brick *
+CvrVoxelStore::newBrick(const SbVec3i32 & brickidx)
+{
+  SbVec3i32 bmin, bmax;
+  this->brickRegion(brickidx).getBounds(bmin, bmax);
+
+  Brick * brick = new Brick;
+  brick->owner = this;
+  brick->key = this->brickKey(brickidx);
+  brick->dimensions = bmax - bmin;
+  brick->voxels = NULL;
+  brick->ownsvoxels = FALSE;
+  brick->nrbytes = 0;
+  brick->prefetched = FALSE;
+  brick->users = 0;
+  brick->evicted = FALSE;
+  brick->prev = brick->next = NULL;
+  return brick;
+}
+
+// Loads the given brick into the cache, if it is not there already,
+// and returns the number of bytes of voxels read for it. This is
+// meant to be called from a separate thread, to have bricks ready
+// before the rendering needs them.
+//
+// The voxels are read and scanned for their value range without
+// holding the cache mutex, so other threads are only held up while
+// the brick is put into the cache.
+size_t
+CvrVoxelStore::prefetchBrick(const SbVec3i32 & brickidx)
+{
+  if (this->residentvoxels) { return 0; }
+
+  const uintptr_t key = this->brickKey(brickidx);
+  unsigned int generation;
+  {
+    SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+    void * ptr;
+    if (this->brickdict->find(key, ptr)) { return 0; }
+    generation = this->generation;
+  }
+
+  Brick * brick = this->newBrick(brickidx);
+  this->loadBrick(brick, this->brickRegion(brickidx));
+  const size_t nrbytes = (size_t)brick->dimensions[0] * brick->dimensions[1] *
+    brick->dimensions[2] * this->bytesprvoxel;
+
+  // Value ranges of compressed stores and bricked files are all known
+  // up front.
+  BrickRange range;
+  range.valid = FALSE;
+  if ((this->packedbricks == NULL) && (this->brickreader == NULL)) {
+    this->scanRange(range, SbBox3i32(SbVec3i32(0, 0, 0), brick->dimensions),
+                    brick->voxels, brick->dimensions);
+  }
+
+  SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+  void * ptr;
+  if ((generation != this->generation) || this->brickdict->find(key, ptr)) {
+    // The store was flushed, or the brick was loaded for rendering
+    // while we were reading it.
+    if (brick->ownsvoxels) { delete[] brick->voxels; }
+    delete brick;
+    return 0;
+  }
+
+  CvrVoxelStore::makeRoomFor(brick->nrbytes);
+  brick->prefetched = TRUE;
+  CvrVoxelStore::prefetchedbytes += brick->nrbytes;
+  this->insertBrick(brick);
+
+  BrickRange & stored = this->brickranges[key];
+  if (!stored.valid && range.valid) { stored = range; }
+
+  return nrbytes;
+}
+
+// Puts a loaded brick into the cache. Room for it should already have
+// been made with makeRoomFor().
+void
+CvrVoxelStore::insertBrick(Brick * brick)
+{
+  CvrVoxelStore::lruPushFront(brick);
+  CvrVoxelStore::residentbytes += brick->nrbytes;
+  const SbBool newentry = this->brickdict->enter(brick->key, brick);
+  assert(newentry);
+}
+
+// Sets up the brick's voxel buffer from the reader. If the reader
+// can hand over a buffer, that is used as-is (and only counted
+// towards the cache's memory limit if we are to deallocate it),
+// otherwise the voxels are copied out through getSubVolume().
+//
+// This does not touch the cache, so the caller must make room for
+// the brick and insert it.
+void
+CvrVoxelStore::loadBrick(Brick * brick, const SbBox3i32 & region)
+{
+  SbVec3i32 bmin, bmax;
+  region.getBounds(bmin, bmax);
+
+  if (CvrUtil::doDebugging()) {
+    SoDebugError::postInfo("CvrVoxelStore::loadBrick",
+                           "loading brick [%d, %d, %d] -> [%d, %d, %d], "
+                           "%u kB resident before load",
+                           bmin[0], bmin[1], bmin[2], bmax[0], bmax[1], bmax[2],
+                           (unsigned int)(CvrVoxelStore::getResidentMemory() / 1024));
+  }
+
+  const size_t nrbytes = (size_t)brick->dimensions[0] * brick->dimensions[1] *
+    brick->dimensions[2] * this->bytesprvoxel;
+
+  if (this->packedbricks) {
+    brick->voxels = new uint8_t[nrbytes];
+    brick->ownsvoxels = TRUE;
+    brick->nrbytes = nrbytes;
+
+    const PackedBrick & packed = this->packedbricks[brick->key];
+    const SbBool ok = CvrBrickCodec::decompress(packed.data, packed.nrbytes,
+                                                this->bytesprvoxel,
+                                                brick->voxels, nrbytes);
+    assert(ok && "corrupt compressed brick");
+    return;
+  }
+
+  if (this->viewedstore) {
+    // Only the bricks of a view of a store which is not resident are
+    // loaded, and those are copied out of the viewed store's bricks.
+    brick->voxels = new uint8_t[nrbytes];
+    brick->ownsvoxels = TRUE;
+    brick->nrbytes = nrbytes;
+
+    const SbBox3i32 viewed(bmin + this->viewoffset, bmax + this->viewoffset);
+    this->viewedstore->copyRegion(viewed, brick->voxels);
+    return;
+  }
+
+  if (this->reducedfrom) {
+    brick->voxels = new uint8_t[nrbytes];
+    brick->ownsvoxels = TRUE;
+    brick->nrbytes = nrbytes;
+
+    this->reducedfrom->reduceRegion(this->reducemethod, region, brick->voxels);
+    return;
+  }
+
+  if (this->readerlevel > 0) {
+    // The reader takes the region of level 0 the brick covers, and
+    // hands over a buffer with the voxels of the level within it.
+    const CvrVoxelStore * full = this->levelof;
+    const int32_t step = 1 << this->readerlevel;
+    SbVec3i32 fmin, fmax;
+    for (unsigned int i = 0; i < 3; i++) {
+      fmin[i] = bmin[i] * step;
+      fmax[i] = SbMin(bmax[i] * step, full->dimensions[i]);
+    }
+    const short l = (short)this->readerlevel;
+
+    SbThreadAutoLock lock(&this->levelof->readermutex);
+    void * voxels = NULL;
+    const SbBool ok =
+      this->reader->getSubVolume(SbBox3i32(fmin, fmax), SbVec3s(l, l, l), voxels);
+    assert(ok && "reader failed to deliver sub-volume");
+    brick->voxels = (uint8_t *)voxels;
+    brick->ownsvoxels = TRUE;
+    brick->nrbytes = nrbytes;
+    return;
+  }
+
+  SbThreadAutoLock lock(&this->readermutex);
+
+  SbBox3i32 subvolume = region;
+  SbVec3s subsamplelevel;
+  SoVolumeReader::CopyPolicy policy = SoVolumeReader::COPY;
+  const SbBool info =
+    this->reader->getSubVolumeInfo(subvolume, SbVec3s(0, 0, 0),
+                                   subsamplelevel, policy) &&
+    (subsamplelevel == SbVec3s(0, 0, 0));
+
+  if (info && (policy != SoVolumeReader::COPY)) {
+    void * voxels = NULL;
+    if (this->reader->getSubVolume(region, subsamplelevel, voxels)) {
+      brick->voxels = (uint8_t *)voxels;
+      brick->ownsvoxels = (policy == SoVolumeReader::NO_COPY_AND_DELETE);
+      brick->nrbytes = brick->ownsvoxels ? nrbytes : 0;
+      return;
+    }
+  }
+
+  brick->voxels = new uint8_t[nrbytes];
+  brick->ownsvoxels = TRUE;
+  brick->nrbytes = nrbytes;
+
+  const SbBool ok = this->reader->getSubVolume(subvolume, brick->voxels);
+  assert(ok && "reader failed to deliver sub-volume");
+}
+
+// Scans the value range of a freshly loaded brick, if it has not
+// been recorded before.
+void
+CvrVoxelStore::recordRange(const Brick * brick)
+{
+  BrickRange & range = this->brickranges[brick->key];
+  if (range.valid) { return; }
+  const SbBox3i32 region(SbVec3i32(0, 0, 0), brick->dimensions);
+  this->scanRange(range, region, brick->voxels, brick->dimensions);
+}
+
+// *************************************************************************
+
+// Converts the store to keep all bricks compressed in memory. Each
+// brick is read once from the resident voxels or the reader, and
+// after this the store does not access either of them again, so the
+// voxel buffer they hold can be released.
+//
+// The compression is spread over several threads, and is done
+// without holding the cache mutex, so other stores can be used in
+// the meantime. The compressed bricks are put into the store at the
+// end.
+//
+// Returns FALSE, and leaves the store uncompressed, if the reader
+// failed to deliver any of the bricks.
+SbBool
+CvrVoxelStore::compress(void)
+{
+  if (this->packedbricks) { return TRUE; }
+
+  PackedBatch packed;
+  if (!this->packBricks(SbBox3i32(SbVec3i32(0, 0, 0), this->dimensions), packed)) {
+    CvrVoxelStore::freePackedBricks(packed);
+    return FALSE;
+  }
+
+  SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+  this->flush();
+
+  const size_t nrpacked =
+    (size_t)this->nrbricks[0] * this->nrbricks[1] * this->nrbricks[2];
+  this->packedbricks = new PackedBrick[nrpacked];
+  for (size_t i = 0; i < nrpacked; i++) {
+    this->packedbricks[i].data = NULL;
+    this->packedbricks[i].nrbytes = 0;
+  }
+  this->packedbytes = 0;
+  this->installPackedBricks(packed);
+
+  this->residentvoxels = NULL;
+  this->totalrange.valid = FALSE;
+
+  if (CvrUtil::doDebugging()) {
+    const size_t rawbytes = (size_t)this->dimensions[0] * this->dimensions[1] *
+      this->dimensions[2] * this->bytesprvoxel;
+    SoDebugError::postInfo("CvrVoxelStore::compress",
+                           "compressed %u kB of voxels to %u kB (%.1f%%)",
+                           (unsigned int)(rawbytes / 1024),
+                           (unsigned int)(this->packedbytes / 1024),
+                           100.0 * this->packedbytes / SbMax(rawbytes, (size_t)1));
+  }
+  return TRUE;
+}
+
+// Compresses the bricks overlapping "region" into "packed", along
+// with their value ranges. The voxels are read from where the store
+// had them before it was compressed, so after compress() this only
+// works for stores with a reader.
+//
+// Must be called without holding the cache mutex. The store itself
+// is left as it is.
+//
+// If the reader fails to deliver a brick, an error is posted, the
+// brick is made of zero voxels, and FALSE is returned.
+SbBool
+CvrVoxelStore::packBricks(const SbBox3i32 & region, PackedBatch & packed)
+{
+  SbVec3i32 rmin, rmax;
+  region.getBounds(rmin, rmax);
+  const SbVec3i32 & bs = this->bricksize;
+  SbList<uintptr_t> keys;
+  for (int32_t bz = rmin[2] / bs[2]; bz <= (rmax[2] - 1) / bs[2]; bz++) {
+    for (int32_t by = rmin[1] / bs[1]; by <= (rmax[1] - 1) / bs[1]; by++) {
+      for (int32_t bx = rmin[0] / bs[0]; bx <= (rmax[0] - 1) / bs[0]; bx++) {
+        keys.append(this->brickKey(SbVec3i32(bx, by, bz)));
+      }
+    }
+  }
+
+  // Bricks are pulled in sequentially, as the reader is not expected
+  // to be thread-safe, a batch at a time to bound the memory used.
+  const unsigned int batchsize = 4 * CvrParallel::getNrOfThreads();
+  cvr_brick_batch batch;
+  batch.owner = this;
+  batch.packed = &packed;
+  batch.firstpacked = packed.keys.getLength();
+  SbBool allread = TRUE;
+
+  for (int k = 0; k < keys.getLength(); k++) {
+    const uintptr_t key = keys[k];
+    SbBox3i32 brickregion = this->brickRegion(this->brickIndex(key));
+    SbVec3i32 bmin, bmax;
+    brickregion.getBounds(bmin, bmax);
+    const SbVec3i32 bdims = bmax - bmin;
+    const size_t nrbytes = (size_t)bdims[0] * bdims[1] * bdims[2] * this->bytesprvoxel;
+    uint8_t * voxels = new uint8_t[nrbytes];
+
+    if (this->residentvoxels) {
+      this->copyRegion(brickregion, voxels);
+    }
+    else if (this->viewedstore) {
+      const SbBox3i32 viewed(bmin + this->viewoffset, bmax + this->viewoffset);
+      this->viewedstore->copyRegion(viewed, voxels);
+    }
+    else if (this->reducedfrom) {
+      this->reducedfrom->reduceRegion(this->reducemethod, brickregion, voxels);
+    }
+    else {
+      SbThreadAutoLock readerlock(&this->readermutex);
+      SbBox3i32 subvolume = brickregion;
+      if (!this->reader->getSubVolume(subvolume, voxels)) {
+        SoDebugError::post("CvrVoxelStore::packBricks",
+                           "reader failed to deliver the voxels of "
+                           "<%d, %d, %d> - <%d, %d, %d>",
+                           bmin[0], bmin[1], bmin[2], bmax[0], bmax[1], bmax[2]);
+        (void)memset(voxels, 0, nrbytes);
+        allread = FALSE;
+      }
+    }
+
+    PackedBrick pb;
+    pb.data = NULL;
+    pb.nrbytes = 0;
+    BrickRange range;
+    range.valid = FALSE;
+    packed.keys.append(key);
+    packed.bricks.append(pb);
+    packed.ranges.append(range);
+
+    batch.keys.append(key);
+    batch.dimensions.append(bdims);
+    batch.buffers.append(voxels);
+
+    if (((unsigned int)batch.keys.getLength() == batchsize) ||
+        (k == keys.getLength() - 1)) {
+      CvrParallel::run(batch.keys.getLength(), CvrVoxelStore::compressBrickCB, &batch);
+      for (int i = 0; i < batch.keys.getLength(); i++) { delete[] batch.buffers[i]; }
+      batch.keys.truncate(0);
+      batch.dimensions.truncate(0);
+      batch.buffers.truncate(0);
+      batch.firstpacked = packed.keys.getLength();
+    }
+  }
+  return allread;
+}
+
+// Replaces the compressed bricks of the store, and their value
+// ranges, with those of "packed", which takes over their memory. The
+// cache mutex must be held.
+void
+CvrVoxelStore::installPackedBricks(const PackedBatch & packed)
+{
+  assert(this->packedbricks);
+  for (int i = 0; i < packed.keys.getLength(); i++) {
+    const uintptr_t key = packed.keys[i];
+    PackedBrick & old = this->packedbricks[key];
+    this->packedbytes -= old.nrbytes;
+    delete[] old.data;
+    old = packed.bricks[i];
+    this->packedbytes += old.nrbytes;
+    this->brickranges[key] = packed.ranges[i];
+  }
+}
+
+// Frees the compressed bricks of "packed", which were not installed.
+void
+CvrVoxelStore::freePackedBricks(PackedBatch & packed)
+{
+  for (int i = 0; i < packed.bricks.getLength(); i++) { delete[] packed.bricks[i].data; }
+  packed.keys.truncate(0);
+  packed.bricks.truncate(0);
+  packed.ranges.truncate(0);
+}
+
+SbBool
+CvrVoxelStore::isCompressed(void) const
+{
+  return this->packedbricks != NULL;
+}
+
+// Returns the total size of the compressed bricks, or 0 if the store
+// is not compressed.
+size_t
+CvrVoxelStore::getCompressedSize(void) const
+{
+  return this->packedbytes;
+}
+
+// Compresses one brick of a cvr_brick_batch, and finds its value
+// range. Called from CvrParallel::run(), and so only touches the
+// entries for its own brick.
+void
+CvrVoxelStore::compressBrickCB(void * closure, unsigned int jobidx)
+{
+  cvr_brick_batch * batch = (cvr_brick_batch *)closure;
+  CvrVoxelStore * thisp = (CvrVoxelStore *)batch->owner;
+  PackedBatch * packed = (PackedBatch *)batch->packed;
+  const int outidx = batch->firstpacked + jobidx;
+  const SbVec3i32 & bdims = batch->dimensions[jobidx];
+  const uint8_t * voxels = batch->buffers[jobidx];
+  const size_t nrbytes = (size_t)bdims[0] * bdims[1] * bdims[2] * thisp->bytesprvoxel;
+
+  BrickRange & range = packed->ranges[outidx];
+  range.valid = FALSE;
+  thisp->scanRange(range, SbBox3i32(SbVec3i32(0, 0, 0), bdims), voxels, bdims);
+
+  uint8_t * buffer = new uint8_t[CvrBrickCodec::getMaxCompressedSize(nrbytes)];
+  const size_t packedsize =
+    CvrBrickCodec::compress(voxels, nrbytes, thisp->bytesprvoxel, buffer);
+
+  PackedBrick & pb = packed->bricks[outidx];
+  pb.data = new uint8_t[packedsize];
+  (void)memcpy(pb.data, buffer, packedsize);
+  pb.nrbytes = packedsize;
+  delete[] buffer;
+}
+
+// Decompresses one brick of a cvr_brick_batch into its buffer.
+void
+CvrVoxelStore::decompressBrickCB(void * closure, unsigned int jobidx)
+{
+  cvr_brick_batch * batch = (cvr_brick_batch *)closure;
+  CvrVoxelStore * thisp = (CvrVoxelStore *)batch->owner;
+  const SbVec3i32 & bdims = batch->dimensions[jobidx];
+  const size_t nrbytes = (size_t)bdims[0] * bdims[1] * bdims[2] * thisp->bytesprvoxel;
+
+  const PackedBrick & packed = thisp->packedbricks[batch->keys[jobidx]];
+  const SbBool ok = CvrBrickCodec::decompress(packed.data, packed.nrbytes,
+                                              thisp->bytesprvoxel,
+                                              batch->buffers[jobidx], nrbytes);
+  assert(ok && "corrupt compressed brick");
+}
+
+// Reduces one brick of a cvr_brick_batch into its buffer, from the
+// level of the resolution pyramid below.
+void
+CvrVoxelStore::reduceBrickCB(void * closure, unsigned int jobidx)
+{
+  cvr_brick_batch * batch = (cvr_brick_batch *)closure;
+  CvrVoxelStore * thisp = (CvrVoxelStore *)batch->owner;
+  const SbBox3i32 region = thisp->brickRegion(thisp->brickIndex(batch->keys[jobidx]));
+  thisp->reducedfrom->reduceRegion(thisp->reducemethod, region,
+                                   batch->buffers[jobidx]);
+}
+
+// Decompresses all bricks overlapping "region" that are not already
+// in the cache, or for a level of the resolution pyramid reduces them
+// from the level below, in parallel, and puts them in the cache. The
+// cache mutex is not held while the bricks are made.
+void
+CvrVoxelStore::fetchBricks(const SbBox3i32 & region)
+{
+  assert(this->packedbricks || this->reducedfrom);
+
+  SbVec3i32 rmin, rmax;
+  region.getBounds(rmin, rmax);
+
+  CvrVoxelStore::cachemutex->lock();
+  const unsigned int generation = this->generation;
+
+  cvr_brick_batch batch;
+  batch.owner = this;
+  batch.packed = NULL;
+  batch.firstpacked = 0;
+  size_t batchbytes = 0;
+  // Don't decompress more than what can be kept in the cache at
+  // once. Any bricks left out are decompressed one by one later.
+  const size_t maxbytes = CvrVoxelStore::getMemoryLimit() / 2;
+
+  const SbVec3i32 & bs = this->bricksize;
+  for (int32_t bz = rmin[2] / bs[2]; bz <= (rmax[2] - 1) / bs[2]; bz++) {
+    for (int32_t by = rmin[1] / bs[1]; by <= (rmax[1] - 1) / bs[1]; by++) {
+      for (int32_t bx = rmin[0] / bs[0]; bx <= (rmax[0] - 1) / bs[0]; bx++) {
+        const SbVec3i32 brickidx(bx, by, bz);
+        const uintptr_t key = this->brickKey(brickidx);
+        void * ptr;
+        if (this->brickdict->find(key, ptr)) { continue; }
+
+        SbVec3i32 bmin, bmax;
+        this->brickRegion(brickidx).getBounds(bmin, bmax);
+        const SbVec3i32 bdims = bmax - bmin;
+        const size_t nrbytes =
+          (size_t)bdims[0] * bdims[1] * bdims[2] * this->bytesprvoxel;
+        if ((batchbytes + nrbytes) > maxbytes) { continue; }
+        batchbytes += nrbytes;
+
+        batch.keys.append(key);
+        batch.dimensions.append(bdims);
+        batch.buffers.append(new uint8_t[nrbytes]);
+      }
+    }
+  }
+
+  CvrVoxelStore::cachemutex->unlock();
+
+  // A single brick is just as well handled by getBrick().
+  if (batch.keys.getLength() < 2) {
+    for (int i = 0; i < batch.buffers.getLength(); i++) { delete[] batch.buffers[i]; }
+    return;
+  }
+
+  CvrParallel::run(batch.keys.getLength(),
+                   this->packedbricks ?
+                   CvrVoxelStore::decompressBrickCB : CvrVoxelStore::reduceBrickCB,
+                   &batch);
+
+  SbThreadAutoLock lock(CvrVoxelStore::cachemutex);
+  for (int i = 0; i < batch.keys.getLength(); i++) {
+    // Skip the bricks another thread has put into the cache since,
+    // and all of them if the store has been flushed.
+    void * ptr;
+    if ((generation != this->generation) ||
+        this->brickdict->find(batch.keys[i], ptr)) {
+      delete[] batch.buffers[i];
+      continue;
+    }
+
+    const SbVec3i32 & bdims = batch.dimensions[i];
+    Brick * brick = new Brick;
+    brick->owner = this;
+    brick->key = batch.keys[i];
+    brick->dimensions = bdims;
+    brick->voxels = batch.buffers[i];
+    brick->ownsvoxels = TRUE;
+    brick->nrbytes = (size_t)bdims[0] * bdims[1] * bdims[2] * this->bytesprvoxel;
+    brick->prefetched = FALSE;
+    brick->users = 0;
+    brick->evicted = FALSE;
+    CvrVoxelStore::makeRoomFor(brick->nrbytes);
+    this->insertBrick(brick);
+  }
+}
+
+// Takes the brick out of the LRU list and deallocates it. Does *not*
+// remove it from the owner's dictionary. A pinned brick is left for
+// unpinBrick() to deallocate.
+void
+CvrVoxelStore::releaseBrick(Brick * brick)
+{
+  CvrVoxelStore::lruUnlink(brick);
+  assert(CvrVoxelStore::residentbytes >= brick->nrbytes);
+  CvrVoxelStore::residentbytes -= brick->nrbytes;
+  if (brick->prefetched) {
+    assert(CvrVoxelStore::prefetchedbytes >= brick->nrbytes);
+    CvrVoxelStore::prefetchedbytes -= brick->nrbytes;
+  }
+  if (brick->users > 0) {
+    brick->evicted = TRUE;
+    return;
+  }
+  if (brick->ownsvoxels) { delete[] brick->voxels; }
+  delete brick;
+}
+
+// *************************************************************************
+
+void
+CvrVoxelStore::lruUnlink(Brick * brick)
+{
+  if (brick->prev) { brick->prev->next = brick->next; }
+  else { CvrVoxelStore::lruhead = brick->next; }
+  if (brick->next) { brick->next->prev = brick->prev; }
+  else { CvrVoxelStore::lrutail = brick->prev; }
+  brick->prev = brick->next = NULL;
+}
+
+void
+CvrVoxelStore::lruPushFront(Brick * brick)
+{
+  brick->prev = NULL;
+  brick->next = CvrVoxelStore::lruhead;
+  if (CvrVoxelStore::lruhead) { CvrVoxelStore::lruhead->prev = brick; }
+  CvrVoxelStore::lruhead = brick;
+  if (CvrVoxelStore::lrutail == NULL) { CvrVoxelStore::lrutail = brick; }
+}
+
+// Evicts least-recently-used bricks until there is room for
+// "nrbytes" more within the memory limit (or until only pinned
+// bricks are left in the cache).
+void
+CvrVoxelStore::makeRoomFor(size_t nrbytes)
+{
+  const size_t limit = CvrVoxelStore::getMemoryLimit();
+  Brick * victim = CvrVoxelStore::lrutail;
+  while (victim && (CvrVoxelStore::residentbytes + nrbytes > limit)) {
+    Brick * prev = victim->prev;
+    if (victim->users == 0) {
+      const SbBool ok = victim->owner->brickdict->remove(victim->key);
+      assert(ok);
+      CvrVoxelStore::releaseBrick(victim);
+    }
+    victim = prev;
+  }
+}
+
+// *************************************************************************
@@ -111,7 +111,7 @@ CvrNonIndexedSetRenderBaseP::GLRender(SoGLRenderAction * action,
   CvrUtil::getTransformFromVolumeBoxDimensions(vbelem, volumetransform);
   SoModelMatrixElement::mult(state, this->master, volumetransform);
 
-  const SbVec3s & dims = vbelem->getVoxelCubeDimensions();
+  const SbVec3i32 & dims = vbelem->getVoxelCubeDimensions();
   SbVec3f origo(-((float) dims[0]) / 2.0f, -((float) dims[1]) / 2.0f, -((float) dims[2]) / 2.0f);
 
   // This must be done, as we want to control stuff in the GL state
@@ -130,7 +130,8 @@ CvrNonIndexedSetRenderBaseP::GLRender(SoGLRenderAction * action,
   if (!this->cube) { this->cube = new Cvr3DTexCube(action); }
 
   const SoTransferFunctionElement * tfelement = SoTransferFunctionElement::getInstance(state);
-  const CvrCLUT * c = CvrVoxelChunk::getCLUT(tfelement, CvrCLUT::ALPHA_AS_IS);
+  const CvrCLUT * c = CvrVoxelChunk::getCLUT(tfelement, CvrCLUT::ALPHA_AS_IS,
+                                             vbelem->getVoxelStore());
   if (this->clut != c) {
     this->cube->setPalette(c);
     this->clut = c;
@@ -84,7 +84,7 @@
 
 #include <Inventor/C/glue/gl.h>
 #include <Inventor/C/tidbits.h>
-#include <Inventor/SbBox3s.h>
+#include <Inventor/SbBox3i32.h>
 #include <Inventor/SbRotation.h>
 #include <Inventor/SoPickedPoint.h>
 #include <Inventor/actions/SoGLRenderAction.h>
@@ -101,6 +101,7 @@
 #include <VolumeViz/elements/SoTransferFunctionElement.h>
 #include <VolumeViz/render/3D/CvrCubeHandler.h>
 #include <VolumeViz/misc/CvrUtil.h>
+#include <VolumeViz/misc/CvrVoxelStore.h>
 #include <VolumeViz/misc/CvrGlobalRenderLock.h>
 
 // *************************************************************************
@@ -317,7 +318,7 @@ SoObliqueSlice::GLRender(SoGLRenderAction * action)
   CvrUtil::getTransformFromVolumeBoxDimensions(vbelem, volumetransform);
   SoModelMatrixElement::mult(state, this, volumetransform);
 
-  const SbVec3s & voxcubedims = vbelem->getVoxelCubeDimensions();
+  const SbVec3i32 & voxcubedims = vbelem->getVoxelCubeDimensions();
 
   const cc_glglue * glue = cc_glglue_instance(action->getCacheContext());
   if (!cc_glglue_has_3d_textures(glue)) {
@@ -377,10 +378,10 @@ SoObliqueSlice::rayPick(SoRayPickAction * action)
   if (sliceplane.intersect(ray, intersection) && // returns FALSE if parallel
       action->isBetweenPlanes(intersection)) {
 
-    SbVec3s ijk = vbelem->objectCoordsToIJK(intersection);
+    const SbVec3i32 ijk = vbelem->objectCoordsToIJK(intersection);
 
-    const SbVec3s & voxcubedims = vbelem->getVoxelCubeDimensions();
-    const SbBox3s voxcubebounds(SbVec3s(0, 0, 0), voxcubedims - SbVec3s(1, 1, 1));
+    const SbVec3i32 & voxcubedims = vbelem->getVoxelStore()->getDimensions();
+    const SbBox3i32 voxcubebounds(SbVec3i32(0, 0, 0), voxcubedims - SbVec3i32(1, 1, 1));
 
     if (voxcubebounds.intersect(ijk)) {
 
@@ -395,7 +396,8 @@ SoObliqueSlice::rayPick(SoRayPickAction * action)
       pp->setDetail(detail, this);
 
       detail->objectcoords = intersection;
-      detail->ijkcoords = ijk;
+      detail->voxelpos = ijk;
+      detail->ijkcoords = CvrUtil::fitsShort(ijk) ? CvrUtil::toVec3s(ijk) : SbVec3s(-1, -1, -1);
       detail->voxelvalue = vbelem->getVoxelValue(ijk);
 
       if (CvrUtil::useFlippedYAxis()) {
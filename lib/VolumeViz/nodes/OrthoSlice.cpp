@@ -74,6 +74,7 @@
 #include <Inventor/SoPickedPoint.h>
 #include <Inventor/system/gl.h>
 #include <Inventor/C/tidbits.h>
+#include <Inventor/SbBox3i32.h>
 #include <Inventor/SbRotation.h>
 
 #include <VolumeViz/nodes/SoOrthoSlice.h>
@@ -88,6 +89,7 @@
 #include <VolumeViz/misc/CvrCLUT.h>
 #include <VolumeViz/misc/CvrVoxelChunk.h>
 #include <VolumeViz/misc/CvrUtil.h>
+#include <VolumeViz/misc/CvrVoxelStore.h>
 #include <VolumeViz/misc/CvrGlobalRenderLock.h>
 
 // *************************************************************************
@@ -300,7 +302,7 @@ SoOrthoSliceP::getSliceAsPlane(SoAction * action) const
 
   SbVec3f origo = spacesize.getCenter();
 
-  const SbVec3s & dimensions = vbelem->getVoxelCubeDimensions();
+  const SbVec3i32 & dimensions = vbelem->getVoxelCubeDimensions();
   const float depthprslice = (spacemax[axis] - spacemin[axis]) / dimensions[axis];
   const float depth = spacemin[axis] + PUBLIC(this)->sliceNumber.getValue() * depthprslice;
   origo[axis] = depth;
@@ -339,7 +341,7 @@ SoOrthoSliceP::confirmValidInContext(SoState * state) const
   }
 
   const int slicenr = PUBLIC(this)->sliceNumber.getValue();
-  const short slices = vbelem->getVoxelCubeDimensions()[axisidx];
+  const int32_t slices = vbelem->getVoxelCubeDimensions()[axisidx];
   if (slicenr < 0 || slicenr >= slices) {
     // I don't think this can legally happen, so assert if no slices
     // are available. mortene.
@@ -466,7 +468,7 @@ SoOrthoSlice::GLRender(SoGLRenderAction * action)
   // This is done to support client code depending on an old bug: data
   // along the Y axis used to be rendered flipped.
   if (CvrUtil::useFlippedYAxis() && (axisidx == Y)) {
-    const short ydim = vbelem->getVoxelCubeDimensions()[Y];
+    const int32_t ydim = vbelem->getVoxelCubeDimensions()[Y];
     pageslice = (ydim - 1) - pageslice;
   }
 
@@ -474,7 +476,8 @@ SoOrthoSlice::GLRender(SoGLRenderAction * action)
     PRIVATE(this)->getPage(action, axisidx, pageslice);
 
   const SoTransferFunctionElement * tfelement = SoTransferFunctionElement::getInstance(state);
-  CvrCLUT * c = CvrVoxelChunk::getCLUT(tfelement, (CvrCLUT::AlphaUse)this->alphaUse.getValue());
+  CvrCLUT * c = CvrVoxelChunk::getCLUT(tfelement, (CvrCLUT::AlphaUse)this->alphaUse.getValue(),
+                                       vbelem->getVoxelStore());
 
   c->ref();
   const CvrCLUT * pageclut = texpage->getPalette();
@@ -578,10 +581,10 @@ SoOrthoSlice::rayPick(SoRayPickAction * action)
   if (sliceplane.intersect(ray, intersection) && // returns FALSE if parallel
       action->isBetweenPlanes(intersection)) {
 
-    SbVec3s ijk = vbelem->objectCoordsToIJK(intersection);
+    const SbVec3i32 ijk = vbelem->objectCoordsToIJK(intersection);
 
-    const SbVec3s & voxcubedims = vbelem->getVoxelCubeDimensions();
-    const SbBox3s voxcubebounds(SbVec3s(0, 0, 0), voxcubedims - SbVec3s(1, 1, 1));
+    const SbVec3i32 & voxcubedims = vbelem->getVoxelStore()->getDimensions();
+    const SbBox3i32 voxcubebounds(SbVec3i32(0, 0, 0), voxcubedims - SbVec3i32(1, 1, 1));
 
     if (voxcubebounds.intersect(ijk)) {
 
@@ -596,7 +599,8 @@ SoOrthoSlice::rayPick(SoRayPickAction * action)
       pp->setDetail(detail, this);
 
       detail->objectcoords = intersection;
-      detail->ijkcoords = ijk;
+      detail->voxelpos = ijk;
+      detail->ijkcoords = CvrUtil::fitsShort(ijk) ? CvrUtil::toVec3s(ijk) : SbVec3s(-1, -1, -1);
       detail->voxelvalue = vbelem->getVoxelValue(ijk);
 
       if (CvrUtil::useFlippedYAxis()) {
@@ -645,7 +649,7 @@ SoOrthoSlice::computeBBox(SoAction * action, SbBox3f & box, SbVec3f & center)
   SbVec3f bmin, bmax;
   vdbox.getBounds(bmin, bmax);
 
-  const SbVec3s & dimensions = vbelem->getVoxelCubeDimensions();
+  const SbVec3i32 & dimensions = vbelem->getVoxelCubeDimensions();
 
   const int axisidx = (int)axis.getValue();
   const int slice = this->sliceNumber.getValue();
@@ -216,7 +216,7 @@ SoROI::GLRender(SoGLRenderAction *action)
   SbBox3f volumeSize = volumeData->getVolumeSize();
   volumeSize.getBounds(volumeMin, volumeMax);
 
-  SbVec3s dimensions;
+  SbVec3i32 dimensions;
   void * data;
   SoVolumeData::DataType type;
   SbBool ok = volumeData->getVolumeData(dimensions, data, type);
@@ -36,6 +36,7 @@
 #include <VolumeViz/nodes/SoVolumeRendering.h>
 #include <Inventor/fields/SoMFFloat.h>
 #include <Inventor/fields/SoSFEnum.h>
+#include <Inventor/fields/SoSFFloat.h>
 #include <Inventor/fields/SoSFInt32.h>
 #include <Inventor/fields/SoSFUInt32.h>
 
@@ -77,6 +78,9 @@ public:
   void reMap(int low, int high);
   SbBool hasTransparency(void) const;
 
+  void setDataWindow(float low, float high);
+  SbBool getDataWindow(float & low, float & high) const;
+
 protected:
   ~SoTransferFunction();
 
@@ -95,6 +99,10 @@ private:
   SoSFUInt32 remapLow;
   SoSFUInt32 remapHigh;
 
+  // Same as above, for the setDataWindow() function.
+  SoSFFloat windowLow;
+  SoSFFloat windowHigh;
+
   friend class SoTransferFunctionP;
   class SoTransferFunctionP * pimpl;
 };
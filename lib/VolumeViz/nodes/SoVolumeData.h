@@ -36,11 +36,14 @@
 #include <Inventor/fields/SoSFString.h>
 #include <Inventor/fields/SoSFEnum.h>
 #include <Inventor/fields/SoSFBool.h>
+#include <Inventor/fields/SoSFInt32.h>
 #include <Inventor/fields/SoSFVec3f.h>
 #include <Inventor/SbVec3f.h>
 #include <Inventor/SbVec3s.h>
+#include <Inventor/SbVec3i32.h>
 #include <Inventor/SbBox3f.h>
 #include <Inventor/SbBox3s.h>
+#include <Inventor/SbBox3i32.h>
 #include <Inventor/SbBox2s.h>
 #include <Inventor/SbBox2f.h>
 #include <VolumeViz/nodes/SoVolumeRendering.h>
@@ -73,13 +76,14 @@ public:
   enum SubMethod { NEAREST, MAX, AVERAGE };
   enum OverMethod { NONE, CONSTANT, LINEAR, CUBIC };
 
-  enum DataType { UNSIGNED_BYTE, UNSIGNED_SHORT };
+  enum DataType { UNSIGNED_BYTE, UNSIGNED_SHORT, SIGNED_SHORT, FLOAT };
 
   SoSFString fileName;
   SoSFEnum storageHint;
   SoSFBool usePalettedTexture;
   SoSFBool useSharedPalettedTexture;
   SoSFBool useCompressedTexture;
+  SoSFInt32 timeStep;
 
   void setVolumeData(const SbVec3s & dimension, void * data,
                      SoVolumeData::DataType type = SoVolumeData::UNSIGNED_BYTE,
@@ -87,8 +91,15 @@ public:
   SbBool getVolumeData(SbVec3s & dimension, void *& data,
                        SoVolumeData::DataType & type,
                        int * significantbits = NULL) const;
+  void setVolumeData(const SbVec3i32 & dimension, void * data,
+                     SoVolumeData::DataType type = SoVolumeData::UNSIGNED_BYTE,
+                     int significantbits = 0);
+  SbBool getVolumeData(SbVec3i32 & dimension, void *& data,
+                       SoVolumeData::DataType & type,
+                       int * significantbits = NULL) const;
 
   uint32_t getVoxelValue(const SbVec3s & voxelpos) const;
+  uint32_t getVoxelValue(const SbVec3i32 & voxelpos) const;
 
   void setVolumeSize(const SbBox3f & size);
   SbBox3f getVolumeSize(void) const;
@@ -99,20 +110,27 @@ public:
 
   void setReader(SoVolumeReader & reader);
   SoVolumeReader * getReader(void) const;
+  int getNumTimeSteps(void) const;
 
   void setTexMemorySize(int megatexels);
   int getTexMemorySize(void) const;
 
   SbBool getMinMax(int & minval, int & maxval);
+  SbBool getMinMax(double & minval, double & maxval);
   SbBool getHistogram(int & length, int *& histogram);
 
   SoVolumeData * subSetting(const SbBox3s & region);
+  SoVolumeData * subSetting(const SbBox3i32 & region);
   void updateRegions(const SbBox3s * region, int num);
+  void updateRegions(const SbBox3i32 * region, int num);
   void loadRegions(const SbBox3s * region, int num, SoState * state, SoTransferFunction * node);
 
   SoVolumeData * reSampling(const SbVec3s & dimension,
                             SoVolumeData::SubMethod subMethod,
                             SoVolumeData::OverMethod = NONE);
+  SoVolumeData * reSampling(const SbVec3i32 & dimension,
+                            SoVolumeData::SubMethod subMethod,
+                            SoVolumeData::OverMethod = NONE);
 
   void enableSubSampling(SbBool enable);
   SbBool isSubSamplingEnabled(void) const;
@@ -131,6 +149,8 @@ public:
   void setSubSamplingLevel(const SbVec3s & roi, const SbVec3s & secondary);
   void getSubSamplingLevel(SbVec3s & roi, SbVec3s & secondary) const;
 
+  void enableCompressedStorage(SbBool enable);
+  SbBool isCompressedStorageEnabled(void) const;
 
 protected:
   ~SoVolumeData();
@@ -240,9 +240,17 @@ private:
   be normalized to be within [0.0, 1.0] for the intensity value of a
   color, or the alpha value for transparency.
 
-  The array must contain 256 colors. The number of floats needed in
-  the array for each color depends on the
+  The array would usually contain 256 colors. The number of floats
+  needed in the array for each color depends on the
   SoTransferFunction::ColorMapType setting.
+
+  The colors are spread out evenly over the full range of voxel
+  values, so for 16-bit voxel data a 256-color map gives each color
+  to 256 consecutive voxel values. Use a larger map, of up to 65536
+  colors, to take advantage of the full precision of 16-bit data. For
+  data with fewer significant bits, like 12-bit data stored as 16-bit
+  voxels, the SoTransferFunction::shift field can be used to make the
+  voxel values cover the full range of the color map.
 */
 
 // FIXME: the colorMap field shouldn't have to contain exactly 256
@@ -290,6 +298,10 @@ SoTransferFunction::SoTransferFunction(void)
   // Init to lowest and highest uint16_t values.
   SO_NODE_ADD_FIELD(remapLow, (0));
   SO_NODE_ADD_FIELD(remapHigh, ((2 << 16) - 1));
+
+  // An empty window means no windowing.
+  SO_NODE_ADD_FIELD(windowLow, (0.0f));
+  SO_NODE_ADD_FIELD(windowHigh, (0.0f));
 }
 
 
@@ -321,6 +333,9 @@ SoTransferFunction::doAction(SoAction * action)
   const uint32_t low = this->remapLow.getValue();
   const uint32_t high = this->remapHigh.getValue();
   SoTransferFunctionElement::setTransparencyThresholds(s, low, high);
+
+  SoTransferFunctionElement::setDataWindow(s, this->windowLow.getValue(),
+                                           this->windowHigh.getValue());
 }
 
 void
@@ -371,6 +386,57 @@ SoTransferFunction::reMap(int low, int high)
   this->remapHigh = h;
 }
 
+/*!
+  Set the window of voxel data values to spread the colormap over. The
+  colormap's first entry is used for all values at or below \a low,
+  and the last entry for all values at or above \a high.
+
+  The values are given in the units of the voxel data, i.e. as signed
+  values for SoVolumeData::SIGNED_SHORT data, and as the actual
+  floating point values for SoVolumeData::FLOAT data. The window is
+  applied after any \a shift and \a offset.
+
+  Changing the window only regenerates the color lookup table, and
+  does not cause any reprocessing of the voxel data when paletted
+  textures are used.
+
+  Pass \a low equal to \a high to remove the window again, which
+  will spread the colormap over the full range of the data type (or
+  over the range of values in the volume, for
+  SoVolumeData::FLOAT data). This is the default.
+
+  \since SIM Voleon 2.0
+*/
+void
+SoTransferFunction::setDataWindow(float low, float high)
+{
+  assert(low <= high);
+
+  if ((low == this->windowLow.getValue()) &&
+      (high == this->windowHigh.getValue())) {
+    return;
+  }
+
+  // As for reMap(), this causes a node-id update, and with that a new
+  // lookup table.
+  this->windowLow = low;
+  this->windowHigh = high;
+}
+
+/*!
+  Returns the window set with setDataWindow(). Return value is \c
+  FALSE if no window is set.
+
+  \since SIM Voleon 2.0
+*/
+SbBool
+SoTransferFunction::getDataWindow(float & low, float & high) const
+{
+  low = this->windowLow.getValue();
+  high = this->windowHigh.getValue();
+  return low < high;
+}
+
 // *************************************************************************
 
 SbBool
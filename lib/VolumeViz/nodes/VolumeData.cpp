@@ -75,6 +75,12 @@
 
   Internal regeneration of textures etc. for visualization will then be
   done automatically by the SIM Voleon rendering system.
+
+  Nodes loading the same file through the SoVolumeData::fileName
+  field share the voxels in memory, and the textures made from them,
+  so a volume shown in several scene graphs at once is only stored
+  once. Files are matched by their full path and modification time,
+  so a file which has been rewritten is loaded anew.
 */
 
 // *************************************************************************
@@ -82,9 +88,15 @@
 #include <VolumeViz/nodes/SoVolumeData.h>
 
 #include <limits.h>
+#include <stdlib.h> // atoi()
 #include <float.h> // FLT_MAX
+#include <math.h> // floor(), ceil()
+#include <string.h> // memset()
 
 #include <Inventor/C/tidbits.h>
+#include <Inventor/SbBox2s.h>
+#include <Inventor/SbBox3i32.h>
+#include <Inventor/SbVec3i32.h>
 #include <Inventor/SbVec3s.h>
 #include <Inventor/actions/SoCallbackAction.h>
 #include <Inventor/actions/SoGLRenderAction.h>
@@ -100,13 +112,55 @@
 #include <VolumeViz/elements/CvrPalettedTexturesElement.h>
 #include <VolumeViz/elements/CvrPageSizeElement.h>
 #include <VolumeViz/elements/CvrStorageHintElement.h>
+#include <VolumeViz/elements/CvrSubSamplingElement.h>
 #include <VolumeViz/elements/CvrVoxelBlockElement.h>
 #include <VolumeViz/readers/SoVRMemReader.h>
-#include <VolumeViz/readers/SoVRVolFileReader.h>
+#include <VolumeViz/misc/CvrBrickPrefetcher.h>
+#include <VolumeViz/misc/CvrResampler.h>
+#include <VolumeViz/misc/CvrSharedSource.h>
+#include <VolumeViz/misc/CvrTimeSeries.h>
 #include <VolumeViz/misc/CvrUtil.h>
+#include <VolumeViz/misc/CvrVoxelStore.h>
 
 // *************************************************************************
 
+/*!
+  \enum SoVolumeData::DataType
+
+  The type of each voxel value in the volume data.
+*/
+/*!
+  \var SoVolumeData::DataType SoVolumeData::UNSIGNED_BYTE
+
+  8-bit unsigned voxel values.
+*/
+/*!
+  \var SoVolumeData::DataType SoVolumeData::UNSIGNED_SHORT
+
+  16-bit unsigned voxel values.
+*/
+/*!
+  \var SoVolumeData::DataType SoVolumeData::SIGNED_SHORT
+
+  16-bit signed voxel values. These are rendered as if the value range
+  -32768 to 32767 was shifted to 0 to 65535, so a colormap for them is
+  laid out the same way as for UNSIGNED_SHORT data.
+
+  \since SIM Voleon 2.0
+*/
+/*!
+  \var SoVolumeData::DataType SoVolumeData::FLOAT
+
+  32-bit floating point voxel values. For rendering, the range of
+  values found in the volume is spread linearly over the 16-bit index
+  range of the colormap. NaN values map to the first colormap entry.
+
+  Use SoTransferFunction::setDataWindow() to pick out a sub-range of
+  the values for display, without any reprocessing of the voxel data.
+
+  \since SIM Voleon 2.0
+*/
+
 /*!
   \var SoSFBool SoVolumeData::usePalettedTexture
 
@@ -189,6 +243,29 @@
   the SoVolumeData::usePalettedTexture field.
 */
 
+/*!
+  \var SoSFInt32 SoVolumeData::timeStep
+
+  The time step to render, for readers delivering a time-varying
+  volume (see SoVolumeReader::getNumTimeSteps()). Values outside the
+  range of steps are clamped. Ignored for other volumes.
+  SoVRVolFileReader delivers VOL files holding several volumes one
+  after the other as time steps.
+
+  While one step is rendered, the step following it is decoded from
+  the reader in a background thread, so playing through the steps at
+  a steady pace, forwards or backwards, will usually find the next
+  step ready. Changing to it then only swaps two voxel buffers.
+  Jumping to any other step has to wait for that step to be decoded.
+
+  Each step is decoded into memory in full, so two steps of the
+  volume must fit in memory at once.
+
+  Default value is 0.
+
+  \since SIM Voleon 2.0
+*/
+
 // *************************************************************************
 
 SO_NODE_SOURCE(SoVolumeData);
@@ -205,36 +282,109 @@ public:
 
     // FIXME: I think I can kill these since the pagehandler was
     // introduced. 20021122 mortene.
-    this->dimensions = SbVec3s(0, 0, 0);
+    this->dimensions = SbVec3i32(0, 0, 0);
     this->subpagesize = SbVec3s(128, 128, 128);
+    this->datatype = SoVolumeData::UNSIGNED_BYTE;
 
     // Our default size (0 == unlimited).
     this->maxnrtexels = 0;
 
     this->VRMemReader = new SoVRMemReader;
     this->reader = NULL;
+    this->voxelstore = NULL;
+    this->voxelstorenodeid = 0;
+    this->source = NULL;
+    this->timeseries = NULL;
+    this->prefetcher = NULL;
+    this->resamplereader = NULL;
+    this->viewparent = NULL;
+    this->datanodeid = 0;
+    this->dataparentid = 0;
+    this->dataid = 0;
+
+    this->subsampling = FALSE;
+    this->autosubsampling = FALSE;
+    this->submethod = SoVolumeData::NEAREST;
+    this->roisampling = SbVec3s(0, 0, 0);
+    this->secondarysampling = SbVec3s(0, 0, 0);
+    this->budgetlevel = 0;
+
+    const char * env = coin_getenv("CVR_COMPRESS_VOXELS");
+    this->compressedstorage = env && (atoi(env) > 0);
   }
 
   ~SoVolumeDataP()
   {
+    assert(this->views.getLength() == 0);
+    delete this->prefetcher;
+    this->releaseVoxelStore();
+    if (this->viewparent) { this->detachView(); }
     delete this->VRMemReader;
+    delete this->resamplereader;
     // FIXME: should really delete "this->reader", but that leads to
     // SEGFAULT now (reader and VRMemReader can be the same pointer.)
     // 20021120 mortene.
   }
 
-  SbVec3s dimensions;
+  SbVec3i32 dimensions;
   SbVec3s subpagesize;
   SoVolumeData::DataType datatype;
 
   SoVRMemReader * VRMemReader;
   SoVolumeReader * reader;
 
+  // Gives brick-wise access to the voxels of the reader, so the
+  // complete volume need not be in memory at once.
+  CvrVoxelStore * voxelstore;
+  SbUniqueId voxelstorenodeid;
+  unsigned int bytesPrVoxel(void) const;
+  void syncVoxelStore(void);
+  void dropVoxelStore(void);
+  void releaseVoxelStore(void);
+  void useVoxelStore(SoVolumeReader * reader, CvrVoxelStore * store,
+                     CvrSharedSource * source);
+
+  // Set when the reader and the voxel store are those of a file,
+  // shared with the other nodes reading the same file.
+  CvrSharedSource * source;
+
+  // Set for time-varying volumes, and then owns the voxel store,
+  // which holds the current time step.
+  CvrTimeSeries * timeseries;
+  int clampedTimeStep(void) const;
+  void syncTimeStep(void);
+
+  // Loads bricks of the voxel store ahead of the camera. Only used
+  // when the voxels are not all resident in memory.
+  CvrBrickPrefetcher * prefetcher;
+  void startPrefetcher(void);
+  void stopPrefetcher(void);
+
   // FIXME: this is fubar -- we need a global manager, of course, as
   // there can be more than one voxelcube in the scene at once. These
   // should probably be static variables in that manager. 20021118 mortene.
   unsigned int maxnrtexels;
 
+  SbBool subsampling;
+  SbBool autosubsampling;
+  SoVolumeData::SubMethod submethod;
+  SbVec3s roisampling;
+  SbVec3s secondarysampling;
+  unsigned int getSubSamplingLevel(void) const;
+  void touchKeepVoxelStore(void);
+  void touchKeepDataId(void);
+  SbBool updateStoreRegions(const SbBox3i32 * region, int num);
+  void touchAfterUpdate(const SbBool keeptextures);
+  void stopPrefetchers(void);
+  void startPrefetchers(void);
+
+  // Lowest resolution pyramid level where all textures fit within
+  // maxnrtexels, as found on the last render traversal.
+  unsigned int budgetlevel;
+  unsigned int findBudgetLevel(void) const;
+
+  SbBool compressedstorage;
+
   SoFieldSensor * filenamesensor;
   static void filenameFieldModified(void * userdata, SoSensor * sensor);
   SbBool readNamedFile(void);
@@ -243,8 +393,28 @@ public:
   int * histogram;
   unsigned int histogramlength;
 
-  void downSample(SbVec3s dimensions, SoVolumeData::SubMethod subMethod, void * data);
-  void overSample(SbVec3s dimensions, SoVolumeData::OverMethod overMethod, void * data);
+  // Set up by SoVolumeData::reSampling() for oversampled volumes,
+  // and owned by the node.
+  class ResampleReader;
+  SoVolumeReader * resamplereader;
+
+  // Set for the volumes made by SoVolumeData::subSetting(), which
+  // have no reader of their own, but a voxel store which is a view of
+  // "viewregion" of the voxel store of "viewparent". Views of views
+  // view the outermost volume directly. The viewed volume keeps a
+  // list of its views, to set them up again when it gets new voxels.
+  SoVolumeData * viewparent;
+  SbBox3i32 viewregion;
+  SbList<SoVolumeData *> views;
+  void setupViewStore(void);
+  void releaseViewStore(void);
+  void detachView(void);
+  void releaseViews(void);
+  void setupViews(void);
+  void flushViews(void);
+
+  SbUniqueId datanodeid, dataparentid, dataid;
+  SbUniqueId getDataId(void);
 
 private:
   SoVolumeData * master;
@@ -252,6 +422,228 @@ private:
 
 const char SoVolumeDataP::UNDEFINED_FILE[] = "";
 
+// *************************************************************************
+
+// Reader for the volumes made by SoVolumeData::reSampling() when
+// oversampling. Voxels are interpolated from the voxel store of the
+// source volume as they are read, so only those parts of the result
+// which are pulled into its own voxel store are ever computed.
+class SoVolumeDataP::ResampleReader : public SoVolumeReader {
+public:
+  ResampleReader(SoVolumeData * source, SoVolumeDataP * sourcep,
+                 const SbVec3i32 & dimensions, SoVolumeData::OverMethod method)
+  {
+    this->source = source;
+    this->source->ref();
+    this->sourcep = sourcep;
+    this->dimensions = dimensions;
+    this->method = method;
+    this->datatype = sourcep->datatype;
+    this->bytesprvoxel = sourcep->bytesPrVoxel();
+    assert(sourcep->voxelstore);
+    this->sourcedimensions = sourcep->voxelstore->getDimensions();
+  }
+
+  virtual ~ResampleReader()
+  {
+    this->source->unref();
+  }
+
+  virtual void getDataChar(SbBox3f & size, SoVolumeData::DataType & type,
+                           SbVec3i32 & dim)
+  {
+    size = this->source->getVolumeSize();
+    type = this->datatype;
+    dim = this->dimensions;
+  }
+
+  virtual void getDataChar(SbBox3f & size, SoVolumeData::DataType & type,
+                           SbVec3s & dim)
+  {
+    SbVec3i32 dim32;
+    this->getDataChar(size, type, dim32);
+    if (!CvrUtil::fitsShort(dim32)) { dim32.setValue(0, 0, 0); }
+    dim = CvrUtil::toVec3s(dim32);
+  }
+
+  virtual void getSubSlice(SbBox2s & slice, int slicenumber, void * voxels)
+  {
+    const SbVec2s & smin = slice.getMin();
+    const SbVec2s & smax = slice.getMax();
+    this->read(SbBox3i32(smin[0], smin[1], slicenumber,
+                         smax[0], smax[1], slicenumber + 1), voxels);
+  }
+
+  virtual SbBool getSubVolume(SbBox3i32 & volume, void * voxels)
+  {
+    this->read(volume, voxels);
+    return TRUE;
+  }
+
+  virtual SbBool getSubVolume(SbBox3s & volume, void * voxels)
+  {
+    this->read(CvrUtil::toBox3i32(volume), voxels);
+    return TRUE;
+  }
+
+private:
+  // The source volume should keep its voxels while this reader is in
+  // use. If it has dropped them, or been given voxels of another type
+  // or size, the region is set to zero rather than interpolated from
+  // voxels it was not made for.
+  void read(const SbBox3i32 & region, void * voxels)
+  {
+    CvrVoxelStore * store = this->sourcep->voxelstore;
+    const char * error = NULL;
+    if (store == NULL) {
+      error = "source volume has no voxels";
+    }
+    else if (store->getDataType() != this->datatype) {
+      error = "data type of source volume has changed";
+    }
+    else if (store->getDimensions() != this->sourcedimensions) {
+      error = "dimensions of source volume have changed";
+    }
+
+    if (error) {
+      SoDebugError::post("SoVolumeDataP::ResampleReader::read", "%s", error);
+      const SbVec3i32 size = region.getMax() - region.getMin();
+      (void)memset(voxels, 0, (size_t)size[0] * size[1] * size[2] *
+                   this->bytesprvoxel);
+      return;
+    }
+    CvrResampler::overSample(store, this->dimensions, this->method,
+                             region, voxels);
+  }
+
+  SoVolumeData * source;
+  SoVolumeDataP * sourcep;
+  SbVec3i32 dimensions;
+  SoVolumeData::OverMethod method;
+  SoVolumeData::DataType datatype;
+  unsigned int bytesprvoxel;
+  SbVec3i32 sourcedimensions;
+};
+
+// Returns the fixed pyramid level set up by the application.
+unsigned int
+SoVolumeDataP::getSubSamplingLevel(void) const
+{
+  if (!this->subsampling) { return 0; }
+  return SbMax(this->roisampling[0],
+               SbMax(this->roisampling[1], this->roisampling[2]));
+}
+
+// Padded size of a texture along one axis, as done in
+// CvrTextureObject::create().
+static double
+cvr_texture_axis_size(unsigned int texels)
+{
+  return (double)SbMax((uint32_t)4, coin_geq_power_of_two(texels));
+}
+
+// Returns the number of texels needed to hold the complete volume at
+// the given level of the resolution pyramid, when split into pages of
+// the current page size.
+static double
+cvr_texels_at_level(const SbVec3i32 & dims, const SbVec3s & pagesize,
+                    unsigned int level)
+{
+  double total = 1.0;
+  for (unsigned int i = 0; i < 3; i++) {
+    const unsigned int step = 1 << level;
+    const unsigned int fullpages = dims[i] / pagesize[i];
+    const unsigned int rest = dims[i] % pagesize[i];
+
+    double axistexels =
+      fullpages * cvr_texture_axis_size((pagesize[i] + step - 1) / step);
+    if (rest > 0) { axistexels += cvr_texture_axis_size((rest + step - 1) / step); }
+    total *= axistexels;
+  }
+  return total;
+}
+
+// Finds the first level of the resolution pyramid which makes the
+// textures for the complete volume fit in the set texture memory
+// limit.
+unsigned int
+SoVolumeDataP::findBudgetLevel(void) const
+{
+  if ((this->maxnrtexels == 0) || (this->voxelstore == NULL)) { return 0; }
+
+  const unsigned int nrlevels = this->voxelstore->getNrOfLevels();
+  unsigned int level = 0;
+  while (((level + 1) < nrlevels) &&
+         (cvr_texels_at_level(this->dimensions, this->subpagesize, level) >
+          (double)this->maxnrtexels)) {
+    level++;
+  }
+  return level;
+}
+
+// Like SoNode::touch(), but for changes which only influence how the
+// voxels are rendered. The voxel store will then not be flushed, so
+// its resolution pyramid can be reused.
+void
+SoVolumeDataP::touchKeepVoxelStore(void)
+{
+  const SbBool uptodate = (this->voxelstorenodeid == this->master->getNodeId());
+  this->master->touch();
+  if (uptodate) { this->voxelstorenodeid = this->master->getNodeId(); }
+}
+
+// Like touchKeepVoxelStore(), but also keeps the id the voxels are
+// known by to the rendering code, for changes which the voxel store
+// and the textures made from it keep track of themselves.
+void
+SoVolumeDataP::touchKeepDataId(void)
+{
+  (void)this->getDataId();
+  this->touchKeepVoxelStore();
+  this->datanodeid = this->master->getNodeId();
+}
+
+// Sets up the prefetcher for the current voxel store, unless its
+// voxels are all resident in memory anyway.
+void
+SoVolumeDataP::startPrefetcher(void)
+{
+  assert(this->prefetcher == NULL);
+  if ((this->voxelstore == NULL) || this->voxelstore->getResidentVoxels()) { return; }
+  if (!CvrBrickPrefetcher::isEnabled()) { return; }
+  // Oversampled volumes are read from the voxel store of their
+  // source node. Locking is not the problem: readers are called with
+  // only the reader mutex of our own store held, and the source store
+  // takes the cache mutex and its own reader mutex after that, never
+  // the other way around. But the source node may replace or delete
+  // its voxel store from the application thread at any time, which
+  // the prefetcher thread of this node would not know to stop for.
+  if (this->reader && (this->reader == this->resamplereader)) { return; }
+  this->prefetcher = new CvrBrickPrefetcher(this->voxelstore);
+}
+
+// Must be called before the voxel store is changed in any other way
+// than through its own locking methods.
+void
+SoVolumeDataP::stopPrefetcher(void)
+{
+  delete this->prefetcher;
+  this->prefetcher = NULL;
+}
+
+unsigned int
+SoVolumeDataP::bytesPrVoxel(void) const
+{
+  switch (this->datatype) {
+  case SoVolumeData::UNSIGNED_BYTE: return 1;
+  case SoVolumeData::UNSIGNED_SHORT: return 2;
+  case SoVolumeData::SIGNED_SHORT: return 2;
+  case SoVolumeData::FLOAT: return 4;
+  default: assert(FALSE); break;
+  }
+  return 0;
+}
+
 #define PRIVATE(p) (p->pimpl)
 #define PUBLIC(p) (p->master)
 
@@ -289,6 +681,7 @@ SoVolumeData::SoVolumeData(void)
   // ignored. 20041007 mortene.
   SO_NODE_ADD_FIELD(useSharedPalettedTexture, (TRUE));
   SO_NODE_ADD_FIELD(useCompressedTexture, (TRUE));
+  SO_NODE_ADD_FIELD(timeStep, (0));
 
   SO_NODE_ADD_FIELD(volumeboxmin, (SbVec3f(FLT_MAX, FLT_MAX, FLT_MAX)));
   SO_NODE_ADD_FIELD(volumeboxmax, (SbVec3f(-FLT_MAX, -FLT_MAX, -FLT_MAX)));
@@ -323,6 +716,7 @@ SoVolumeData::initClass(void)
   SO_ENABLE(SoGLRenderAction, CvrPalettedTexturesElement);
   SO_ENABLE(SoGLRenderAction, CvrPageSizeElement);
   SO_ENABLE(SoGLRenderAction, CvrStorageHintElement);
+  SO_ENABLE(SoGLRenderAction, CvrSubSamplingElement);
 }
 
 /*!
@@ -366,7 +760,7 @@ SoVolumeData::getVolumeSize(void) const
         volbox.setBounds(-0.5f, -0.5f, -0.5f, 0.5f, 0.5f, 0.5f);
       }
       else {
-        SoVolumeData::DataType type; SbVec3s dim; // dummy parameters
+        SoVolumeData::DataType type; SbVec3i32 dim; // dummy parameters
         PRIVATE(this)->reader->getDataChar(volbox, type, dim);
       }
     }
@@ -411,6 +805,21 @@ SoVolumeData::setVolumeData(const SbVec3s & dimensions,
                             void * data,
                             SoVolumeData::DataType type,
                             int significantbits)
+{
+  this->setVolumeData(CvrUtil::toVec3i32(dimensions), data, type, significantbits);
+}
+
+/*!
+  Same as above, but with 32-bit \a dimensions, for volumes with more
+  than 32767 voxels along an axis.
+
+  \since SIM Voleon 2.0
+*/
+void
+SoVolumeData::setVolumeData(const SbVec3i32 & dimensions,
+                            void * data,
+                            SoVolumeData::DataType type,
+                            int significantbits)
 {
   // FIXME: implement support for this setting. 20041008 mortene.
   if (significantbits != 0) {
@@ -421,12 +830,15 @@ SoVolumeData::setVolumeData(const SbVec3s & dimensions,
 
   delete[] PRIVATE(this)->histogram;
   PRIVATE(this)->histogram = NULL;
+  PRIVATE(this)->histogramlength = 0;
 
   if (CvrUtil::doDebugging()) {
     SbString typestr;
     switch (type) {
     case UNSIGNED_BYTE: typestr = "8-bit"; break;
     case UNSIGNED_SHORT: typestr = "16-bit"; break;
+    case SIGNED_SHORT: typestr = "signed 16-bit"; break;
+    case FLOAT: typestr = "32-bit float"; break;
     default: assert(FALSE); break;
     }
 
@@ -457,10 +869,33 @@ SbBool
 SoVolumeData::getVolumeData(SbVec3s & dimensions, void *& data,
                             SoVolumeData::DataType & type,
                             int * significantbits) const
+{
+  SbVec3i32 dims32;
+  if (!this->getVolumeData(dims32, data, type, significantbits)) { return FALSE; }
+  if (!CvrUtil::fitsShort(dims32)) {
+    SoDebugError::post("SoVolumeData::getVolumeData",
+                       "dimensions %dx%dx%d need the SbVec3i32 version "
+                       "of this function", dims32[0], dims32[1], dims32[2]);
+    return FALSE;
+  }
+  dimensions = CvrUtil::toVec3s(dims32);
+  return TRUE;
+}
+
+/*!
+  Same as above, but with 32-bit \a dimensions, for volumes with more
+  than 32767 voxels along an axis.
+
+  \since SIM Voleon 2.0
+*/
+SbBool
+SoVolumeData::getVolumeData(SbVec3i32 & dimensions, void *& data,
+                            SoVolumeData::DataType & type,
+                            int * significantbits) const
 {
   if (PRIVATE(this)->reader == NULL) { return FALSE; }
 
-  dimensions = SbVec3s(PRIVATE(this)->dimensions);
+  dimensions = PRIVATE(this)->dimensions;
   // FIXME: this is completely bogus use of SoVolumeReader::m_data --
   // this is *not* where the voxel data is supposed to be stored. That
   // is inside SoVolumeData. 20041008 mortene.
@@ -481,43 +916,28 @@ SoVolumeData::getVolumeData(SbVec3s & dimensions, void *& data,
 
 /*!
   Returns "raw" value of voxel at given position.
+
+  For SIGNED_SHORT data, the lower 16 bits hold the signed value. For
+  FLOAT data, the returned value holds the bit pattern of the
+  floating point value.
  */
 uint32_t
 SoVolumeData::getVoxelValue(const SbVec3s & voxelpos) const
 {
-  // FIXME: this function is also present in CvrVoxelBlockElement.
-  // Refactor to common util function. 20040719 mortene.
-
-  assert(voxelpos[0] < PRIVATE(this)->dimensions[0]);
-  assert(voxelpos[1] < PRIVATE(this)->dimensions[1]);
-  assert(voxelpos[2] < PRIVATE(this)->dimensions[2]);
-
-  uint8_t * voxptr = (uint8_t *)PRIVATE(this)->reader->m_data;
-  int advance = 0;
-  const unsigned int dim[3] = { // so we don't overflow a short
-    static_cast<unsigned int>(PRIVATE(this)->dimensions[0]),
-    static_cast<unsigned int>(PRIVATE(this)->dimensions[1]),
-    static_cast<unsigned int>(PRIVATE(this)->dimensions[2])
-  };
-  advance += voxelpos[2] * dim[0] * dim[1];
-  advance += voxelpos[1] * dim[0];
-  advance += voxelpos[0];
-
-  switch (PRIVATE(this)->datatype) {
-  case UNSIGNED_BYTE: break;
-  case UNSIGNED_SHORT: advance *= 2; break;
-  default: assert(FALSE); break;
-  }
+  return this->getVoxelValue(CvrUtil::toVec3i32(voxelpos));
+}
 
-  voxptr += advance;
+/*!
+  Same as above, but with a 32-bit voxel position, for volumes with
+  more than 32767 voxels along an axis.
 
-  uint32_t val = 0;
-  switch (PRIVATE(this)->datatype) {
-  case UNSIGNED_BYTE: val = *voxptr; break;
-  case UNSIGNED_SHORT: val = *((uint16_t *)voxptr); break;
-  default: assert(FALSE); break;
-  }
-  return val;
+  \since SIM Voleon 2.0
+*/
+uint32_t
+SoVolumeData::getVoxelValue(const SbVec3i32 & voxelpos) const
+{
+  assert(PRIVATE(this)->voxelstore);
+  return PRIVATE(this)->voxelstore->getVoxelValue(voxelpos);
 }
 
 /*!
@@ -587,19 +1007,21 @@ SoVolumeData::getPageSize(void) const
 void
 SoVolumeData::doAction(SoAction * action)
 {
-  unsigned int bytesprvoxel;
-  switch (PRIVATE(this)->datatype) {
-  case UNSIGNED_BYTE: bytesprvoxel = 1; break;
-  case UNSIGNED_SHORT: bytesprvoxel = 2; break;
-  default: assert(FALSE); break;
-  }
-
-  const uint8_t * voxels = (const uint8_t *)
-    (PRIVATE(this)->reader ? PRIVATE(this)->reader->m_data : NULL);
-
-  CvrVoxelBlockElement::set(action->getState(), this, bytesprvoxel,
-                            PRIVATE(this)->dimensions, voxels,
-                            this->getVolumeSize());
+  PRIVATE(this)->syncTimeStep();
+  PRIVATE(this)->syncVoxelStore();
+
+  // Views are rendered from the same voxels as the volume they view,
+  // which lets them share its textures.
+  SoVolumeData * storageowner =
+    PRIVATE(this)->viewparent ? PRIVATE(this)->viewparent : this;
+
+  CvrVoxelBlockElement::set(action->getState(), this,
+                            PRIVATE(this)->bytesPrVoxel(),
+                            PRIVATE(this)->dimensions,
+                            PRIVATE(this)->voxelstore,
+                            this->getVolumeSize(),
+                            PRIVATE(this)->getDataId(),
+                            PRIVATE(storageowner)->getDataId());
 }
 
 void
@@ -612,6 +1034,20 @@ SoVolumeData::GLRender(SoGLRenderAction * action)
   CvrPalettedTexturesElement::set(s, this->usePalettedTexture.getValue());
   CvrPageSizeElement::set(s, this->getPageSize());
   CvrStorageHintElement::set(s, this->storageHint.getValue());
+  PRIVATE(this)->budgetlevel = PRIVATE(this)->findBudgetLevel();
+  CvrSubSamplingElement::set(s, PRIVATE(this)->subsampling,
+                             PRIVATE(this)->getSubSamplingLevel(),
+                             PRIVATE(this)->autosubsampling,
+                             PRIVATE(this)->budgetlevel,
+                             PRIVATE(this)->submethod);
+
+  // Full resolution bricks are not used when everything is rendered
+  // from a coarser level of the resolution pyramid.
+  if (PRIVATE(this)->prefetcher &&
+      (PRIVATE(this)->getSubSamplingLevel() == 0) &&
+      (PRIVATE(this)->budgetlevel == 0)) {
+    PRIVATE(this)->prefetcher->update(s, this->getVolumeSize());
+  }
 }
 
 void
@@ -643,9 +1079,12 @@ SoVolumeData::pick(SoPickAction * action)
   with a variable number of bits-per-texel, and even compressed before
   transferred to the graphics card's on-chip memory.
 
-  Due to the above mentioned reasons, the usefulness of this method is
-  rather dubious, but it is still included for compatibility with
-  TGS VolumeViz API extension to Open Inventor.
+  The limit is enforced by rendering the volume from a reduced
+  resolution level, as if SoVolumeData::enableAutoSubSampling() was
+  on, whenever the textures for the full volume would not fit. The
+  resolution chosen can be found with
+  SoVolumeData::getSubSamplingLevel(), and
+  SoVolumeData::isAutoSubSamplingEnabled() will then return \c TRUE.
 
   The default value is to allow unlimited texture memory usage. This
   means that it's up to the underlying OpenGL driver to take care of
@@ -664,19 +1103,9 @@ SoVolumeData::setTexMemorySize(int megatexels)
 
   PRIVATE(this)->maxnrtexels = megatexels * 1024 * 1024;
 
-#if CVR_DEBUG
-  SoDebugError::postWarning("SoVolumeData::setTexMemorySize",
-                            "Limitation of texture memory usage not "
-                            "implemented yet.");
-#endif // CVR_DEBUG
-
-
-  // FIXME: should kick out texmem pages if we're currently over
-  // limit. 20021121 mortene.
-
   // Trigger a notification and a node-ID update, so texture pages etc
-  // are regenerated.
-  this->touch();
+  // are regenerated at a resolution which fits.
+  PRIVATE(this)->touchKeepVoxelStore();
 }
 
 /*!
@@ -695,15 +1124,47 @@ SoVolumeData::getTexMemorySize(void) const
 void
 SoVolumeData::setReader(SoVolumeReader & reader)
 {
-  PRIVATE(this)->reader = &reader;
+  // The reader of a file is owned by the storage shared with the
+  // other nodes reading it, so setting it again reads the file again.
+  if (PRIVATE(this)->source && (&reader == PRIVATE(this)->source->getReader())) {
+    (void)PRIVATE(this)->readNamedFile();
+    return;
+  }
+
+  PRIVATE(this)->dropVoxelStore();
 
   SbBox3f dummyvolbox;
-  reader.getDataChar(dummyvolbox,
-                     PRIVATE(this)->datatype, PRIVATE(this)->dimensions);
+  SoVolumeData::DataType datatype;
+  SbVec3i32 dimensions;
+  reader.getDataChar(dummyvolbox, datatype, dimensions);
+
+  // Time-varying volumes are read one step at a time, into voxel
+  // stores of their own.
+  if (reader.getNumTimeSteps() > 1) {
+    CvrTimeSeries * timeseries = new CvrTimeSeries(&reader, dimensions, datatype);
+    PRIVATE(this)->timeseries = timeseries;
+    CvrVoxelStore * store =
+      timeseries->setCurrentStep(PRIVATE(this)->clampedTimeStep());
+    if (store == NULL) {
+      PRIVATE(this)->timeseries = NULL;
+      delete timeseries;
+      return;
+    }
+    PRIVATE(this)->useVoxelStore(&reader, store, NULL);
+    timeseries->decodeAhead();
+    return;
+  }
 
-  // Trigger a notification and a node-ID update, so texture pages etc
-  // are regenerated.
-  this->touch();
+  // If the reader has the complete voxel set in memory, the store
+  // will use it directly. If not, voxels will be fetched through the
+  // reader brick by brick, as they are needed.
+  CvrVoxelStore * store = new CvrVoxelStore(&reader, dimensions, datatype, reader.m_data);
+
+  // Done right away, so the application can release its voxel
+  // buffer as soon as we return.
+  if (PRIVATE(this)->compressedstorage) { store->compress(); }
+
+  PRIVATE(this)->useVoxelStore(&reader, store, NULL);
 }
 
 SoVolumeReader *
@@ -712,62 +1173,63 @@ SoVolumeData::getReader(void) const
   return PRIVATE(this)->reader;
 }
 
+/*!
+  Returns the number of time steps of the volume, which is 1 unless
+  the reader delivers a time-varying volume.
+
+  \sa SoVolumeData::timeStep
+  \since SIM Voleon 2.0
+*/
+int
+SoVolumeData::getNumTimeSteps(void) const
+{
+  if (PRIVATE(this)->timeseries == NULL) { return 1; }
+  return PRIVATE(this)->timeseries->getNumTimeSteps();
+}
+
 /*!
   Returns a reference to a histogram of all voxel values. \a length
-  will be set to either 256 for 8-bit data or 65356 for 16-bit data.
+  will be set to either 256 for 8-bit data or 65356 for 16-bit and
+  FLOAT data.
 
   At each index of the histogram table, there will be a value
   indicating the number of voxels that has the data value
-  corresponding to the index.
+  corresponding to the index. For SIGNED_SHORT data, the value -32768
+  is at index 0. For FLOAT data, the index range is spread linearly
+  over the range of values in the volume, just as for rendering.
+
+  The voxels are counted over several threads, the number of which
+  can be set with the environment variable \c CVR_NR_THREADS. Counts
+  are kept for each brick of the volume, so calling this again after
+  only parts of the volume have changed is much cheaper than the
+  first call.
 
   Return value is always \c TRUE.
 */
 SbBool
 SoVolumeData::getHistogram(int & length, int *& histogram)
 {
-  assert(PRIVATE(this)->reader);
-  assert(PRIVATE(this)->reader->m_data);
-
-  if (PRIVATE(this)->histogram != NULL) {
-    length = PRIVATE(this)->histogramlength;
-    histogram = PRIVATE(this)->histogram;
-    return TRUE;
-  }
-
-  const unsigned int dim[3] = { // so we don't overflow a short
-    static_cast<unsigned int>(PRIVATE(this)->dimensions[0]),
-    static_cast<unsigned int>(PRIVATE(this)->dimensions[1]),
-    static_cast<unsigned int>(PRIVATE(this)->dimensions[2])
-  };
+  assert(PRIVATE(this)->voxelstore);
 
   switch (PRIVATE(this)->datatype) {
   case UNSIGNED_BYTE: length = (1 << 8); break;
   case UNSIGNED_SHORT: length = (1 << 16); break;
+  case SIGNED_SHORT: length = (1 << 16); break;
+  case FLOAT: length = (1 << 16); break;
   default: assert(FALSE); break;
   }
 
-  PRIVATE(this)->histogram = new int[length];
-  PRIVATE(this)->histogramlength = length;
-
-  for (unsigned int blankidx = 0; blankidx < (unsigned int)length; blankidx++) {
-    PRIVATE(this)->histogram[blankidx] = 0;
+  if (PRIVATE(this)->histogramlength != (unsigned int)length) {
+    delete[] PRIVATE(this)->histogram;
+    PRIVATE(this)->histogram = new int[length];
+    PRIVATE(this)->histogramlength = length;
   }
 
-  const unsigned long NRVOXELS = dim[0] * dim[1] * dim[2];
-
-  if (PRIVATE(this)->datatype == UNSIGNED_BYTE) {
-    uint8_t * voxptr = (uint8_t *)PRIVATE(this)->reader->m_data;
-    for (unsigned long voxidx = 0; voxidx < NRVOXELS; voxidx++) {
-      PRIVATE(this)->histogram[*voxptr++]++;
-    }
-  }
-  else if (PRIVATE(this)->datatype == UNSIGNED_SHORT) {
-    uint16_t * voxptr = (uint16_t *)PRIVATE(this)->reader->m_data;
-    for (unsigned long voxidx = 0; voxidx < NRVOXELS; voxidx++) {
-      PRIVATE(this)->histogram[*voxptr++]++;
-    }
-  }
-  // unknown types caught by assert() further up
+  // The voxel store keeps the counts per brick, so this is only
+  // expensive the first time, and otherwise just recounts the parts
+  // of the volume which have been flushed from the store. Works
+  // brick by brick, so also for volumes not resident in memory.
+  PRIVATE(this)->voxelstore->getHistogram(PRIVATE(this)->histogram, length);
 
   histogram = PRIVATE(this)->histogram;
 
@@ -776,30 +1238,217 @@ SoVolumeData::getHistogram(int & length, int *& histogram)
 
 // *************************************************************************
 
+/*!
+  Sets \a minval and \a maxval to the smallest and largest voxel
+  value in the volume. For FLOAT data, the values are rounded outwards
+  to the nearest integers; use the \c double overload of this method
+  to get the exact range.
+
+  The value ranges are kept per brick of the volume, and are read from
+  the file for volumes stored in the bricked file format, so after the
+  first call this only has to combine the ranges of the bricks. The
+  first call scans the bricks which have not been scanned yet over
+  several threads, the number of which can be set with the
+  environment variable \c CVR_NR_THREADS.
+
+  Returns \c FALSE if no voxel data has been set.
+*/
 SbBool
 SoVolumeData::getMinMax(int & minval, int & maxval)
 {
-  // FIXME: implement. 20041007 mortene.
-  SoDebugError::post("SoVolumeData::getMinMax",
-                     "not yet implemented -- just a stub");
-  return FALSE;
+  double dmin, dmax;
+  if (!this->getMinMax(dmin, dmax)) { return FALSE; }
+
+  minval = (int)floor(dmin);
+  maxval = (int)ceil(dmax);
+  return TRUE;
+}
+
+/*!
+  Sets \a minval and \a maxval to the smallest and largest voxel
+  value in the volume, as for the \c int overload of this method.
+
+  Returns \c FALSE if no voxel data has been set.
+
+  \since SIM Voleon 2.0
+*/
+SbBool
+SoVolumeData::getMinMax(double & minval, double & maxval)
+{
+  if (PRIVATE(this)->voxelstore == NULL) { return FALSE; }
+
+  PRIVATE(this)->voxelstore->getMinMax(minval, maxval);
+  return TRUE;
 }
 
+/*!
+  Returns a new SoVolumeData node for the voxels within \a region of
+  this volume, given in voxel coordinates, with the maximum corner
+  exclusive. The region is clipped to the volume. The new node covers
+  the corresponding part of this volume's size, and has the same data
+  type.
+
+  No voxels are copied: the new node is a view of the voxels of this
+  node. If they are all resident in memory, the view reads them in
+  place, and otherwise it pulls in just the bricks it needs through
+  the voxel cache. Textures built for the parts of the view which
+  line up with the textures of this volume are shared with it.
+
+  The new node keeps a reference to this node, and follows along when
+  this node is given new voxels, or its voxels are changed and the
+  node touched. Setting a reader or voxel data on the new node makes
+  it an ordinary volume, and releases the reference.
+
+  Returns \c NULL if \a region does not overlap the volume.
+*/
 SoVolumeData *
 SoVolumeData::subSetting(const SbBox3s &region)
 {
-  // FIXME: implement. 20041007 mortene.
-  SoDebugError::post("SoVolumeData::subSetting",
-                     "not yet implemented -- just a stub");
-  return NULL;
+  return this->subSetting(CvrUtil::toBox3i32(region));
 }
 
+/*!
+  Same as above, but with a 32-bit \a region, for volumes with more
+  than 32767 voxels along an axis.
+
+  \since SIM Voleon 2.0
+*/
+SoVolumeData *
+SoVolumeData::subSetting(const SbBox3i32 & region)
+{
+  if (PRIVATE(this)->voxelstore == NULL) {
+    SoDebugError::post("SoVolumeData::subSetting", "no voxel data set");
+    return NULL;
+  }
+
+  SbVec3i32 rmin, rmax;
+  region.getBounds(rmin, rmax);
+  const SbVec3i32 & dims = PRIVATE(this)->dimensions;
+  for (unsigned int i = 0; i < 3; i++) {
+    rmin[i] = SbMax(rmin[i], 0);
+    rmax[i] = SbMin(rmax[i], dims[i]);
+    if (rmin[i] >= rmax[i]) {
+      SoDebugError::post("SoVolumeData::subSetting",
+                         "region [%d, %d, %d] -> [%d, %d, %d] is outside "
+                         "the volume", region.getMin()[0], region.getMin()[1],
+                         region.getMin()[2], region.getMax()[0],
+                         region.getMax()[1], region.getMax()[2]);
+      return NULL;
+    }
+  }
+
+  // Geometric size of the region, as a part of ours.
+  SbVec3f volmin, volmax;
+  this->getVolumeSize().getBounds(volmin, volmax);
+  SbVec3f submin, submax;
+  for (unsigned int i = 0; i < 3; i++) {
+    const float voxelsize = (volmax[i] - volmin[i]) / dims[i];
+    submin[i] = volmin[i] + rmin[i] * voxelsize;
+    submax[i] = volmin[i] + rmax[i] * voxelsize;
+  }
+
+  // A view of a view is set up as a view of the outermost volume.
+  SoVolumeData * parent = this;
+  if (PRIVATE(this)->viewparent) {
+    parent = PRIVATE(this)->viewparent;
+    const SbVec3i32 & offset = PRIVATE(this)->voxelstore->getViewOffset();
+    rmin += offset;
+    rmax += offset;
+  }
+
+  SoVolumeData * newdataset = new SoVolumeData;
+  parent->ref();
+  PRIVATE(newdataset)->viewparent = parent;
+  PRIVATE(newdataset)->viewregion.setBounds(rmin, rmax);
+  PRIVATE(parent)->views.append(newdataset);
+  PRIVATE(newdataset)->setupViewStore();
+
+  newdataset->setVolumeSize(SbBox3f(submin, submax));
+  return newdataset;
+}
+
+/*!
+  Tells the node that the voxels within the \a num regions in \a
+  region have been changed, either in the buffer passed to
+  setVolumeData() or in the data source of the reader.
+
+  Unlike a touch() of the node, which makes all voxels be read again
+  and all textures be rebuilt, only the textures which cover the
+  changed regions are rebuilt, and they are uploaded into the
+  existing GL textures. Reduced resolution levels are recalculated
+  over the regions only, and the histogram and the min / max values
+  are recounted only for the bricks within them.
+
+  For \c FLOAT data, all textures must be rebuilt if the changes
+  widen or narrow the value range of the volume.
+
+  Regions of a node made by subSetting() are given in the voxel
+  coordinates of that node, and update the volume it views.
+
+  \since SIM Voleon 2.0
+*/
 void
 SoVolumeData::updateRegions(const SbBox3s *region, int num)
 {
-  // FIXME: implement. 20041007 mortene.
-  SoDebugError::post("SoVolumeData::updateRegions",
-                     "not yet implemented -- just a stub");
+  if (num <= 0) { return; }
+  SbBox3i32 * regions32 = new SbBox3i32[num];
+  for (int i = 0; i < num; i++) { regions32[i] = CvrUtil::toBox3i32(region[i]); }
+  this->updateRegions(regions32, num);
+  delete[] regions32;
+}
+
+/*!
+  Same as above, but with 32-bit regions, for volumes with more than
+  32767 voxels along an axis.
+
+  \since SIM Voleon 2.0
+*/
+void
+SoVolumeData::updateRegions(const SbBox3i32 * region, int num)
+{
+  if ((PRIVATE(this)->voxelstore == NULL) || (num <= 0)) { return; }
+
+  // The voxels of a view belong to the volume it views.
+  SoVolumeData * parent = PRIVATE(this)->viewparent;
+  if (parent) {
+    const SbVec3i32 & offset = PRIVATE(this)->voxelstore->getViewOffset();
+    SbBox3i32 * viewed = new SbBox3i32[num];
+    for (int i = 0; i < num; i++) {
+      SbVec3i32 rmin, rmax;
+      region[i].getBounds(rmin, rmax);
+      viewed[i].setBounds(rmin + offset, rmax + offset);
+    }
+    parent->updateRegions(viewed, num);
+    delete[] viewed;
+    return;
+  }
+
+  // Any voxels pulled in since the last touch() must be flushed
+  // first, or they would be taken as up to date.
+  PRIVATE(this)->syncVoxelStore();
+
+  // Nodes reading the same file share the voxel store, but each has
+  // its own prefetcher and views.
+  SbList<SoVolumeData *> users;
+  if (PRIVATE(this)->source) { users = PRIVATE(this)->source->getUsers(); }
+  else { users.append(this); }
+
+  // The prefetchers read bricks without holding the cache lock, while
+  // the bricks are replaced below.
+  int i;
+  for (i = 0; i < users.getLength(); i++) { PRIVATE(users[i])->stopPrefetchers(); }
+
+  const SbBool keeptextures = PRIVATE(this)->updateStoreRegions(region, num);
+  for (i = 0; i < users.getLength(); i++) {
+    SoVolumeDataP * user = PRIVATE(users[i]);
+    user->touchAfterUpdate(keeptextures);
+    for (int j = 0; j < user->views.getLength(); j++) {
+      SoVolumeDataP * view = PRIVATE(user->views[j]);
+      view->touchAfterUpdate(view->updateStoreRegions(region, num));
+    }
+  }
+
+  for (i = 0; i < users.getLength(); i++) { PRIVATE(users[i])->startPrefetchers(); }
 }
 
 /*!
@@ -823,43 +1472,85 @@ SoVolumeData::loadRegions(const SbBox3s * region, int num, SoState * state,
 
 // *************************************************************************
 
+/*!
+  Returns a new SoVolumeData node with the voxels of this volume
+  resampled to \a dimensions. The new node covers the same volume
+  size, and has the same data type.
+
+  Each voxel of the new volume covers a box of voxels in this volume,
+  and gets either the value of its first voxel (\c NEAREST), the
+  largest value within it (\c MAX), or the average of the values
+  (\c AVERAGE).
+
+  The voxels are resampled over several threads, the number of which
+  can be set with the environment variable \c CVR_NR_THREADS. This
+  also works for volumes which are not resident in memory.
+
+  If \a dimensions are larger than those of this volume along any
+  axis, and \a overMethod is not \c NONE, the new volume is instead
+  interpolated from this volume along all axes, by picking the nearest
+  voxel (\c CONSTANT), or by trilinear (\c LINEAR) or tricubic
+  (\c CUBIC) interpolation. The voxels of the new volume are then
+  computed as they are needed, so the complete volume is never held
+  in memory at once. The new node keeps a reference to this node, and
+  this node should not be given new voxel data for as long as the new
+  node is in use.
+
+  With \a overMethod \c NONE, \a dimensions are clamped to the
+  dimensions of this volume.
+*/
 SoVolumeData *
 SoVolumeData::reSampling(const SbVec3s &dimensions,
                          SoVolumeData::SubMethod subMethod,
                          SoVolumeData::OverMethod overMethod)
+{
+  return this->reSampling(CvrUtil::toVec3i32(dimensions), subMethod, overMethod);
+}
+
+/*!
+  Same as above, but with 32-bit \a dimensions, for volumes with more
+  than 32767 voxels along an axis.
+
+  \since SIM Voleon 2.0
+*/
+SoVolumeData *
+SoVolumeData::reSampling(const SbVec3i32 & dimensions,
+                         SoVolumeData::SubMethod subMethod,
+                         SoVolumeData::OverMethod overMethod)
 { 
-  SoVolumeData * newdataset = new SoVolumeData;
-  
-  // Creating a temporary dataset which will hold the result
-  const int datasize = dimensions[0] * dimensions[1] * dimensions[2];
-  void * data;
-  switch (PRIVATE(this)->datatype) {
-  case UNSIGNED_BYTE: 
-    data = new uint8_t[datasize];       
-    break;
-  case UNSIGNED_SHORT: 
-    data = new uint16_t[datasize];
-    break;
-  default:
-    assert(0 && "Unknown datatype");
+  CvrVoxelStore * store = PRIVATE(this)->voxelstore;
+  assert(store);
+
+  const SbVec3i32 & volumeslices = store->getDimensions();
+  SbBool oversample = FALSE;
+  for (unsigned int i = 0; i < 3; i++) {
+    assert(dimensions[i] > 0);
+    if (dimensions[i] > volumeslices[i]) { oversample = TRUE; }
+  }
+
+  if (oversample && (overMethod != NONE)) {
+    SoVolumeData * newdataset = new SoVolumeData;
+    PRIVATE(newdataset)->resamplereader =
+      new SoVolumeDataP::ResampleReader(this, PRIVATE(this), dimensions, overMethod);
+    newdataset->setReader(*PRIVATE(newdataset)->resamplereader);
+    newdataset->setVolumeSize(this->getVolumeSize());
+    return newdataset;
   }
-  
-  SbVec3s volumeslices;
-  void * discardptr;
-  SoVolumeData::DataType type;
-  const SbBool ok = this->getVolumeData(volumeslices, discardptr, type);
-  assert(ok);
-
-  // FIXME: Over sampling is not implemented yet (Not by TGS
-  // either). We therefore crop the dimensions if oversampling is
-  // requested as done by VolumeViz. (20040113 handegar)
-  SbVec3s newdim = dimensions;
-  if (volumeslices[0] < newdim[0]) newdim[0] = volumeslices[0];
-  if (volumeslices[1] < newdim[1]) newdim[1] = volumeslices[1];
-  if (volumeslices[2] < newdim[2]) newdim[2] = volumeslices[2];
-
-  PRIVATE(this)->downSample(newdim, subMethod, data);
-  
+
+  // Without an oversampling method, the dimensions are cropped, as
+  // done by VolumeViz. (20040113 handegar)
+  SbVec3i32 newdim = dimensions;
+  for (unsigned int i = 0; i < 3; i++) {
+    newdim[i] = SbMax(1, SbMin(newdim[i], volumeslices[i]));
+  }
+
+  // Holds the voxels of the new node.
+  const size_t datasize = (size_t)newdim[0] * newdim[1] * newdim[2];
+  void * data = new uint8_t[datasize * store->getBytesPrVoxel()];
+
+  CvrResampler::downSample(store, newdim, subMethod, data);
+
+  SoVolumeData * newdataset = new SoVolumeData;
   newdataset->setVolumeData(newdim, data, PRIVATE(this)->datatype);
   newdataset->setVolumeSize(this->getVolumeSize());
   // FIXME: this next line looks superfluous? 20040229 mortene.
@@ -870,38 +1561,142 @@ SoVolumeData::reSampling(const SbVec3s &dimensions,
 
 // *************************************************************************
 
+/*!
+  Turn on or off rendering at the resolution set up with
+  SoVolumeData::setSubSamplingLevel().
+
+  \sa SoVolumeData::setSubSamplingLevel()
+  \since SIM Voleon 2.0
+*/
 void
 SoVolumeData::enableSubSampling(SbBool enable)
 {
-  // FIXME: implement. 20041007 mortene.
-  SoDebugError::post("SoVolumeData::enableSubSampling",
-                     "not yet implemented -- just a stub");
+  PRIVATE(this)->subsampling = enable;
+  PRIVATE(this)->touchKeepVoxelStore();
 }
 
-// \since SIM Voleon 2.0
+/*!
+  Returns whether or not rendering is done at a fixed reduced
+  resolution.
+
+  \since SIM Voleon 2.0
+*/
 SbBool
 SoVolumeData::isSubSamplingEnabled(void) const
 {
-  // FIXME: implement. 20041007 mortene.
-  return FALSE;
+  return PRIVATE(this)->subsampling;
+}
+
+// *************************************************************************
+
+/*!
+  Keep the voxels compressed in memory. Each brick of the volume is
+  compressed with a fast lossless scheme, and only decompressed when
+  it is needed for building textures. Recently used bricks are kept
+  in uncompressed form in the voxel cache, whose size can be set with
+  the environment variable \c CVR_VOXEL_CACHE_SIZE (in megabytes).
+
+  Volumes with large empty or uniform regions, which is typical for
+  e.g. medical and seismic data, usually compress to a fraction of
+  their original size.
+
+  With compressed storage enabled, the volume data node holds its own
+  copy of the voxels, so a buffer passed in with
+  SoVolumeData::setVolumeData() can be deallocated after the call. The
+  compression is done over several threads, the number of which can
+  be set with the environment variable \c CVR_NR_THREADS.
+
+  When compressed storage is enabled for a volume already set up, the
+  voxels are compressed right away. Disabling it makes the node access
+  the reader's voxels again, so then they must still be available.
+
+  Default value is \c FALSE, unless the environment variable \c
+  CVR_COMPRESS_VOXELS is set to a positive value.
+
+  \since SIM Voleon 2.0
+*/
+void
+SoVolumeData::enableCompressedStorage(SbBool enable)
+{
+  if (PRIVATE(this)->compressedstorage == enable) { return; }
+  PRIVATE(this)->compressedstorage = enable;
+
+  // Views share the voxels of the volume they view, whichever way
+  // it stores them.
+  CvrVoxelStore * store = PRIVATE(this)->voxelstore;
+  if ((store == NULL) || PRIVATE(this)->viewparent) { return; }
+
+  // Time steps are swapped in and out whole, and not worth the cost
+  // of compressing.
+  if (PRIVATE(this)->timeseries) { return; }
+
+  // The storage of a file is only shared between nodes which store
+  // it the same way.
+  if (PRIVATE(this)->source) {
+    (void)PRIVATE(this)->readNamedFile();
+    return;
+  }
+
+  if (enable) {
+    // Views may point straight into the voxels which are released
+    // by the compression.
+    PRIVATE(this)->releaseViews();
+    PRIVATE(this)->stopPrefetcher();
+    store->compress();
+    PRIVATE(this)->startPrefetcher();
+    PRIVATE(this)->setupViews();
+    PRIVATE(this)->touchKeepVoxelStore();
+  }
+  else {
+    this->setReader(*(PRIVATE(this)->reader));
+  }
+}
+
+/*!
+  Returns whether or not the voxels are kept compressed in memory.
+
+  \sa SoVolumeData::enableCompressedStorage()
+  \since SIM Voleon 2.0
+*/
+SbBool
+SoVolumeData::isCompressedStorageEnabled(void) const
+{
+  return PRIVATE(this)->compressedstorage;
 }
 
 // *************************************************************************
 
+/*!
+  When enabled, parts of the volume which are small on screen will
+  automatically be rendered at a reduced resolution, so that no
+  more texels are used than can be seen. This can save a lot of
+  texture memory for volumes far away from the camera.
+
+  Default is \c FALSE.
+
+  \since SIM Voleon 2.0
+*/
 void
 SoVolumeData::enableAutoSubSampling(SbBool enable)
 {
-  // FIXME: implement. 20041007 mortene.
-  SoDebugError::post("SoVolumeData::enableAutoSubSampling",
-                     "not yet implemented -- just a stub");
+  PRIVATE(this)->autosubsampling = enable;
+  PRIVATE(this)->touchKeepVoxelStore();
 }
 
-// \since SIM Voleon 2.0
+/*!
+  Returns whether or not the rendering resolution is picked
+  automatically.
+
+  This will also return \c TRUE if the volume is currently rendered
+  at a reduced resolution to fit within the limit set by
+  SoVolumeData::setTexMemorySize().
+
+  \since SIM Voleon 2.0
+*/
 SbBool
 SoVolumeData::isAutoSubSamplingEnabled(void) const
 {
-  // FIXME: implement. 20041007 mortene.
-  return FALSE;
+  return PRIVATE(this)->autosubsampling || (PRIVATE(this)->budgetlevel > 0);
 }
 
 // *************************************************************************
@@ -924,153 +1719,92 @@ SoVolumeData::isAutoUnSamplingEnabled(void) const
 
 // *************************************************************************
 
+/*!
+  Go back to rendering the volume at full resolution, by turning off
+  both fixed and automatic subsampling.
+
+  \since SIM Voleon 2.0
+*/
 void
 SoVolumeData::unSample(void)
 {
-  // FIXME: implement. 20041007 mortene.
-  SoDebugError::post("SoVolumeData::unSample",
-                     "not yet implemented -- just a stub");
+  PRIVATE(this)->subsampling = FALSE;
+  PRIVATE(this)->autosubsampling = FALSE;
+  PRIVATE(this)->touchKeepVoxelStore();
 }
 
 // *************************************************************************
 
+/*!
+  Sets how voxel values are combined when making reduced resolution
+  versions of the volume. SoVolumeData::NEAREST picks one of the
+  voxels, SoVolumeData::MAX picks the largest value (which keeps
+  small, bright features visible), and SoVolumeData::AVERAGE uses
+  the mean value.
+
+  Default is SoVolumeData::NEAREST.
+
+  \since SIM Voleon 2.0
+*/
 void
 SoVolumeData::setSubSamplingMethod(SubMethod method)
 {
-  // FIXME: implement. 20041007 mortene.
-  SoDebugError::post("SoVolumeData::setSubSamplingMethod",
-                     "not yet implemented -- just a stub");
+  PRIVATE(this)->submethod = method;
+  PRIVATE(this)->touchKeepVoxelStore();
 }
 
 // \since SIM Voleon 2.0
 SoVolumeData::SubMethod
 SoVolumeData::getSubSamplingMethod(void) const
 {
-  // FIXME: implement. 20041007 mortene.
-  return SoVolumeData::NEAREST;
+  return PRIVATE(this)->submethod;
 }
 
 // *************************************************************************
 
-void
-SoVolumeData::setSubSamplingLevel(const SbVec3s &ROISampling,
-                    const SbVec3s &secondarySampling)
-{
-  // FIXME: implement. 20041007 mortene.
-  SoDebugError::post("SoVolumeData::setSubSamplingLevel",
-                     "not yet implemented -- just a stub");
-}
+/*!
+  Sets the reduced resolution used for rendering when
+  SoVolumeData::enableSubSampling() has been turned on.
 
-// \since SIM Voleon 2.0
+  The values are levels of the resolution pyramid, where level \e n
+  is reduced by a factor of 2^n along each axis. Levels are the same
+  along all axes, so the largest component is used.
+
+  Regions of interest are not supported, so \a roi is used for the
+  complete volume. \a secondary is only stored.
+
+  \since SIM Voleon 2.0
+*/
 void
-SoVolumeData::getSubSamplingLevel(SbVec3s & roi, SbVec3s & secondary) const
+SoVolumeData::setSubSamplingLevel(const SbVec3s & roi,
+                                  const SbVec3s & secondary)
 {
-  // FIXME: implement. 20041007 mortene.
-  SoDebugError::post("SoVolumeData::getSubSamplingLevel",
-                     "not yet implemented -- just a stub");
+  assert(roi[0] >= 0 && roi[1] >= 0 && roi[2] >= 0);
+
+  PRIVATE(this)->roisampling = roi;
+  PRIVATE(this)->secondarysampling = secondary;
+  PRIVATE(this)->touchKeepVoxelStore();
 }
 
-// *************************************************************************
+/*!
+  Returns the subsampling levels set with
+  SoVolumeData::setSubSamplingLevel(), or the level needed to fit
+  within the limit set by SoVolumeData::setTexMemorySize(), if that
+  is coarser.
 
-void 
-SoVolumeDataP::overSample(SbVec3s dimensions, SoVolumeData::OverMethod subMethod, void * data)
+  \since SIM Voleon 2.0
+*/
+void
+SoVolumeData::getSubSamplingLevel(SbVec3s & roi, SbVec3s & secondary) const
 {
-  // FIXME: implement. 20041007 mortene.
-  SoDebugError::post("SoVolumeData::overSample",
-                     "not yet implemented -- just a stub");
-}
+  roi = PRIVATE(this)->roisampling;
+  secondary = PRIVATE(this)->secondarysampling;
 
-void 
-SoVolumeDataP::downSample(SbVec3s dimensions, SoVolumeData::SubMethod subMethod, void * data)
-{
-
-  SbVec3s volumeslices;
-  void * discardptr;
-  SoVolumeData::DataType type;
-  const SbBool ok = master->getVolumeData(volumeslices, discardptr, type);
-  assert(ok);
-
-  const float scalefactorx = ((float) volumeslices[0]) / (dimensions[0]);
-  const float scalefactory = ((float) volumeslices[1]) / (dimensions[1]);
-  const float scalefactorz = ((float) volumeslices[2]) / (dimensions[2]);
-    
-  for (int i=0; i<dimensions[0]; ++i) { // x
-    for (int j=0; j<dimensions[1]; ++j) { // y
-      for (int k=0; k<dimensions[2]; ++k) { // z
-
-        const int xpos = (int) (scalefactorx * i);
-        const int ypos = (int) (scalefactory * j);
-        const int zpos = (int) (scalefactorz * k);   
-        uint32_t resultvoxel = 0; 
-        
-        if (subMethod != SoVolumeData::NEAREST) { // Maximum and Average
-         
-          double averagevoxel[4] = {0, 0, 0, 0};
-
-          for (int x=0; x<((int) scalefactorx); ++x) {
-            for (int y=0; y<((int) scalefactory); ++y) {
-              for (int z=0; z<((int) scalefactorz); ++z) {
-
-                if (subMethod == SoVolumeData::AVERAGE) { // AVERAGE sampling
-                  uint32_t val = master->getVoxelValue(SbVec3s(xpos+x, ypos+y, zpos+z));
-                  averagevoxel[0] += (double) val;                                    
-                  if (this->datatype != SoVolumeData::UNSIGNED_BYTE) {
-                    averagevoxel[1] += (double) ((val>>8) & 0x000000ff);
-                  }
-                }
-                else { // MAX sampling
-                  resultvoxel = SbMax(resultvoxel, 
-                                      master->getVoxelValue(SbVec3s(xpos+x, ypos+y, zpos+z)));
-                }
-              }
-            }
-          }
-
-          if (subMethod == SoVolumeData::AVERAGE) { 
-
-            float nr = scalefactorx * scalefactory * scalefactorz;
-            switch (this->datatype) {
-            case SoVolumeData::UNSIGNED_SHORT: nr = nr * 2; break;
-            default: break;
-            }
-
-            resultvoxel = (uint32_t) (averagevoxel[3] / nr);
-            resultvoxel = resultvoxel << 8;
-            resultvoxel += (uint8_t) (averagevoxel[2] / nr);
-            resultvoxel = resultvoxel << 8;
-            resultvoxel += (uint8_t) (averagevoxel[1] / nr);
-            resultvoxel = resultvoxel << 8;
-            resultvoxel += (uint8_t) (averagevoxel[0] / nr);                         
-          }
-          
-        } 
-        else { // NEAREST sampling
-          resultvoxel = master->getVoxelValue(SbVec3s(xpos, ypos, zpos)); 
-        }
-       
-        const int index = (k * dimensions[0] * dimensions[1]) + (j * dimensions[0]) + i;
-
-        switch (this->datatype) {
-        case SoVolumeData::UNSIGNED_BYTE: 
-          {
-            uint8_t * tmp = (uint8_t *) data;            
-            tmp[index] = (uint8_t) resultvoxel; 
-            break; 
-          }              
-        case SoVolumeData::UNSIGNED_SHORT:        
-          {
-            uint16_t * tmp = (uint16_t *) data;   
-            tmp[index] = (uint16_t) resultvoxel;
-            break;
-          }
-        default: assert(FALSE);
-        }
-        
-      }
-    }
+  const short budget = (short)PRIVATE(this)->budgetlevel;
+  for (unsigned int i = 0; i < 3; i++) {
+    roi[i] = SbMax(roi[i], budget);
+    secondary[i] = SbMax(secondary[i], budget);
   }
-  
-
 }
 
 // *************************************************************************
@@ -1099,18 +1833,21 @@ SoVolumeDataP::readNamedFile(void)
     return FALSE;
   }
 
-  // FIXME: need to detect file format and choose the correct
-  // reader. 20031009 mortene.
-  SoVRVolFileReader * filereader = new SoVRVolFileReader;
-  filereader->setUserData((void *)fullfilename.getString());
-
   // FIXME: need all sorts of error checking; format, permission to
   // open, that the file is not corrupt, etc etc. The crappy interface
   // of the SoVolumeReader class (and its subclasses) does not permit
   // that, though (so that's the real problem to fix.) 20031009 mortene.
 
-  if (this->reader) { /* FIXME: delete old! 20031009 mortene. */ }
-  PUBLIC(this)->setReader(*filereader);
+  // Other nodes may already have read the file, in which case its
+  // voxels and textures are shared with them. Acquired before the
+  // current source is released, so that reading the same file again
+  // keeps it.
+  CvrSharedSource * source =
+    CvrSharedSource::acquire(fullfilename.getString(), this->compressedstorage, PUBLIC(this));
+  if (source == NULL) { return FALSE; }
+
+  this->dropVoxelStore();
+  this->useVoxelStore(source->getReader(), source->getVoxelStore(), source);
 
 //   SoReadError::post(in, "Unable to read volume data file: ``%s''",
 //                     fullfilename.getString());
@@ -1125,3 +1862,274 @@ SoVolumeDataP::filenameFieldModified(void * userdata, SoSensor * sensor)
 }
 
 // *************************************************************************
+
+// A touch() may mean that the voxel data has been modified, so any
+// bricks cached from the reader could be stale. Views copy their
+// bricks from the volume they view, so they are flushed along with
+// it, as are the other nodes sharing the voxel store.
+void
+SoVolumeDataP::syncVoxelStore(void)
+{
+  if (this->viewparent) { PRIVATE(this->viewparent)->syncVoxelStore(); }
+
+  const SbUniqueId nodeid = PUBLIC(this)->getNodeId();
+  if ((this->voxelstore == NULL) || (this->voxelstorenodeid == nodeid)) { return; }
+
+  this->voxelstore->flush();
+  this->voxelstorenodeid = nodeid;
+
+  if (this->source == NULL) {
+    this->flushViews();
+    return;
+  }
+
+  this->source->renewDataId();
+  const SbList<SoVolumeData *> & users = this->source->getUsers();
+  for (int i = 0; i < users.getLength(); i++) { PRIVATE(users[i])->flushViews(); }
+}
+
+// Swaps in the voxel store of the step set in the timeStep field, for
+// time-varying volumes, and starts decoding the step after it.
+//
+// Changing the field touches the node, so the voxels get a new data id
+// and textures are made for the new step. Views are set up on the new
+// store, and get new data ids from ours.
+void
+SoVolumeDataP::syncTimeStep(void)
+{
+  if (this->timeseries == NULL) { return; }
+
+  const int step = this->clampedTimeStep();
+  if (step != this->timeseries->getCurrentStep()) {
+    CvrVoxelStore * store = this->timeseries->setCurrentStep(step);
+    if (store && (store != this->voxelstore)) {
+      this->releaseViews();
+      this->voxelstore = store;
+      for (int i = 0; i < this->views.getLength(); i++) {
+        PRIVATE(this->views[i])->setupViewStore();
+      }
+    }
+  }
+
+  this->timeseries->decodeAhead();
+}
+
+int
+SoVolumeDataP::clampedTimeStep(void) const
+{
+  assert(this->timeseries);
+  const int step = PUBLIC(this)->timeStep.getValue();
+  return SbMin(SbMax(step, 0), this->timeseries->getNumTimeSteps() - 1);
+}
+
+// Gives up the current voxel store, before another is taken into use.
+void
+SoVolumeDataP::dropVoxelStore(void)
+{
+  this->releaseViews();
+  this->stopPrefetcher();
+  this->releaseVoxelStore();
+}
+
+// Deletes the voxel store, or releases it to the other nodes sharing
+// it.
+void
+SoVolumeDataP::releaseVoxelStore(void)
+{
+  if (this->source) {
+    this->source->release(PUBLIC(this));
+    this->source = NULL;
+  }
+  else if (this->timeseries) {
+    delete this->timeseries;
+    this->timeseries = NULL;
+  }
+  else {
+    delete this->voxelstore;
+  }
+  this->voxelstore = NULL;
+}
+
+// Takes the voxel store of "reader" into use. "source" is set if the
+// store is shared with other nodes, and owns both.
+void
+SoVolumeDataP::useVoxelStore(SoVolumeReader * reader, CvrVoxelStore * store,
+                             CvrSharedSource * source)
+{
+  assert(this->voxelstore == NULL);
+  this->reader = reader;
+  this->voxelstore = store;
+  this->source = source;
+  this->dimensions = store->getDimensions();
+  this->datatype = store->getDataType();
+
+  // A view given voxels of its own is no longer a view.
+  if (this->viewparent) { this->detachView(); }
+
+  if (reader != this->resamplereader) {
+    delete this->resamplereader;
+    this->resamplereader = NULL;
+  }
+
+  this->startPrefetcher();
+  this->setupViews();
+
+  // Trigger a notification and a node-ID update, so texture pages etc
+  // are regenerated.
+  PUBLIC(this)->touch();
+}
+
+// Returns the id the voxels of the node are known by to the rendering
+// code, for the CvrVoxelBlockElement. It changes when the node is
+// touched, except by touchKeepDataId(), and for a view also when the
+// id of the volume it views changes. Nodes reading the same file use
+// the id of the shared source.
+SbUniqueId
+SoVolumeDataP::getDataId(void)
+{
+  if (this->source) { return this->source->getDataId(); }
+
+  const SbUniqueId nodeid = PUBLIC(this)->getNodeId();
+  const SbUniqueId parentid =
+    this->viewparent ? PRIVATE(this->viewparent)->getDataId() : 0;
+  if ((nodeid != this->datanodeid) || (parentid != this->dataparentid)) {
+    this->datanodeid = nodeid;
+    this->dataparentid = parentid;
+    this->dataid = this->viewparent ? SoNode::getNextNodeId() : nodeid;
+  }
+  return this->dataid;
+}
+
+// Updates the voxel store for the regions changed by
+// SoVolumeData::updateRegions(), which are given in the voxel
+// coordinates of the viewed volume for a view. Returns FALSE if all
+// textures made from the store must be rebuilt.
+SbBool
+SoVolumeDataP::updateStoreRegions(const SbBox3i32 * region, int num)
+{
+  CvrVoxelStore * store = this->voxelstore;
+  if (store == NULL) { return TRUE; }
+
+  // The lookup indices of FLOAT voxels are spread over the value
+  // range of the volume, so all textures are stale if it changes.
+  const SbBool floatdata = (this->datatype == SoVolumeData::FLOAT);
+  double offset0 = 0.0, scale0 = 1.0, offset1 = 0.0, scale1 = 1.0;
+  if (floatdata) { store->getIndexMapping(offset0, scale0); }
+
+  const SbVec3i32 & offset = store->getViewOffset();
+  for (int i = 0; i < num; i++) {
+    SbVec3i32 rmin, rmax;
+    region[i].getBounds(rmin, rmax);
+    store->updateRegion(SbBox3i32(rmin - offset, rmax - offset));
+  }
+
+  if (floatdata) { store->getIndexMapping(offset1, scale1); }
+  return (offset0 == offset1) && (scale0 == scale1);
+}
+
+// Notifies about voxels changed by SoVolumeData::updateRegions(). The
+// textures track the changes themselves, unless "keeptextures" is
+// FALSE.
+void
+SoVolumeDataP::touchAfterUpdate(const SbBool keeptextures)
+{
+  if (keeptextures) { this->touchKeepDataId(); }
+  else { PUBLIC(this)->touch(); }
+}
+
+// Stops the prefetchers of the node and its views, while the voxel
+// store is changed.
+void
+SoVolumeDataP::stopPrefetchers(void)
+{
+  this->stopPrefetcher();
+  for (int i = 0; i < this->views.getLength(); i++) {
+    PRIVATE(this->views[i])->stopPrefetcher();
+  }
+}
+
+void
+SoVolumeDataP::startPrefetchers(void)
+{
+  this->startPrefetcher();
+  for (int i = 0; i < this->views.getLength(); i++) {
+    PRIVATE(this->views[i])->startPrefetcher();
+  }
+}
+
+// Sets up the voxel store of a view from the current voxel store of
+// the volume it views.
+void
+SoVolumeDataP::setupViewStore(void)
+{
+  assert(this->viewparent && (this->voxelstore == NULL));
+
+  CvrVoxelStore * viewed = PRIVATE(this->viewparent)->voxelstore;
+  if (viewed == NULL) { return; }
+
+  // The viewed volume may have been given voxels of other dimensions
+  // since the view was made.
+  const SbVec3i32 & vieweddims = viewed->getDimensions();
+  SbVec3i32 rmin, rmax;
+  this->viewregion.getBounds(rmin, rmax);
+  for (unsigned int i = 0; i < 3; i++) {
+    rmin[i] = SbMin(rmin[i], vieweddims[i] - 1);
+    rmax[i] = SbMax(rmin[i] + 1, SbMin(rmax[i], vieweddims[i]));
+  }
+
+  this->voxelstore = new CvrVoxelStore(viewed, SbBox3i32(rmin, rmax));
+  this->dimensions = rmax - rmin;
+  this->datatype = viewed->getDataType();
+  this->startPrefetcher();
+}
+
+void
+SoVolumeDataP::releaseViewStore(void)
+{
+  this->stopPrefetcher();
+  this->releaseVoxelStore();
+}
+
+// Turns a view into an ordinary volume. Its voxel store must already
+// have been released or replaced.
+void
+SoVolumeDataP::detachView(void)
+{
+  assert(this->viewparent);
+  SoVolumeData * parent = this->viewparent;
+  this->viewparent = NULL;
+  PRIVATE(parent)->views.removeItem(PUBLIC(this));
+  parent->unref();
+}
+
+// Must be called before the voxel store is replaced or compressed, as
+// the views may point into it.
+void
+SoVolumeDataP::releaseViews(void)
+{
+  for (int i = 0; i < this->views.getLength(); i++) {
+    PRIVATE(this->views[i])->releaseViewStore();
+  }
+}
+
+// Sets the views up again after releaseViews().
+void
+SoVolumeDataP::setupViews(void)
+{
+  for (int i = 0; i < this->views.getLength(); i++) {
+    PRIVATE(this->views[i])->setupViewStore();
+    this->views[i]->touch();
+  }
+}
+
+// Drops the bricks the views have copied out of the voxel store.
+void
+SoVolumeDataP::flushViews(void)
+{
+  for (int i = 0; i < this->views.getLength(); i++) {
+    CvrVoxelStore * viewstore = PRIVATE(this->views[i])->voxelstore;
+    if (viewstore) { viewstore->flush(); }
+  }
+}
+
+// *************************************************************************
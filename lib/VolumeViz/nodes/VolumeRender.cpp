@@ -163,8 +163,8 @@ public:
     if (this->cubehandler) delete this->cubehandler;
   }
 
-  unsigned int calculateNrOf2DSlices(SoGLRenderAction * action, const SbVec3s & dimensions);
-  unsigned int calculateNrOf3DSlices(SoGLRenderAction * action, const SbVec3s & dimensions);
+  unsigned int calculateNrOf2DSlices(SoGLRenderAction * action, const SbVec3i32 & dimensions);
+  unsigned int calculateNrOf3DSlices(SoGLRenderAction * action, const SbVec3i32 & dimensions);
   SbBool use3DTexturing(const cc_glglue * glglue) const;
 
   static void setupPerformanceTest(const cc_glglue * glglue, void *);
@@ -475,7 +475,7 @@ SoVolumeRender::GLRender(SoGLRenderAction * action)
 
   // Fetching the current volumedata
   const CvrVoxelBlockElement * vbelement = CvrVoxelBlockElement::getInstance(state);
-  const SbVec3s & voxcubedims = vbelement->getVoxelCubeDimensions();
+  const SbVec3i32 & voxcubedims = vbelement->getVoxelCubeDimensions();
 
   if (vbelement == NULL) {
     static SbBool first = TRUE;
@@ -1040,7 +1040,7 @@ SoVolumeRenderP::use3DTexturing(const cc_glglue * glglue) const
 
 unsigned int
 SoVolumeRenderP::calculateNrOf2DSlices(SoGLRenderAction * action,
-                                       const SbVec3s & dimensions)
+                                       const SbVec3i32 & dimensions)
 {
   int numslices = 0;
   const int control = PUBLIC(this)->numSlicesControl.getValue();
@@ -1072,7 +1072,7 @@ SoVolumeRenderP::calculateNrOf2DSlices(SoGLRenderAction * action,
 
 unsigned int
 SoVolumeRenderP::calculateNrOf3DSlices(SoGLRenderAction * action,
-                                       const SbVec3s & dimensions)
+                                       const SbVec3i32 & dimensions)
 {
   int numslices = 0;
   const int control = PUBLIC(this)->numSlicesControl.getValue();
@@ -1081,9 +1081,9 @@ SoVolumeRenderP::calculateNrOf3DSlices(SoGLRenderAction * action,
   if ((control == SoVolumeRender::ALL) ||
       (PUBLIC(this)->numSlices.getValue() <= 0)) {
     // 'Applying' the Nyquist theorem
-    numslices = (unsigned int) sqrt(double(dimensions[0]*dimensions[0] +
-                                           dimensions[1]*dimensions[1] +
-                                           dimensions[2]*dimensions[2])) * 2;
+    numslices = (unsigned int) sqrt(double(dimensions[0])*dimensions[0] +
+                                    double(dimensions[1])*dimensions[1] +
+                                    double(dimensions[2])*dimensions[2]) * 2;
     numslices = int(complexity * 2.0f * numslices);
   }
   else if (control == SoVolumeRender::MANUAL) {
@@ -213,8 +213,19 @@
   format introduced by the book <i>"Introduction To Volume
   Rendering"</i>, by Lichtenbelt, Crane and Naqvi (Hewlett-Packard /
   Prentice Hall), <i>ISBN 0-13-861683-3</i>. (See the
-  SoVRVolFileReader class doc for info). Support for more file formats
-  can be added by extending the SoVolumeReader class.
+  SoVRVolFileReader class doc for info). Large volumes can be stored in
+  a bricked format of SIM Voleon's own, which is read on demand, brick
+  by brick (see the SoVRBrickFileReader class doc). Support for more
+  file formats can be added by extending the SoVolumeReader class.
+
+  For volumes read on demand, bricks are loaded ahead of need in a
+  background thread, from where the camera motion is predicted to
+  take the view next. How much this may read per rendered frame, and
+  how much of the voxel cache the prefetched bricks may occupy, can
+  be set in megabytes with the environment variables \c
+  CVR_PREFETCH_IO_BUDGET (default 16) and \c CVR_PREFETCH_MEMORY
+  (default a quarter of the cache size). Setting \c CVR_NO_PREFETCH
+  turns this off.
 
   Beware that large voxel sets are divided into sub cubes. The largest
   default sub cube size is by default set to 128x128x128, to match the
@@ -255,6 +266,7 @@
 
 #include <VolumeViz/nodes/SoVolumeRendering.h>
 
+#include <Inventor/C/tidbits.h>
 #include <Inventor/actions/SoGLRenderAction.h>
 #include <Inventor/errors/SoDebugError.h>
 
@@ -268,6 +280,7 @@
 #include <VolumeViz/elements/CvrPageSizeElement.h>
 #include <VolumeViz/elements/CvrPalettedTexturesElement.h>
 #include <VolumeViz/elements/CvrStorageHintElement.h>
+#include <VolumeViz/elements/CvrSubSamplingElement.h>
 #include <VolumeViz/elements/CvrVoxelBlockElement.h>
 #include <VolumeViz/elements/CvrLightingElement.h>
 #include <VolumeViz/elements/SoTransferFunctionElement.h>
@@ -283,6 +296,7 @@
 #include <VolumeViz/nodes/SoVolumeTriangleStripSet.h>
 #include <VolumeViz/render/common/CvrTextureObject.h>
 #include <VolumeViz/misc/CvrGlobalRenderLock.h>
+#include <VolumeViz/misc/CvrParallel.h>
 
 // *************************************************************************
 
@@ -293,8 +307,17 @@ SO_NODE_ABSTRACT_SOURCE(SoVolumeRendering);
 class SoVolumeRenderingP {
 public:
   static SbBool wasinitialized;
+  static void cleanup(void);
 };
 
+// Called from coin_atexit(), to stop the threads of the library
+// before the process exits.
+void
+SoVolumeRenderingP::cleanup(void)
+{
+  CvrParallel::cleanup();
+}
+
 SbBool SoVolumeRenderingP::wasinitialized = FALSE;
 
 #define PRIVATE(p) (p->pimpl)
@@ -330,6 +353,7 @@ SoVolumeRendering::init(void)
   SoVolumeRenderingP::wasinitialized = TRUE;
 
   CvrGlobalRenderLock::init();
+  coin_atexit((coin_atexit_f *)SoVolumeRenderingP::cleanup, 0);
 
   SoTransferFunctionElement::initClass();
   CvrCompressedTexturesElement::initClass();
@@ -337,6 +361,7 @@ SoVolumeRendering::init(void)
   CvrPageSizeElement::initClass();
   CvrPalettedTexturesElement::initClass();
   CvrStorageHintElement::initClass();
+  CvrSubSamplingElement::initClass();
   CvrVoxelBlockElement::initClass();
   CvrLightingElement::initClass();
 
@@ -151,7 +151,7 @@ SoVolumeSkinP::buildSkinCube(SoGLRenderAction * action)
   const CvrVoxelBlockElement * vbelem =
     CvrVoxelBlockElement::getInstance(action->getState());
   assert(vbelem != NULL);
-  const SbVec3s & voxcubedims = vbelem->getVoxelCubeDimensions();
+  const SbVec3i32 & voxcubedims = vbelem->getVoxelCubeDimensions();
 
   const int maxslicesx = voxcubedims[0]-1;
   const int maxslicesy = voxcubedims[1]-1;
@@ -0,0 +1,88 @@
+#ifndef COIN_SOVRBRICKFILEREADER_H
+#define COIN_SOVRBRICKFILEREADER_H
+
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+#include <VolumeViz/readers/SoVolumeReader.h>
+
+
+class SIMVOLEON_DLL_API SoVRBrickFileReader : public SoVolumeReader {
+  typedef SoVolumeReader inherited;
+
+public:
+  SoVRBrickFileReader(void);
+  ~SoVRBrickFileReader();
+
+  static SbBool isBrickFile(const char * filename);
+
+  void setUserData(void * data);
+  void getDataChar(SbBox3f & size, SoVolumeData::DataType & type, SbVec3s & dim);
+  void getDataChar(SbBox3f & size, SoVolumeData::DataType & type, SbVec3i32 & dim);
+  virtual void getSubSlice(SbBox2s & subslice, int slicenumber, void * data);
+  virtual SbBool getSubVolume(SbBox3s & volume, void * data);
+  virtual SbBool getSubVolume(const SbBox3s & volume,
+                              const SbVec3s subsamplelevel, void *& voxels);
+  virtual SbBool getSubVolumeInfo(SbBox3s & volume,
+                                  SbVec3s reqsubsamplelevel,
+                                  SbVec3s & subsamplelevel,
+                                  SoVolumeReader::CopyPolicy & policy);
+  virtual SbBool getSubVolume(SbBox3i32 & volume, void * data);
+  virtual SbBool getSubVolume(const SbBox3i32 & volume,
+                              const SbVec3s subsamplelevel, void *& voxels);
+  virtual SbBool getSubVolumeInfo(SbBox3i32 & volume,
+                                  SbVec3s reqsubsamplelevel,
+                                  SbVec3s & subsamplelevel,
+                                  SoVolumeReader::CopyPolicy & policy);
+
+  const SbVec3s & getBrickSize(void) const;
+  unsigned int getNumLevels(void) const;
+  SoVolumeData::SubMethod getLevelMethod(void) const;
+  SbVec3i32 getNumBricks(unsigned int level) const;
+
+  void getMinMax(double & minval, double & maxval) const;
+  void getBrickMinMax(unsigned int level, const SbVec3i32 & brickidx,
+                      double & minval, double & maxval) const;
+  void getHistogramRange(double & minval, double & maxval) const;
+  const uint32_t * getBrickHistogram(unsigned int level, const SbVec3i32 & brickidx,
+                                     unsigned int & nrbins) const;
+
+private:
+  class SoVRBrickFileReaderP * pimpl;
+  friend class SoVRBrickFileReaderP;
+
+  // Not implemented, as the reader holds an open file.
+  SoVRBrickFileReader(const SoVRBrickFileReader & reader);
+  SoVRBrickFileReader & operator=(const SoVRBrickFileReader & reader);
+};
+
+#endif // ! COIN_SOVRBRICKFILEREADER_H
@@ -40,6 +40,7 @@
 
 #include <VolumeViz/readers/SoVolumeReader.h>
 #include <Inventor/SbBox3f.h>
+#include <Inventor/SbVec3i32.h>
 
 
 class SoVRMemReader : public SoVolumeReader{
@@ -51,10 +52,12 @@ public:
 
   void getDataChar(SbBox3f & size, SoVolumeData::DataType & type,
                    SbVec3s & dim);
+  void getDataChar(SbBox3f & size, SoVolumeData::DataType & type,
+                   SbVec3i32 & dim);
 
   virtual void getSubSlice(SbBox2s & subslice, int slicenumber, void * data);
 
-  void setData(const SbVec3s &dimensions, void * data,
+  void setData(const SbVec3i32 & dimensions, void * data,
                SoVolumeData::DataType type = SoVolumeData::UNSIGNED_BYTE);
 
 private:
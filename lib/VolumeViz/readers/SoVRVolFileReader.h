@@ -45,7 +45,10 @@ public:
 
   void setUserData(void * data);
   void getDataChar(SbBox3f & size, SoVolumeData::DataType & type, SbVec3s & dim);
+  void getDataChar(SbBox3f & size, SoVolumeData::DataType & type, SbVec3i32 & dim);
   virtual void getSubSlice(SbBox2s & subslice, int slicenumber, void * data);
+  virtual int getNumTimeSteps(void);
+  virtual SbBool getTimeStep(int step, void * voxels);
 
 private:
   class SoVRVolFileReaderP * pimpl;
@@ -37,6 +37,8 @@
 
 class SbBox2s;
 class SbBox3f;
+class SbBox3i32;
+class SbVec3i32;
 class SbVec3s;
 
 
@@ -50,6 +52,8 @@ public:
 
   virtual void getDataChar(SbBox3f & size, SoVolumeData::DataType & type,
                            SbVec3s & dim) = 0;
+  virtual void getDataChar(SbBox3f & size, SoVolumeData::DataType & type,
+                           SbVec3i32 & dim);
 
   enum CopyPolicy { COPY, NO_COPY, NO_COPY_AND_DELETE };
   
@@ -61,8 +65,19 @@ public:
                                   SbVec3s reqsubsamplelevel,
                                   SbVec3s & subsamplelevel,
                                   SoVolumeReader::CopyPolicy & policy);
+  virtual SbBool getSubVolume(SbBox3i32 & volume, void * voxels);
+  virtual SbBool getSubVolume(const SbBox3i32 & volume,
+                              const SbVec3s subsamplelevel, void *& voxels);
+  virtual SbBool getSubVolumeInfo(SbBox3i32 & volume,
+                                  SbVec3s reqsubsamplelevel,
+                                  SbVec3s & subsamplelevel,
+                                  SoVolumeReader::CopyPolicy & policy);
+
+  virtual int getNumTimeSteps(void);
+  virtual SbBool getTimeStep(int step, void * voxels);
 
   SbVec3s getNumVoxels(SbVec3s realsize, SbVec3s subsamplinglevel) const;
+  SbVec3i32 getNumVoxels(const SbVec3i32 & realsize, SbVec3s subsamplinglevel) const;
   SbVec3s getSizeToAllocate(SbVec3s realsize, SbVec3s subsamplinglevel) const;
 
   int setFilename(const char * filename);
@@ -83,6 +98,7 @@ private:
   // should be stored within SoVolumeData, and not on this pointer.
   // 20041008 mortene.
   friend class SoVolumeData; // For m_data access.
+  friend class CvrSharedSource; // Ditto.
 };
 
 #endif // !COIN_SOVOLUMEREADER_H
@@ -0,0 +1,828 @@
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+/*!
+  \class SoVRBrickFileReader VolumeViz/readers/SoVRBrickFileReader.h
+  \brief Loader for files in the bricked SIM Voleon volume format.
+
+  Unlike the VOL format, where the voxels are laid out as one flat
+  array, this format stores the volume as fixed-size cubic bricks. The
+  reader only reads the header and the brick tables up front, and
+  fetches bricks from disk as the rendering code asks for them, so the
+  volume does not need to fit in memory.
+
+  The file also holds a value range and a histogram for each brick,
+  and precomputed lower resolution levels of the volume, so none of
+  this has to be found by scanning through the voxels.
+
+  Files in this format can be written with the \c raw2vol utility,
+  using its \c -bricked option.
+
+  The file starts with this header:
+
+  \verbatim
+  struct cvb_header {
+    uint32_t magic_number;   // 0x43564231, "CVB1"
+    uint32_t header_length;  // offset of the first brick table
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t data_type;      // SoVolumeData::DataType
+    uint32_t brick_size;     // edge length of the bricks
+    uint32_t nr_levels;      // including the full resolution level
+    uint32_t level_method;   // SoVolumeData::SubMethod used for the levels
+    uint32_t histogram_bins; // number of histogram bins per brick
+    float minval, maxval;    // value range of the complete volume
+    float histogram_min, histogram_max;
+    float scaleX, scaleY, scaleZ;
+  };
+  \endverbatim
+
+  Level \e n of the volume has dimensions reduced by a factor 2^n
+  along each axis, rounded upwards, and is split into bricks just like
+  the full resolution level 0. For each level, starting with level 0,
+  follows a table with one entry per brick, in X, then Y, then Z
+  order:
+
+  \verbatim
+  struct cvb_brick {
+    uint32_t offset_high, offset_low; // file offset of the voxels
+    float minval, maxval;
+    uint32_t histogram[histogram_bins];
+  };
+  \endverbatim
+
+  The histogram bins are spread evenly over the value range
+  [histogram_min, histogram_max> from the header, which is usually the
+  range of the data type, as that can be settled before the voxels
+  are read.
+
+  The voxels of each brick are laid out like for a volume of its own,
+  with bricks along the upper volume edges cut to fit within the
+  volume. The bricks of each level are stored in Z-curve (Morton)
+  order, so bricks which are close in the volume are also close in
+  the file.
+
+  All header and table values are stored in network byte order (i.e.
+  big-endian), as for the VOL format, while voxel values are stored in
+  little-endian byte order.
+
+  As for SoVRVolFileReader, the volume is by default normalized to be
+  within a 2x2x2 unit dimensions cube, scaled by the scale vector from
+  the header.
+
+  \since SIM Voleon 2.0
+*/
+
+// *************************************************************************
+
+#include <VolumeViz/readers/SoVRBrickFileReader.h>
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif // HAVE_CONFIG_H
+
+#include <VolumeViz/misc/CvrUtil.h>
+
+#include <Inventor/C/tidbits.h>
+#include <Inventor/SbBox2s.h>
+#include <Inventor/SbBox3f.h>
+#include <Inventor/SbBox3i32.h>
+#include <Inventor/SbBox3s.h>
+#include <Inventor/errors/SoDebugError.h>
+#include <Inventor/threads/SbMutex.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// *************************************************************************
+
+#define CVR_BRICKFILE_MAGIC 0x43564231
+
+struct cvb_header {
+  uint32_t magic_number;
+  uint32_t header_length;
+  uint32_t width;
+  uint32_t height;
+  uint32_t depth;
+  uint32_t data_type;
+  uint32_t brick_size;
+  uint32_t nr_levels;
+  uint32_t level_method;
+  uint32_t histogram_bins;
+  float minval, maxval;
+  float histogram_min, histogram_max;
+  float scaleX, scaleY, scaleZ;
+};
+
+static float
+cvr_brickfile_ntoh_float(float value)
+{
+  union {
+    float f32;
+    uint32_t u32;
+  } val;
+  val.f32 = value;
+  val.u32 = coin_ntoh_uint32(val.u32);
+  return val.f32;
+}
+
+// Seeks with 64-bit offsets, as brick files can easily be larger
+// than 2 GB.
+static SbBool
+cvr_brickfile_seek(FILE * f, uint64_t offset)
+{
+#ifdef _WIN32
+  return _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#else // !_WIN32
+  return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif // !_WIN32
+}
+
+// *************************************************************************
+
+#define PRIVATE(p) (p->pimpl)
+#define PUBLIC(p) (p->master)
+
+class SoVRBrickFileReaderP {
+public:
+  // Brick layout and summaries of one resolution level.
+  struct Level {
+    SbVec3i32 dimensions;
+    SbVec3i32 nrbricks;
+    uint64_t * offsets;
+    float * ranges; // min and max per brick
+    uint32_t * histograms;
+  };
+
+  SoVRBrickFileReaderP(SoVRBrickFileReader * master) {
+    this->master = master;
+    this->file = NULL;
+    this->valid = FALSE;
+    this->levels = NULL;
+    this->nrlevels = 0;
+  }
+
+  ~SoVRBrickFileReaderP() {
+    this->close();
+  }
+
+  SbBool open(const char * filename);
+  void close(void);
+  SbBool readTables(void);
+
+  unsigned int bytesPrVoxel(void) const;
+  size_t brickBytes(const Level & level, const SbVec3i32 & brickidx,
+                    SbVec3i32 & bmin, SbVec3i32 & bmax) const;
+  size_t brickIndex(const Level & level, const SbVec3i32 & brickidx) const;
+  SbBool isWithin(const SbVec3i32 & vmin, const SbVec3i32 & vmax) const;
+  SbBool readRegion(unsigned int levelidx, const SbVec3i32 & rmin,
+                    const SbVec3i32 & rmax, uint8_t * output);
+  SbBool readBytes(uint64_t offset, void * output, size_t nrbytes);
+  void swapVoxels(uint8_t * voxels, size_t nrvoxels) const;
+
+  struct cvb_header header;
+  SbVec3s bricksize;
+  Level * levels;
+  unsigned int nrlevels;
+
+  FILE * file;
+  // Serializes file access, so bricks can be fetched from several
+  // threads.
+  SbMutex filemutex;
+  SbBool valid;
+
+private:
+  SoVRBrickFileReader * master;
+};
+
+SbBool
+SoVRBrickFileReaderP::open(const char * filename)
+{
+  this->file = fopen(filename, "rb");
+  if (this->file == NULL) {
+    SoDebugError::post("SoVRBrickFileReaderP::open",
+                       "couldn't open '%s': %s", filename, strerror(errno));
+    return FALSE;
+  }
+
+  struct cvb_header * h = &this->header;
+  if (fread(h, sizeof(struct cvb_header), 1, this->file) != 1) {
+    SoDebugError::post("SoVRBrickFileReaderP::open",
+                       "couldn't read header of '%s'", filename);
+    return FALSE;
+  }
+
+  uint32_t * words = (uint32_t *)h;
+  for (unsigned int i = 0; i < 10; i++) { words[i] = coin_ntoh_uint32(words[i]); }
+  h->minval = cvr_brickfile_ntoh_float(h->minval);
+  h->maxval = cvr_brickfile_ntoh_float(h->maxval);
+  h->histogram_min = cvr_brickfile_ntoh_float(h->histogram_min);
+  h->histogram_max = cvr_brickfile_ntoh_float(h->histogram_max);
+  h->scaleX = cvr_brickfile_ntoh_float(h->scaleX);
+  h->scaleY = cvr_brickfile_ntoh_float(h->scaleY);
+  h->scaleZ = cvr_brickfile_ntoh_float(h->scaleZ);
+
+  const SbBool ok =
+    (h->magic_number == CVR_BRICKFILE_MAGIC) &&
+    (h->header_length >= sizeof(struct cvb_header)) &&
+    (h->brick_size > 0) && (h->brick_size <= 1024) &&
+    (h->width > 0) && (h->width <= INT_MAX) &&
+    (h->height > 0) && (h->height <= INT_MAX) &&
+    (h->depth > 0) && (h->depth <= INT_MAX) &&
+    (h->data_type <= (uint32_t)SoVolumeData::FLOAT) &&
+    (h->nr_levels > 0) && (h->nr_levels <= 16) &&
+    (h->level_method <= (uint32_t)SoVolumeData::AVERAGE) &&
+    (h->histogram_bins <= 65536);
+  if (!ok) {
+    SoDebugError::post("SoVRBrickFileReaderP::open",
+                       "'%s' has an invalid header", filename);
+    return FALSE;
+  }
+
+  const short bs = (short)h->brick_size;
+  this->bricksize.setValue(bs, bs, bs);
+
+  // Can't compare versus 0.0f directly, see SoVRVolFileReader.
+  h->scaleX = (h->scaleX < 0.0001f) ? 1.0f : h->scaleX;
+  h->scaleY = (h->scaleY < 0.0001f) ? 1.0f : h->scaleY;
+  h->scaleZ = (h->scaleZ < 0.0001f) ? 1.0f : h->scaleZ;
+
+  if (!this->readTables()) {
+    SoDebugError::post("SoVRBrickFileReaderP::open",
+                       "couldn't read brick tables of '%s'", filename);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// Reads in the brick table of each level, right after the header.
+SbBool
+SoVRBrickFileReaderP::readTables(void)
+{
+  const unsigned int nrbins = this->header.histogram_bins;
+  const size_t entrywords = 4 + nrbins;
+  const SbVec3i32 dims((int32_t)this->header.width, (int32_t)this->header.height,
+                       (int32_t)this->header.depth);
+
+  this->nrlevels = this->header.nr_levels;
+  this->levels = new Level[this->nrlevels];
+  for (unsigned int l = 0; l < this->nrlevels; l++) {
+    this->levels[l].offsets = NULL;
+    this->levels[l].ranges = NULL;
+    this->levels[l].histograms = NULL;
+  }
+
+  if (!this->readBytes(this->header.header_length, NULL, 0)) { return FALSE; }
+
+  uint32_t * entry = new uint32_t[entrywords];
+  SbBool ok = TRUE;
+
+  for (unsigned int l = 0; ok && (l < this->nrlevels); l++) {
+    Level & level = this->levels[l];
+    level.dimensions = PUBLIC(this)->getNumVoxels(dims, SbVec3s(l, l, l));
+    for (unsigned int i = 0; i < 3; i++) {
+      level.nrbricks[i] =
+        (level.dimensions[i] + this->bricksize[i] - 1) / this->bricksize[i];
+    }
+
+    const size_t nrbricks =
+      (size_t)level.nrbricks[0] * level.nrbricks[1] * level.nrbricks[2];
+    level.offsets = new uint64_t[nrbricks];
+    level.ranges = new float[nrbricks * 2];
+    level.histograms = new uint32_t[nrbricks * nrbins + 1];
+
+    for (size_t b = 0; ok && (b < nrbricks); b++) {
+      ok = fread(entry, sizeof(uint32_t), entrywords, this->file) == entrywords;
+      if (!ok) { break; }
+
+      level.offsets[b] = ((uint64_t)coin_ntoh_uint32(entry[0]) << 32) |
+        coin_ntoh_uint32(entry[1]);
+      level.ranges[b * 2 + 0] = cvr_brickfile_ntoh_float(((float *)entry)[2]);
+      level.ranges[b * 2 + 1] = cvr_brickfile_ntoh_float(((float *)entry)[3]);
+      for (unsigned int i = 0; i < nrbins; i++) {
+        level.histograms[b * nrbins + i] = coin_ntoh_uint32(entry[4 + i]);
+      }
+    }
+  }
+
+  delete[] entry;
+  return ok;
+}
+
+void
+SoVRBrickFileReaderP::close(void)
+{
+  if (this->file) { (void)fclose(this->file); }
+  this->file = NULL;
+
+  for (unsigned int l = 0; l < this->nrlevels; l++) {
+    delete[] this->levels[l].offsets;
+    delete[] this->levels[l].ranges;
+    delete[] this->levels[l].histograms;
+  }
+  delete[] this->levels;
+  this->levels = NULL;
+  this->nrlevels = 0;
+  this->valid = FALSE;
+}
+
+unsigned int
+SoVRBrickFileReaderP::bytesPrVoxel(void) const
+{
+  switch (this->header.data_type) {
+  case SoVolumeData::UNSIGNED_BYTE: return 1;
+  case SoVolumeData::UNSIGNED_SHORT: return 2;
+  case SoVolumeData::SIGNED_SHORT: return 2;
+  case SoVolumeData::FLOAT: return 4;
+  default: assert(FALSE && "unknown data type"); break;
+  }
+  return 1;
+}
+
+size_t
+SoVRBrickFileReaderP::brickIndex(const Level & level, const SbVec3i32 & brickidx) const
+{
+  for (unsigned int i = 0; i < 3; i++) {
+    assert(brickidx[i] >= 0 && brickidx[i] < level.nrbricks[i]);
+  }
+  return ((size_t)brickidx[2] * level.nrbricks[1] + brickidx[1]) *
+    level.nrbricks[0] + brickidx[0];
+}
+
+// Returns the number of bytes stored for the given brick, and its
+// voxel region within the level.
+size_t
+SoVRBrickFileReaderP::brickBytes(const Level & level, const SbVec3i32 & brickidx,
+                                 SbVec3i32 & bmin, SbVec3i32 & bmax) const
+{
+  size_t nrvoxels = 1;
+  for (unsigned int i = 0; i < 3; i++) {
+    bmin[i] = brickidx[i] * this->bricksize[i];
+    bmax[i] = SbMin(bmin[i] + this->bricksize[i], level.dimensions[i]);
+    nrvoxels *= (size_t)(bmax[i] - bmin[i]);
+  }
+  return nrvoxels * this->bytesPrVoxel();
+}
+
+// Whether [vmin, vmax> is a non-empty region within level 0.
+SbBool
+SoVRBrickFileReaderP::isWithin(const SbVec3i32 & vmin, const SbVec3i32 & vmax) const
+{
+  const SbVec3i32 & dims = this->levels[0].dimensions;
+  for (unsigned int i = 0; i < 3; i++) {
+    if ((vmin[i] < 0) || (vmin[i] >= vmax[i]) || (vmax[i] > dims[i])) { return FALSE; }
+  }
+  return TRUE;
+}
+
+// Reads "nrbytes" from the file at "offset". With "nrbytes" 0, just
+// positions the file for sequential reading.
+SbBool
+SoVRBrickFileReaderP::readBytes(uint64_t offset, void * output, size_t nrbytes)
+{
+  if (!cvr_brickfile_seek(this->file, offset)) { return FALSE; }
+  if (nrbytes == 0) { return TRUE; }
+  return fread(output, 1, nrbytes, this->file) == nrbytes;
+}
+
+// Voxel values are stored little-endian in the file.
+void
+SoVRBrickFileReaderP::swapVoxels(uint8_t * voxels, size_t nrvoxels) const
+{
+  if (coin_host_get_endianness() != COIN_HOST_IS_BIGENDIAN) { return; }
+
+  const unsigned int bpv = this->bytesPrVoxel();
+  if (bpv == 1) { return; }
+
+  for (size_t i = 0; i < nrvoxels; i++) {
+    uint8_t * v = voxels + i * bpv;
+    for (unsigned int j = 0; j < bpv / 2; j++) {
+      const uint8_t tmp = v[j];
+      v[j] = v[bpv - 1 - j];
+      v[bpv - 1 - j] = tmp;
+    }
+  }
+}
+
+// Fills "output" with the voxels of the region [rmin, rmax> of the
+// given level. Only the slices of each brick which overlap the
+// region are read from the file.
+SbBool
+SoVRBrickFileReaderP::readRegion(unsigned int levelidx, const SbVec3i32 & rmin,
+                                 const SbVec3i32 & rmax, uint8_t * output)
+{
+  assert(levelidx < this->nrlevels);
+  const Level & level = this->levels[levelidx];
+  const size_t bpv = this->bytesPrVoxel();
+  const size_t outw = rmax[0] - rmin[0];
+  const size_t outh = rmax[1] - rmin[1];
+  const size_t outd = rmax[2] - rmin[2];
+
+  const SbVec3s & bs = this->bricksize;
+  uint8_t * slab = NULL;
+  SbBool ok = TRUE;
+
+  this->filemutex.lock();
+
+  for (int32_t bz = rmin[2] / bs[2]; ok && (bz <= (rmax[2] - 1) / bs[2]); bz++) {
+    for (int32_t by = rmin[1] / bs[1]; ok && (by <= (rmax[1] - 1) / bs[1]); by++) {
+      for (int32_t bx = rmin[0] / bs[0]; ok && (bx <= (rmax[0] - 1) / bs[0]); bx++) {
+        const SbVec3i32 brickidx(bx, by, bz);
+        SbVec3i32 bmin, bmax;
+        (void)this->brickBytes(level, brickidx, bmin, bmax);
+        const uint64_t offset = level.offsets[this->brickIndex(level, brickidx)];
+
+        // Common case: the region is exactly one brick.
+        if ((bmin == rmin) && (bmax == rmax)) {
+          ok = this->readBytes(offset, output, outw * outh * outd * bpv);
+          continue;
+        }
+
+        SbVec3i32 imin, imax;
+        for (unsigned int i = 0; i < 3; i++) {
+          imin[i] = SbMax(rmin[i], bmin[i]);
+          imax[i] = SbMin(rmax[i], bmax[i]);
+        }
+
+        const size_t bw = bmax[0] - bmin[0];
+        const size_t bh = bmax[1] - bmin[1];
+        const size_t slicebytes = bw * bh * bpv;
+        const size_t nrslices = imax[2] - imin[2];
+        if (slab == NULL) {
+          slab = new uint8_t[(size_t)bs[0] * bs[1] * bs[2] * bpv];
+        }
+        ok = this->readBytes(offset + (uint64_t)(imin[2] - bmin[2]) * slicebytes,
+                             slab, nrslices * slicebytes);
+        if (!ok) { break; }
+
+        const size_t rowbytes = (imax[0] - imin[0]) * bpv;
+        for (int32_t z = imin[2]; z < imax[2]; z++) {
+          for (int32_t y = imin[1]; y < imax[1]; y++) {
+            const uint8_t * src = slab +
+              (((z - imin[2]) * bh + (y - bmin[1])) * bw + (imin[0] - bmin[0])) * bpv;
+            uint8_t * dst = output +
+              (((z - rmin[2]) * outh + (y - rmin[1])) * outw + (imin[0] - rmin[0])) * bpv;
+            (void)memcpy(dst, src, rowbytes);
+          }
+        }
+      }
+    }
+  }
+
+  this->filemutex.unlock();
+  delete[] slab;
+
+  if (!ok) {
+    SoDebugError::post("SoVRBrickFileReaderP::readRegion",
+                       "couldn't read voxels: %s", strerror(errno));
+    return FALSE;
+  }
+
+  this->swapVoxels(output, outw * outh * outd);
+  return TRUE;
+}
+
+// *************************************************************************
+
+SoVRBrickFileReader::SoVRBrickFileReader(void)
+{
+  PRIVATE(this) = new SoVRBrickFileReaderP(this);
+}
+
+SoVRBrickFileReader::~SoVRBrickFileReader()
+{
+  delete PRIVATE(this);
+}
+
+/*!
+  Returns \c TRUE if \a filename is a file in the bricked format, as
+  recognized from its first bytes.
+*/
+SbBool
+SoVRBrickFileReader::isBrickFile(const char * filename)
+{
+  FILE * f = fopen(filename, "rb");
+  if (f == NULL) { return FALSE; }
+
+  uint32_t magic = 0;
+  const SbBool gotmagic = fread(&magic, sizeof(uint32_t), 1, f) == 1;
+  (void)fclose(f);
+  return gotmagic && (coin_ntoh_uint32(magic) == CVR_BRICKFILE_MAGIC);
+}
+
+/*!
+  \a data should be a pointer to a character string with the full
+  filename of a file in the bricked format.
+
+  Only the header and the brick tables are read here, and the file is
+  kept open for reading bricks as they are needed.
+*/
+void
+SoVRBrickFileReader::setUserData(void * data)
+{
+  const char * filename = (const char *)data;
+  inherited::setFilename(filename);
+
+  PRIVATE(this)->close();
+  if (!PRIVATE(this)->open(filename)) {
+    PRIVATE(this)->close();
+    return;
+  }
+
+  if (CvrUtil::doDebugging()) {
+    const struct cvb_header * h = &PRIVATE(this)->header;
+    SoDebugError::postInfo("SoVRBrickFileReader::setUserData",
+                           "'%s': %ux%ux%u voxels of type %u, bricks of "
+                           "size %u, %u levels, values in [%f, %f]",
+                           filename, h->width, h->height, h->depth,
+                           h->data_type, h->brick_size, h->nr_levels,
+                           h->minval, h->maxval);
+  }
+
+  PRIVATE(this)->valid = TRUE;
+}
+
+// Documented in superclass.
+void
+SoVRBrickFileReader::getDataChar(SbBox3f & size, SoVolumeData::DataType & type,
+                                 SbVec3s & dim)
+{
+  SbVec3i32 dim32;
+  this->getDataChar(size, type, dim32);
+  if (!CvrUtil::fitsShort(dim32)) {
+    SoDebugError::post("SoVRBrickFileReader::getDataChar",
+                       "dimensions %dx%dx%d need the SbVec3i32 version "
+                       "of this function", dim32[0], dim32[1], dim32[2]);
+    dim.setValue(0, 0, 0);
+    return;
+  }
+  dim = CvrUtil::toVec3s(dim32);
+}
+
+// Documented in superclass.
+void
+SoVRBrickFileReader::getDataChar(SbBox3f & size, SoVolumeData::DataType & type,
+                                 SbVec3i32 & dim)
+{
+  assert(PRIVATE(this)->valid);
+
+  const struct cvb_header * h = &PRIVATE(this)->header;
+  type = (SoVolumeData::DataType)h->data_type;
+  dim = PRIVATE(this)->levels[0].dimensions;
+
+  const int32_t largestdimension = SbMax(dim[0], SbMax(dim[1], dim[2]));
+  SbVec3f normdims((float)dim[0], (float)dim[1], (float)dim[2]);
+  normdims /= float(largestdimension);
+  normdims *= 2.0f;
+
+  const SbVec3f scale(h->scaleX, h->scaleY, h->scaleZ);
+  for (unsigned int i = 0; i < 3; i++) { normdims[i] *= scale[i]; }
+  size.setBounds(-normdims / 2.0f, normdims / 2.0f);
+}
+
+// Documented in superclass.
+void
+SoVRBrickFileReader::getSubSlice(SbBox2s & subslice, int slicenumber, void * data)
+{
+  assert(PRIVATE(this)->valid);
+
+  SbVec2s ssmin, ssmax;
+  subslice.getBounds(ssmin, ssmax);
+  SbBox3i32 volume(ssmin[0], ssmin[1], slicenumber,
+                   ssmax[0], ssmax[1], slicenumber + 1);
+  const SbBool ok = this->getSubVolume(volume, data);
+  assert(ok && "invalid sub-slice");
+}
+
+// Documented in superclass.
+SbBool
+SoVRBrickFileReader::getSubVolume(SbBox3s & volume, void * data)
+{
+  SbBox3i32 volume32 = CvrUtil::toBox3i32(volume);
+  return this->getSubVolume(volume32, data);
+}
+
+// Documented in superclass.
+SbBool
+SoVRBrickFileReader::getSubVolume(const SbBox3s & volume,
+                                  const SbVec3s subsamplelevel, void *& voxels)
+{
+  return this->getSubVolume(CvrUtil::toBox3i32(volume), subsamplelevel, voxels);
+}
+
+// Documented in superclass.
+SbBool
+SoVRBrickFileReader::getSubVolumeInfo(SbBox3s & volume,
+                                      SbVec3s reqsubsamplelevel,
+                                      SbVec3s & subsamplelevel,
+                                      SoVolumeReader::CopyPolicy & policy)
+{
+  SbBox3i32 volume32 = CvrUtil::toBox3i32(volume);
+  return this->getSubVolumeInfo(volume32, reqsubsamplelevel, subsamplelevel, policy);
+}
+
+// Documented in superclass. Reads the voxels straight from the
+// bricks in the file.
+SbBool
+SoVRBrickFileReader::getSubVolume(SbBox3i32 & volume, void * data)
+{
+  if (!PRIVATE(this)->valid) { return FALSE; }
+
+  SbVec3i32 vmin, vmax;
+  volume.getBounds(vmin, vmax);
+  if (!PRIVATE(this)->isWithin(vmin, vmax)) { return FALSE; }
+
+  return PRIVATE(this)->readRegion(0, vmin, vmax, (uint8_t *)data);
+}
+
+// Documented in superclass. Subsampled sub-volumes are read from the
+// precomputed levels in the file, and handed over as a buffer the
+// caller must deallocate.
+SbBool
+SoVRBrickFileReader::getSubVolume(const SbBox3i32 & volume,
+                                  const SbVec3s subsamplelevel, void *& voxels)
+{
+  voxels = NULL;
+  if (!PRIVATE(this)->valid) { return FALSE; }
+
+  const short l = subsamplelevel[0];
+  if ((l != subsamplelevel[1]) || (l != subsamplelevel[2])) { return FALSE; }
+  if ((l < 0) || ((unsigned int)l >= PRIVATE(this)->nrlevels)) { return FALSE; }
+
+  SbVec3i32 vmin, vmax;
+  volume.getBounds(vmin, vmax);
+  if (!PRIVATE(this)->isWithin(vmin, vmax)) { return FALSE; }
+
+  // The region at the subsampled level which covers the requested
+  // region.
+  const int32_t step = 1 << l;
+  SbVec3i32 lmin, lmax;
+  for (unsigned int i = 0; i < 3; i++) {
+    lmin[i] = vmin[i] / step;
+    lmax[i] = SbMax(lmin[i] + 1, (int32_t)(((int64_t)vmax[i] + step - 1) / step));
+  }
+
+  const size_t nrbytes = (size_t)(lmax[0] - lmin[0]) * (lmax[1] - lmin[1]) *
+    (lmax[2] - lmin[2]) * PRIVATE(this)->bytesPrVoxel();
+  uint8_t * buffer = new uint8_t[nrbytes];
+  if (!PRIVATE(this)->readRegion(l, lmin, lmax, buffer)) {
+    delete[] buffer;
+    return FALSE;
+  }
+
+  voxels = buffer;
+  return TRUE;
+}
+
+// Documented in superclass. Any subsampling level up to the coarsest
+// level in the file can be delivered. Full resolution sub-volumes
+// should be read with getSubVolume(SbBox3i32 &, void *), while
+// subsampled ones are always handed over with
+// SoVolumeReader::NO_COPY_AND_DELETE.
+SbBool
+SoVRBrickFileReader::getSubVolumeInfo(SbBox3i32 & volume,
+                                      SbVec3s reqsubsamplelevel,
+                                      SbVec3s & subsamplelevel,
+                                      SoVolumeReader::CopyPolicy & policy)
+{
+  if (!PRIVATE(this)->valid) { return FALSE; }
+
+  SbVec3i32 vmin, vmax;
+  volume.getBounds(vmin, vmax);
+  if (!PRIVATE(this)->isWithin(vmin, vmax)) { return FALSE; }
+
+  // Levels are reduced equally along all axes, so use the finest one
+  // which is asked for.
+  short l = SbMin(reqsubsamplelevel[0],
+                  SbMin(reqsubsamplelevel[1], reqsubsamplelevel[2]));
+  l = SbMax((short)0, SbMin(l, (short)(PRIVATE(this)->nrlevels - 1)));
+
+  subsamplelevel.setValue(l, l, l);
+  policy = (l == 0) ? SoVolumeReader::COPY : SoVolumeReader::NO_COPY_AND_DELETE;
+  return TRUE;
+}
+
+/*!
+  Returns the size of the bricks in the file.
+*/
+const SbVec3s &
+SoVRBrickFileReader::getBrickSize(void) const
+{
+  return PRIVATE(this)->bricksize;
+}
+
+/*!
+  Returns the number of resolution levels in the file, including the
+  full resolution level 0.
+*/
+unsigned int
+SoVRBrickFileReader::getNumLevels(void) const
+{
+  return PRIVATE(this)->nrlevels;
+}
+
+/*!
+  Returns the method used for building the lower resolution levels
+  stored in the file.
+*/
+SoVolumeData::SubMethod
+SoVRBrickFileReader::getLevelMethod(void) const
+{
+  return (SoVolumeData::SubMethod)PRIVATE(this)->header.level_method;
+}
+
+/*!
+  Returns the number of bricks along each axis at the given level.
+*/
+SbVec3i32
+SoVRBrickFileReader::getNumBricks(unsigned int level) const
+{
+  assert(level < PRIVATE(this)->nrlevels);
+  return PRIVATE(this)->levels[level].nrbricks;
+}
+
+/*!
+  Returns the range of the voxel values of the complete volume.
+*/
+void
+SoVRBrickFileReader::getMinMax(double & minval, double & maxval) const
+{
+  minval = PRIVATE(this)->header.minval;
+  maxval = PRIVATE(this)->header.maxval;
+}
+
+/*!
+  Returns the range of the voxel values within a brick.
+*/
+void
+SoVRBrickFileReader::getBrickMinMax(unsigned int level, const SbVec3i32 & brickidx,
+                                    double & minval, double & maxval) const
+{
+  assert(level < PRIVATE(this)->nrlevels);
+  const SoVRBrickFileReaderP::Level & l = PRIVATE(this)->levels[level];
+  const size_t idx = PRIVATE(this)->brickIndex(l, brickidx);
+  minval = l.ranges[idx * 2 + 0];
+  maxval = l.ranges[idx * 2 + 1];
+}
+
+/*!
+  Returns the range the brick histograms are spread over.
+*/
+void
+SoVRBrickFileReader::getHistogramRange(double & minval, double & maxval) const
+{
+  minval = PRIVATE(this)->header.histogram_min;
+  maxval = PRIVATE(this)->header.histogram_max;
+}
+
+/*!
+  Returns the histogram of the voxel values within a brick, as \a
+  nrbins counts spread evenly over the range given by
+  getHistogramRange(). Returns \c NULL if the file has no histograms.
+*/
+const uint32_t *
+SoVRBrickFileReader::getBrickHistogram(unsigned int level, const SbVec3i32 & brickidx,
+                                       unsigned int & nrbins) const
+{
+  assert(level < PRIVATE(this)->nrlevels);
+  nrbins = PRIVATE(this)->header.histogram_bins;
+  if (nrbins == 0) { return NULL; }
+
+  const SoVRBrickFileReaderP::Level & l = PRIVATE(this)->levels[level];
+  return l.histograms + PRIVATE(this)->brickIndex(l, brickidx) * nrbins;
+}
+
+// *************************************************************************
@@ -57,11 +57,11 @@ public:
   SoVRMemReaderP(SoVRMemReader * master) {
     this->master = master;
 
-    this->dimensions = SbVec3s(0, 0, 0);
+    this->dimensions = SbVec3i32(0, 0, 0);
     this->dataType = SoVolumeData::UNSIGNED_BYTE;
   }
 
-  SbVec3s dimensions;
+  SbVec3i32 dimensions;
   SoVolumeData::DataType dataType;
 
 private:
@@ -90,18 +90,34 @@ SoVRMemReader::setUserData(void * data)
 
 void SoVRMemReader::getDataChar(SbBox3f & size,
                                 SoVolumeData::DataType & type,
-                                SbVec3s & dim)
+                                SbVec3i32 & dim)
 {
   type = PRIVATE(this)->dataType;
   dim = PRIVATE(this)->dimensions;
 
-  const short largestdimension = SbMax(dim[0], SbMax(dim[1], dim[2]));
-  SbVec3f normdims(dim[0], dim[1], dim[2]);
+  const int32_t largestdimension = SbMax(dim[0], SbMax(dim[1], dim[2]));
+  SbVec3f normdims((float)dim[0], (float)dim[1], (float)dim[2]);
   normdims /= float(largestdimension);
   normdims *= 2.0f;
   size.setBounds(-normdims / 2.0f, normdims / 2.0f);
 }
 
+void SoVRMemReader::getDataChar(SbBox3f & size,
+                                SoVolumeData::DataType & type,
+                                SbVec3s & dim)
+{
+  SbVec3i32 dim32;
+  this->getDataChar(size, type, dim32);
+  if (!CvrUtil::fitsShort(dim32)) {
+    SoDebugError::post("SoVRMemReader::getDataChar",
+                       "dimensions %dx%dx%d need the SbVec3i32 version "
+                       "of this function", dim32[0], dim32[1], dim32[2]);
+    dim.setValue(0, 0, 0);
+    return;
+  }
+  dim = CvrUtil::toVec3s(dim32);
+}
+
 void
 SoVRMemReader::getSubSlice(SbBox2s & subslice, int slicenumber, void * data)
 {
@@ -109,20 +125,32 @@ SoVRMemReader::getSubSlice(SbBox2s & subslice, int slicenumber, void * data)
   switch (PRIVATE(this)->dataType) {
   case SoVolumeData::UNSIGNED_BYTE: bytesprvoxel = 1; break;
   case SoVolumeData::UNSIGNED_SHORT: bytesprvoxel = 2; break;
+  case SoVolumeData::SIGNED_SHORT: bytesprvoxel = 2; break;
+  case SoVolumeData::FLOAT: bytesprvoxel = 4; break;
   default: assert(FALSE); break;
   }
 
-  // FIXME: interface of buildSubPage() should be improved to avoid
-  // this roundabout way of clipping out a slice.  20021203 mortene.
-  CvrVoxelChunk vc(PRIVATE(this)->dimensions, bytesprvoxel, this->m_data);
-  CvrVoxelChunk * output = vc.buildSubPage(2 /* Z */, slicenumber, subslice);
-  (void)memcpy(data, output->getBuffer(), output->bufferSize());
-  delete output;
+  // Copy out the exact sub-slice, row by row. (Note: we can not use
+  // CvrVoxelChunk::buildSubPage() for this, as that adds the border
+  // voxels needed for the 2D texture pages.)
+  SbVec2s ssmin, ssmax;
+  subslice.getBounds(ssmin, ssmax);
+  const SbVec3i32 & voldims = PRIVATE(this)->dimensions;
+  const size_t rowbytes = (size_t)(ssmax[0] - ssmin[0]) * bytesprvoxel;
+  const uint8_t * slicestart = (const uint8_t *)this->m_data +
+    (size_t)slicenumber * voldims[0] * voldims[1] * bytesprvoxel;
+  uint8_t * dst = (uint8_t *)data;
+  for (short y = ssmin[1]; y < ssmax[1]; y++) {
+    const uint8_t * src =
+      slicestart + ((size_t)y * voldims[0] + ssmin[0]) * bytesprvoxel;
+    (void)memcpy(dst, src, rowbytes);
+    dst += rowbytes;
+  }
 }
 
 
 void
-SoVRMemReader::setData(const SbVec3s &dimensions,
+SoVRMemReader::setData(const SbVec3i32 & dimensions,
                        void * data,
                        SoVolumeData::DataType type)
 {
@@ -66,6 +66,15 @@
   The scale vector (if present in the header) will subsequently be
   used on the resulting normalized volume dimensions.
 
+  A file may hold the voxels of several volumes of the dimensions
+  given in the header, one right after the other. It is then read as
+  a time-varying volume, with one time step for each complete volume,
+  see SoVolumeReader::getNumTimeSteps(). The time steps can only be
+  played back by a reader set up with SoVolumeData::setReader(): a
+  file read through the SoVolumeData::fileName field shows the first
+  step only, as the voxels of such files are shared by all the nodes
+  reading them.
+
   You may use SoVolumeData::setVolumeSize() to force a different unit
   size box around the volume, or you can simply use the standard Coin
   transformation nodes, like e.g. SoScale, to accomplish this.
@@ -78,13 +87,34 @@
 // *************************************************************************
 
 #include <VolumeViz/readers/SoVRVolFileReader.h>
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif // HAVE_CONFIG_H
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif // HAVE_UNISTD_H
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif // HAVE_SYS_TYPES_H
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif // HAVE_SYS_MMAN_H
+
 #include <VolumeViz/misc/CvrUtil.h>
-#include <VolumeViz/misc/CvrVoxelChunk.h>
 
 #include <Inventor/C/tidbits.h>
+#include <Inventor/SbVec3i32.h>
 #include <Inventor/errors/SoDebugError.h>
 
 #include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 struct vol_header {
@@ -141,15 +171,39 @@ public:
 
   SoVRVolFileReaderP(void) {
     this->valid = FALSE;
+    this->filedata = NULL;
+    this->filedatasize = 0;
+    this->mapped = FALSE;
+    this->nrsteps = 1;
+    this->stepbytes = 0;
+  }
+
+  ~SoVRVolFileReaderP() {
+    this->releaseFileData();
   }
 
   static void debugDumpHeader(struct vol_header * vh);
   static SbBool debugFileRead(void);
+  static SbBool useMemoryMapping(void);
   SoVolumeData::DataType dataType(void);
 
+  SbBool mapFileData(const char * filename, size_t filesize);
+  SbBool readFileData(const char * filename, size_t filesize);
+  void releaseFileData(void);
+
   struct vol_header volh;
   SbString description;
   SbBool valid;
+
+  // The complete file contents, either memory mapped or read into a
+  // malloc()'ed buffer.
+  uint8_t * filedata;
+  size_t filedatasize;
+  SbBool mapped;
+
+  // Number of complete volumes in the file, and the size of each.
+  int nrsteps;
+  size_t stepbytes;
 };
 
 /* Return value of CVR_DEBUG_IMPORT environment variable. */
@@ -164,6 +218,110 @@ SoVRVolFileReaderP::debugFileRead(void)
   return (d > 0) ? TRUE : FALSE;
 }
 
+/* Memory mapping of the file can be turned off by setting the
+   CVR_VOL_NO_MMAP environment variable, to get the old behaviour of
+   reading the complete file into memory up front. */
+SbBool
+SoVRVolFileReaderP::useMemoryMapping(void)
+{
+  static int d = -1;
+  if (d == -1) {
+    const char * val = coin_getenv("CVR_VOL_NO_MMAP");
+    d = (val && (atoi(val) > 0)) ? 0 : 1;
+  }
+  return (d > 0) ? TRUE : FALSE;
+}
+
+// Map the file into our address space. Nothing but the pages of the
+// file we actually touch will be read from disk, which means only the
+// header is read up front, while voxel slabs are faulted in on demand
+// by the OS.
+SbBool
+SoVRVolFileReaderP::mapFileData(const char * filename, size_t filesize)
+{
+#ifdef HAVE_SYS_MMAN_H
+  const int fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    SoDebugError::post("SoVRVolFileReaderP::mapFileData",
+                       "couldn't open '%s': %s", filename, strerror(errno));
+    return FALSE;
+  }
+
+  // Mapped private and writable, so SoVolumeDetail's voxel annotation
+  // can still write into the voxel buffer (which will then only
+  // copy-on-write the touched pages, and not modify the file).
+  void * p = mmap(NULL, filesize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  (void)close(fd); // the mapping keeps its own reference to the file
+
+  if (p == MAP_FAILED) {
+    SoDebugError::post("SoVRVolFileReaderP::mapFileData",
+                       "couldn't mmap() '%s': %s", filename, strerror(errno));
+    return FALSE;
+  }
+
+  this->filedata = (uint8_t *)p;
+  this->filedatasize = filesize;
+  this->mapped = TRUE;
+  return TRUE;
+#else // !HAVE_SYS_MMAN_H
+  (void)filename;
+  (void)filesize;
+  return FALSE;
+#endif // !HAVE_SYS_MMAN_H
+}
+
+SbBool
+SoVRVolFileReaderP::readFileData(const char * filename, size_t filesize)
+{
+  FILE * f = fopen(filename, "rb");
+  if (f == NULL) {
+    SoDebugError::post("SoVRVolFileReaderP::readFileData",
+                       "couldn't open '%s': %s", filename, strerror(errno));
+    return FALSE;
+  }
+
+  this->filedata = (uint8_t *)malloc(filesize);
+  assert(this->filedata);
+
+  // FIXME: move relevant code to
+  // SoVolumeReader::getBuffer(). 20021125 mortene.
+  const size_t gotnrbytes = fread(this->filedata, 1, filesize, f);
+  const int r = fclose(f);
+  assert(r == 0);
+
+  if (gotnrbytes != filesize) {
+    SoDebugError::post("SoVRVolFileReaderP::readFileData",
+                       "read only %lu of %lu bytes from '%s'",
+                       (unsigned long)gotnrbytes, (unsigned long)filesize,
+                       filename);
+    free(this->filedata);
+    this->filedata = NULL;
+    return FALSE;
+  }
+
+  this->filedatasize = filesize;
+  this->mapped = FALSE;
+  return TRUE;
+}
+
+void
+SoVRVolFileReaderP::releaseFileData(void)
+{
+  if (this->filedata == NULL) { return; }
+
+#ifdef HAVE_SYS_MMAN_H
+  if (this->mapped) {
+    const int r = munmap(this->filedata, this->filedatasize);
+    assert(r == 0);
+  }
+#endif // HAVE_SYS_MMAN_H
+  if (!this->mapped) { free(this->filedata); }
+
+  this->filedata = NULL;
+  this->filedatasize = 0;
+  this->mapped = FALSE;
+}
+
 SoVolumeData::DataType
 SoVRVolFileReaderP::dataType(void)
 {
@@ -210,6 +368,23 @@ SoVRVolFileReader::~SoVRVolFileReader()
 void
 SoVRVolFileReader::getDataChar(SbBox3f & size, SoVolumeData::DataType & type,
                                SbVec3s & dim)
+{
+  SbVec3i32 dim32;
+  this->getDataChar(size, type, dim32);
+  if (!CvrUtil::fitsShort(dim32)) {
+    SoDebugError::post("SoVRVolFileReader::getDataChar",
+                       "dimensions %dx%dx%d need the SbVec3i32 version "
+                       "of this function", dim32[0], dim32[1], dim32[2]);
+    dim.setValue(0, 0, 0);
+    return;
+  }
+  dim = CvrUtil::toVec3s(dim32);
+}
+
+// Documented in superclass.
+void
+SoVRVolFileReader::getDataChar(SbBox3f & size, SoVolumeData::DataType & type,
+                               SbVec3i32 & dim)
 {
   assert(PRIVATE(this)->valid);
 
@@ -217,10 +392,10 @@ SoVRVolFileReader::getDataChar(SbBox3f & size, SoVolumeData::DataType & type,
 
   struct vol_header * volh = &(PRIVATE(this)->volh);
 
-  dim.setValue(volh->width, volh->height, volh->images);
+  dim.setValue((int32_t)volh->width, (int32_t)volh->height, (int32_t)volh->images);
 
-  const short largestdimension = SbMax(dim[0], SbMax(dim[1], dim[2]));
-  SbVec3f normdims(dim[0], dim[1], dim[2]);
+  const int32_t largestdimension = SbMax(dim[0], SbMax(dim[1], dim[2]));
+  SbVec3f normdims((float)dim[0], (float)dim[1], (float)dim[2]);
   normdims /= float(largestdimension);
   normdims *= 2.0f;
 
@@ -230,6 +405,30 @@ SoVRVolFileReader::getDataChar(SbBox3f & size, SoVolumeData::DataType & type,
   size.setBounds(-normdims / 2.0f, normdims / 2.0f);
 }
 
+// Documented in superclass. Returns the number of complete volumes in
+// the file.
+int
+SoVRVolFileReader::getNumTimeSteps(void)
+{
+  if (!PRIVATE(this)->valid) { return 1; }
+  return PRIVATE(this)->nrsteps;
+}
+
+// Documented in superclass. Copies the voxels of the step out of the
+// file data, so this is safe to call from another thread while the
+// other methods are used.
+SbBool
+SoVRVolFileReader::getTimeStep(int step, void * voxels)
+{
+  if (!PRIVATE(this)->valid) { return FALSE; }
+  if ((step < 0) || (step >= PRIVATE(this)->nrsteps)) { return FALSE; }
+
+  const size_t stepbytes = PRIVATE(this)->stepbytes;
+  (void)memcpy(voxels, (const uint8_t *)this->m_data + (size_t)step * stepbytes,
+               stepbytes);
+  return TRUE;
+}
+
 // Documented in superclass.
 //
 // FIXME: this is supposed to be the sole interface (well, together
@@ -246,7 +445,8 @@ SoVRVolFileReader::getSubSlice(SbBox2s & subslice, int slicenumber, void * data)
   assert(PRIVATE(this)->valid);
 
   struct vol_header * volh = &(PRIVATE(this)->volh);
-  SbVec3s dims(volh->width, volh->height, volh->images);
+  const SbVec3i32 dims((int32_t)volh->width, (int32_t)volh->height,
+                       (int32_t)volh->images);
   SoVolumeData::DataType type = PRIVATE(this)->dataType();
 
 #if CVR_DEBUG && 0 // debug
@@ -266,12 +466,22 @@ SoVRVolFileReader::getSubSlice(SbBox2s & subslice, int slicenumber, void * data)
   default: assert(FALSE); break;
   }
 
-  // FIXME: interface of buildSubPage() should be improved to avoid
-  // this roundabout way of clipping out a slice.  20021203 mortene.
-  CvrVoxelChunk vc(dims, bytesprvoxel, this->m_data);
-  CvrVoxelChunk * output = vc.buildSubPage(2 /* Z */, slicenumber, subslice);
-  (void)memcpy(data, output->getBuffer(), output->bufferSize());
-  delete output;
+  // Copy out the exact sub-slice, row by row. (Note: we can not use
+  // CvrVoxelChunk::buildSubPage() for this, as that adds the border
+  // voxels needed for the 2D texture pages.)
+  SbVec2s ssmin, ssmax;
+  subslice.getBounds(ssmin, ssmax);
+  const SbVec3i32 & voldims = dims;
+  const size_t rowbytes = (size_t)(ssmax[0] - ssmin[0]) * bytesprvoxel;
+  const uint8_t * slicestart = (const uint8_t *)this->m_data +
+    (size_t)slicenumber * voldims[0] * voldims[1] * bytesprvoxel;
+  uint8_t * dst = (uint8_t *)data;
+  for (short y = ssmin[1]; y < ssmax[1]; y++) {
+    const uint8_t * src =
+      slicestart + ((size_t)y * voldims[0] + ssmin[0]) * bytesprvoxel;
+    (void)memcpy(dst, src, rowbytes);
+    dst += rowbytes;
+  }
 }
 
 /*!
@@ -288,33 +498,37 @@ SoVRVolFileReader::setUserData(void * data)
   if (filesize == -1) { return; }
 
   assert(filesize > 0);
-  // FIXME: this is completely bogus use of SoVolumeReader::m_data --
-  // this is *not* where the voxel data is supposed to be stored. That
-  // is inside SoVolumeData. 20041008 mortene.
-  this->m_data = malloc((size_t)filesize); // FIXME: bogus cast. 2004121 mortene.
-  assert(this->m_data);
-
-  FILE * f = fopen(filename, "rb");
-  assert(f && "couldn't open file");
-  // FIXME: move relevant code to
-  // SoVolumeReader::getBuffer(). 20021125 mortene.
-  size_t gotnrbytes =
-    fread(this->m_data, 1, (size_t)filesize, f); // FIXME: bogus cast. 2004121 mortene.
-  assert(gotnrbytes == (size_t)filesize); // FIXME: bogus cast. 2004121 mortene.
+  // Note: on 32-bit systems, a file larger than the address space
+  // can neither be mapped nor read in full.
+  const size_t nrbytes = (size_t)filesize;
+
+  // Any voxels set up from a previous file are invalid from here on.
+  PRIVATE(this)->valid = FALSE;
+  this->m_data = NULL;
+  PRIVATE(this)->nrsteps = 1;
+  PRIVATE(this)->releaseFileData();
+
+  SbBool ok = FALSE;
+  if (SoVRVolFileReaderP::useMemoryMapping()) {
+    ok = PRIVATE(this)->mapFileData(filename, nrbytes);
+  }
+  if (!ok) { ok = PRIVATE(this)->readFileData(filename, nrbytes); }
+  if (!ok) { return; }
 
   if (CvrUtil::doDebugging()) {
     SoDebugError::postInfo("SoVRVolFileReader::setUserData",
-                           "read %d bytes (%.2f MB)",
-                           gotnrbytes, ((float)gotnrbytes) / 1024.0f / 1024.0f);
+                           "%s %lu bytes (%.2f MB)",
+                           PRIVATE(this)->mapped ? "mapped" : "read",
+                           (unsigned long)nrbytes,
+                           ((float)nrbytes) / 1024.0f / 1024.0f);
   }
 
-  int r = fclose(f);
-  assert(r == 0);
+  const uint8_t * filedata = PRIVATE(this)->filedata;
 
   assert((uint64_t)filesize > sizeof(struct vol_header));
   struct vol_header * volh = &PRIVATE(this)->volh;
   // magic_number and header_length
-  (void)memcpy(volh, this->m_data, 2 * sizeof(uint32_t));
+  (void)memcpy(volh, filedata, 2 * sizeof(uint32_t));
   volh->magic_number = coin_ntoh_uint32(volh->magic_number);
   volh->header_length = coin_ntoh_uint32(volh->header_length);
 
@@ -341,7 +555,7 @@ SoVRVolFileReader::setUserData(void * data)
     SbMin((uint32_t)sizeof(struct vol_header), volh->header_length) - 2 * sizeof(uint32_t);
 
   (void)memcpy(&(volh->width),
-               (uint8_t *)this->m_data + (2 * sizeof(uint32_t)),
+               filedata + (2 * sizeof(uint32_t)),
                copylen);
 
   // FIXME: this actually fails with SYN_64.vol. 20021110 mortene.
@@ -363,7 +577,7 @@ SoVRVolFileReader::setUserData(void * data)
   volh->rotY = ntoh_float(&volh->rotY);
   volh->rotZ = ntoh_float(&volh->rotZ);
 
-  const char * descrptr = ((const char *)(this->m_data)) + sizeof(struct vol_header);
+  const char * descrptr = ((const char *)filedata) + sizeof(struct vol_header);
   PRIVATE(this)->description = descrptr;
   // FIXME: there's more descriptive text available after the first
   // '\0'. Must check header_length and convert '\0'-chars to
@@ -380,9 +594,9 @@ SoVRVolFileReader::setUserData(void * data)
   // FIXME: this actually fails with LOBSTER.vol. 20021110 mortene.
   // assert(volh->magic_number == 0x0b7e7759);
 
-  assert((volh->width > 0) && (volh->width < 32767));
-  assert((volh->height > 0) && (volh->height < 32767));
-  assert((volh->images > 0) && (volh->images < 32767));
+  assert((volh->width > 0) && (volh->width <= INT_MAX));
+  assert((volh->height > 0) && (volh->height <= INT_MAX));
+  assert((volh->images > 0) && (volh->images <= INT_MAX));
 
   assert(volh->bits_per_voxel >= 1);
 
@@ -407,21 +621,48 @@ SoVRVolFileReader::setUserData(void * data)
   volh->scaleY = ((volh->scaleY > 1000000.0f) ? 1.0f : volh->scaleY);
   volh->scaleZ = ((volh->scaleZ > 1000000.0f) ? 1.0f : volh->scaleZ);
 
-  uint32_t nrvoxels = volh->width * volh->height * volh->images;
-  uint32_t minsize = (nrvoxels * volh->bits_per_voxel) / 8;
-  assert(filesize >= minsize);
+  const uint64_t nrvoxels = (uint64_t)volh->width * volh->height * volh->images;
+  const uint64_t minsize = (nrvoxels * volh->bits_per_voxel) / 8;
+  // A truncated file must be caught here, as touching a mapped page
+  // past the end of the file raises SIGBUS instead of returning an
+  // error.
+  if ((uint64_t)filesize < (uint64_t)volh->header_length + minsize) {
+    SoDebugError::post("SoVRVolFileReader::setUserData",
+                       "'%s' is truncated: %lu bytes, header and voxels "
+                       "need %lu bytes", filename, (unsigned long)filesize,
+                       (unsigned long)(volh->header_length + minsize));
+    PRIVATE(this)->releaseFileData();
+    return;
+  }
 
-  // Shift actual voxel data to start at the m_data pointer.
-  (void)memmove(this->m_data, (uint8_t *)this->m_data + volh->header_length,
-                ((size_t)filesize) - volh->header_length); // FIXME: bogus cast. 2004121 mortene.
+  // Point m_data at the voxel values directly following the header,
+  // instead of shifting them down in a copy of the file.
+  //
+  // FIXME: this is completely bogus use of SoVolumeReader::m_data --
+  // this is *not* where the voxel data is supposed to be stored. That
+  // is inside SoVolumeData. 20041008 mortene.
+  this->m_data = PRIVATE(this)->filedata + volh->header_length;
+
+  // Any further complete volumes following the first one are time
+  // steps. A partial volume at the end is ignored, as before.
+  PRIVATE(this)->stepbytes = (size_t)minsize;
+  if (minsize > 0) {
+    const uint64_t nrsteps =
+      ((uint64_t)filesize - volh->header_length) / minsize;
+    PRIVATE(this)->nrsteps = (int)SbMin(nrsteps, (uint64_t)INT_MAX);
+  }
+  if ((PRIVATE(this)->nrsteps > 1) && CvrUtil::doDebugging()) {
+    SoDebugError::postInfo("SoVRVolFileReader::setUserData",
+                           "'%s' holds %d time steps", filename,
+                           PRIVATE(this)->nrsteps);
+  }
 
   const char * env = coin_getenv("CVR_DEBUG_DUMP_RAW");
   if (env) {
     FILE * f = fopen(env, "w");
     assert(f); // FIXME: handle in robust manner. 20030702 mortene.
     // FIXME: error check next two. 20030702 mortene.
-    fwrite(this->m_data, 1,
-           ((size_t)filesize) - volh->header_length, f); // FIXME: bogus cast. 2004121 mortene.
+    fwrite(this->m_data, 1, nrbytes - volh->header_length, f);
     fclose(f);
   }
 
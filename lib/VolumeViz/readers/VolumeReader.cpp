@@ -55,8 +55,14 @@
 #include <errno.h>
 #include <string.h>
 
+#include <Inventor/SbBox2s.h>
+#include <Inventor/SbBox3f.h>
+#include <Inventor/SbBox3i32.h>
+#include <Inventor/SbBox3s.h>
 #include <Inventor/errors/SoDebugError.h>
 
+#include <VolumeViz/misc/CvrUtil.h>
+
 // *************************************************************************
 
 /*!
@@ -69,9 +75,9 @@
   \a size is set to the "world size" of the volume, in unit
   coordinates.
 
-  \a type is set to either SoVolumeData::UNSIGNED_BYTE or
-  SoVolumeData::UNSIGNED_SHORT, to signify that the voxel values are
-  either 8-bit or 16-bit, respectively.
+  \a type is set to the type of the voxel values, i.e. one of
+  SoVolumeData::UNSIGNED_BYTE, SoVolumeData::UNSIGNED_SHORT,
+  SoVolumeData::SIGNED_SHORT or SoVolumeData::FLOAT.
 
   \a dim gives the volume dimensions in voxel coordinates, i.e. the
   number of rows, columns and stacks of voxels along the internal 3
@@ -84,6 +90,10 @@
   Extract a subslice from the volume (which may still reside solely on
   disk). Sub-classes, i.e. the non-abstract readers, need to
   implement this function.
+
+  The \a subslice box is inclusive at its minimum corner and exclusive
+  at its maximum corner, and \a data should be filled with exactly
+  those voxels, row by row, with no border around them.
 */
 
 // *************************************************************************
@@ -96,6 +106,19 @@ public:
 
   SbString filename;
 
+  void getVolumeInfo(SbVec3i32 & dims, unsigned int & bytesprvoxel);
+  const uint8_t * contiguousRegion(const SbVec3i32 & vmin, const SbVec3i32 & vmax,
+                                   const SbVec3i32 & dims,
+                                   unsigned int bytesprvoxel) const;
+  static SbBool isWithin(const SbVec3i32 & vmin, const SbVec3i32 & vmax,
+                         const SbVec3i32 & dims);
+
+  SbBool copySubVolume(const SbBox3i32 & volume, void * data);
+  SbBool pointSubVolume(const SbBox3i32 & volume, const SbVec3s & subsamplelevel,
+                        void *& voxels);
+  SbBool subVolumeInfo(const SbBox3i32 & volume, SbVec3s & subsamplelevel,
+                       SoVolumeReader::CopyPolicy & policy);
+
 private:
   SoVolumeReader * master;
 };
@@ -106,6 +129,157 @@ private:
 
 // *************************************************************************
 
+void
+SoVolumeReaderP::getVolumeInfo(SbVec3i32 & dims, unsigned int & bytesprvoxel)
+{
+  SbBox3f size;
+  SoVolumeData::DataType type;
+  PUBLIC(this)->getDataChar(size, type, dims);
+
+  switch (type) {
+  case SoVolumeData::UNSIGNED_BYTE: bytesprvoxel = 1; break;
+  case SoVolumeData::UNSIGNED_SHORT: bytesprvoxel = 2; break;
+  case SoVolumeData::SIGNED_SHORT: bytesprvoxel = 2; break;
+  case SoVolumeData::FLOAT: bytesprvoxel = 4; break;
+  default: assert(FALSE && "unknown data type"); bytesprvoxel = 1; break;
+  }
+}
+
+SbBool
+SoVolumeReaderP::isWithin(const SbVec3i32 & vmin, const SbVec3i32 & vmax,
+                          const SbVec3i32 & dims)
+{
+  for (unsigned int i = 0; i < 3; i++) {
+    if ((vmin[i] < 0) || (vmin[i] >= vmax[i]) || (vmax[i] > dims[i])) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+// Returns a pointer into the in-memory voxel buffer if the given
+// sub-volume is laid out contiguously there, i.e. if it spans
+// complete slices, or complete rows of a single slice, or part of a
+// single row. Otherwise returns NULL.
+const uint8_t *
+SoVolumeReaderP::contiguousRegion(const SbVec3i32 & vmin, const SbVec3i32 & vmax,
+                                  const SbVec3i32 & dims,
+                                  unsigned int bytesprvoxel) const
+{
+  const uint8_t * voxels = (const uint8_t *)PUBLIC(this)->m_data;
+  if (voxels == NULL) { return NULL; }
+
+  const SbBool fullrows = (vmin[0] == 0) && (vmax[0] == dims[0]);
+  const SbBool fullslices = fullrows && (vmin[1] == 0) && (vmax[1] == dims[1]);
+  const SbBool oneslice = (vmax[2] - vmin[2]) == 1;
+  const SbBool onerow = oneslice && ((vmax[1] - vmin[1]) == 1);
+
+  if (!fullslices && !(fullrows && oneslice) && !onerow) { return NULL; }
+
+  const size_t idx = ((size_t)vmin[2] * dims[1] + vmin[1]) * dims[0] + vmin[0];
+  return voxels + idx * bytesprvoxel;
+}
+
+// The default getSubVolume(SbBox3s &, void *), for both box types.
+// Without voxels in memory, the sub-volume is assembled through
+// getSubSlice(), which can only address 16-bit boxes.
+SbBool
+SoVolumeReaderP::copySubVolume(const SbBox3i32 & volume, void * data)
+{
+  SbVec3i32 dims;
+  unsigned int bytesprvoxel;
+  this->getVolumeInfo(dims, bytesprvoxel);
+
+  SbVec3i32 vmin, vmax;
+  volume.getBounds(vmin, vmax);
+  if (!SoVolumeReaderP::isWithin(vmin, vmax, dims)) { return FALSE; }
+
+  const size_t rowbytes = (size_t)(vmax[0] - vmin[0]) * bytesprvoxel;
+  const size_t slicebytes = rowbytes * (vmax[1] - vmin[1]);
+  uint8_t * dst = (uint8_t *)data;
+
+  if (PUBLIC(this)->m_data == NULL) {
+    if (!CvrUtil::fitsShort(volume)) { return FALSE; }
+    for (int32_t z = vmin[2]; z < vmax[2]; z++) {
+      SbBox2s subslice((short)vmin[0], (short)vmin[1], (short)vmax[0], (short)vmax[1]);
+      PUBLIC(this)->getSubSlice(subslice, z, dst);
+      dst += slicebytes;
+    }
+    return TRUE;
+  }
+
+  // If the sub-volume is contiguous in the voxel buffer, do it as a
+  // single copy.
+  const uint8_t * src = this->contiguousRegion(vmin, vmax, dims, bytesprvoxel);
+  if (src) {
+    (void)memcpy(dst, src, slicebytes * (vmax[2] - vmin[2]));
+    return TRUE;
+  }
+
+  const uint8_t * voxels = (const uint8_t *)PUBLIC(this)->m_data;
+  for (int32_t z = vmin[2]; z < vmax[2]; z++) {
+    for (int32_t y = vmin[1]; y < vmax[1]; y++) {
+      const size_t idx = ((size_t)z * dims[1] + y) * dims[0] + vmin[0];
+      (void)memcpy(dst, voxels + idx * bytesprvoxel, rowbytes);
+      dst += rowbytes;
+    }
+  }
+  return TRUE;
+}
+
+// The default getSubVolume(const SbBox3s &, const SbVec3s, void *&),
+// for both box types.
+SbBool
+SoVolumeReaderP::pointSubVolume(const SbBox3i32 & volume,
+                                const SbVec3s & subsamplelevel, void *& voxels)
+{
+  voxels = NULL;
+  if (PUBLIC(this)->m_data == NULL) { return FALSE; }
+  if (subsamplelevel != SbVec3s(0, 0, 0)) { return FALSE; }
+
+  SbVec3i32 dims;
+  unsigned int bytesprvoxel;
+  this->getVolumeInfo(dims, bytesprvoxel);
+
+  SbVec3i32 vmin, vmax;
+  volume.getBounds(vmin, vmax);
+  if (!SoVolumeReaderP::isWithin(vmin, vmax, dims)) { return FALSE; }
+
+  const uint8_t * src = this->contiguousRegion(vmin, vmax, dims, bytesprvoxel);
+  if (src == NULL) { return FALSE; }
+
+  voxels = (void *)src;
+  return TRUE;
+}
+
+// The default getSubVolumeInfo(), for both box types.
+SbBool
+SoVolumeReaderP::subVolumeInfo(const SbBox3i32 & volume, SbVec3s & subsamplelevel,
+                               SoVolumeReader::CopyPolicy & policy)
+{
+  SbVec3i32 dims;
+  unsigned int bytesprvoxel;
+  this->getVolumeInfo(dims, bytesprvoxel);
+
+  SbVec3i32 vmin, vmax;
+  volume.getBounds(vmin, vmax);
+  if (!SoVolumeReaderP::isWithin(vmin, vmax, dims)) { return FALSE; }
+
+  // Subsampling is not supported by the default implementation.
+  subsamplelevel.setValue(0, 0, 0);
+
+  if (PUBLIC(this)->m_data &&
+      this->contiguousRegion(vmin, vmax, dims, bytesprvoxel)) {
+    policy = SoVolumeReader::NO_COPY;
+  }
+  else {
+    policy = SoVolumeReader::COPY;
+  }
+  return TRUE;
+}
+
+// *************************************************************************
+
 SoVolumeReader::SoVolumeReader(void)
 {
   PRIVATE(this) = new SoVolumeReaderP(this);
@@ -177,61 +351,214 @@ SoVolumeReader::getNumSignificantBits(void)
 // *************************************************************************
 
 // \since SIM Voleon 2.0
+//
+// Copies the voxels within \a volume into \a data, which must be
+// large enough to hold them. As for getSubSlice(), the minimum corner
+// of \a volume is inclusive and the maximum corner is exclusive.
+//
+// The default implementation copies straight out of the voxel buffer
+// if the reader has all voxels in memory, and otherwise assembles the
+// sub-volume slice by slice through getSubSlice(). Returns FALSE only
+// if the box is not within the volume.
 SbBool
 SoVolumeReader::getSubVolume(SbBox3s & volume, void * data)
 {
-  // FIXME: implement in SoVRVolFileReader, plus use it from within
-  // the library when loading blocks. 20041008 mortene.
-
-  // FALSE means fall back on getSubSlice().
-  return FALSE;
+  return PRIVATE(this)->copySubVolume(CvrUtil::toBox3i32(volume), data);
 }
 
 // \since SIM Voleon 2.0
+//
+// Sets \a voxels to point at the voxels within \a volume, at the
+// given subsampling level. Ownership of the returned buffer is as
+// reported by getSubVolumeInfo() for the same arguments:
+// SoVolumeReader::NO_COPY means \a voxels points into storage owned
+// by the reader, which stays valid for as long as the reader is not
+// given new data, while SoVolumeReader::NO_COPY_AND_DELETE means the
+// caller must deallocate the buffer with "delete[] (uint8_t *)".
+//
+// The default implementation only handles sub-volumes at full
+// resolution which are contiguous in the in-memory voxel buffer, and
+// returns FALSE for anything else. The caller should then use
+// getSubVolume(SbBox3s &, void *) instead.
 SbBool
 SoVolumeReader::getSubVolume(const SbBox3s & volume,
                              const SbVec3s subsamplelevel, void *& voxels)
 {
-  // FIXME: implement in SoVRVolFileReader, plus use it from within
-  // the library when loading blocks. 20041008 mortene.
-
-  // FALSE means fall back on getSubSlice().
-  return FALSE;
+  return PRIVATE(this)->pointSubVolume(CvrUtil::toBox3i32(volume),
+                                       subsamplelevel, voxels);
 }
 
 // \since SIM Voleon 2.0
+//
+// Tells how the reader can deliver the voxels of \a volume, at (or
+// near) the requested subsampling level. Returns FALSE if the reader
+// can not deliver the sub-volume through getSubVolume() at all.
+//
+// On return, \a subsamplelevel is set to the subsampling level which
+// will actually be used, and \a policy is set to one of:
+//
+// <ul>
+// <li>SoVolumeReader::NO_COPY: getSubVolume(const SbBox3s &, const
+// SbVec3s, void *&) hands back a pointer into the reader's own
+// storage,</li>
+// <li>SoVolumeReader::NO_COPY_AND_DELETE: the same function hands
+// back a buffer the caller takes ownership of,</li>
+// <li>SoVolumeReader::COPY: the caller should allocate a buffer and
+// fill it with getSubVolume(SbBox3s &, void *).</li>
+// </ul>
 SbBool
 SoVolumeReader::getSubVolumeInfo(SbBox3s & volume,
                                  SbVec3s reqsubsamplelevel,
                                  SbVec3s & subsamplelevel,
                                  SoVolumeReader::CopyPolicy & policy)
 {
-  // FIXME: implement. 20041008 mortene.
-  return FALSE;
+  return PRIVATE(this)->subVolumeInfo(CvrUtil::toBox3i32(volume),
+                                      subsamplelevel, policy);
+}
+
+// \since SIM Voleon 2.0
+//
+// As getDataChar(SbBox3f &, SoVolumeData::DataType &, SbVec3s &), but
+// for volumes with more than 32767 voxels along an axis. This is what
+// SoVolumeData uses. Readers of such volumes must override it, while
+// the default implementation just asks for the 16-bit dimensions.
+void
+SoVolumeReader::getDataChar(SbBox3f & size, SoVolumeData::DataType & type,
+                            SbVec3i32 & dim)
+{
+  SbVec3s dim16;
+  this->getDataChar(size, type, dim16);
+  dim = CvrUtil::toVec3i32(dim16);
+}
+
+// \since SIM Voleon 2.0
+//
+// The getSubVolume() and getSubVolumeInfo() functions taking SbBox3i32
+// boxes are the ones SoVolumeData uses. By default, boxes within
+// 16-bit range are passed on to the functions taking SbBox3s boxes,
+// so readers which override those keep working. Boxes beyond that are
+// handled as by the default implementations of the 16-bit functions,
+// except that voxels not in memory can not be read through
+// getSubSlice(). Readers of volumes with more than 32767 voxels along
+// an axis, and no voxels in memory, should override these.
+SbBool
+SoVolumeReader::getSubVolume(SbBox3i32 & volume, void * voxels)
+{
+  if (CvrUtil::fitsShort(volume)) {
+    SbBox3s volume16 = CvrUtil::toBox3s(volume);
+    return this->getSubVolume(volume16, voxels);
+  }
+  return PRIVATE(this)->copySubVolume(volume, voxels);
+}
+
+// \since SIM Voleon 2.0
+//
+// See getSubVolume(SbBox3i32 &, void *).
+SbBool
+SoVolumeReader::getSubVolume(const SbBox3i32 & volume,
+                             const SbVec3s subsamplelevel, void *& voxels)
+{
+  if (CvrUtil::fitsShort(volume)) {
+    return this->getSubVolume(CvrUtil::toBox3s(volume), subsamplelevel, voxels);
+  }
+  return PRIVATE(this)->pointSubVolume(volume, subsamplelevel, voxels);
+}
+
+// \since SIM Voleon 2.0
+//
+// See getSubVolume(SbBox3i32 &, void *).
+SbBool
+SoVolumeReader::getSubVolumeInfo(SbBox3i32 & volume,
+                                 SbVec3s reqsubsamplelevel,
+                                 SbVec3s & subsamplelevel,
+                                 SoVolumeReader::CopyPolicy & policy)
+{
+  if (CvrUtil::fitsShort(volume)) {
+    SbBox3s volume16 = CvrUtil::toBox3s(volume);
+    return this->getSubVolumeInfo(volume16, reqsubsamplelevel,
+                                  subsamplelevel, policy);
+  }
+  return PRIVATE(this)->subVolumeInfo(volume, subsamplelevel, policy);
 }
 
 // *************************************************************************
 
 // \since SIM Voleon 2.0
+//
+// Returns the number of time steps of a time-varying volume. The
+// default is a single, static volume.
+int
+SoVolumeReader::getNumTimeSteps(void)
+{
+  return 1;
+}
+
+// \since SIM Voleon 2.0
+//
+// Reads all voxels of time step \a step into \a voxels, which is
+// large enough to hold the complete volume, laid out as for
+// SoVolumeData::setVolumeData(). All time steps must have the
+// dimensions and the data type returned from getDataChar().
+//
+// Readers of time-varying volumes must override this. For those,
+// SoVolumeData calls it from a background thread, to decode the next
+// time step while the current one is rendered, and does not call any
+// other methods of the reader meanwhile. The default implementation
+// only delivers the single step of a static volume.
+SbBool
+SoVolumeReader::getTimeStep(int step, void * voxels)
+{
+  if (step != 0) { return FALSE; }
+
+  SbVec3i32 dims;
+  unsigned int bytesprvoxel;
+  PRIVATE(this)->getVolumeInfo(dims, bytesprvoxel);
+  SbBox3i32 volume(SbVec3i32(0, 0, 0), dims);
+  return this->getSubVolume(volume, voxels);
+}
+
+// \since SIM Voleon 2.0
+//
+// Returns the number of voxels along each axis of a volume of \a
+// realsize voxels, when subsampled at the given levels. Level n means
+// every 2^n'th voxel is kept.
 SbVec3s
 SoVolumeReader::getNumVoxels(SbVec3s realsize, SbVec3s subsamplinglevel) const
 {
-  // FIXME: implement. 20041008 mortene.
+  SbVec3s nrvoxels;
+  for (unsigned int i = 0; i < 3; i++) {
+    assert(subsamplinglevel[i] >= 0 && subsamplinglevel[i] < 15);
+    const short step = (short)(1 << subsamplinglevel[i]);
+    nrvoxels[i] = SbMax((short)1, (short)((realsize[i] + step - 1) / step));
+  }
+  return nrvoxels;
+}
 
-  SoDebugError::postWarning("SoVolumeReader::getNumVoxels",
-                            "not yet implemented, just a stub");
-  return SbVec3s(0, 0, 0);
+// \since SIM Voleon 2.0
+//
+// As getNumVoxels(SbVec3s, SbVec3s), for volumes with more than 32767
+// voxels along an axis.
+SbVec3i32
+SoVolumeReader::getNumVoxels(const SbVec3i32 & realsize, SbVec3s subsamplinglevel) const
+{
+  SbVec3i32 nrvoxels;
+  for (unsigned int i = 0; i < 3; i++) {
+    assert(subsamplinglevel[i] >= 0 && subsamplinglevel[i] < 31);
+    const int32_t step = (int32_t)1 << subsamplinglevel[i];
+    nrvoxels[i] = SbMax((int32_t)1, (int32_t)(((int64_t)realsize[i] + step - 1) / step));
+  }
+  return nrvoxels;
 }
 
 // \since SIM Voleon 2.0
+//
+// Returns the dimensions of the buffer needed for a subsampled volume
+// of \a realsize voxels. This is the same as getNumVoxels(), as no
+// padding is used.
 SbVec3s
 SoVolumeReader::getSizeToAllocate(SbVec3s realsize, SbVec3s subsamplinglevel) const
 {
-  // FIXME: implement. 20041008 mortene.
-
-  SoDebugError::postWarning("SoVolumeReader::getSizeToAllocate",
-                            "not yet implemented, just a stub");
-  return SbVec3s(0, 0, 0);
+  return this->getNumVoxels(realsize, subsamplinglevel);
 }
 
 // *************************************************************************
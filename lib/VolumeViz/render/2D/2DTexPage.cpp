@@ -36,16 +36,19 @@
 #include <string.h>
 
 #include <Inventor/C/tidbits.h>
-#include <Inventor/SbBox2s.h>
+#include <Inventor/SbBox2i32.h>
+#include <Inventor/SbBox3i32.h>
 #include <Inventor/actions/SoGLRenderAction.h>
 #include <Inventor/errors/SoDebugError.h>
 #include <Inventor/system/gl.h>
 
+#include <VolumeViz/elements/CvrSubSamplingElement.h>
 #include <VolumeViz/elements/CvrVoxelBlockElement.h>
 #include <VolumeViz/elements/SoTransferFunctionElement.h>
 #include <VolumeViz/misc/CvrCLUT.h>
 #include <VolumeViz/misc/CvrUtil.h>
 #include <VolumeViz/misc/CvrVoxelChunk.h>
+#include <VolumeViz/misc/CvrVoxelStore.h>
 #include <VolumeViz/nodes/SoTransferFunction.h>
 #include <VolumeViz/render/common/CvrTextureObject.h>
 #include <VolumeViz/render/2D/Cvr2DTexSubPage.h>
@@ -62,6 +65,12 @@ public:
   Cvr2DTexSubPage * page;
   SbUniqueId volumedataid;
   SbBool invisible;
+  unsigned int level; // of the voxel store's resolution pyramid
+  // voxels the page was made from, and the voxel store's update
+  // serial at the time, to find out when an invisible page must be
+  // remade:
+  SbBox3i32 region;
+  unsigned int updateserial;
 };
 
 // *************************************************************************
@@ -84,7 +93,7 @@ Cvr2DTexPage::Cvr2DTexPage(const SoGLRenderAction * action,
   this->subpagesize = subpagetexsize;
 
   const CvrVoxelBlockElement * vbelem = CvrVoxelBlockElement::getInstance(action->getState());
-  const SbVec3s & dim = vbelem->getVoxelCubeDimensions();
+  const SbVec3i32 & dim = vbelem->getVoxelCubeDimensions();
 
   assert(dim[0] > 0);
   assert(dim[1] > 0);
@@ -200,23 +209,46 @@ Cvr2DTexPage::render(const SoGLRenderAction * action,
   // Find the "local 3D-space" size of each subpage.
 
   const SbVec2s & sub = this->subpagesize;
-  const SbVec2s & dim = this->dimensions;
+  const SbVec2i32 & dim = this->dimensions;
   const SbVec3f subpagewidth = horizspan * float(sub[0]) / float(dim[0]);
   const SbVec3f subpageheight = verticalspan * float(sub[1]) / float(dim[1]);
 
   SoState * state = action->getState();
 
-  // Render all subpages making up the full page.
+  // The extent of a single voxel, for deciding at which resolution
+  // each subpage should be rendered.
+  const CvrVoxelBlockElement * vbelem = CvrVoxelBlockElement::getInstance(state);
+  const unsigned int nrlevels = vbelem->getVoxelStore()->getNrOfLevels();
+  const CvrSubSamplingElement * sselem = CvrSubSamplingElement::getInstance(state);
+  const SbVec3f voxeledges[3] = {
+    horizspan / float(dim[0]), verticalspan / float(dim[1]), SbVec3f(0, 0, 0)
+  };
+
+  // Find the resolution level of each subpage, and build all missing
+  // subpages in one go.
 
+  unsigned int * levels = new unsigned int[this->nrrows * this->nrcolumns];
   for (int rowidx = 0; rowidx < this->nrrows; rowidx++) {
     for (int colidx = 0; colidx < this->nrcolumns; colidx++) {
+      const SbVec3f center = origo +
+        subpagewidth * ((float)colidx + 0.5f) +
+        subpageheight * ((float)rowidx + 0.5f);
+      const int idx = this->calcSubPageIdx(rowidx, colidx);
+      levels[idx] = sselem->getLevel(state, center, voxeledges, nrlevels);
 
-      Cvr2DTexSubPage * page = NULL;
       Cvr2DTexSubPageItem * pageitem = this->getSubPage(state, colidx, rowidx);
-      if (pageitem == NULL) { pageitem = this->buildSubPage(action, colidx, rowidx); }
-      assert(pageitem != NULL);
-      if (pageitem->invisible) continue;
-      assert(pageitem->page != NULL);
+      if (pageitem && (pageitem->level != levels[idx])) {
+        this->releaseSubPage(rowidx, colidx);
+      }
+    }
+  }
+  this->buildSubPages(action, levels);
+  delete[] levels;
+
+  // Render all subpages making up the full page.
+
+  for (int rowidx = 0; rowidx < this->nrrows; rowidx++) {
+    for (int colidx = 0; colidx < this->nrcolumns; colidx++) {
 
       SbVec3f upleft = origo +
         // horizontal shift to correct column
@@ -224,6 +256,12 @@ Cvr2DTexPage::render(const SoGLRenderAction * action,
         // vertical shift to correct row
         subpageheight * (float)rowidx;
 
+      Cvr2DTexSubPageItem * pageitem =
+        this->subpages[this->calcSubPageIdx(rowidx, colidx)];
+      assert(pageitem != NULL);
+      if (pageitem->invisible) continue;
+      assert(pageitem->page != NULL);
+
       // FIXME: should do view frustum culling on each page as an
       // optimization measure (both for rendering speed and texture
       // memory usage). 20021121 mortene.
@@ -243,9 +281,13 @@ Cvr2DTexPage::calcSubPageIdx(int row, int col) const
   return (row * this->nrcolumns) + col;
 }
 
-// Builds a page if it doesn't exist. Rebuilds it if it does exist.
-Cvr2DTexSubPageItem *
-Cvr2DTexPage::buildSubPage(const SoGLRenderAction * action, int col, int row)
+// Builds all subpages which do not exist, or have to be remade, at
+// the resolution levels given per subpage in \a levels. The textures
+// of all of them are made in one go, so the voxels can be read and
+// transferred in parallel.
+void
+Cvr2DTexPage::buildSubPages(const SoGLRenderAction * action,
+                            const unsigned int * levels)
 {
   // FIXME: optimalization idea; *crop* textures for 100%
   // transparency. 20021124 mortene.
@@ -254,8 +296,6 @@ Cvr2DTexPage::buildSubPage(const SoGLRenderAction * action, int col, int row)
   // pages, and make pages able to map to several "slice indices". Not
   // sure if this can be much of a gain -- but look into it. 20021124 mortene.
 
-  assert(this->getSubPage(action->getState(), col, row) == NULL);
-
   // First Cvr2DTexSubPage ever in this slice?
   if (this->subpages == NULL) {
     this->subpages = new Cvr2DTexSubPageItem*[this->nrrows * this->nrcolumns];
@@ -267,48 +307,90 @@ Cvr2DTexPage::buildSubPage(const SoGLRenderAction * action, int col, int row)
     }
   }
 
-  SbVec2s subpagemin(col * this->subpagesize[0], row * this->subpagesize[1]);
-  SbVec2s subpagemax((col + 1) * this->subpagesize[0],
-                     (row + 1) * this->subpagesize[1]);
-  subpagemax[0] = SbMin(subpagemax[0], this->dimensions[0]);
-  subpagemax[1] = SbMin(subpagemax[1], this->dimensions[1]);
-
-#if CVR_DEBUG && 0 // debug
-  SoDebugError::postInfo("Cvr2DTexPage::buildSubPage",
-                         "subpagemin=[%d, %d] subpagemax=[%d, %d]",
-                         subpagemin[0], subpagemin[1],
-                         subpagemax[0], subpagemax[1]);
-#endif // debug
+  SoState * state = action->getState();
 
-  const SbBox2s subpagecut(subpagemin, subpagemax);
+  SbList<int> indices;
+  SbList<SbVec2s> texsizes;
+  SbList<SbBox2i32> cuts;
+  SbList<unsigned int> cutlevels;
+  for (int row = 0; row < this->nrrows; row++) {
+    for (int col = 0; col < this->nrcolumns; col++) {
+      if (this->getSubPage(state, col, row) != NULL) { continue; }
 
-  // Size of the texture that we're actually using. Will be less than
-  // this->subpagesize on datasets where dimensions are not all power
-  // of two, or where dimensions are smaller than this->subpagesize.
-  const SbVec2s texsize(subpagemax - subpagemin);
+      SbVec2i32 subpagemin(col * this->subpagesize[0], row * this->subpagesize[1]);
+      SbVec2i32 subpagemax((col + 1) * this->subpagesize[0],
+                           (row + 1) * this->subpagesize[1]);
+      subpagemax[0] = SbMin(subpagemax[0], this->dimensions[0]);
+      subpagemax[1] = SbMin(subpagemax[1], this->dimensions[1]);
 
-  const CvrTextureObject * texobj =
-    CvrTextureObject::create(action, this->clut, texsize, subpagecut,
-                             this->axis, this->sliceidx);
-  // if NULL is returned, it means all voxels are fully transparent
+#if CVR_DEBUG && 0 // debug
+      SoDebugError::postInfo("Cvr2DTexPage::buildSubPages",
+                             "subpagemin=[%d, %d] subpagemax=[%d, %d]",
+                             subpagemin[0], subpagemin[1],
+                             subpagemax[0], subpagemax[1]);
+#endif // debug
 
-  Cvr2DTexSubPage * page = NULL;
-  if (texobj) {
-    page = new Cvr2DTexSubPage(action, texobj, this->subpagesize, texsize);
-    page->setPalette(this->clut);
+      const int idx = this->calcSubPageIdx(row, col);
+      indices.append(idx);
+      cuts.append(SbBox2i32(subpagemin, subpagemax));
+      // Size of the texture that we're actually using. Will be less
+      // than this->subpagesize on datasets where dimensions are not
+      // all power of two, or where dimensions are smaller than
+      // this->subpagesize.
+      texsizes.append(SbVec2s((short)(subpagemax[0] - subpagemin[0]),
+                              (short)(subpagemax[1] - subpagemin[1])));
+      cutlevels.append(levels[idx]);
+    }
   }
 
-  SoState * state = action->getState();
+  const int nr = indices.getLength();
+  if (nr == 0) { return; }
+
   const CvrVoxelBlockElement * vbelem = CvrVoxelBlockElement::getInstance(state);
+  CvrVoxelStore * store = vbelem->getVoxelStore();
+  const unsigned int updateserial = store->getUpdateSerial();
+
+  const CvrTextureObject ** texobjs = new const CvrTextureObject *[nr];
+  CvrTextureObject::create(action, this->clut, nr, texsizes.getArrayPtr(),
+                           cuts.getArrayPtr(), this->axis, this->sliceidx,
+                           cutlevels.getArrayPtr(), texobjs);
+
+  for (int i = 0; i < nr; i++) {
+    const SbBox2i32 & subpagecut = cuts[i];
+    const SbVec2s & texsize = texsizes[i];
+    const unsigned int level = cutlevels[i];
+    const CvrTextureObject * texobj = texobjs[i];
+    // if NULL is returned, it means all voxels are fully transparent
+
+    // The part of the texture covered by the voxels, which is less
+    // than texsize when using a reduced resolution level.
+    const SbVec2i32 & subpagemin = subpagecut.getMin();
+    const SbVec2i32 & subpagemax = subpagecut.getMax();
+    const SbBox3i32 levelcut =
+      CvrVoxelStore::getLevelRegion(SbBox3i32(subpagemin[0], subpagemin[1], 0,
+                                              subpagemax[0], subpagemax[1], 1),
+                                    level);
+    const SbVec2s leveltexsize((short)(levelcut.getMax()[0] - levelcut.getMin()[0]),
+                               (short)(levelcut.getMax()[1] - levelcut.getMin()[1]));
+
+    Cvr2DTexSubPage * page = NULL;
+    if (texobj) {
+      page = new Cvr2DTexSubPage(action, texobj, this->subpagesize, texsize,
+                                 leveltexsize);
+      page->setPalette(this->clut);
+    }
 
-  Cvr2DTexSubPageItem * pitem = new Cvr2DTexSubPageItem(page);
-  pitem->volumedataid = vbelem->getNodeId();
-  pitem->invisible = (texobj == NULL);
+    Cvr2DTexSubPageItem * pitem = new Cvr2DTexSubPageItem(page);
+    pitem->volumedataid = vbelem->getNodeId();
+    pitem->invisible = (texobj == NULL);
+    pitem->level = level;
+    pitem->region = store->getPageRegion(this->axis, this->sliceidx, subpagecut);
+    pitem->updateserial = updateserial;
 
-  const int idx = this->calcSubPageIdx(row, col);
-  this->subpages[idx] = pitem;
+    this->subpages[indices[i]] = pitem;
+  }
 
-  return pitem;
+  delete[] texobjs;
 }
 
 // *******************************************************************
@@ -381,6 +463,15 @@ Cvr2DTexPage::getSubPage(SoState * state, int col, int row)
       this->releaseSubPage(row, col);
       return NULL;
     }
+
+    // The voxels of a fully transparent page may have been changed
+    // by SoVolumeData::updateRegions(). (Visible pages refresh their
+    // textures themselves.)
+    if (subp->invisible &&
+        vbelem->getVoxelStore()->isUpdatedSince(subp->region, subp->updateserial)) {
+      this->releaseSubPage(row, col);
+      return NULL;
+    }
   }
 
   return subp;
@@ -79,10 +79,15 @@ GLuint Cvr2DTexSubPage::emptyimgname[1] = { 0 };
 
 // *************************************************************************
 
+// \a texsize is the number of voxels covered by this subpage, while
+// \a leveltexsize is the number of texels used for them in \a
+// texobj. The two differ when the texture was made from a reduced
+// resolution level of the volume.
 Cvr2DTexSubPage::Cvr2DTexSubPage(const SoGLRenderAction * action,
                                  const CvrTextureObject * texobj,
                                  const SbVec2s & pagesize,
-                                 const SbVec2s & texsize)
+                                 const SbVec2s & texsize,
+                                 const SbVec2s & leveltexsize)
 {
   this->bitspertexel = 0;
   this->clut = NULL;
@@ -94,6 +99,8 @@ Cvr2DTexSubPage::Cvr2DTexSubPage(const SoGLRenderAction * action,
 
   assert(texsize[0] <= pagesize[0]);
   assert(texsize[1] <= pagesize[1]);
+  assert(leveltexsize[0] <= texsize[0]);
+  assert(leveltexsize[1] <= texsize[1]);
 
   this->texobj = texobj;
   this->texobj->ref();
@@ -104,9 +111,9 @@ Cvr2DTexSubPage::Cvr2DTexSubPage(const SoGLRenderAction * action,
 
   // Calculates part of texture to show.
   this->texmaxcoords = SbVec2f(1.0f, 1.0f);
-  if (texdims != texsize) {
-    this->texmaxcoords[0] = float(texsize[0]) / float(texdims[0]);
-    this->texmaxcoords[1] = float(texsize[1]) / float(texdims[1]);
+  if (texdims != leveltexsize) {
+    this->texmaxcoords[0] = float(leveltexsize[0]) / float(texdims[0]);
+    this->texmaxcoords[1] = float(leveltexsize[1]) / float(texdims[1]);
   }
 
   // Calculates part of GL quad to show.
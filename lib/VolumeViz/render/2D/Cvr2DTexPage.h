@@ -34,6 +34,7 @@
 \**************************************************************************/
 
 #include <Inventor/SbVec2s.h>
+#include <Inventor/SbVec2i32.h>
 
 class Cvr2DTexSubPage;
 class CvrCLUT;
@@ -60,8 +61,8 @@ public:
 private:
   class Cvr2DTexSubPageItem * getSubPage(SoState * state, int col, int row);
 
-  class Cvr2DTexSubPageItem * buildSubPage(const SoGLRenderAction * action,
-                                           int col, int row);
+  void buildSubPages(const SoGLRenderAction * action,
+                     const unsigned int * levels);
 
   void releaseSubPage(Cvr2DTexSubPage * page);
 
@@ -75,7 +76,7 @@ private:
   unsigned int axis;
   unsigned int sliceidx;
   SbVec2s subpagesize;
-  SbVec2s dimensions;
+  SbVec2i32 dimensions;
 
   int nrcolumns;
   int nrrows;
@@ -48,7 +48,8 @@ public:
   Cvr2DTexSubPage(const SoGLRenderAction * action,
                   const CvrTextureObject * texobj,
                   const SbVec2s & pagesize, 
-                  const SbVec2s & texsize);
+                  const SbVec2s & texsize,
+                  const SbVec2s & leveltexsize);
   ~Cvr2DTexSubPage();
 
   void render(const SoGLRenderAction * action,
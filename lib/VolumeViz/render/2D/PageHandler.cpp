@@ -60,7 +60,7 @@ CvrPageHandler::CvrPageHandler(const SoGLRenderAction * action)
   const CvrVoxelBlockElement * vbelem = CvrVoxelBlockElement::getInstance(action->getState());
   assert(vbelem);
 
-  const SbVec3s & dims = vbelem->getVoxelCubeDimensions();
+  const SbVec3i32 & dims = vbelem->getVoxelCubeDimensions();
   this->voldatadims[0] = dims[0];
   this->voldatadims[1] = dims[1];
   this->voldatadims[2] = dims[2];
@@ -230,7 +230,7 @@ CvrPageHandler::render(const SoGLRenderAction * action, CvrCLUT::AlphaUse alphau
     this->releaseSlices(0);
     this->releaseSlices(1);
     this->releaseSlices(2);    
-    const SbVec3s & dims = vbelem->getVoxelCubeDimensions();
+    const SbVec3i32 & dims = vbelem->getVoxelCubeDimensions();
     this->voldatadims[0] = dims[0];
     this->voldatadims[1] = dims[1];
     this->voldatadims[2] = dims[2];
@@ -238,7 +238,7 @@ CvrPageHandler::render(const SoGLRenderAction * action, CvrCLUT::AlphaUse alphau
   }
 
   const SoTransferFunctionElement * tfelement = SoTransferFunctionElement::getInstance(state);
-  CvrCLUT * c = CvrVoxelChunk::getCLUT(tfelement, alphause);
+  CvrCLUT * c = CvrVoxelChunk::getCLUT(tfelement, alphause, vbelem->getVoxelStore());
   if (this->clut != c) { this->setPalette(c); }
 
   // This must be done, as we want to control stuff in the GL state
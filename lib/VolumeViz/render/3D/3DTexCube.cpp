@@ -47,13 +47,16 @@
 #include <Inventor/errors/SoDebugError.h>
 
 #include <VolumeViz/elements/CvrPageSizeElement.h>
+#include <VolumeViz/elements/CvrSubSamplingElement.h>
 #include <VolumeViz/elements/CvrVoxelBlockElement.h>
 #include <VolumeViz/elements/SoTransferFunctionElement.h>
 #include <VolumeViz/misc/CvrCLUT.h>
 #include <VolumeViz/misc/CvrUtil.h>
+#include <VolumeViz/misc/CvrVoxelStore.h>
 #include <VolumeViz/nodes/SoTransferFunction.h>
 #include <VolumeViz/render/common/Cvr3DPaletteTexture.h>
 #include <VolumeViz/render/common/Cvr3DRGBATexture.h>
+#include <VolumeViz/render/common/CvrTextureObject.h>
 #include <VolumeViz/render/3D/Cvr3DTexSubCube.h>
 
 // *************************************************************************
@@ -76,6 +79,14 @@ public:
 
   float boundingsphereradius;
   float cameraplane2cubecenter;
+
+  unsigned int level; // of the voxel store's resolution pyramid
+
+  // Voxels the cube was made from, and the voxel store's update
+  // serial at the time, to find out when an invisible cube must be
+  // remade.
+  SbBox3i32 region;
+  unsigned int updateserial;
 };
 
 // *************************************************************************
@@ -99,7 +110,7 @@ Cvr3DTexCube::Cvr3DTexCube(const SoGLRenderAction * action)
   }
 
   const CvrVoxelBlockElement * vbelem = CvrVoxelBlockElement::getInstance(state);
-  const SbVec3s & dim = vbelem->getVoxelCubeDimensions();
+  const SbVec3i32 & dim = vbelem->getVoxelCubeDimensions();
 
   assert(dim[0] > 0);
   assert(dim[1] > 0);
@@ -339,11 +350,15 @@ Cvr3DTexCube::render(const SoGLRenderAction * action,
   }
   // debug end
 
+  this->buildSubCubes(action, startrow, endrow, startcolumn, endcolumn,
+                      startdepth, enddepth);
+
   for (unsigned int rowidx = startrow; rowidx <= endrow; rowidx++) {
     for (unsigned int colidx = startcolumn; colidx <= endcolumn; colidx++) {
       for (unsigned int depthidx = startdepth; depthidx <= enddepth; depthidx++) {
 
-        Cvr3DTexSubCubeItem * cubeitem = this->getSubCube(state, colidx, rowidx, depthidx);
+        Cvr3DTexSubCubeItem * cubeitem =
+          this->subcubes[this->calcSubCubeIdx(rowidx, colidx, depthidx)];
 
         const SbVec3f subcubeorigo =
           this->origo +
@@ -351,9 +366,6 @@ Cvr3DTexCube::render(const SoGLRenderAction * action,
           subcubeheight * (float)rowidx +
           subcubedepth * (float)depthidx;
 
-        if (cubeitem == NULL) { 
-          cubeitem = this->buildSubCube(action, subcubeorigo, colidx, rowidx, depthidx); 
-        }
         assert(cubeitem != NULL);
 
         if (cubeitem->invisible) continue;
@@ -507,22 +519,16 @@ Cvr3DTexCube::renderObliqueSlice(const SoGLRenderAction * action,
 
   SbList <Cvr3DTexSubCubeItem *> subcubelist;
 
+  this->buildSubCubes(action, 0, this->nrrows - 1, 0, this->nrcolumns - 1,
+                      0, this->nrdepths - 1);
+
   for (unsigned int rowidx = 0; rowidx < this->nrrows; rowidx++) {
     for (unsigned int colidx = 0; colidx < this->nrcolumns; colidx++) {
       for (unsigned int depthidx = 0; depthidx < this->nrdepths; depthidx++) {
 
         Cvr3DTexSubCube * cube = NULL;
-        Cvr3DTexSubCubeItem * cubeitem = this->getSubCube(state, colidx, rowidx, depthidx);
-
-        const SbVec3f subcubeorigo =
-          this->origo +
-          subcubewidth * (float)colidx +
-          subcubeheight * (float)rowidx +
-          subcubedepth * (float)depthidx;
-
-        if (cubeitem == NULL) { 
-          cubeitem = this->buildSubCube(action, subcubeorigo, colidx, rowidx, depthidx); 
-        }
+        Cvr3DTexSubCubeItem * cubeitem =
+          this->subcubes[this->calcSubCubeIdx(rowidx, colidx, depthidx)];
         assert(cubeitem != NULL);
 
         if (cubeitem->invisible) continue;
@@ -561,22 +567,16 @@ Cvr3DTexCube::renderIndexedSet(const SoGLRenderAction * action,
   SbList <Cvr3DTexSubCubeItem *> subcubelist;
   const SbMatrix invmodelmatrix = SoModelMatrixElement::get(state).inverse();
 
+  this->buildSubCubes(action, 0, this->nrrows - 1, 0, this->nrcolumns - 1,
+                      0, this->nrdepths - 1);
+
   for (unsigned int rowidx = 0; rowidx < this->nrrows; rowidx++) {
     for (unsigned int colidx = 0; colidx < this->nrcolumns; colidx++) {
       for (unsigned int depthidx = 0; depthidx < this->nrdepths; depthidx++) {
 
         Cvr3DTexSubCube * cube = NULL;
-        Cvr3DTexSubCubeItem * cubeitem = this->getSubCube(state, colidx, rowidx, depthidx);
-
-        const SbVec3f subcubeorigo =
-          this->origo +
-          subcubewidth * (float)colidx +
-          subcubeheight * (float)rowidx +
-          subcubedepth * (float)depthidx;
-        
-        if (cubeitem == NULL) { 
-          cubeitem = this->buildSubCube(action, subcubeorigo, colidx, rowidx, depthidx); 
-        }
+        Cvr3DTexSubCubeItem * cubeitem =
+          this->subcubes[this->calcSubCubeIdx(rowidx, colidx, depthidx)];
         assert(cubeitem != NULL);
 
         if (cubeitem->invisible) continue;
@@ -628,22 +628,16 @@ Cvr3DTexCube::renderNonindexedSet(const SoGLRenderAction * action,
   SbList <Cvr3DTexSubCubeItem *> subcubelist;
   const SbMatrix invmodelmatrix = SoModelMatrixElement::get(state).inverse();
 
+  this->buildSubCubes(action, 0, this->nrrows - 1, 0, this->nrcolumns - 1,
+                      0, this->nrdepths - 1);
+
   for (unsigned int rowidx = 0; rowidx < this->nrrows; rowidx++) {
     for (unsigned int colidx = 0; colidx < this->nrcolumns; colidx++) {
       for (unsigned int depthidx = 0; depthidx < this->nrdepths; depthidx++) {
 
         Cvr3DTexSubCube * cube = NULL;
-        Cvr3DTexSubCubeItem * cubeitem = this->getSubCube(state, colidx, rowidx, depthidx);
-
-        const SbVec3f subcubeorigo =
-          this->origo +
-          subcubewidth * (float)colidx +
-          subcubeheight * (float)rowidx +
-          subcubedepth * (float)depthidx;
-
-        if (cubeitem == NULL) { 
-          cubeitem = this->buildSubCube(action, subcubeorigo, colidx, rowidx, depthidx); 
-        }
+        Cvr3DTexSubCubeItem * cubeitem =
+          this->subcubes[this->calcSubCubeIdx(rowidx, colidx, depthidx)];
         assert(cubeitem != NULL);
 
         if (cubeitem->invisible) continue;
@@ -689,11 +683,15 @@ Cvr3DTexCube::calcSubCubeIdx(unsigned int row, unsigned int col, unsigned int de
 }
 
 
-// Builds a cube if it doesn't exist. Rebuilds it if it does exist.
-Cvr3DTexSubCubeItem *
-Cvr3DTexCube::buildSubCube(const SoGLRenderAction * action,
-                           const SbVec3f & subcubeorigo,
-                           unsigned int col, unsigned int row, unsigned int depth)
+// Builds all sub-cubes within the given ranges of rows, columns and
+// depths which do not exist, or have to be remade. The textures of
+// all of them are made in one go, so the voxels can be read and
+// transferred in parallel.
+void
+Cvr3DTexCube::buildSubCubes(const SoGLRenderAction * action,
+                            unsigned int startrow, unsigned int endrow,
+                            unsigned int startcol, unsigned int endcol,
+                            unsigned int startdepth, unsigned int enddepth)
 {
   // FIXME: optimalization idea; *crop* textures for 100%
   // transparency. 20021124 mortene.
@@ -702,12 +700,10 @@ Cvr3DTexCube::buildSubCube(const SoGLRenderAction * action,
   // cubes, and make cubes able to map to several "slice indices". Not
   // sure if this can be much of a gain -- but look into it. 20021124 mortene.
 
-  assert((this->getSubCube(action->getState(), col, row, depth) == NULL) && "Subcube already created!");
-
   // First Cvr3DTexSubCube ever in this slice?
   if (this->subcubes == NULL) {
     if (CvrUtil::doDebugging()) {
-      SoDebugError::postInfo("Cvr3DTexCube::buildSubCube",
+      SoDebugError::postInfo("Cvr3DTexCube::buildSubCubes",
                              "number of subcubes needed == %d (%d x %d x %d)",
                              this->nrrows * this->nrcolumns * this->nrdepths,
                              this->nrrows, this->nrcolumns, this->nrdepths);
@@ -724,25 +720,125 @@ Cvr3DTexCube::buildSubCube(const SoGLRenderAction * action,
     }
   }
 
-  SbVec3s subcubemin, subcubemax;
+  SoState * state = action->getState();
+
+  SbList<SbVec3i32> positions; // as <col, row, depth>
+  SbList<SbBox3i32> cuts;
+  SbList<unsigned int> levels;
+  for (unsigned int row = startrow; row <= endrow; row++) {
+    for (unsigned int col = startcol; col <= endcol; col++) {
+      for (unsigned int depth = startdepth; depth <= enddepth; depth++) {
+        if (this->getSubCube(state, col, row, depth) != NULL) { continue; }
+        positions.append(SbVec3i32(col, row, depth));
+        cuts.append(this->calcSubCubeCut(col, row, depth));
+        levels.append(this->calcSubCubeLevel(state, col, row, depth));
+      }
+    }
+  }
+
+  const int nr = positions.getLength();
+  if (nr == 0) { return; }
+
+  const CvrVoxelBlockElement * vbelem = CvrVoxelBlockElement::getInstance(state);
+  assert(vbelem != NULL);
+  const unsigned int updateserial = vbelem->getVoxelStore()->getUpdateSerial();
+
+  const CvrTextureObject ** texobjs = new const CvrTextureObject *[nr];
+  CvrTextureObject::create(action, this->clut, nr, cuts.getArrayPtr(),
+                           levels.getArrayPtr(), texobjs);
+
+  // RGBA textures shaded at fragment time get their gradients from a
+  // texture of their own, only needed for the visible sub-cubes.
+  const CvrTextureObject ** gradobjs = new const CvrTextureObject *[nr];
+  for (int i = 0; i < nr; i++) { gradobjs[i] = NULL; }
+  if (CvrCLUT::useFragmentShading(action)) {
+    SbList<int> visible;
+    SbList<SbBox3i32> visiblecuts;
+    SbList<unsigned int> visiblelevels;
+    for (int i = 0; i < nr; i++) {
+      if (texobjs[i] == NULL) { continue; }
+      visible.append(i);
+      visiblecuts.append(cuts[i]);
+      visiblelevels.append(levels[i]);
+    }
+    const int nrvisible = visible.getLength();
+    if (nrvisible > 0) {
+      const CvrTextureObject ** made = new const CvrTextureObject *[nrvisible];
+      CvrTextureObject::createGradients(action, nrvisible, visiblecuts.getArrayPtr(),
+                                        visiblelevels.getArrayPtr(), made);
+      for (int i = 0; i < nrvisible; i++) { gradobjs[visible[i]] = made[i]; }
+      delete[] made;
+    }
+  }
+
+  const SbVec3f subcubewidth(this->subcubesize[0], 0, 0);
+  const SbVec3f subcubeheight(0, this->subcubesize[1], 0);
+  const SbVec3f subcubedepth(0, 0, this->subcubesize[2]);
+
+  for (int i = 0; i < nr; i++) {
+    const unsigned int col = positions[i][0];
+    const unsigned int row = positions[i][1];
+    const unsigned int depth = positions[i][2];
+    const SbBox3i32 & subcubecut = cuts[i];
+    const CvrTextureObject * texobj = texobjs[i];
+    // if NULL is returned, it means all voxels are fully transparent
+
+    const SbVec3f subcubeorigo =
+      this->origo +
+      subcubewidth * (float)col +
+      subcubeheight * (float)row +
+      subcubedepth * (float)depth;
+
+    Cvr3DTexSubCube * cube = NULL;
+    if (texobj) {
+      const SbBox3i32 levelcut = CvrVoxelStore::getLevelRegion(subcubecut, levels[i]);
+      cube = new Cvr3DTexSubCube(action, texobj, subcubeorigo,
+                                 subcubecut.getMax() - subcubecut.getMin(),
+                                 levelcut.getMax() - levelcut.getMin());
+      cube->setPalette(this->clut);
+      if (gradobjs[i]) { cube->setGradientTexture(gradobjs[i]); }
+    }
+
+    Cvr3DTexSubCubeItem * pitem = new Cvr3DTexSubCubeItem(cube);
+    pitem->volumedataid = vbelem->getNodeId();
+    pitem->invisible = (texobj == NULL) ? TRUE : FALSE;
+    pitem->level = levels[i];
+    pitem->region = subcubecut;
+    pitem->updateserial = updateserial;
+
+    const int idx = this->calcSubCubeIdx(row, col, depth);
+    this->subcubes[idx] = pitem;
+  }
+
+  delete[] texobjs;
+  delete[] gradobjs;
+}
+
+
+// Returns the voxels covered by a sub-cube, in full resolution voxel
+// coordinates.
+SbBox3i32
+Cvr3DTexCube::calcSubCubeCut(unsigned int col, unsigned int row, unsigned int depth) const
+{
+  SbVec3i32 subcubemin, subcubemax;
   if (CvrUtil::useFlippedYAxis()) {
     // NOTE: Building subcubes 'upwards' so that the Y orientation
     // will be equal to the 2D slice rendering (the voxelchunks are
     // also flipped).
-    subcubemin = SbVec3s(col * this->subcubesize[0],
-                         this->dimensions[1] - (row + 1) * this->subcubesize[1],
-                         depth * this->subcubesize[2]);
-    subcubemax = SbVec3s((col + 1) * this->subcubesize[0],
-                         this->dimensions[1] - row * this->subcubesize[1],
-                         (depth + 1) * this->subcubesize[2]);
+    subcubemin = SbVec3i32(col * this->subcubesize[0],
+                           this->dimensions[1] - (row + 1) * this->subcubesize[1],
+                           depth * this->subcubesize[2]);
+    subcubemax = SbVec3i32((col + 1) * this->subcubesize[0],
+                           this->dimensions[1] - row * this->subcubesize[1],
+                           (depth + 1) * this->subcubesize[2]);
   }
   else {
-    subcubemin = SbVec3s(col * this->subcubesize[0],
-                         row * this->subcubesize[1],
-                         depth * this->subcubesize[2]);
-    subcubemax = SbVec3s((col + 1) * this->subcubesize[0],
-                         (row + 1) * this->subcubesize[1],
-                         (depth + 1) * this->subcubesize[2]);
+    subcubemin = SbVec3i32(col * this->subcubesize[0],
+                           row * this->subcubesize[1],
+                           depth * this->subcubesize[2]);
+    subcubemax = SbVec3i32((col + 1) * this->subcubesize[0],
+                           (row + 1) * this->subcubesize[1],
+                           (depth + 1) * this->subcubesize[2]);
   }
 
   // Crop subcube size
@@ -750,37 +846,38 @@ Cvr3DTexCube::buildSubCube(const SoGLRenderAction * action,
   subcubemax[1] = SbMin(subcubemax[1], this->dimensions[1]);
   subcubemax[2] = SbMin(subcubemax[2], this->dimensions[2]);
 
-  subcubemin[1] = SbMax(subcubemin[1], (short) 0);
+  subcubemin[1] = SbMax(subcubemin[1], 0);
 
 #if CVR_DEBUG && 0 // debug
-  SoDebugError::postInfo("Cvr3DTexCube::buildSubCube",
+  SoDebugError::postInfo("Cvr3DTexCube::calcSubCubeCut",
                          "subcubemin=[%d, %d, %d] subcubemax=[%d, %d, %d]",
                          subcubemin[0], subcubemin[1], subcubemin[2],
                          subcubemax[0], subcubemax[1], subcubemax[2]);
 #endif // debug
-  const SbBox3s subcubecut(subcubemin, subcubemax);
-  const CvrTextureObject * texobj = CvrTextureObject::create(action, this->clut, subcubecut);
-  // if NULL is returned, it means all voxels are fully transparent
-
-  Cvr3DTexSubCube * cube = NULL;
-  if (texobj) {
-    cube = new Cvr3DTexSubCube(action, texobj, subcubeorigo,
-                               subcubecut.getMax() - subcubecut.getMin());
-    cube->setPalette(this->clut);
-  }
+  return SbBox3i32(subcubemin, subcubemax);
+}
 
-  SoState * state = action->getState();
+
+// Returns the resolution pyramid level a sub-cube should be made
+// from, given the size of its voxels on screen.
+unsigned int
+Cvr3DTexCube::calcSubCubeLevel(SoState * state, unsigned int col, unsigned int row, unsigned int depth) const
+{
   const CvrVoxelBlockElement * vbelem = CvrVoxelBlockElement::getInstance(state);
   assert(vbelem != NULL);
-  
-  Cvr3DTexSubCubeItem * pitem = new Cvr3DTexSubCubeItem(cube);
-  pitem->volumedataid = vbelem->getNodeId();
-  pitem->invisible = (texobj == NULL) ? TRUE : FALSE;
-
-  const int idx = this->calcSubCubeIdx(row, col, depth);
-  this->subcubes[idx] = pitem;
-
-  return pitem;
+  const unsigned int nrlevels = vbelem->getVoxelStore()->getNrOfLevels();
+  const CvrSubSamplingElement * sselem = CvrSubSamplingElement::getInstance(state);
+
+  // Sub-cubes are laid out with one unit per voxel in the local
+  // coordinate system.
+  const SbVec3f center =
+    this->origo + SbVec3f(this->subcubesize[0] * (col + 0.5f),
+                          this->subcubesize[1] * (row + 0.5f),
+                          this->subcubesize[2] * (depth + 0.5f));
+  const SbVec3f voxeledges[3] = {
+    SbVec3f(1, 0, 0), SbVec3f(0, 1, 0), SbVec3f(0, 0, 1)
+  };
+  return sselem->getLevel(state, center, voxeledges, nrlevels);
 }
 
 
@@ -863,6 +960,22 @@ Cvr3DTexCube::getSubCube(SoState * state, unsigned int col, unsigned int row, un
       this->releaseSubCube(row, col, depth);
       return NULL;
     }
+
+    // Rebuild from another resolution level if the sub-cube's size on
+    // screen has changed enough.
+    if (subp->level != this->calcSubCubeLevel(state, col, row, depth)) {
+      this->releaseSubCube(row, col, depth);
+      return NULL;
+    }
+
+    // The voxels of a fully transparent cube may have been changed by
+    // SoVolumeData::updateRegions(). (Visible cubes refresh their
+    // textures themselves.)
+    if (subp->invisible &&
+        vbelem->getVoxelStore()->isUpdatedSince(subp->region, subp->updateserial)) {
+      this->releaseSubCube(row, col, depth);
+      return NULL;
+    }
   }
   
   return subp;
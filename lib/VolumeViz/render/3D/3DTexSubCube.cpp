@@ -59,19 +59,26 @@
     subcube would have its parameter cubeorigo==<-160, -160, -17>.
 
     \a cubesize is the voxel dimensions of the sub-cube.
+
+    \a texsize is the number of texels actually used in \a texobj,
+    which will be less than \a cubesize when the texture was made from
+    a lower resolution level of the volume.
 */
 Cvr3DTexSubCube::Cvr3DTexSubCube(const SoGLRenderAction * action,
                                  const CvrTextureObject * texobj,
                                  const SbVec3f & cubeorigo,
-                                 const SbVec3s & cubesize)
+                                 const SbVec3i32 & cubesize,
+                                 const SbVec3i32 & texsize)
 {
   this->clut = NULL;
+  this->gradienttexture = NULL;
 
   assert(cubesize[0] >= 0);
   assert(cubesize[1] >= 0);
   assert(cubesize[2] >= 0);
 
   this->dimensions = cubesize;
+  this->texsize = texsize;
 
   if (texobj->getTypeId() == Cvr3DPaletteTexture::getClassTypeId()) {
     this->clut = ((CvrPaletteTexture *)texobj)->getCLUT();
@@ -110,6 +117,7 @@ Cvr3DTexSubCube::~Cvr3DTexSubCube()
 {
   this->textureobject->unref();
   if (this->clut) this->clut->unref();
+  if (this->gradienttexture) this->gradienttexture->unref();
 }
 
 
@@ -134,6 +142,19 @@ Cvr3DTexSubCube::setPalette(const CvrCLUT * newclut)
 }
 
 
+// Sets the texture with the gradients of the voxels of this subcube,
+// for shading an RGBA texture at fragment time.
+void
+Cvr3DTexSubCube::setGradientTexture(const CvrTextureObject * texobj)
+{
+  assert(!this->textureobject->isPaletted());
+
+  if (texobj) { texobj->ref(); }
+  if (this->gradienttexture) { this->gradienttexture->unref(); }
+  this->gradienttexture = texobj;
+}
+
+
 // *************************************************************************
 
 // FIXME: almost identical with 2DTexSubPage's ditto, should be
@@ -176,6 +197,40 @@ Cvr3DTexSubCube::deactivateCLUT(const SoGLRenderAction * action)
 }
 
 
+// Binds the gradient texture to texture unit 1, and sets up the
+// fragment program to light the RGBA texture on unit 0 with it.
+void
+Cvr3DTexSubCube::activateShading(const SoGLRenderAction * action)
+{
+  assert(this->gradienttexture != NULL);
+
+  const CvrLightingElement * lightelem = CvrLightingElement::getInstance(action->getState());
+  assert(lightelem != NULL);
+  SbVec3f lightDir;
+  float lightIntensity;
+  lightelem->get(action->getState(), lightDir, lightIntensity);
+  lightDir.normalize();
+
+  const cc_glglue * glue = cc_glglue_instance(action->getCacheContext());
+  // Unit #1 is also where the CLUT goes for paletted textures.
+  cc_glglue_glActiveTexture(glue, GL_TEXTURE1);
+  this->gradienttexture->activateTexture(action);
+  cc_glglue_glActiveTexture(glue, GL_TEXTURE0);
+
+  CvrCLUT::activateShading(action->getCacheContext());
+  cc_glglue_glProgramLocalParameter4f(glue, GL_FRAGMENT_PROGRAM_ARB, 1,
+                                      lightDir[0], lightDir[1], lightDir[2], lightIntensity);
+}
+
+
+void
+Cvr3DTexSubCube::deactivateShading(const SoGLRenderAction * action)
+{
+  const cc_glglue * glw = cc_glglue_instance(action->getCacheContext());
+  CvrCLUT::deactivateShading(glw);
+}
+
+
 // *************************************************************************
 
 // Check if this cube is intersected by a faceset.
@@ -381,7 +436,7 @@ Cvr3DTexSubCube::clipPolygonAgainstCube(void)
     // This resolves issue COINSUPPORT-1264.
     SbVec3s texdimsmodded = texdims;
     for (int i=0;i<3;++i) {
-      if (this->dimensions[i] < texdims[i])
+      if (this->texsize[i] < texdims[i])
         texdimsmodded[i] += 1;
     }      
     
@@ -389,10 +444,12 @@ Cvr3DTexSubCube::clipPolygonAgainstCube(void)
       this->clippoly.getVertex(i, vert);
       slice->vertex.append(vert);
       
+      // Scale from voxel units of the full resolution volume to
+      // texels, in case the texture is from a reduced level.
       const SbVec3f dist = vert - this->origo;
-      const SbVec3f v(dist[0] / texdimsmodded[0], 
-                      dist[1] / texdimsmodded[1], 
-                      dist[2] / texdimsmodded[2]);
+      const SbVec3f v(dist[0] * this->texsize[0] / this->dimensions[0] / texdimsmodded[0],
+                      dist[1] * this->texsize[1] / this->dimensions[1] / texdimsmodded[1],
+                      dist[2] * this->texsize[2] / this->dimensions[2] / texdimsmodded[2]);
 
       slice->texcoord.append(v);
     }
@@ -413,6 +470,7 @@ Cvr3DTexSubCube::renderSlices(const SoGLRenderAction * action, SbBool wireframe)
     // palette, or the previous palette will be used.
     this->textureobject->activateTexture(action);
     if (this->textureobject->isPaletted()) { this->activateCLUT(action); }
+    else if (this->gradienttexture) { this->activateShading(action); }
   }
 
   if (CvrUtil::dontModulateTextures()) // Is texture mod. disabled by an envvar?
@@ -449,6 +507,9 @@ Cvr3DTexSubCube::renderSlices(const SoGLRenderAction * action, SbBool wireframe)
   if (!wireframe && this->textureobject->isPaletted()) {
     this->deactivateCLUT(action);
   }
+  else if (!wireframe && this->gradienttexture) {
+    this->deactivateShading(action);
+  }
 }
 
 
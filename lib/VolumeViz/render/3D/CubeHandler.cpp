@@ -136,6 +136,9 @@ CvrCubeHandler::render(SoGLRenderAction * action, CvrCLUT::AlphaUse alphause, un
   float lightIntensity;
   lightelem->get(action->getState(), lightDir, lightIntensity);
   SbBool usePaletteTextures = CvrCLUT::usePaletteTextures(action);
+  // The light is baked into RGBA textures, unless they are shaded at
+  // fragment time.
+  const SbBool lightinrgba = !usePaletteTextures && !CvrCLUT::useFragmentShading(action);
 
   // Has the dataelement changed since last time?
   // FIXME: Is this test too strict? Not all components in the voxel
@@ -143,7 +146,7 @@ CvrCubeHandler::render(SoGLRenderAction * action, CvrCLUT::AlphaUse alphause, un
   // object (20040806 handegar)  
   if ((this->voxelblockelementnodeid != vbelem->getNodeId()) ||
       (this->lighting != lighting ||
-       (!usePaletteTextures && (this->lightDirection != lightDir || this->lightIntensity != lightIntensity))) ||
+       (lightinrgba && (this->lightDirection != lightDir || this->lightIntensity != lightIntensity))) ||
       (this->volumecube == NULL)){
     delete this->volumecube;
     this->clut = NULL;
@@ -155,7 +158,7 @@ CvrCubeHandler::render(SoGLRenderAction * action, CvrCLUT::AlphaUse alphause, un
   }
 
   const SoTransferFunctionElement * tfelement = SoTransferFunctionElement::getInstance(state);
-  const CvrCLUT * c = CvrVoxelChunk::getCLUT(tfelement, alphause);
+  const CvrCLUT * c = CvrVoxelChunk::getCLUT(tfelement, alphause, vbelem->getVoxelStore());
   if (this->clut != c) { this->setPalette(c); }
 
   // This must be done, as we want to control stuff in the GL state
@@ -261,7 +264,7 @@ CvrCubeHandler::renderObliqueSlice(SoGLRenderAction * action,
     case SoObliqueSlice::ALPHA_BINARY: clutalphause = CvrCLUT::ALPHA_BINARY; break;
     default: assert(0 && "invalid alphause value"); break;
   }
-  CvrCLUT * c = CvrVoxelChunk::getCLUT(tfelement, clutalphause);
+  CvrCLUT * c = CvrVoxelChunk::getCLUT(tfelement, clutalphause, vbelem->getVoxelStore());
   if (this->clut != c) {  
     this->setPalette(c);  
   }
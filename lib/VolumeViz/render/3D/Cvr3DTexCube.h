@@ -37,6 +37,7 @@
 #error this is a private header file
 #endif // !SIMVOLEON_INTERNAL
 
+#include <Inventor/SbBox3i32.h>
 #include <Inventor/SbVec3s.h>
 #include <VolumeViz/nodes/SoVolumeRender.h>
 
@@ -80,15 +81,16 @@ public:
 
 private:
   class Cvr3DTexSubCubeItem * getSubCube(SoState * state, unsigned int col, unsigned int row, unsigned int depth);
-  class Cvr3DTexSubCubeItem * buildSubCube(const SoGLRenderAction * action,
-                                           const SbVec3f & origo,
-                                           unsigned int col,
-                                           unsigned int row,
-                                           unsigned int depth);   
+  void buildSubCubes(const SoGLRenderAction * action,
+                     unsigned int startrow, unsigned int endrow,
+                     unsigned int startcol, unsigned int endcol,
+                     unsigned int startdepth, unsigned int enddepth);
+  SbBox3i32 calcSubCubeCut(unsigned int col, unsigned int row, unsigned int depth) const;
 
   void releaseAllSubCubes(void);
   void releaseSubCube(const unsigned int row, const unsigned int col, const unsigned int depth);
   unsigned int calcSubCubeIdx(unsigned int row, unsigned int col, unsigned int depth) const;
+  unsigned int calcSubCubeLevel(SoState * state, unsigned int col, unsigned int row, unsigned int depth) const;
   void renderResult(const SoGLRenderAction * action, 
                     SbList <Cvr3DTexSubCubeItem *> & subcubelist);
 
@@ -97,7 +99,7 @@ private:
   class Cvr3DTexSubCubeItem ** subcubes;
 
   SbVec3s subcubesize;
-  SbVec3s dimensions;
+  SbVec3i32 dimensions;
   SbVec3f origo;
 
   unsigned int nrcolumns;
@@ -33,7 +33,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 \**************************************************************************/
 
-#include <Inventor/SbVec3s.h>
+#include <Inventor/SbVec3i32.h>
 #include <Inventor/SbVec3f.h>
 #include <Inventor/SbPlane.h>
 #include <Inventor/lists/SbList.h>
@@ -53,7 +53,8 @@ public:
   Cvr3DTexSubCube(const SoGLRenderAction * action,
                   const CvrTextureObject * texobj,
                   const SbVec3f & cubeorigo,
-                  const SbVec3s & cubesize);
+                  const SbVec3i32 & cubesize,
+                  const SbVec3i32 & texsize);
   ~Cvr3DTexSubCube();
 
   void render(const SoGLRenderAction * action);
@@ -61,6 +62,7 @@ public:
   // FIXME: do these need to be private? Investigate. 20040716 mortene.
   SbBool isPaletted(void) const;
   void setPalette(const CvrCLUT * newclut);
+  void setGradientTexture(const CvrTextureObject * texobj);
 
   void intersectSlice(const SbVec3f * sliceplanecorners);
 
@@ -95,13 +97,18 @@ private:
 
   void activateCLUT(const SoGLRenderAction * action); 
   void deactivateCLUT(const SoGLRenderAction * action); 
+  void activateShading(const SoGLRenderAction * action);
+  void deactivateShading(const SoGLRenderAction * action);
  
   void clipPolygonAgainstCube(void);
 
   const CvrTextureObject * textureobject;
   const CvrCLUT * clut;
+  // gradients of RGBA textures shaded at fragment time, or NULL
+  const CvrTextureObject * gradienttexture;
 
-  SbVec3s dimensions;
+  SbVec3i32 dimensions;
+  SbVec3i32 texsize;
   SbVec3f origo;
 
   struct subcube_slice {
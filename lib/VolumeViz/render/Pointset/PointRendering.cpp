@@ -45,6 +45,7 @@
 
 #include "PointRendering.h"
 
+#include <Inventor/SbBox3i32.h>
 #include <Inventor/actions/SoGLRenderAction.h>
 
 #include <VolumeViz/elements/CvrVoxelBlockElement.h>
@@ -52,6 +53,7 @@
 #include <VolumeViz/misc/CvrCLUT.h>
 #include <VolumeViz/misc/CvrUtil.h>
 #include <VolumeViz/misc/CvrVoxelChunk.h>
+#include <VolumeViz/misc/CvrVoxelStore.h>
 #include <VolumeViz/nodes/SoTransferFunction.h>
 
 // *************************************************************************
@@ -65,14 +67,17 @@ PointRendering::render(SoGLRenderAction * action)
   assert(vbelem != NULL);
 
   const SoTransferFunctionElement * tfelement = SoTransferFunctionElement::getInstance(state);
-  CvrCLUT * clut = CvrVoxelChunk::getCLUT(tfelement, CvrCLUT::ALPHA_AS_IS);
+  CvrCLUT * clut = CvrVoxelChunk::getCLUT(tfelement, CvrCLUT::ALPHA_AS_IS,
+                                          vbelem->getVoxelStore());
 
-  const SbVec3s & dimension = vbelem->getVoxelCubeDimensions();
-  const void * data = vbelem->getVoxels();
-  
-  // FIXME: support 16-bit data. 20040220 mortene.
-  assert((vbelem->getBytesPrVoxel() == 1) && "unsupported datatype");
-  const uint8_t * voxels = (const uint8_t *)data;
+  const SbVec3i32 & dimension = vbelem->getVoxelCubeDimensions();
+  CvrVoxelStore * store = vbelem->getVoxelStore();
+  assert(store != NULL);
+
+  const unsigned int bytesprvoxel = store->getBytesPrVoxel();
+  const SoVolumeData::DataType datatype = store->getDataType();
+  double mapoffset, mapscale;
+  store->getIndexMapping(mapoffset, mapscale);
 
   glPushAttrib(GL_ALL_ATTRIB_BITS);
   glDisable(GL_TEXTURE_2D);
@@ -86,18 +91,26 @@ PointRendering::render(SoGLRenderAction * action)
   const unsigned int XYPAGEWIDTH = (unsigned int)dimension[0];
   const unsigned int XYPAGEHEIGHT = (unsigned int)dimension[1];
   const unsigned int STACKDEPTH = (unsigned int)dimension[2];
-  const unsigned int XYPAGESIZE = XYPAGEWIDTH * XYPAGEHEIGHT;
+  const size_t XYPAGESIZE = (size_t)XYPAGEWIDTH * XYPAGEHEIGHT;
 
   // FIXME: support the numslices setting. 20040222 mortene.
   // FIXME: support the abort callback from the public API. 20040222 mortene.
+  // Fetch one slice at a time from the voxel store, so we don't
+  // need the complete volume in memory.
+  uint8_t * voxels = new uint8_t[XYPAGESIZE * bytesprvoxel];
+
   for (unsigned int z=0; z < STACKDEPTH; z++) {
-    const unsigned int CURRENTDEPTH = z * XYPAGESIZE;
+    const SbBox3i32 slicebox(0, 0, (int32_t)z,
+                             dimension[0], dimension[1], (int32_t)(z + 1));
+    store->copyRegion(slicebox, voxels);
     // FIXME: the y-axis is rendered upside down versus 2D texture
     // rendering -- which one is correct? 20040222 mortene.
     for (unsigned int y=0; y < XYPAGEHEIGHT; y++) {
-      const unsigned int CURRENTPAGEPOSITION = y * XYPAGEWIDTH;
+      const size_t CURRENTPAGEPOSITION = (size_t)y * XYPAGEWIDTH;
       for (unsigned int x=0; x < XYPAGEWIDTH; x++) {
-        uint8_t colidx = voxels[CURRENTDEPTH + CURRENTPAGEPOSITION + x];
+        const unsigned int colidx =
+          CvrVoxelStore::voxelToIndex(voxels, CURRENTPAGEPOSITION + x, datatype,
+                                      mapoffset, mapscale);
         uint8_t rgba[4];
         clut->lookupRGBA(colidx, rgba);
         if (rgba[3] > 0x00) {
@@ -113,6 +126,8 @@ PointRendering::render(SoGLRenderAction * action)
 
   glEnd();
 
+  delete[] voxels;
+
   glPopAttrib();
 }
 
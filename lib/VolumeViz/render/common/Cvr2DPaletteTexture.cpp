@@ -72,8 +72,8 @@ Cvr2DPaletteTexture::~Cvr2DPaletteTexture()
 
 // *************************************************************************
 
-// Returns pointer to buffer with 8-bit indices. Allocates memory for
-// it if necessary.
+// Returns pointer to buffer with indices. Allocates memory for it if
+// necessary.
 uint8_t *
 Cvr2DPaletteTexture::getIndex8Buffer(void) const
 {
@@ -89,7 +89,7 @@ Cvr2DPaletteTexture::getIndex8Buffer(void) const
     // a crash from the OpenGL driver if left out, however, so it is
     // obviously needed (the crash seems to happen where a texture is
     // created from this memory buffer). should investigate. 20090812 mortene.
-    const size_t bufsize = (dim[0]+2) * (dim[1]+2);
+    const size_t bufsize = (size_t)(dim[0]+2) * (dim[1]+2) * this->indexsize;
     that->indexbuffer = new uint8_t[bufsize];
     // FIXME: suddenly, this was also needed, which was not the case
     // previously. should investigate why. 20090813 mortene.
@@ -115,17 +115,18 @@ Cvr2DPaletteTexture::blankUnused(const SbVec3s & texsize) const
   assert(texsize[2] == 1);
 
   const SbVec3s texobjdims = this->getDimensions();
+  const unsigned int n = this->indexsize;
   {
     for (short y=texsize[1]+2; y < texobjdims[1]+2; y++) {
       for (short x=0; x < texobjdims[0]+2; x++) {
-        this->indexbuffer[y * (texobjdims[0]+2) + x] = 0x00;
+        (void)memset(&this->indexbuffer[(y * (texobjdims[0]+2) + x) * n], 0x00, n);
       }
     }
   }
   {
     for (short x=texsize[0]+2; x < texobjdims[0]+2; x++) {
       for (short y=0; y < texobjdims[1]+2; y++) {
-        this->indexbuffer[y * (texobjdims[0]+2) + x] = 0x00;
+        (void)memset(&this->indexbuffer[(y * (texobjdims[0]+2) + x) * n], 0x00, n);
       }
     }
   }
@@ -0,0 +1,111 @@
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+#include <VolumeViz/render/common/Cvr3DGradientTexture.h>
+
+#include <assert.h>
+#include <string.h>
+#include <Inventor/SbName.h>
+
+// *************************************************************************
+
+// Don't set value explicitly to SoType::badType(), to avoid a bug in
+// Sun CC v4.0. (Bitpattern 0x0000 equals SoType::badType()).
+SoType Cvr3DGradientTexture::classTypeId;
+
+SoType Cvr3DGradientTexture::getTypeId(void) const { return Cvr3DGradientTexture::classTypeId; }
+SoType Cvr3DGradientTexture::getClassTypeId(void) { return Cvr3DGradientTexture::classTypeId; }
+
+void * Cvr3DGradientTexture::createInstance(void) { return new Cvr3DGradientTexture; }
+
+// *************************************************************************
+
+void
+Cvr3DGradientTexture::initClass(void)
+{
+  assert(Cvr3DGradientTexture::classTypeId == SoType::badType());
+  Cvr3DGradientTexture::classTypeId =
+    SoType::createType(Cvr3DRGBATexture::getClassTypeId(), "Cvr3DGradientTexture",
+                       Cvr3DGradientTexture::createInstance);
+}
+
+Cvr3DGradientTexture::Cvr3DGradientTexture(void)
+{
+  assert(Cvr3DGradientTexture::classTypeId != SoType::badType());
+}
+
+Cvr3DGradientTexture::~Cvr3DGradientTexture()
+{
+}
+
+// *************************************************************************
+
+// Returns the number of 8-bit components of each texel, which holds
+// the range compressed gradient vector only.
+unsigned int
+Cvr3DGradientTexture::getNrOfComponents(void)
+{
+  return 3;
+}
+
+// Returns pointer to buffer with getNrOfComponents()-component
+// texels. Allocates memory for it if necessary, cleared to zero.
+//
+// The buffer is allocated as 32-bit words, as it is deallocated as
+// such by CvrRGBATexture. The 3D texture dimensions are powers of two
+// of at least 4, so the rows need no padding for the default
+// GL_UNPACK_ALIGNMENT.
+uint32_t *
+Cvr3DGradientTexture::getRGBABuffer(void) const
+{
+  if (this->rgbabuffer == NULL) {
+    // Cast away constness.
+    Cvr3DGradientTexture * that = (Cvr3DGradientTexture *)this;
+    const SbVec3s dims = this->getDimensions();
+    const size_t nrbytes = (size_t)dims[0] * dims[1] * dims[2] *
+      Cvr3DGradientTexture::getNrOfComponents();
+    const size_t nrwords = (nrbytes + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+    that->rgbabuffer = new uint32_t[nrwords];
+    (void)memset(that->rgbabuffer, 0, nrwords * sizeof(uint32_t));
+  }
+
+  return this->rgbabuffer;
+}
+
+// Empty, as the buffer is cleared when allocated, and only the used
+// part is written to by CvrVoxelChunk::transferGradients().
+void
+Cvr3DGradientTexture::blankUnused(const SbVec3s & texsize) const
+{
+}
+
+// *************************************************************************
@@ -0,0 +1,69 @@
+#ifndef SIMVOLEON_CVR3DGRADIENTTEXTURE_H
+#define SIMVOLEON_CVR3DGRADIENTTEXTURE_H
+
+/**************************************************************************\
+ * Copyright (c) Kongsberg Oil & Gas Technologies AS
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+\**************************************************************************/
+
+#include <VolumeViz/render/common/Cvr3DRGBATexture.h>
+
+
+// The gradients of a 3D cut, range compressed to the components of
+// an RGB texture. Used with RGBA textures which are shaded at
+// fragment time, see CvrCLUT::useFragmentShading().
+//
+// The buffer from getRGBABuffer() has getNrOfComponents() bytes per
+// texel, not four as for the other CvrRGBATexture classes.
+
+class Cvr3DGradientTexture : public Cvr3DRGBATexture {
+  typedef Cvr3DRGBATexture inherited;
+
+public:
+  static void initClass(void);
+
+  virtual SoType getTypeId(void) const;
+  static SoType getClassTypeId(void);
+
+  virtual uint32_t * getRGBABuffer(void) const;
+  virtual void blankUnused(const SbVec3s & texsize) const;
+
+  static unsigned int getNrOfComponents(void);
+
+protected:
+  Cvr3DGradientTexture(void);
+  virtual ~Cvr3DGradientTexture();
+
+private:
+  static SoType classTypeId;
+  static void * createInstance(void);
+};
+
+#endif // !SIMVOLEON_CVR3DGRADIENTTEXTURE_H
@@ -36,6 +36,7 @@
 #include <stdlib.h>
 #include <Inventor/SbName.h>
 #include <VolumeViz/misc/CvrCLUT.h>
+#include <VolumeViz/misc/CvrUtil.h>
 
 // *************************************************************************
 
@@ -71,8 +72,19 @@ Cvr3DPaletteGradientTexture::~Cvr3DPaletteGradientTexture()
 
 // *************************************************************************
 
-// Returns pointer to buffer with 32-bit indices. Allocates memory for
-// it if necessary.
+// Returns the number of components of each texel: the palette index
+// followed by either the three gradient vector components, or the
+// two octahedral-mapped normal components when compact normals are
+// used.
+unsigned int
+Cvr3DPaletteGradientTexture::getNrOfComponents(void)
+{
+  return CvrUtil::useCompactNormals() ? 3 : 4;
+}
+
+// Returns pointer to buffer with getNrOfComponents()-component
+// texels, each component being getIndexSize() bytes wide. Allocates
+// memory for it if necessary.
 uint8_t *
 Cvr3DPaletteGradientTexture::getIndex8Buffer(void) const
 {
@@ -82,7 +94,9 @@ Cvr3DPaletteGradientTexture::getIndex8Buffer(void) const
     const SbVec3s dims = this->getDimensions();
     // FIXME: what is calloc()'ed here is probably delete'd somewhere
     // else, which is not good. Fix. 20050628 mortene.
-    that->indexbuffer = (uint8_t *) calloc((size_t)dims[0] * dims[1] * dims[2], sizeof(uint8_t) * 4);
+    const unsigned int nrcomponents = Cvr3DPaletteGradientTexture::getNrOfComponents();
+    that->indexbuffer = (uint8_t *) calloc((size_t)dims[0] * dims[1] * dims[2],
+                                           this->indexsize * nrcomponents);
     //that->indexbuffer = new uint8_t[dims[0] * dims[1] * dims[2] * 4];
     //for (int i=0; i < dims[0] * dims[1] * dims[2] * 4; i++) that->indexbuffer[i] = 0;
   }
@@ -51,6 +51,8 @@ public:
   virtual uint8_t * getIndex8Buffer(void) const;
   virtual void blankUnused(const SbVec3s & texsize) const;
 
+  static unsigned int getNrOfComponents(void);
+
 protected:
   Cvr3DPaletteGradientTexture(void);
   virtual ~Cvr3DPaletteGradientTexture();
@@ -33,6 +33,7 @@
 #include <VolumeViz/render/common/Cvr3DPaletteTexture.h>
 
 #include <assert.h>
+#include <string.h>
 #include <Inventor/SbName.h>
 #include <VolumeViz/misc/CvrCLUT.h>
 
@@ -70,8 +71,8 @@ Cvr3DPaletteTexture::~Cvr3DPaletteTexture()
 
 // *************************************************************************
 
-// Returns pointer to buffer with 8-bit indices. Allocates memory for
-// it if necessary.
+// Returns pointer to buffer with indices. Allocates memory for it if
+// necessary.
 uint8_t *
 Cvr3DPaletteTexture::getIndex8Buffer(void) const
 {
@@ -79,7 +80,7 @@ Cvr3DPaletteTexture::getIndex8Buffer(void) const
     // Cast away constness.
     Cvr3DPaletteTexture * that = (Cvr3DPaletteTexture *)this;
     const SbVec3s dims = this->getDimensions();
-    that->indexbuffer = new uint8_t[dims[0] * dims[1] * dims[2]];
+    that->indexbuffer = new uint8_t[(size_t)dims[0] * dims[1] * dims[2] * this->indexsize];
   }
 
   return this->indexbuffer;
@@ -94,12 +95,13 @@ Cvr3DPaletteTexture::blankUnused(const SbVec3s & texsize) const
   unsigned short x, y, z;
 
   const SbVec3s dims = this->getDimensions();
+  const unsigned int n = this->indexsize;
 
   // Bottom 'slab'
   for (z=texsize[2]; z < dims[2]; z++) {
     for (x=0;x<dims[0];++x) {
       for (y=0;y<dims[1];++y) {
-        this->indexbuffer[(z * dims[0] * dims[1]) + (y * dims[0]) + x] = 0x00;
+        (void)memset(&this->indexbuffer[((z * dims[0] * dims[1]) + (y * dims[0]) + x) * n], 0x00, n);
       }
     }
   }
@@ -108,7 +110,7 @@ Cvr3DPaletteTexture::blankUnused(const SbVec3s & texsize) const
   for (z=0;z<texsize[2];++z) {
     for (x=0;x<texsize[0];++x) {
       for (y=texsize[1];y<dims[1];++y) {
-        this->indexbuffer[(z * dims[0] * dims[1]) + (y * dims[0]) + x] = 0x00;
+        (void)memset(&this->indexbuffer[((z * dims[0] * dims[1]) + (y * dims[0]) + x) * n], 0x00, n);
       }
     }
   }
@@ -117,7 +119,7 @@ Cvr3DPaletteTexture::blankUnused(const SbVec3s & texsize) const
   for (z=0;z<texsize[2];++z) {
     for (x=texsize[0];x<dims[0];++x) {
       for (y=0;y<dims[1];++y) {
-        this->indexbuffer[(z * dims[0] * dims[1]) + (y * dims[0]) + x] = 0x00;
+        (void)memset(&this->indexbuffer[((z * dims[0] * dims[1]) + (y * dims[0]) + x) * n], 0x00, n);
       }
     }
   }
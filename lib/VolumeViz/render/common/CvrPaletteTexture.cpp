@@ -59,6 +59,7 @@ CvrPaletteTexture::CvrPaletteTexture(void)
 {
   assert(CvrPaletteTexture::classTypeId != SoType::badType());
   this->indexbuffer = NULL;
+  this->indexsize = 1;
   this->clut = NULL;
 }
 
@@ -70,13 +71,40 @@ CvrPaletteTexture::~CvrPaletteTexture()
 
 // *************************************************************************
 
-// Returns pointer to buffer with 8-bit indices.
+// Returns pointer to buffer with indices. Each index is
+// getIndexSize() bytes wide.
 uint8_t *
 CvrPaletteTexture::getIndex8Buffer(void) const
 {
   return this->indexbuffer;
 }
 
+// Returns the index buffer casted to the correct size. Don't use this
+// method unless there are two bytes pr index.
+uint16_t *
+CvrPaletteTexture::getIndex16Buffer(void) const
+{
+  assert(this->indexsize == 2);
+  return (uint16_t *)this->getIndex8Buffer();
+}
+
+// Set the number of bytes pr index, 1 for 8-bit voxel data or 2 for
+// 16-bit voxel data. Must be done before the index buffer is
+// allocated.
+void
+CvrPaletteTexture::setIndexSize(const unsigned int nrbytes)
+{
+  assert(nrbytes == 1 || nrbytes == 2);
+  assert(this->indexbuffer == NULL);
+  this->indexsize = nrbytes;
+}
+
+unsigned int
+CvrPaletteTexture::getIndexSize(void) const
+{
+  return this->indexsize;
+}
+
 // *************************************************************************
 
 void
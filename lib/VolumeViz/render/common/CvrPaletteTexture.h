@@ -48,6 +48,10 @@ public:
   static SoType getClassTypeId(void);
 
   virtual uint8_t * getIndex8Buffer(void) const;
+  uint16_t * getIndex16Buffer(void) const;
+
+  void setIndexSize(const unsigned int nrbytes);
+  unsigned int getIndexSize(void) const;
 
   void setCLUT(const CvrCLUT * table);
   const CvrCLUT * getCLUT(void) const;
@@ -59,6 +63,7 @@ protected:
   virtual ~CvrPaletteTexture();
 
   uint8_t * indexbuffer;
+  unsigned int indexsize;
 
 private:
   const CvrCLUT * clut;
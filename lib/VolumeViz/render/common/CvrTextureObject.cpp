@@ -41,7 +41,8 @@
 
 #include <Inventor/C/glue/gl.h>
 #include <Inventor/C/tidbits.h>
-#include <Inventor/SbBox2s.h>
+#include <Inventor/SbBox2i32.h>
+#include <Inventor/SbBox3i32.h>
 #include <Inventor/SbName.h>
 #include <Inventor/SbVec2s.h>
 #include <Inventor/actions/SoGLRenderAction.h>
@@ -53,13 +54,17 @@
 #include <VolumeViz/elements/CvrGLInterpolationElement.h>
 #include <VolumeViz/elements/CvrVoxelBlockElement.h>
 #include <VolumeViz/elements/CvrLightingElement.h>
+#include <VolumeViz/elements/CvrSubSamplingElement.h>
 #include <VolumeViz/misc/CvrCLUT.h>
+#include <VolumeViz/misc/CvrParallel.h>
 #include <VolumeViz/misc/CvrUtil.h>
 #include <VolumeViz/misc/CvrVoxelChunk.h>
+#include <VolumeViz/misc/CvrVoxelStore.h>
 #include <VolumeViz/render/common/Cvr2DRGBATexture.h>
 #include <VolumeViz/render/common/Cvr2DPaletteTexture.h>
 #include <VolumeViz/render/common/Cvr3DRGBATexture.h>
 #include <VolumeViz/render/common/Cvr3DPaletteTexture.h>
+#include <VolumeViz/render/common/Cvr3DGradientTexture.h>
 #include <VolumeViz/render/common/Cvr3DPaletteGradientTexture.h>
 
 // *************************************************************************
@@ -168,6 +173,7 @@ CvrTextureObject::initClass(void)
   Cvr3DRGBATexture::initClass();
   Cvr3DPaletteTexture::initClass();
   Cvr3DPaletteGradientTexture::initClass();
+  Cvr3DGradientTexture::initClass();
 
   // FIXME: leak, never deallocated. 20040721 mortene.
   CvrTextureObject::instancedict = new SbDict;
@@ -178,6 +184,9 @@ CvrTextureObject::CvrTextureObject(void)
 {
   assert(CvrTextureObject::classTypeId != SoType::badType());
   this->refcounter = 0;
+  this->eqcmp.clut = NULL;
+  this->updateserial = 0;
+  this->version = 0;
 }
 
 
@@ -216,6 +225,8 @@ CvrTextureObject::~CvrTextureObject()
     const SbBool ok = CvrTextureObject::instancedict->remove(key);
     assert(ok);
   }
+
+  if (this->eqcmp.clut) { this->eqcmp.clut->unref(); }
 }
 
 
@@ -343,7 +354,18 @@ GLuint
 CvrTextureObject::getGLTexture(const SoGLRenderAction * action) const
 {
   GLuint texid;
-  if (this->findGLTexture(action, texid)) { return texid; }
+  if (this->findGLTexture(action, texid)) {
+    // Upload the voxels changed by SoVolumeData::updateRegions() into
+    // the existing texture.
+    void * ptr;
+    const unsigned long glctx = (unsigned long)action->getCacheContext();
+    if (this->glctxversions.find(glctx, ptr) &&
+        ((unsigned int)(uintptr_t)ptr != this->version)) {
+      this->updateGLTexture(action, texid);
+      ((CvrTextureObject *)this)->glctxversions.enter(glctx, (void *)(uintptr_t)this->version);
+    }
+    return texid;
+  }
 
   SoState * state = action->getState();
 
@@ -357,6 +379,9 @@ CvrTextureObject::getGLTexture(const SoGLRenderAction * action) const
   assert(lightelem != NULL);
   const SbBool lighting = lightelem->useLighting(action->getState());
 
+  GLenum gltextureformat, gltexturetype;
+  this->getGLPixelFormat(action, gltextureformat, gltexturetype);
+
   // FIXME: in SoAsciiText, pederb uses this right after making a
   // cache -- what does this do?:
   //
@@ -450,20 +475,7 @@ CvrTextureObject::getGLTexture(const SoGLRenderAction * action) const
   if (this->isPaletted()) imgptr = ((CvrPaletteTexture *)this)->getIndex8Buffer();
   else imgptr = ((CvrRGBATexture *)this)->getRGBABuffer();
 
-
-  GLenum gltextureformat = GL_COLOR_INDEX;
-  if (this->isPaletted() && CvrCLUT::useFragmentProgramLookup(glw)) {
-    if (lighting) {
-      // Trick: use larger texture, to store the gradient, for access
-      // from the fragment program(s). We're then using a 4-component
-      // texture to store a luminance component plus 3 8-bits
-      // vector-components for the gradient vector.
-      gltextureformat = GL_RGBA;
-    }
-    else {
-      gltextureformat = GL_LUMINANCE;
-    }
-  }
+  const SbBool index16 = (gltexturetype == GL_UNSIGNED_SHORT);
 
   // NOTE: Combining texture compression and GL_COLOR_INDEX doesn't
   // seem to work on NVIDIA cards (tested on GeForceFX 5600 &
@@ -490,7 +502,20 @@ CvrTextureObject::getGLTexture(const SoGLRenderAction * action) const
   // FIXME: because of the store-gradient-in-texture trick, lighting
   // only works if we can do paletted textures -- is this checked
   // anywhere? Should ask kristian (or audit the code). 20050602 mortene.
-  if (lighting) { internalFormat = GL_RGBA; }
+  //
+  // With compact normals, the gradient is instead stored as two
+  // octahedral-mapped components, see
+  // Cvr3DPaletteGradientTexture::getNrOfComponents().
+  if (lighting && (gltextureformat == GL_RGB)) { internalFormat = index16 ? GL_RGB16 : GL_RGB8; }
+  else if (lighting) { internalFormat = index16 ? GL_RGBA16 : GL_RGBA; }
+  else if (index16) { internalFormat = GL_LUMINANCE16; }
+
+  // The gradients for fragment shading only need the three
+  // components, and are not compressed, as that would distort the
+  // normals.
+  if (this->getTypeId() == Cvr3DGradientTexture::getClassTypeId()) {
+    internalFormat = GL_RGB8;
+  }
 
   // By default we modulate textures with the material settings.
   if (!CvrUtil::dontModulateTextures()) {
@@ -536,8 +561,8 @@ CvrTextureObject::getGLTexture(const SoGLRenderAction * action) const
                  internalFormat,
                  texdims[0]+2*border, texdims[1]+2*border,
                  border,
-                 this->isPaletted() ? gltextureformat : GL_RGBA,
-                 GL_UNSIGNED_BYTE,
+                 gltextureformat,
+                 gltexturetype,
                  imgptr);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
   }
@@ -549,8 +574,8 @@ CvrTextureObject::getGLTexture(const SoGLRenderAction * action) const
                            internalFormat,
                            texdims[0], texdims[1], texdims[2],
                            0,
-                           this->isPaletted() ? gltextureformat : GL_RGBA,
-                           GL_UNSIGNED_BYTE,
+                           gltextureformat,
+                           gltexturetype,
                            imgptr);
   }
 
@@ -568,22 +593,24 @@ CvrTextureObject::getGLTexture(const SoGLRenderAction * action) const
       if (nrtexdims == 2) {
         SoDebugError::postWarning("CvrTextureObject::getGLTexture",
                                   "error came from "
-                                  "glTexImage2D(0x%x, 0, 0x%x, %d, %d, 0, 0x%x, GL_UNSIGNED_BYTE, %p)",
+                                  "glTexImage2D(0x%x, 0, 0x%x, %d, %d, 0, 0x%x, 0x%x, %p)",
                                   gltextypeenum,
                                   internalFormat,
                                   texdims[0], texdims[1],
-                                  this->isPaletted() ? gltextureformat : GL_RGBA,
+                                  gltextureformat,
+                                  gltexturetype,
                                   imgptr);
       }
       else {
         assert(nrtexdims == 3);
         SoDebugError::postWarning("CvrTextureObject::getGLTexture",
                                   "error came from "
-                                  "glTexImage3D(0x%x, 0, 0x%x, %d, %d, %d, 0, 0x%x, GL_UNSIGNED_BYTE, %p)",
+                                  "glTexImage3D(0x%x, 0, 0x%x, %d, %d, %d, 0, 0x%x, 0x%x, %p)",
                                   gltextypeenum,
                                   internalFormat,
                                   texdims[0], texdims[1], texdims[2],
-                                  this->isPaletted() ? gltextureformat : GL_RGBA,
+                                  gltextureformat,
+                                  gltexturetype,
                                   imgptr);
       }
     }
@@ -598,6 +625,8 @@ CvrTextureObject::getGLTexture(const SoGLRenderAction * action) const
     ((CvrTextureObject *)this)->glctxdict.enter((unsigned long)glctxid, l);
   }
   l->append(cache);
+  ((CvrTextureObject *)this)->glctxversions.enter((unsigned long)glctxid,
+                                                  (void *)(uintptr_t)this->version);
 
   state->pop();
   SoCacheElement::setInvalid(storedinvalid);
@@ -606,6 +635,112 @@ CvrTextureObject::getGLTexture(const SoGLRenderAction * action) const
 }
 
 
+// The format and type of the texture buffer, as passed on to
+// glTex[Sub]Image[2|3]D().
+void
+CvrTextureObject::getGLPixelFormat(const SoGLRenderAction * action,
+                                   GLenum & format, GLenum & type) const
+{
+  format = GL_RGBA;
+  type = GL_UNSIGNED_BYTE;
+  if (this->getTypeId() == Cvr3DGradientTexture::getClassTypeId()) {
+    assert(Cvr3DGradientTexture::getNrOfComponents() == 3);
+    format = GL_RGB;
+  }
+  if (!this->isPaletted()) { return; }
+
+  const cc_glglue * glw = cc_glglue_instance(action->getCacheContext());
+
+  // 16-bit voxel data is uploaded as 16-bit indices, which will be
+  // looked up in a correspondingly larger CLUT by the fragment
+  // program.
+  const SbBool index16 = (((CvrPaletteTexture *)this)->getIndexSize() == 2);
+  assert(!index16 || CvrCLUT::useFragmentProgramLookup(glw));
+  if (index16) { type = GL_UNSIGNED_SHORT; }
+
+  format = GL_COLOR_INDEX;
+  if (CvrCLUT::useFragmentProgramLookup(glw)) {
+    const CvrLightingElement * lightelem = CvrLightingElement::getInstance(action->getState());
+    assert(lightelem != NULL);
+    if (lightelem->useLighting(action->getState())) {
+      // Trick: use larger texture, to store the gradient, for access
+      // from the fragment program(s). We're then using a 4-component
+      // texture to store a luminance component plus 3 8-bits
+      // vector-components for the gradient vector -- or only 2
+      // components for it, if it is stored octahedral-mapped.
+      format = (Cvr3DPaletteGradientTexture::getNrOfComponents() == 3) ? GL_RGB : GL_RGBA;
+    }
+    else {
+      format = GL_LUMINANCE;
+    }
+  }
+}
+
+
+// Replaces the contents of an already uploaded texture with the
+// texture buffer, without reallocating it in the GL driver.
+void
+CvrTextureObject::updateGLTexture(const SoGLRenderAction * action,
+                                  const GLuint texid) const
+{
+  const cc_glglue * glw = cc_glglue_instance(action->getCacheContext());
+
+  GLenum format, type;
+  this->getGLPixelFormat(action, format, type);
+
+  void * imgptr = NULL;
+  if (this->isPaletted()) imgptr = ((CvrPaletteTexture *)this)->getIndex8Buffer();
+  else imgptr = ((CvrRGBATexture *)this)->getRGBABuffer();
+
+  const SbVec3s texdims = this->getDimensions();
+  const unsigned short nrtexdims = this->getNrOfTextureDimensions();
+  const GLenum gltextypeenum = (nrtexdims == 2) ? GL_TEXTURE_2D : GL_TEXTURE_3D;
+  glBindTexture(gltextypeenum, texid);
+
+  // Drivers are only required to support sub-image updates of
+  // compressed textures on block boundaries, so these are respecified
+  // as a whole.
+  GLint compressed = GL_FALSE;
+  if (!this->isPaletted() && cc_glue_has_texture_compression(glw)) {
+    glGetTexLevelParameteriv(gltextypeenum, 0, GL_TEXTURE_COMPRESSED_ARB, &compressed);
+  }
+
+  if (nrtexdims == 2) {
+    // The border is included, starting at offset -1.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (compressed) {
+      glTexImage2D(gltextypeenum, 0, GL_COMPRESSED_RGBA_ARB,
+                   texdims[0] + 2, texdims[1] + 2, 1, format, type, imgptr);
+    }
+    else {
+      glTexSubImage2D(gltextypeenum, 0, -1, -1, texdims[0] + 2, texdims[1] + 2,
+                      format, type, imgptr);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  }
+  else {
+    if (compressed) {
+      cc_glglue_glTexImage3D(glw, gltextypeenum, 0, GL_COMPRESSED_RGBA_ARB,
+                             texdims[0], texdims[1], texdims[2], 0,
+                             format, type, imgptr);
+    }
+    else {
+      cc_glglue_glTexSubImage3D(glw, gltextypeenum, 0, 0, 0, 0,
+                                texdims[0], texdims[1], texdims[2],
+                                format, type, imgptr);
+    }
+  }
+
+#if CVR_DEBUG
+  if (cvr_debug_textureuse()) {
+    SoDebugError::postInfo("CvrTextureObject::updateGLTexture",
+                           "updated texture %u in GL context %u",
+                           texid, action->getCacheContext());
+  }
+#endif // debug
+}
+
+
 // *************************************************************************
 
 
@@ -657,52 +792,301 @@ CvrTextureObject::findInstanceMatch(const SoType t,
 }
 
 
+// A texture object being made by build(). Set up from the traversal
+// thread by prepare(), and filled in from the worker threads.
+struct CvrTextureObject::Build {
+  // arguments of the common create():
+  SbVec3s texsize;
+  SbBox3i32 cutcube;
+  SbBox2i32 cutslice;
+  unsigned int axisidx;
+  int pageidx;
+  unsigned int level;
+  // make the gradient texture of the cut, see createGradients()
+  SbBool gradients;
+
+  // the resulting texture object, if already made
+  CvrTextureObject * result;
+  // index of an earlier build of the same batch making the same
+  // texture object, or -1
+  int sameas;
+
+  // set for texture objects to be made:
+  CvrTextureObject * newtexobj;
+  struct EqualityComparison cmp;
+  unsigned int updateserial;
+  CvrVoxelStore * store;
+  CvrVoxelChunk * chunk;
+};
+
+// A range of slices of the chunk of a build, transferred to texels by
+// one job.
+struct CvrTextureObject::Slab {
+  unsigned int buildidx;
+  unsigned int firstslice, endslice;
+  SbBool invisible;
+};
+
+struct CvrTextureObject::Batch {
+  Build * builds;
+  SbList<unsigned int> pending;
+  SbList<Slab> slabs;
+  const CvrCLUT * clut;
+  CvrVoxelChunk::TransferInfo info;
+};
+
+// Chunks are not split into slabs thinner than this.
+static const unsigned int CVR_MIN_SLAB_SLICES = 8;
+
 /*! Returns an instance which embodies a chunk of voxels out of the
     current SoVolumeData on the state stack, as given by the \a
     cutcube argument.
 
+    \a cutcube is always given in full resolution voxel coordinates,
+    even when \a level asks for the texture to be made from a reduced
+    resolution level of the volume.
+
     Automatically takes care of sharing if an instance was already
     made to the same specifications.
 */
 const CvrTextureObject *
 CvrTextureObject::create(const SoGLRenderAction * action,
                          const CvrCLUT * clut,
-                         const SbBox3s & cutcube)
+                         const SbBox3i32 & cutcube,
+                         const unsigned int level)
 {
-  const SbVec3s texsize(cutcube.getMax() - cutcube.getMin());
-  const SbBox2s dummy; // constructor initializes it to an empty box
-  return CvrTextureObject::create(action, clut, texsize, cutcube, dummy, UINT_MAX, INT_MAX);
+  const CvrTextureObject * result;
+  CvrTextureObject::create(action, clut, 1, &cutcube, &level, &result);
+  return result;
 }
 
 
+// Makes the texture objects for \a nr cuts at once, as by the
+// create() call above. The voxels of the cuts are read and
+// transferred to texels by several threads. Results are set in \a
+// result.
+void
+CvrTextureObject::create(const SoGLRenderAction * action,
+                         const CvrCLUT * clut,
+                         const unsigned int nr,
+                         const SbBox3i32 * cutcubes,
+                         const unsigned int * levels,
+                         const CvrTextureObject ** result)
+{
+  Build * builds = new Build[nr];
+  for (unsigned int i = 0; i < nr; i++) {
+    Build & b = builds[i];
+    const SbBox3i32 levelcut = CvrVoxelStore::getLevelRegion(cutcubes[i], levels[i]);
+    b.texsize = CvrUtil::toVec3s(levelcut.getMax() - levelcut.getMin());
+    b.cutcube = levelcut;
+    b.cutslice = SbBox2i32(); // constructor initializes it to an empty box
+    b.axisidx = UINT_MAX;
+    b.pageidx = INT_MAX;
+    b.level = levels[i];
+    b.gradients = FALSE;
+  }
+
+  CvrTextureObject::build(action, clut, nr, builds);
+  for (unsigned int i = 0; i < nr; i++) { result[i] = builds[i].result; }
+  delete[] builds;
+}
+
+
+// Makes the Cvr3DGradientTexture instances for \a nr cuts, to go
+// with the RGBA textures of the same cuts when these are shaded at
+// fragment time (see CvrCLUT::useFragmentShading()). They don't
+// depend on the transfer function, so are shared between all RGBA
+// textures of a cut.
+void
+CvrTextureObject::createGradients(const SoGLRenderAction * action,
+                                  const unsigned int nr,
+                                  const SbBox3i32 * cutcubes,
+                                  const unsigned int * levels,
+                                  const CvrTextureObject ** result)
+{
+  Build * builds = new Build[nr];
+  for (unsigned int i = 0; i < nr; i++) {
+    Build & b = builds[i];
+    const SbBox3i32 levelcut = CvrVoxelStore::getLevelRegion(cutcubes[i], levels[i]);
+    b.texsize = CvrUtil::toVec3s(levelcut.getMax() - levelcut.getMin());
+    b.cutcube = levelcut;
+    b.cutslice = SbBox2i32(); // constructor initializes it to an empty box
+    b.axisidx = UINT_MAX;
+    b.pageidx = INT_MAX;
+    b.level = levels[i];
+    b.gradients = TRUE;
+  }
+
+  CvrTextureObject::build(action, NULL, nr, builds);
+  for (unsigned int i = 0; i < nr; i++) { result[i] = builds[i].result; }
+  delete[] builds;
+}
+
+
+// For 2D textures, \a texsize, \a cutslice and \a pageidx are all
+// given in full resolution voxel coordinates.
 const CvrTextureObject *
 CvrTextureObject::create(const SoGLRenderAction * action,
                          const CvrCLUT * clut,
                          const SbVec2s & texsize,
-                         const SbBox2s & cutslice,
+                         const SbBox2i32 & cutslice,
                          const unsigned int axisidx,
-                         const int pageidx)
+                         const int pageidx,
+                         const unsigned int level)
 {
+  const CvrTextureObject * result;
+  CvrTextureObject::create(action, clut, 1, &texsize, &cutslice, axisidx, pageidx,
+                           &level, &result);
+  return result;
+}
+
+
+// Makes the texture objects for \a nr cuts of the same page at once,
+// as by the create() call above.
+void
+CvrTextureObject::create(const SoGLRenderAction * action,
+                         const CvrCLUT * clut,
+                         const unsigned int nr,
+                         const SbVec2s * texsizes,
+                         const SbBox2i32 * cutslices,
+                         const unsigned int axisidx,
+                         const int pageidx,
+                         const unsigned int * levels,
+                         const CvrTextureObject ** result)
+{
+  const CvrVoxelBlockElement * vbelem = CvrVoxelBlockElement::getInstance(action->getState());
+  assert(vbelem != NULL);
 
-  const SbVec3s tex(texsize[0], texsize[1], 1);
+  Build * builds = new Build[nr];
+  for (unsigned int i = 0; i < nr; i++) {
+    Build & b = builds[i];
+    const unsigned int level = levels[i];
+
+    // Convert to coordinates within the reduced level. Neighbouring
+    // pages will map to the same page at the level, so they will also
+    // share the same texture object.
+    const SbVec3i32 leveldims =
+      CvrVoxelStore::getLevelDimensions(vbelem->getVoxelCubeDimensions(), level);
+    const int levelpage = SbMin(pageidx >> level, leveldims[axisidx] - 1);
+
+    const SbVec2i32 & smin = cutslices[i].getMin();
+    const SbVec2i32 & smax = cutslices[i].getMax();
+    const SbBox3i32 levelcut =
+      CvrVoxelStore::getLevelRegion(SbBox3i32(smin[0], smin[1], 0, smax[0], smax[1], 1), level);
+    const SbBox2i32 levelslice(levelcut.getMin()[0], levelcut.getMin()[1],
+                               levelcut.getMax()[0], levelcut.getMax()[1]);
+
+    SbVec3s tex(texsizes[i][0], texsizes[i][1], 1);
+    if (level > 0) {
+      tex[0] = (short)(levelslice.getMax()[0] - levelslice.getMin()[0]);
+      tex[1] = (short)(levelslice.getMax()[1] - levelslice.getMin()[1]);
+    }
 
-  const SbBox3s dummy; // constructor initializes it to an empty box
+    b.texsize = tex;
+    b.cutcube = SbBox3i32(); // constructor initializes it to an empty box
+    b.cutslice = levelslice;
+    b.axisidx = axisidx;
+    b.pageidx = levelpage;
+    b.level = level;
+    b.gradients = FALSE;
+  }
 
-  return CvrTextureObject::create(action, clut, tex, dummy, cutslice, axisidx, pageidx);
+  CvrTextureObject::build(action, clut, nr, builds);
+  for (unsigned int i = 0; i < nr; i++) { result[i] = builds[i].result; }
+  delete[] builds;
 }
 
 
 // The common create function, used for both 2D and 3D cuts of the
-// volume.
-CvrTextureObject *
-CvrTextureObject::create(const SoGLRenderAction * action,
-                         const CvrCLUT * clut,
-                         /* common: */ const SbVec3s & texsize,
-                         /* 3D only: */ const SbBox3s & cutcube,
-                         /* 2D only: */ const SbBox2s & cutslice, 
-                         const unsigned int axisidx, 
-                         const int pageidx)
+// volume, and for any number of cuts at once. Cuts are given at the
+// resolution of their level.
+//
+// Everything depending on the traversal state, and the bookkeeping of
+// the texture objects, is done from the calling thread. Reading the
+// voxels of the cuts and transferring them to texels is spread over
+// the CvrParallel threads. Chunks are split into slabs of slices when
+// there are fewer of them than threads. The GL textures are made
+// later, on first use from the thread of their GL context.
+void
+CvrTextureObject::build(const SoGLRenderAction * action,
+                        const CvrCLUT * clut,
+                        const unsigned int nr,
+                        Build * builds)
 {
+  Batch batch;
+  batch.builds = builds;
+  batch.clut = clut;
+
+  for (unsigned int i = 0; i < nr; i++) {
+    CvrTextureObject::prepare(action, clut, builds, i);
+    if (builds[i].newtexobj) { batch.pending.append(i); }
+  }
+
+  const unsigned int nrpending = batch.pending.getLength();
+  if (nrpending > 0) {
+    CvrVoxelChunk::getTransferInfo(action, batch.info);
+    CvrParallel::run(nrpending, CvrTextureObject::buildChunkCB, &batch);
+
+    const unsigned int nrthreads = CvrParallel::getNrOfThreads();
+    const unsigned int wantslabs = (nrpending >= nrthreads) ? 1 :
+      (2 * nrthreads + nrpending - 1) / nrpending;
+    for (unsigned int i = 0; i < nrpending; i++) {
+      const unsigned int buildidx = batch.pending[i];
+      const unsigned int nrslices = builds[buildidx].chunk->getDimensions()[2];
+      const unsigned int nrslabs =
+        SbMax(1u, SbMin(wantslabs, nrslices / CVR_MIN_SLAB_SLICES));
+      for (unsigned int j = 0; j < nrslabs; j++) {
+        Slab slab;
+        slab.buildidx = buildidx;
+        slab.firstslice = (nrslices * j) / nrslabs;
+        slab.endslice = (nrslices * (j + 1)) / nrslabs;
+        slab.invisible = TRUE;
+        batch.slabs.append(slab);
+      }
+    }
+    CvrParallel::run(batch.slabs.getLength(), CvrTextureObject::transferSlabCB, &batch);
+  }
+
+  int slabidx = 0;
+  for (unsigned int i = 0; i < nrpending; i++) {
+    const unsigned int buildidx = batch.pending[i];
+    SbBool invisible = TRUE;
+    while ((slabidx < batch.slabs.getLength()) &&
+           (batch.slabs[slabidx].buildidx == buildidx)) {
+      invisible = invisible && batch.slabs[slabidx].invisible;
+      slabidx++;
+    }
+    CvrTextureObject::finish(builds[buildidx], invisible);
+  }
+
+  for (unsigned int i = 0; i < nr; i++) {
+    if (builds[i].sameas != -1) { builds[i].result = builds[builds[i].sameas].result; }
+  }
+}
+
+
+// Finds the texture object of \a builds[idx], if it exists or the cut
+// is known to be fully transparent. Otherwise sets up a new texture
+// object to be filled in.
+void
+CvrTextureObject::prepare(const SoGLRenderAction * action,
+                          const CvrCLUT * clut,
+                          Build * builds, const unsigned int idx)
+{
+  Build & b = builds[idx];
+  b.result = NULL;
+  b.sameas = -1;
+  b.newtexobj = NULL;
+  b.store = NULL;
+  b.chunk = NULL;
+
+  const SbVec3s & texsize = b.texsize;
+  const SbBox3i32 & cutcube = b.cutcube;
+  const SbBox2i32 & cutslice = b.cutslice;
+  const unsigned int axisidx = b.axisidx;
+  const int pageidx = b.pageidx;
+  const unsigned int level = b.level;
+
   const CvrVoxelBlockElement * vbelem = CvrVoxelBlockElement::getInstance(action->getState());
   assert(vbelem != NULL);
 
@@ -714,7 +1098,11 @@ CvrTextureObject::create(const SoGLRenderAction * action,
   const SbBool lighting = lightelem->useLighting(action->getState());
 
   SoType createtype;
-  if (is2d && paletted) { 
+  if (b.gradients) {
+    assert(!is2d && !paletted && (clut == NULL));
+    createtype = Cvr3DGradientTexture::getClassTypeId();
+  }
+  else if (is2d && paletted) { 
     createtype = Cvr2DPaletteTexture::getClassTypeId(); 
   }
   else if (is2d) { 
@@ -732,38 +1120,86 @@ CvrTextureObject::create(const SoGLRenderAction * action,
     createtype = Cvr3DRGBATexture::getClassTypeId(); 
   }
 
+  // Only the bricks of the volume which are touched by the cut will
+  // be pulled in by the voxel store.
+  CvrVoxelStore * store = vbelem->getVoxelStore();
+  assert(store != NULL);
+
   struct CvrTextureObject::EqualityComparison incoming;
   incoming.sovolumedata_id = vbelem->getNodeId();
+  incoming.clut = paletted ? NULL : clut;
   incoming.cutcube = cutcube; // For 3D tex
   incoming.cutslice = cutslice; // For 2D tex
   incoming.axisidx = axisidx; // For 2D tex
   incoming.pageidx = pageidx; // For 2D tex
+  incoming.level = level;
+  CvrTextureObject::shareWithViewedVolume(vbelem, is2d, incoming);
 
   CvrTextureObject * obj =
     CvrTextureObject::findInstanceMatch(createtype, incoming);
   if (obj) { 
-    return obj; 
+    b.result = obj;
+    return; 
   }
-  
-  const SbVec3s & voxdims = vbelem->getVoxelCubeDimensions();
-  const void * dataptr = vbelem->getVoxels();
 
-  // FIXME: improve buildSubPage() interface to fix this roundabout
-  // way of calling it. 20021206 mortene.
-  CvrVoxelChunk * input =
-    new CvrVoxelChunk(voxdims, vbelem->getBytesPrVoxel(), dataptr);
-  CvrVoxelChunk * cubechunk;
-  if (is2d) { 
-    cubechunk = input->buildSubPage(axisidx, pageidx, cutslice); 
+  // Cuts mapping to the same texture object may be asked for twice
+  // in one batch.
+  for (unsigned int i = 0; i < idx; i++) {
+    Build & other = builds[i];
+    if (other.newtexobj && (other.newtexobj->getTypeId() == createtype) &&
+        (other.cmp == incoming)) {
+      b.sameas = i;
+      return;
+    }
   }
-  else { 
-    cubechunk = input->buildSubCube(cutcube); 
+
+  CvrVoxelStore * levelstore = store;
+  if (level > 0) {
+    const CvrSubSamplingElement * sselem =
+      CvrSubSamplingElement::getInstance(action->getState());
+    levelstore = store->getLevel(level, sselem->getMethod());
+  }
+
+  // Cuts where all voxels map to fully transparent colors are found
+  // from the value ranges of the bricks of the full resolution store,
+  // without reading any voxels. The values of a cut at a reduced
+  // level are within the range of the region it covers at level 0.
+  // Paletted textures are always needed, as the palette can change
+  // without the texture being rebuilt, and so are gradient textures,
+  // which are only made for cuts with visible RGBA textures.
+  if (!paletted && !b.gradients) {
+    const SbBox3i32 region =
+      is2d ? levelstore->getPageRegion(axisidx, pageidx, cutslice) : cutcube;
+    SbVec3i32 rmin, rmax;
+    region.getBounds(rmin, rmax);
+    const SbVec3i32 & dims = store->getDimensions();
+    for (unsigned int i = 0; i < 3; i++) {
+      rmin[i] = SbMin(rmin[i] << level, dims[i] - 1);
+      rmax[i] = SbMin(rmax[i] << level, dims[i]);
+    }
+    uint32_t lowidx, highidx;
+    if (store->getRegionIndexRange(SbBox3i32(rmin, rmax), lowidx, highidx) &&
+        (highidx < clut->getNrOfIndices()) &&
+        clut->isTransparent(lowidx, highidx)) {
+      return;
+    }
   }
-  delete input;
+
+  // Lit 3D textures share the gradients computed once for the volume.
+  if ((lighting || b.gradients) && !is2d) { (void)levelstore->buildGradients(); }
+
+  b.updateserial =
+    CvrTextureObject::getKeyStore(vbelem, incoming)->getUpdateSerial();
+  b.store = levelstore;
+  b.cmp = incoming;
 
   CvrTextureObject * newtexobj = (CvrTextureObject *)
     createtype.createInstance();
 
+  if (paletted) {
+    ((CvrPaletteTexture *)newtexobj)->setIndexSize(levelstore->getIndexSize());
+  }
+
   // The actual dimensions of the GL texture must be values that are
   // power-of-two's:
   for (unsigned int i=0; i < 3; i++) {
@@ -792,23 +1228,60 @@ CvrTextureObject::create(const SoGLRenderAction * action,
     //    newtexobj->dimensions[1] += 2;
     newtexobj->dimensions[2] = 1;
   }
-  
 
-  SbBool invisible = FALSE;
-  cubechunk->transfer(action, clut, newtexobj, invisible);
-  delete cubechunk;
+  CvrVoxelChunk::prepareTransfer(clut, newtexobj);
+  b.newtexobj = newtexobj;
+}
+
+
+// Reads the voxels of a pending build. Called from CvrParallel::run().
+void
+CvrTextureObject::buildChunkCB(void * closure, unsigned int idx)
+{
+  Batch * batch = (Batch *)closure;
+  Build & b = batch->builds[batch->pending[idx]];
+  if (b.axisidx != UINT_MAX) {
+    b.chunk = b.store->buildSubPage(b.axisidx, b.pageidx, b.cutslice);
+  }
+  else {
+    b.chunk = b.store->buildSubCube(b.cutcube);
+  }
+}
+
+
+// Transfers the voxels of a slab to texels. Called from
+// CvrParallel::run().
+void
+CvrTextureObject::transferSlabCB(void * closure, unsigned int idx)
+{
+  Batch * batch = (Batch *)closure;
+  Slab & slab = batch->slabs[idx];
+  Build & b = batch->builds[slab.buildidx];
+  b.chunk->transfer(batch->info, batch->clut, b.newtexobj,
+                    slab.firstslice, slab.endslice, slab.invisible);
+}
+
+
+// Registers the texture object of a build once all its texels are in
+// place.
+void
+CvrTextureObject::finish(Build & b, const SbBool invisible)
+{
+  CvrTextureObject * newtexobj = b.newtexobj;
+  delete b.chunk;
+  b.chunk = NULL;
 
   // If completely transparent, and not in palette mode, we need not
   // bother with a texture object for this slice/brick at all:
-  if (invisible && !paletted) {
+  if (invisible && !newtexobj->isPaletted()) {
     // FIXME: we get grave mem-leaks by just returning here, I
     // believe. Audit code in this function. 20041029 mortene.
-    return NULL;
+    return;
   }
 
   // Must clear unused texture area to prevent artifacts due to
   // floating point inaccuracies when calculating texture coords.
-  newtexobj->blankUnused(texsize);
+  newtexobj->blankUnused(b.texsize);
 
   // We'll self-destruct when the SoVolumeData node is changed.
   //
@@ -819,7 +1292,9 @@ CvrTextureObject::create(const SoGLRenderAction * action,
   //
   // UPDATE: ..or is this already taken care of higher up in the
   // call-chain? I think it may be. Investigate. 20040722 mortene.
-  newtexobj->eqcmp = incoming;
+  newtexobj->eqcmp = b.cmp;
+  if (b.cmp.clut) { b.cmp.clut->ref(); }
+  newtexobj->updateserial = b.updateserial;
 
   const uintptr_t key = newtexobj->hashKey();
   void * ptr;
@@ -835,7 +1310,129 @@ CvrTextureObject::create(const SoGLRenderAction * action,
   }
   l->append(newtexobj);
 
-  return newtexobj;
+  b.result = newtexobj;
+}
+
+
+// Textures of a SoVolumeData::subSetting() view are built from the
+// voxels it shares with the volume it views, so they are keyed on
+// that volume and the voxel positions within it, to share them with
+// the textures of the volume itself and of other views of it.
+//
+// Only done at full resolution, as the cuts of reduced levels do not
+// line up between the view and the volume, and not for FLOAT data,
+// where the lookup indices depend on the value range of the view.
+void
+CvrTextureObject::shareWithViewedVolume(const CvrVoxelBlockElement * vbelem,
+                                        const SbBool is2d,
+                                        struct EqualityComparison & cmp)
+{
+  CvrVoxelStore * store = vbelem->getVoxelStore();
+  const CvrVoxelStore * viewed = store->getViewedStore();
+  if ((viewed == NULL) || (cmp.level != 0)) { return; }
+  if (store->getDataType() == SoVolumeData::FLOAT) { return; }
+
+  const SbVec3i32 & offset = store->getViewOffset();
+  const SbVec3i32 & dims = store->getDimensions();
+  const SbVec3i32 & vieweddims = viewed->getDimensions();
+
+  if (is2d) {
+    // 2D textures have a border of one voxel taken from the
+    // neighbouring voxels, so those along an edge of the view are
+    // only the same as the volume's where it is also an edge of the
+    // volume.
+    static const unsigned int horizaxis[3] = { 2, 0, 0 };
+    static const unsigned int vertaxis[3] = { 1, 2, 1 };
+    const unsigned int axes[2] = { horizaxis[cmp.axisidx], vertaxis[cmp.axisidx] };
+    SbVec2i32 smin, smax;
+    cmp.cutslice.getBounds(smin, smax);
+    for (unsigned int i = 0; i < 2; i++) {
+      const unsigned int a = axes[i];
+      if ((smin[i] == 0) && (offset[a] > 0)) { return; }
+      if ((smax[i] == dims[a]) && (offset[a] + dims[a] < vieweddims[a])) { return; }
+    }
+
+    cmp.cutslice.setBounds(smin[0] + offset[axes[0]], smin[1] + offset[axes[1]],
+                           smax[0] + offset[axes[0]], smax[1] + offset[axes[1]]);
+    cmp.pageidx += offset[cmp.axisidx];
+  }
+  else {
+    SbVec3i32 cmin, cmax;
+    cmp.cutcube.getBounds(cmin, cmax);
+    cmp.cutcube.setBounds(cmin + offset, cmax + offset);
+  }
+
+  cmp.sovolumedata_id = vbelem->getStorageId();
+}
+
+
+// The voxel store the cuts of \a cmp are given in, i.e. the store of
+// the current volume, or the one it is a view of.
+CvrVoxelStore *
+CvrTextureObject::getKeyStore(const CvrVoxelBlockElement * vbelem,
+                              const struct EqualityComparison & cmp)
+{
+  CvrVoxelStore * store = vbelem->getVoxelStore();
+  if (cmp.sovolumedata_id == vbelem->getNodeId()) { return store; }
+  assert(cmp.sovolumedata_id == vbelem->getStorageId());
+  return store->getViewedStore();
+}
+
+
+// Rebuilds the texture buffer if any of the voxels it was made from
+// have been changed through SoVolumeData::updateRegions() since. The
+// GL textures made from it are then updated on their next use.
+void
+CvrTextureObject::refresh(const SoGLRenderAction * action) const
+{
+  const CvrVoxelBlockElement * vbelem = CvrVoxelBlockElement::getInstance(action->getState());
+  assert(vbelem != NULL);
+  const struct EqualityComparison & cmp = this->eqcmp;
+  CvrVoxelStore * store = CvrTextureObject::getKeyStore(vbelem, cmp);
+  const unsigned int serial = store->getUpdateSerial();
+  if (serial == this->updateserial) { return; }
+  CvrTextureObject * that = (CvrTextureObject *)this;
+
+  // The full resolution voxels covered by the cut, including the
+  // border of 2D textures.
+  const SbBool is2d = (cmp.axisidx != UINT_MAX);
+  const SbBox3i32 region =
+    is2d ? store->getPageRegion(cmp.axisidx, cmp.pageidx, cmp.cutslice) : cmp.cutcube;
+  SbVec3i32 rmin, rmax;
+  region.getBounds(rmin, rmax);
+  const SbVec3i32 & dims = store->getDimensions();
+  for (unsigned int i = 0; i < 3; i++) {
+    rmin[i] = SbMin(rmin[i] << cmp.level, dims[i] - 1);
+    rmax[i] = SbMin(rmax[i] << cmp.level, dims[i]);
+  }
+  const SbBool changed = store->isUpdatedSince(SbBox3i32(rmin, rmax), this->updateserial);
+  that->updateserial = serial;
+  if (!changed) { return; }
+
+  CvrVoxelStore * levelstore = store;
+  if (cmp.level > 0) {
+    const CvrSubSamplingElement * sselem =
+      CvrSubSamplingElement::getInstance(action->getState());
+    levelstore = store->getLevel(cmp.level, sselem->getMethod());
+  }
+
+  const CvrLightingElement * lightelem = CvrLightingElement::getInstance(action->getState());
+  assert(lightelem != NULL);
+  if (!is2d && (lightelem->useLighting(action->getState()) ||
+                 this->getTypeId() == Cvr3DGradientTexture::getClassTypeId())) {
+    (void)levelstore->buildGradients();
+  }
+
+  CvrVoxelChunk * chunk;
+  if (is2d) { chunk = levelstore->buildSubPage(cmp.axisidx, cmp.pageidx, cmp.cutslice); }
+  else { chunk = levelstore->buildSubCube(cmp.cutcube); }
+
+  const CvrCLUT * clut =
+    this->isPaletted() ? ((CvrPaletteTexture *)this)->getCLUT() : cmp.clut;
+  SbBool invisible;
+  chunk->transfer(action, clut, that, invisible);
+  delete chunk;
+  that->version++;
 }
 
 
@@ -845,6 +1442,7 @@ CvrTextureObject::create(const SoGLRenderAction * action,
 void
 CvrTextureObject::activateTexture(const SoGLRenderAction * action) const
 {
+  this->refresh(action);
   const GLuint texid = this->getGLTexture(action);
 
   const unsigned short nrtexdims = this->getNrOfTextureDimensions();
@@ -931,20 +1529,22 @@ uintptr_t
 CvrTextureObject::hashKey(const struct CvrTextureObject::EqualityComparison & obj)
 {
   uintptr_t key = obj.sovolumedata_id;
+  key += (uintptr_t)obj.clut;
 
   if (obj.axisidx != UINT_MAX) { key += obj.axisidx; }
   if (obj.pageidx != INT_MAX) { key += obj.pageidx; }
+  key += obj.level;
 
-  SbBox3s empty3;
+  SbBox3i32 empty3;
   if (obj.cutcube.getMin() != empty3.getMin()) {
-    short v[6];
+    int32_t v[6];
     obj.cutcube.getBounds(v[0], v[1], v[2], v[3], v[4], v[5]);
     for (unsigned int i = 0; i < 6; i++) { key += v[i]; }
   }
 
-  SbBox2s empty2;
+  SbBox2i32 empty2;
   if (obj.cutslice.getMin() != empty2.getMin()) {
-    short v[4];
+    int32_t v[4];
     obj.cutslice.getBounds(v[0], v[1], v[2], v[3]);
     for (unsigned int i = 0; i < 4; i++) { key += v[i]; }
   }
@@ -961,16 +1561,14 @@ CvrTextureObject::EqualityComparison::operator==(const CvrTextureObject::Equalit
 {
   return
     (this->sovolumedata_id == obj.sovolumedata_id) &&
-    // Note: we compare SbBox3s corner points for the cutcube instead
-    // of using the operator==() for SbBox3s, because the operator was
-    // forgotten for export to the DLL interface up until and
-    // including Coin version 2.3 (and SIM Voleon should be compatible
-    // with anything from Coin 2.0 and upwards).
+    (this->clut == obj.clut) &&
     (this->cutcube.getMin() == obj.cutcube.getMin()) &&
     (this->cutcube.getMax() == obj.cutcube.getMax()) &&
-    (this->cutslice == obj.cutslice) &&
+    (this->cutslice.getMin() == obj.cutslice.getMin()) &&
+    (this->cutslice.getMax() == obj.cutslice.getMax()) &&
     (this->axisidx == obj.axisidx) &&
-    (this->pageidx == obj.pageidx);
+    (this->pageidx == obj.pageidx) &&
+    (this->level == obj.level);
 }
 
 // *************************************************************************
@@ -35,8 +35,8 @@
 
 #include <Inventor/SoType.h>
 #include <Inventor/SbVec3s.h>
-#include <Inventor/SbBox2s.h>
-#include <Inventor/SbBox3s.h>
+#include <Inventor/SbBox2i32.h>
+#include <Inventor/SbBox3i32.h>
 #include <Inventor/system/gl.h>
 #include <Inventor/lists/SbList.h>
 #include <VolumeViz/misc/CvrCLUT.h>
@@ -44,6 +44,8 @@
 class SoGLRenderAction;
 class SbVec2s;
 class CvrGLTextureCache;
+class CvrVoxelBlockElement;
+class CvrVoxelStore;
 
 // *************************************************************************
 
@@ -51,15 +53,42 @@ class CvrTextureObject {
 public:
   static const CvrTextureObject * create(const SoGLRenderAction * action,
                                          const CvrCLUT * clut,
-                                         const SbBox3s & cutcube);
+                                         const SbBox3i32 & cutcube,
+                                         const unsigned int level = 0);
 
 
   static const CvrTextureObject * create(const SoGLRenderAction * action,
                                          const CvrCLUT * clut,
                                          const SbVec2s & texsize,
-                                         const SbBox2s & cutslice,
+                                         const SbBox2i32 & cutslice,
                                          const unsigned int axisidx,
-                                         const int pageidx);
+                                         const int pageidx,
+                                         const unsigned int level = 0);
+
+  // Makes the texture objects of several cuts at once, using worker
+  // threads to read and transfer the voxels.
+  static void create(const SoGLRenderAction * action,
+                     const CvrCLUT * clut,
+                     const unsigned int nr,
+                     const SbBox3i32 * cutcubes,
+                     const unsigned int * levels,
+                     const CvrTextureObject ** result);
+
+  static void create(const SoGLRenderAction * action,
+                     const CvrCLUT * clut,
+                     const unsigned int nr,
+                     const SbVec2s * texsizes,
+                     const SbBox2i32 * cutslices,
+                     const unsigned int axisidx,
+                     const int pageidx,
+                     const unsigned int * levels,
+                     const CvrTextureObject ** result);
+
+  static void createGradients(const SoGLRenderAction * action,
+                              const unsigned int nr,
+                              const SbBox3i32 * cutcubes,
+                              const unsigned int * levels,
+                              const CvrTextureObject ** result);
 
   static void initClass(void);
 
@@ -86,37 +115,61 @@ protected:
 
 private:
   SbBool findGLTexture(const SoGLRenderAction * action, GLuint & texid) const;
-  static CvrTextureObject * create(const SoGLRenderAction * action,
-                                   const CvrCLUT * clut,
-                                   const SbVec3s & texsize,
-                                   const SbBox3s & cutcube,
-                                   const SbBox2s & cutslice,
-                                   const unsigned int axisidx,
-                                   const int pageidx);
+
+  struct Build;
+  struct Slab;
+  struct Batch;
+  static void build(const SoGLRenderAction * action, const CvrCLUT * clut,
+                    const unsigned int nr, Build * builds);
+  static void prepare(const SoGLRenderAction * action, const CvrCLUT * clut,
+                      Build * builds, const unsigned int idx);
+  static void finish(Build & b, const SbBool invisible);
+  static void buildChunkCB(void * closure, unsigned int idx);
+  static void transferSlabCB(void * closure, unsigned int idx);
 
   GLuint getGLTexture(const SoGLRenderAction * action) const;
+  void getGLPixelFormat(const SoGLRenderAction * action,
+                        GLenum & format, GLenum & type) const;
+  void updateGLTexture(const SoGLRenderAction * action, const GLuint texid) const;
+  void refresh(const SoGLRenderAction * action) const;
 
   static SoType classTypeId;
   SbVec3s dimensions;
   uint32_t refcounter;
   static SbDict * instancedict;
   SbDict glctxdict;
+  // serial of the last CvrVoxelStore::updateRegion() the texture
+  // buffer is up to date with, the number of times the buffer has
+  // been rebuilt since creation, and the one uploaded to each GL
+  // context:
+  unsigned int updateserial;
+  unsigned int version;
+  SbDict glctxversions;
 
   SbList<CvrGLTextureCache *> * cacheListForGLContext(const uint32_t glctxid) const;
 
   struct EqualityComparison {
     SbUniqueId sovolumedata_id;
+    // color lookup table of RGBA textures, NULL for paletted textures:
+    const CvrCLUT * clut;
     // FIXME: messy, next data should be part of subclasses. 20040721 mortene.
     // for 3D cuts:
-    SbBox3s cutcube;
+    SbBox3i32 cutcube;
     // these are for 2D cuts:
-    SbBox2s cutslice;
+    SbBox2i32 cutslice;
     unsigned int axisidx;
     int pageidx;
+    // resolution pyramid level, cuts above are given at this level:
+    unsigned int level;
 
     int operator==(const struct EqualityComparison & cmp);
   } eqcmp;
 
+  static void shareWithViewedVolume(const CvrVoxelBlockElement * vbelem,
+                                    const SbBool is2d,
+                                    struct EqualityComparison & cmp);
+  static CvrVoxelStore * getKeyStore(const CvrVoxelBlockElement * vbelem,
+                                     const struct EqualityComparison & cmp);
   static CvrTextureObject * findInstanceMatch(const SoType t,
                                               const struct CvrTextureObject::EqualityComparison & cmp);
   uintptr_t hashKey(void) const;
@@ -0,0 +1,155 @@
+/*
+  Checks that the SSE4.1 and AVX2 versions of the RGBA row lookup
+  used when transferring voxels to RGBA textures give bit-identical
+  results to the scalar version.
+
+  Every index of 8-bit and 16-bit lookup tables is looked up, for a
+  range of shift and offset values, in rows of all lengths from 1 to
+  33, so every remainder after the vector loops is exercised. The
+  bytes after each row are checked for overruns, and the "any color
+  visible" return value is checked on tables with no, one or random
+  non-transparent colors.
+
+  Versions not built in, or not supported by the CPU, are skipped.
+  Returns 0 if all checks passed.
+*/
+
+#include <VolumeViz/misc/CvrRGBALookup.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const unsigned int MAXROWLENGTH = 33;
+static const unsigned int GUARDBYTES = 64;
+static const uint8_t GUARD = 0xa5;
+
+enum AlphaPattern { RANDOM_ALPHA, NO_ALPHA, SINGLE_ALPHA };
+
+static uint32_t randomstate = 12345;
+
+static uint8_t
+random_byte(void)
+{
+  randomstate = randomstate * 1103515245u + 12345u;
+  return (uint8_t)(randomstate >> 16);
+}
+
+static void
+fill_colors(uint8_t * colors, const unsigned int nrcolors, AlphaPattern pattern)
+{
+  for (unsigned int i = 0; i < nrcolors * 4; i++) { colors[i] = random_byte(); }
+  if (pattern == RANDOM_ALPHA) { return; }
+
+  for (unsigned int i = 0; i < nrcolors; i++) { colors[i * 4 + 3] = 0; }
+  if (pattern == SINGLE_ALPHA) { colors[(nrcolors / 2 + 1) * 4 + 3] = 0x01; }
+}
+
+// Returns the number of mismatching rows.
+static unsigned int
+check_rows(CvrRGBALookup::RowFunc * func, const uint32_t * indices,
+           const unsigned int nrindices, const int32_t shift, const int32_t offset,
+           const uint8_t * colors, const unsigned int nrcolors,
+           uint8_t * expected, uint8_t * result)
+{
+  CvrRGBALookup::RowFunc * scalar = CvrRGBALookup::getRowFunc(CvrRGBALookup::SCALAR);
+  unsigned int failures = 0;
+
+  for (unsigned int length = 1; length <= MAXROWLENGTH; length++) {
+    for (unsigned int first = 0; first < nrindices; first += length) {
+      const unsigned int nr = (first + length <= nrindices) ? length : (nrindices - first);
+
+      (void)memset(expected, GUARD, nr * 4 + GUARDBYTES);
+      (void)memset(result, GUARD, nr * 4 + GUARDBYTES);
+
+      const SbBool expectedvisible =
+        scalar(&indices[first], nr, shift, offset, colors, nrcolors, expected);
+      const SbBool visible =
+        func(&indices[first], nr, shift, offset, colors, nrcolors, result);
+
+      if ((memcmp(expected, result, nr * 4 + GUARDBYTES) != 0) ||
+          ((expectedvisible ? 1 : 0) != (visible ? 1 : 0))) {
+        if (failures < 10) {
+          fprintf(stderr, "  mismatch: nrcolors=%u shift=%d offset=%d "
+                  "first index=%u row length=%u\n",
+                  nrcolors, shift, offset, indices[first], nr);
+        }
+        failures++;
+      }
+    }
+  }
+  return failures;
+}
+
+// Returns the number of mismatching rows.
+static unsigned int
+check_implementation(CvrRGBALookup::RowFunc * func, const unsigned int nrcolors,
+                     AlphaPattern pattern)
+{
+  static const int32_t shifts[] = { 0, 1, 2, 3, 4, 7, 8 };
+  static const int32_t offsets[] = { 0, 1, 3, 255, -1, -5, -256 };
+  const unsigned int nrshifts = sizeof(shifts) / sizeof(shifts[0]);
+  const unsigned int nroffsets = sizeof(offsets) / sizeof(offsets[0]);
+
+  uint8_t * colors = new uint8_t[nrcolors * 4];
+  fill_colors(colors, nrcolors, pattern);
+
+  uint32_t * indices = new uint32_t[nrcolors];
+  uint8_t * expected = new uint8_t[MAXROWLENGTH * 4 + GUARDBYTES];
+  uint8_t * result = new uint8_t[MAXROWLENGTH * 4 + GUARDBYTES];
+
+  unsigned int failures = 0;
+  for (unsigned int s = 0; s < nrshifts; s++) {
+    for (unsigned int o = 0; o < nroffsets; o++) {
+      // All indices of the table that map inside it. The mapping is
+      // done on 32-bit unsigned integers, as in the lookups.
+      unsigned int nrindices = 0;
+      for (uint32_t i = 0; i < nrcolors; i++) {
+        const uint32_t idx = (i << shifts[s]) + (uint32_t)offsets[o];
+        if (idx < nrcolors) { indices[nrindices++] = i; }
+      }
+      if (nrindices == 0) { continue; }
+
+      failures += check_rows(func, indices, nrindices, shifts[s], offsets[o],
+                             colors, nrcolors, expected, result);
+    }
+  }
+
+  delete[] colors;
+  delete[] indices;
+  delete[] expected;
+  delete[] result;
+  return failures;
+}
+
+int
+main(void)
+{
+  static const CvrRGBALookup::Implementation impls[] = {
+    CvrRGBALookup::SSE41, CvrRGBALookup::AVX2
+  };
+  static const unsigned int tablesizes[] = { 256, 65536 };
+  static const AlphaPattern patterns[] = { RANDOM_ALPHA, NO_ALPHA, SINGLE_ALPHA };
+
+  unsigned int failures = 0;
+  for (unsigned int i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+    const char * name = CvrRGBALookup::getName(impls[i]);
+    CvrRGBALookup::RowFunc * func = CvrRGBALookup::getRowFunc(impls[i]);
+    if (func == NULL) {
+      printf("%s: not available, skipped\n", name);
+      continue;
+    }
+
+    unsigned int implfailures = 0;
+    for (unsigned int t = 0; t < sizeof(tablesizes) / sizeof(tablesizes[0]); t++) {
+      for (unsigned int p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        implfailures += check_implementation(func, tablesizes[t], patterns[p]);
+      }
+    }
+    printf("%s: %s (%u mismatching rows)\n", name,
+           (implfailures == 0) ? "ok" : "FAILED", implfailures);
+    failures += implfailures;
+  }
+
+  return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}